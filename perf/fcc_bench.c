@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2026 Micron Technology, Inc.  All rights reserved.
+ */
+
+// fcc_bench.c
+// Usage: fcc_bench [-f path] [-s sizes_csv] [-m min_ms]
+//
+// Cost of cache maintenance with each flush instruction the CPU has
+// (clflush, clflushopt, clwb), and with the strategy libfcc selected
+// (flush_processor_cache() / invalidate_processor_cache()), across range
+// sizes (default 64,4K,64K,1M,16M,64M). Each range is measured in three
+// states:
+//   dirty  - just written (the flush_processor_cache() case)
+//   clean  - cached but unmodified (invalidate before re-reading)
+//   absent - not in the cache (e.g. already flushed, or never touched)
+// and reported as ns per cacheline and GB/s. Each measurement repeats
+// until it has run for at least -m milliseconds (default 20).
+//
+// With -f, the buffer is a MAP_SHARED mapping of an existing file (e.g. a
+// famfs file on a DAX device) instead of anonymous memory; the file must
+// be at least as big as the largest size.
+//
+// The strategy libfcc picked is printed first, with its per-line costs if
+// FCC_CALIBRATE=1 is set. FCC_FLUSH_THRESHOLD=<bytes> sets its large-range
+// threshold.
+//
+// Build: cc -O2 -pthread -Isrc -o fcc_bench perf/fcc_bench.c src/fcc-x86_64.c src/famfs_log.c
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libfcc.h"
+
+#define LINE 64
+
+enum state { DIRTY, CLEAN, ABSENT, NSTATES };
+static const char * const state_name[NSTATES] = { "dirty", "clean", "absent" };
+
+/* Operations: each instruction, then the selected strategy */
+#define OP_FLUSH   FCC_NINSN
+#define OP_INVAL   (FCC_NINSN + 1)
+#define NOPS       (FCC_NINSN + 2)
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *
+op_name(int op)
+{
+	if (op == OP_FLUSH)
+		return "flush_processor_cache";
+	if (op == OP_INVAL)
+		return "invalidate_processor_cache";
+	return fcc_insn_name(op);
+}
+
+/* Put [buf, buf+len) in state @st */
+static void
+prepare(char *buf, size_t len, enum state st, int pass)
+{
+	volatile char sink;
+	size_t i;
+
+	memset(buf, pass, len);
+	if (st == DIRTY)
+		return;
+	invalidate_processor_cache(buf, len);
+	if (st == ABSENT)
+		return;
+	for (i = 0; i < len; i += LINE)
+		sink = buf[i];
+	(void)sink;
+}
+
+/* ns per line, or -1 if the op is not supported */
+static double
+measure(int op, char *buf, size_t len, enum state st, uint64_t min_ns)
+{
+	uint64_t t, total = 0;
+	size_t lines = 0;
+	int pass;
+
+	for (pass = 0; total < min_ns || pass < 2; pass++) {
+		prepare(buf, len, st, pass);
+		t = now_ns();
+		if (op == OP_FLUSH)
+			flush_processor_cache(buf, len);
+		else if (op == OP_INVAL)
+			invalidate_processor_cache(buf, len);
+		else if (fcc_flush_range_insn(op, buf, len))
+			return -1;
+		total += now_ns() - t;
+		lines += len / LINE;
+	}
+	return (double)total / lines;
+}
+
+static size_t
+parse_size(const char *s)
+{
+	char *end;
+	size_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	case 'g': case 'G': v <<= 30; break;
+	}
+	return v;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *sizes_csv = "64,4K,64K,1M,16M,64M";
+	size_t sizes[32], maxsize = 0, len;
+	struct fcc_strategy strat;
+	uint64_t min_ns = 20 * 1000000ULL;
+	const char *path = NULL;
+	int nsizes = 0, c, i, op, st;
+	char *list, *tok, *buf;
+	double ns;
+
+	while ((c = getopt(argc, argv, "f:s:m:")) != -1) {
+		switch (c) {
+		case 'f': path = optarg; break;
+		case 's': sizes_csv = optarg; break;
+		case 'm': min_ns = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+		default:
+			fprintf(stderr, "usage: %s [-f path] [-s sizes_csv] "
+				"[-m min_ms]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	list = strdup(sizes_csv);
+	for (tok = strtok(list, ","); tok && nsizes < 32;
+	     tok = strtok(NULL, ",")) {
+		len = parse_size(tok);
+		len = (len + LINE - 1) & ~((size_t)LINE - 1);
+		if (!len)
+			continue;
+		sizes[nsizes++] = len;
+		if (len > maxsize)
+			maxsize = len;
+	}
+	free(list);
+	if (!nsizes) {
+		fprintf(stderr, "no sizes\n");
+		return 1;
+	}
+
+	if (path) {
+		struct stat st_buf;
+		int fd = open(path, O_RDWR);
+
+		if (fd < 0 || fstat(fd, &st_buf) < 0) {
+			perror(path);
+			return 1;
+		}
+		if ((size_t)st_buf.st_size < maxsize) {
+			fprintf(stderr, "%s: smaller than %zu bytes\n",
+				path, maxsize);
+			return 1;
+		}
+		buf = mmap(NULL, maxsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		close(fd);
+		if (buf == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+	} else if (posix_memalign((void **)&buf, 4096, maxsize)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	fcc_get_strategy(&strat);
+	printf("strategy: flush %s, invalidate %s, flush >= ",
+	       fcc_insn_name(strat.flush), fcc_insn_name(strat.invalidate));
+	if (strat.large_threshold == SIZE_MAX)
+		printf("(never)");
+	else
+		printf("%zu bytes %s", strat.large_threshold,
+		       fcc_insn_name(strat.large_flush));
+	printf("\ncalibrated ns/line (dirty):");
+	for (op = 0; op < FCC_NINSN; op++)
+		if (strat.line_ns[op] > 0)
+			break;
+	if (op == FCC_NINSN)
+		printf(" (not calibrated; set FCC_CALIBRATE=1)");
+	for (op = 0; op < FCC_NINSN; op++)
+		if (strat.line_ns[op] > 0)
+			printf(" %s %.1f", fcc_insn_name(op),
+			       strat.line_ns[op]);
+	printf("\n\n%-28s %-7s %10s %10s %10s\n",
+	       "op", "state", "size", "ns/line", "GB/s");
+
+	for (op = 0; op < NOPS; op++) {
+		for (st = 0; st < NSTATES; st++) {
+			/* Only write-back ops care about dirty lines */
+			if (op == OP_INVAL && st == DIRTY)
+				continue;
+			for (i = 0; i < nsizes; i++) {
+				ns = measure(op, buf, sizes[i], st, min_ns);
+				if (ns < 0)
+					break;
+				printf("%-28s %-7s %10zu %10.2f %10.2f\n",
+				       op_name(op), state_name[st], sizes[i],
+				       ns, LINE / ns);
+			}
+		}
+	}
+
+	if (path)
+		munmap(buf, maxsize);
+	else
+		free(buf);
+	return 0;
+}
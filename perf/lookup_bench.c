@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+// lookup_bench.c
+// Usage: lookup_bench [-t threads] [-s seconds] [-n] <dir> <prefix> <count>
+//
+// Lookup/getattr storm: each thread stat()s random files named <prefix>_N
+// (1 <= N <= <count>) inside <dir> for <seconds>, and reports ops/sec and
+// latency percentiles. With -n, the names looked up don't exist (negative
+// lookups). Mount with and without -o io_uring to compare fuse transports;
+// mount with -o timeout=0 so every stat() reaches famfs_fused.
+//
+// Build: cc -O2 -pthread -o lookup_bench perf/lookup_bench.c
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* Log-linear latency buckets: 16 per power of two of ns */
+#define SUB_BITS 4
+#define SUB      (1 << SUB_BITS)
+#define MAX_MSB  40
+#define NBUCKETS ((MAX_MSB - SUB_BITS + 2) * SUB)
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	uint64_t ops;
+	uint64_t errs;
+	uint64_t max_ns;
+	uint64_t bucket[NBUCKETS];
+};
+
+static const char *dir;
+static const char *prefix;
+static int count;
+static int negative;
+static volatile int stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns)
+{
+	int msb;
+
+	if (ns < SUB)
+		return (int)ns;
+	msb = 63 - __builtin_clzll(ns);
+	if (msb > MAX_MSB)
+		return NBUCKETS - 1;
+	return (msb - SUB_BITS + 1) * SUB +
+		(int)((ns >> (msb - SUB_BITS)) & (SUB - 1));
+}
+
+static uint64_t bucket_high(int b)
+{
+	int msb;
+
+	if (b < SUB)
+		return b;
+	msb = b / SUB + SUB_BITS - 1;
+	return ((uint64_t)(SUB + b % SUB + 1) << (msb - SUB_BITS)) - 1;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char path[4096];
+	struct stat st;
+
+	while (!stop) {
+		int n = rand_r(&w->seed) % count + 1;
+		uint64_t t0, ns;
+		int rc;
+
+		snprintf(path, sizeof(path), "%s/%s%s_%d", dir, prefix,
+			 negative ? "_missing" : "", n);
+		t0 = now_ns();
+		rc = stat(path, &st);
+		ns = now_ns() - t0;
+
+		if (rc && !(negative && errno == ENOENT))
+			w->errs++;
+		w->ops++;
+		w->bucket[bucket_of(ns)]++;
+		if (ns > w->max_ns)
+			w->max_ns = ns;
+	}
+	return NULL;
+}
+
+static uint64_t percentile(const uint64_t *bucket, uint64_t total, double pct)
+{
+	uint64_t want = (uint64_t)(total * pct / 100.0);
+	uint64_t seen = 0;
+	int b;
+
+	for (b = 0; b < NBUCKETS; b++) {
+		seen += bucket[b];
+		if (seen > want)
+			return bucket_high(b);
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t threads] [-s seconds] [-n] <dir> <prefix> <count>\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t bucket[NBUCKETS] = { 0 };
+	uint64_t ops = 0, errs = 0, max_ns = 0, t0, elapsed;
+	int nthreads = 4, seconds = 10;
+	struct worker *w;
+	int c, i, b;
+
+	while ((c = getopt(argc, argv, "t:s:n")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'n':
+			negative = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 3 || nthreads < 1 || seconds < 1)
+		usage(argv[0]);
+	dir = argv[optind];
+	prefix = argv[optind + 1];
+	count = atoi(argv[optind + 2]);
+	if (count < 1)
+		usage(argv[0]);
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w) {
+		perror("calloc");
+		return 2;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		w[i].seed = (unsigned int)(t0 + i);
+		if (pthread_create(&w[i].thread, NULL, worker_fn, &w[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 2;
+		}
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now_ns() - t0;
+
+	for (i = 0; i < nthreads; i++) {
+		ops += w[i].ops;
+		errs += w[i].errs;
+		if (w[i].max_ns > max_ns)
+			max_ns = w[i].max_ns;
+		for (b = 0; b < NBUCKETS; b++)
+			bucket[b] += w[i].bucket[b];
+	}
+
+	printf("LOOKUP%s, threads=%d, ops=%llu, errors=%llu, elapsed=%.3f sec, "
+	       "ops/sec=%.0f, p50=%.1f us, p99=%.1f us, p99.9=%.1f us, "
+	       "max=%.1f us\n",
+	       negative ? "_NEG" : "", nthreads, (unsigned long long)ops,
+	       (unsigned long long)errs, elapsed / 1e9, ops * 1e9 / elapsed,
+	       percentile(bucket, ops, 50.0) / 1000.0,
+	       percentile(bucket, ops, 99.0) / 1000.0,
+	       percentile(bucket, ops, 99.9) / 1000.0,
+	       max_ns / 1000.0);
+	free(w);
+	return errs ? 3 : 0;
+}
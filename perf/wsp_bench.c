@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+// wsp_bench.c
+// Usage: wsp_bench [-t threads] [-b big_jobs] [-s small_jobs] [-n pieces]
+//
+// Makespan of a skewed batch on the famfs work-stealing pool: a few big
+// jobs (-n pieces each) queued together with many one-piece jobs, like a
+// famfs cp of a couple of huge files and a directory of small ones. Each
+// piece is a fixed amount of memory-bound work. The batch runs twice: with
+// every job as one task (what a plain FIFO pool does), and as range tasks
+// that split when threads are idle.
+//
+// Build: cc -O2 -pthread -Isrc -o wsp_bench perf/wsp_bench.c src/famfs_wspool.c
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "famfs_wspool.h"
+
+#define PIECE_BYTES (256 * 1024)
+
+static __thread char *piece_buf;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* One piece of work: fill and sum a thread-local buffer a few times */
+static void
+piece(void *arg, size_t start, size_t end)
+{
+	volatile uint64_t sum = 0;
+	size_t p, i;
+	int r;
+
+	(void)arg;
+	if (!piece_buf)
+		piece_buf = malloc(PIECE_BYTES);
+	for (p = start; p < end; p++) {
+		for (r = 0; r < 4; r++) {
+			memset(piece_buf, (int)(p + r), PIECE_BYTES);
+			for (i = 0; i < PIECE_BYTES; i += 64)
+				sum += piece_buf[i];
+		}
+	}
+}
+
+static double
+run(int threads, int nbig, int nsmall, size_t npieces, int split)
+{
+	struct famfs_wsp_group g;
+	struct famfs_wsp *wsp;
+	uint64_t t0;
+	int j;
+
+	wsp = famfs_wsp_create(threads);
+	if (!wsp) {
+		fprintf(stderr, "famfs_wsp_create failed\n");
+		exit(1);
+	}
+	famfs_wsp_group_init(&g);
+	t0 = now_ns();
+	for (j = 0; j < nbig + nsmall; j++) {
+		size_t n = (j < nbig) ? npieces : 1;
+
+		famfs_wsp_submit_range(wsp, &g, piece, NULL, NULL, 0, n,
+				       (split) ? 1 : n);
+	}
+	famfs_wsp_group_wait(&g);
+	t0 = now_ns() - t0;
+	famfs_wsp_group_destroy(&g);
+	famfs_wsp_destroy(wsp, 0);
+	return t0 / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	int threads = 8, nbig = 2, nsmall = 256;
+	size_t npieces = 512;
+	double fifo, split, ideal;
+	uint64_t t0;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:b:s:n:")) != -1) {
+		switch (c) {
+		case 't': threads = atoi(optarg); break;
+		case 'b': nbig = atoi(optarg); break;
+		case 's': nsmall = atoi(optarg); break;
+		case 'n': npieces = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-b big_jobs] "
+				"[-s small_jobs] [-n pieces]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	/* Time one piece to get the ideal (perfectly balanced) makespan */
+	piece(NULL, 0, 16);
+	t0 = now_ns();
+	piece(NULL, 0, 64);
+	ideal = (now_ns() - t0) / 64.0 / 1e6 *
+		(nbig * npieces + nsmall) / threads;
+
+	fifo = run(threads, nbig, nsmall, npieces, 0);
+	split = run(threads, nbig, nsmall, npieces, 1);
+	printf("%d threads, %d x %zu-piece jobs + %d 1-piece jobs\n",
+	       threads, nbig, npieces, nsmall);
+	printf("  unsplit: %8.1f ms\n", fifo);
+	printf("  split:   %8.1f ms\n", split);
+	printf("  ideal:   %8.1f ms\n", ideal);
+	return 0;
+}
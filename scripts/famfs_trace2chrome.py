@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+#
+# Convert a famfs_fused request trace dump to Chrome trace JSON, which can be
+# loaded in chrome://tracing or https://ui.perfetto.dev
+#
+# Get a dump (here, of the last 10 seconds) from the famfs_fused REST socket,
+# which lives next to the shadow tree:
+#
+#   curl -s --unix-socket <shadow_parent>/sock \
+#       'http://localhost/trace_dump?seconds=10' -o trace.bin
+#   famfs_trace2chrome.py trace.bin > trace.json
+#
+# The dump layout is struct famfs_trace_hdr / struct famfs_trace_rec in
+# src/famfs_fused_trace.h.
+
+import json
+import struct
+import sys
+
+HDR = struct.Struct('<8sIIIIQQQ')
+REC = struct.Struct('<QQQIiIHBB')
+MAGIC = b'FAMFSTRC'
+VERSION = 1
+OPNAME_LEN = 16
+
+FLAG_ICACHE_HIT = 0x01
+FLAG_ICACHE_MISS = 0x02
+FLAG_NEG_HIT = 0x04
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        buf = f.read()
+
+    if len(buf) < HDR.size:
+        sys.exit('%s: too short for a trace dump' % path)
+    (magic, version, rec_size, nops, nthreads, nrecs,
+     mono_ns, real_ns) = HDR.unpack_from(buf, 0)
+    if magic != MAGIC:
+        sys.exit('%s: not a famfs trace dump' % path)
+    if version != VERSION or rec_size != REC.size:
+        sys.exit('%s: unsupported trace version %d (record size %d)' %
+                 (path, version, rec_size))
+
+    off = HDR.size
+    ops = []
+    for i in range(nops):
+        name = buf[off:off + OPNAME_LEN].split(b'\0', 1)[0]
+        ops.append(name.decode())
+        off += OPNAME_LEN
+
+    recs = []
+    for i in range(nrecs):
+        recs.append(REC.unpack_from(buf, off))
+        off += REC.size
+
+    return ops, recs, nthreads, mono_ns, real_ns
+
+
+def cache_str(flags):
+    if flags & FLAG_NEG_HIT:
+        return 'negative hit'
+    if flags & FLAG_ICACHE_HIT:
+        return 'hit'
+    if flags & FLAG_ICACHE_MISS:
+        return 'miss'
+    return None
+
+
+def convert(ops, recs, nthreads, mono_ns, real_ns):
+    events = []
+    base = min((r[0] for r in recs), default=0)
+
+    for (start, end, nodeid, name_hash, err, tid, op, flags, _) in recs:
+        name = ops[op] if op < len(ops) else 'op%d' % op
+        args = {'nodeid': '0x%x' % nodeid}
+        if name_hash:
+            args['name_hash'] = '0x%08x' % name_hash
+        if err:
+            args['errno'] = err
+        cache = cache_str(flags)
+        if cache:
+            args['icache'] = cache
+        events.append({
+            'name': name,
+            'cat': 'fuse',
+            'ph': 'X',
+            'ts': (start - base) / 1000.0,
+            'dur': (end - start) / 1000.0,
+            'pid': 1,
+            'tid': tid,
+            'args': args,
+        })
+
+    events.sort(key=lambda e: e['ts'])
+    events.insert(0, {'name': 'process_name', 'ph': 'M', 'pid': 1,
+                      'args': {'name': 'famfs_fused'}})
+
+    # Wall clock time of the first event, for correlating with logs
+    first_real_ns = real_ns - (mono_ns - base) if recs else real_ns
+    return {
+        'traceEvents': events,
+        'displayTimeUnit': 'ns',
+        'otherData': {
+            'threads': nthreads,
+            'records': len(recs),
+            'first_event_realtime_ns': first_real_ns,
+        },
+    }
+
+
+def main():
+    if len(sys.argv) < 2 or sys.argv[1] in ('-h', '--help'):
+        sys.exit('usage: %s <trace_dump> [<out.json>]' % sys.argv[0])
+
+    trace = convert(*load(sys.argv[1]))
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+        sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -39,6 +39,11 @@ echo '```'            >> $OUTFILE
 famfs check -?        >> $OUTFILE
 echo '```'            >> $OUTFILE
 
+echo "## famfs df"    >> $OUTFILE
+echo '```'            >> $OUTFILE
+famfs df -?           >> $OUTFILE
+echo '```'            >> $OUTFILE
+
 echo "## famfs mkdir" >> $OUTFILE
 echo '```'            >> $OUTFILE
 famfs mkdir -?        >> $OUTFILE
@@ -287,6 +287,181 @@ famfs_build_bitmap(const struct famfs_log   *logp,
 	return bitmap;
 }
 
+/*
+ * Find the largest run of clear bits; whole bytes of set bits are skipped,
+ * since the allocated part of a famfs bitmap is usually dense
+ */
+static u64
+famfs_bitmap_largest_free(u8 *bitmap, u64 nbits, u64 *start_out)
+{
+	u64 best = 0, best_start = 0, run = 0, run_start = 0;
+	u64 i = 0;
+
+	while (i < nbits) {
+		if (!(i & 7) && i + 8 <= nbits && bitmap[i >> 3] == 0xff) {
+			if (run > best) {
+				best = run;
+				best_start = run_start;
+			}
+			run = 0;
+			i += 8;
+			continue;
+		}
+		if (mu_bitmap_test(bitmap, i)) {
+			if (run > best) {
+				best = run;
+				best_start = run_start;
+			}
+			run = 0;
+		} else if (run++ == 0) {
+			run_start = i;
+		}
+		i++;
+	}
+	if (run > best) {
+		best = run;
+		best_start = run_start;
+	}
+	*start_out = best_start;
+	return best;
+}
+
+static void
+famfs_alloc_map_add_extent(struct famfs_alloc_map *am, u64 ofs, u64 len)
+{
+	u64 first = ofs / am->alloc_unit;
+	u64 n = (len + am->alloc_unit - 1) / am->alloc_unit;
+	u64 used = 0;
+
+	if ((ofs & (am->alloc_unit - 1)) || first + n > am->nbits) {
+		am->errors++; /* misaligned, or off the end of the device */
+		return;
+	}
+	am->errors += set_extent_in_bitmap(am->bitmap, am->alloc_unit,
+					   ofs, len, &used);
+	am->used += used;
+
+	if (first < am->lfree_start + am->lfree_len &&
+	    first + n > am->lfree_start)
+		am->lfree_stale = 1;
+}
+
+/**
+ * famfs_alloc_map_init()
+ *
+ * Start an allocation map with just the superblock and log allocated. Log
+ * entries are added with famfs_alloc_map_apply().
+ */
+int
+famfs_alloc_map_init(
+	struct famfs_alloc_map *am,
+	u64 alloc_unit,
+	u64 dev_size,
+	u64 log_len)
+{
+	memset(am, 0, sizeof(*am));
+	if (!alloc_unit || (alloc_unit & (alloc_unit - 1)) || !dev_size)
+		return -EINVAL;
+
+	am->alloc_unit = alloc_unit;
+	am->dev_size = dev_size;
+	am->nbits = (dev_size + alloc_unit - 1) / alloc_unit;
+	am->bitmap = calloc(1, mu_bitmap_size(am->nbits) + 1);
+	if (!am->bitmap)
+		return -ENOMEM;
+
+	am->lfree_stale = 1;
+	famfs_alloc_map_add_extent(am, 0, FAMFS_SUPERBLOCK_SIZE + log_len);
+	am->lfree_len = famfs_bitmap_largest_free(am->bitmap, am->nbits,
+						  &am->lfree_start);
+	am->lfree_stale = 0;
+	return 0;
+}
+
+/**
+ * famfs_alloc_map_apply()
+ *
+ * Add the allocations of log entries [@start, @end) to the map. The caller
+ * applies each entry once, in order (normally @start is am->next_index).
+ * The largest free extent is recomputed only if an allocation landed in
+ * it.
+ */
+void
+famfs_alloc_map_apply(
+	struct famfs_alloc_map *am,
+	const struct famfs_log *logp,
+	u64 start,
+	u64 end)
+{
+	u64 i, j, k;
+
+	for (i = start; i < end; i++) {
+		const struct famfs_log_entry *le = &logp->entries[i];
+		const struct famfs_log_fmap *fmap;
+
+		if (le->famfs_log_entry_type != FAMFS_LOG_FILE ||
+		    famfs_validate_log_entry(le, i))
+			continue;
+
+		am->nfiles++;
+		fmap = &le->famfs_fm.fm_fmap;
+		switch (fmap->fmap_ext_type) {
+		case FAMFS_EXT_SIMPLE:
+			for (j = 0; j < fmap->fmap_nextents; j++)
+				famfs_alloc_map_add_extent(
+					am, fmap->se[j].se_offset,
+					fmap->se[j].se_len);
+			break;
+		case FAMFS_EXT_INTERLEAVE:
+			for (j = 0; j < fmap->fmap_niext; j++) {
+				const struct famfs_interleaved_ext *ie =
+					&fmap->ie[j];
+
+				for (k = 0; k < ie->ie_nstrips; k++)
+					famfs_alloc_map_add_extent(
+						am, ie->ie_strips[k].se_offset,
+						ie->ie_strips[k].se_len);
+			}
+			break;
+		default:
+			am->errors++;
+			break;
+		}
+	}
+	if (end > am->next_index)
+		am->next_index = end;
+
+	if (am->lfree_stale) {
+		am->lfree_len = famfs_bitmap_largest_free(am->bitmap,
+							  am->nbits,
+							  &am->lfree_start);
+		am->lfree_stale = 0;
+	}
+}
+
+void
+famfs_alloc_map_summary(
+	const struct famfs_alloc_map *am,
+	struct famfs_alloc_summary *as)
+{
+	memset(as, 0, sizeof(*as));
+	as->alloc_unit = am->alloc_unit;
+	as->total = am->nbits * am->alloc_unit;
+	as->used = am->used;
+	as->free = as->total - MIN(am->used, as->total);
+	as->largest_free = am->lfree_len * am->alloc_unit;
+	as->nfiles = am->nfiles;
+	as->log_index = am->next_index;
+	as->errors = am->errors;
+}
+
+void
+famfs_alloc_map_free(struct famfs_alloc_map *am)
+{
+	free(am->bitmap);
+	memset(am, 0, sizeof(*am));
+}
+
 /**
  * bitmap_alloc_contiguous()
  *
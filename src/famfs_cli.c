@@ -29,7 +29,7 @@
 
 #include "famfs_lib.h"
 #include "random_buffer.h"
-#include "thpool.h"
+#include "famfs_wspool.h"
 #include "famfs_log.h"
 #include "libfcc.h"
 
@@ -765,6 +765,10 @@ famfs_cp_usage(int argc,
 	       "    -u|--uid <uid>                - Specify uid (default is current user's uid)\n"
 	       "    -g|--gid <gid>                - Specify uid (default is current user's gid)\n"
 	       "    -v|--verbose                  - print debugging output while executing the command\n"
+	       "    -K|--cached                   - Copy through the processor cache and flush\n"
+	       "                                    afterward, rather than with non-temporal stores\n"
+	       "    -Q|--qdepth <n>               - Source reads in flight per thread (io_uring)\n"
+	       "                                    (default=%d; 0=synchronous reads)\n"
 	       "Interleaving Arguments:\n"
 	       "    -N|--nstrips <n>              - Number of strips to use in interleaved allocations.\n"
 	       "    -B|--nbuckets <n>             - Number of buckets to divide the device into\n"
@@ -778,7 +782,7 @@ famfs_cp_usage(int argc,
 	       "NOTE 2: you need this tool to copy a file into a famfs file system,\n"
 	       "        but the standard \'cp\' can be used to copy FROM a famfs file system.\n"
 	       "\n",
-	       progname, progname, progname);
+	       progname, progname, progname, FAMFS_CP_QDEPTH);
 }
 
 int
@@ -799,6 +803,8 @@ do_famfs_cli_cp(int argc, char *argv[])
 	int thread_ct = 0;
 
 	extern int cp_compare;
+	extern int cp_cached;
+	extern int cp_qdepth;
 
 	interleave_param.chunk_size = 0x200000; /* 2MiB default chunk */
 
@@ -812,6 +818,8 @@ do_famfs_cli_cp(int argc, char *argv[])
 
 		{"threadct",    required_argument,    0,  't'},
 		{"compare",     no_argument,          0,  'c'},
+		{"cached",      no_argument,          0,  'K'},
+		{"qdepth",      required_argument,    0,  'Q'},
 
 		{"chunksize",   required_argument,    0,  'C'},
 		{"nstrips",     required_argument,    0,  'N'},
@@ -823,7 +831,7 @@ do_famfs_cli_cp(int argc, char *argv[])
 	 * to return -1 when it sees something that is not recognized option
 	 * (e.g. the command that will mux us off to the command handlers
 	 */
-	while ((c = getopt_long(argc, argv, "+rm:u:g:C:N:B:vt:ch?",
+	while ((c = getopt_long(argc, argv, "+rm:u:g:C:N:B:vt:cKQ:h?",
 				cp_options, &optind)) != EOF) {
 
 		char *endptr;
@@ -844,6 +852,18 @@ do_famfs_cli_cp(int argc, char *argv[])
 		case 'c':
 			cp_compare = 1;
 			break;
+		case 'K':
+			cp_cached = 1;
+			break;
+		case 'Q':
+			cp_qdepth = strtol(optarg, 0, 0);
+			if (cp_qdepth < 0 || cp_qdepth > 1024) {
+				fprintf(stderr,
+					"famfs cp: invalid qdepth %s\n",
+					optarg);
+				return -1;
+			}
+			break;
 
 		case 'm':
 			mode = strtol(optarg, 0, 8); /* Must be valid octal */
@@ -1005,6 +1025,111 @@ do_famfs_cli_check(int argc, char *argv[])
 
 /********************************************************************/
 
+void
+famfs_df_usage(int argc,
+	       char *argv[])
+{
+	char *progname = argv[0];
+	(void)argc;
+
+	printf("\n"
+	       "famfs df: Report space usage of a famfs file system\n"
+	       "\n"
+	       "    %s df [args] <mount point>\n"
+	       "\n"
+	       "Reports the size of the file system, the space allocated (including the\n"
+	       "superblock and log), the free space, and the largest free extent (the\n"
+	       "largest file that can be allocated without interleaving). On a famfs-fuse\n"
+	       "mount with a daxdev, the daemon's running totals are used; otherwise\n"
+	       "the log is scanned.\n"
+	       "\n"
+	       "Arguments:\n"
+	       "    -?           - Print this message\n"
+	       "    -h|--human   - Print sizes in GiB\n"
+	       "    -v|--verbose - Print debugging output while executing the command\n"
+	       "\n", progname);
+}
+
+int
+do_famfs_cli_df(int argc, char *argv[])
+{
+	struct famfs_alloc_summary as;
+	float agig = 1024 * 1024 * 1024;
+	int from_daemon = 0;
+	char *path = NULL;
+	int verbose = 0;
+	int human = 0;
+	int rc;
+	int c;
+
+	struct option df_options[] = {
+		{"human",       no_argument,          0,  'h'},
+		{"verbose",     no_argument,          0,  'v'},
+		{0, 0, 0, 0}
+	};
+
+	/* Note: the "+" at the beginning of the arg string tells getopt_long
+	 * to return -1 when it sees something that is not recognized option
+	 * (e.g. the command that will mux us off to the command handlers
+	 */
+	while ((c = getopt_long(argc, argv, "+h?v",
+				df_options, &optind)) != EOF) {
+
+		switch (c) {
+		case 'h':
+			human = 1;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		case '?':
+			famfs_df_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	if (optind > (argc - 1)) {
+		fprintf(stderr, "famfs df: Must specify mount point\n");
+		famfs_df_usage(argc, argv);
+		return EINVAL;
+	}
+
+	path = argv[optind++];
+
+	rc = famfs_df(path, &as, &from_daemon, verbose);
+	if (rc)
+		return -rc;
+
+	if (human) {
+		printf("%-12s %10s %10s %10s %5s %12s\n",
+		       "Filesystem", "Size", "Used", "Avail", "Use%",
+		       "LargestFree");
+		printf("%-12s %9.2fG %9.2fG %9.2fG %4.0f%% %11.2fG\n",
+		       "famfs", (float)as.total / agig, (float)as.used / agig,
+		       (float)as.free / agig,
+		       (as.total) ? 100.0 * as.used / as.total : 0.0,
+		       (float)as.largest_free / agig);
+	} else {
+		printf("%-12s %16s %16s %16s %5s %16s\n",
+		       "Filesystem", "Size", "Used", "Avail", "Use%",
+		       "LargestFree");
+		printf("%-12s %16lld %16lld %16lld %4.0f%% %16lld\n",
+		       "famfs", as.total, as.used, as.free,
+		       (as.total) ? 100.0 * as.used / as.total : 0.0,
+		       as.largest_free);
+	}
+	if (verbose)
+		printf("alloc_unit=0x%llx files=%lld log_index=%lld "
+		       "source=%s\n", as.alloc_unit, as.nfiles, as.log_index,
+		       (from_daemon) ? "famfs_fused" : "log scan");
+	if (as.errors)
+		fprintf(stderr, "famfs df: %lld allocation collisions "
+			"(run famfs fsck)\n", as.errors);
+	return 0;
+}
+
+/********************************************************************/
+
 void
 famfs_getmap_usage(int argc,
 	    char *argv[])
@@ -1354,6 +1479,10 @@ famfs_creat_usage(int argc,
 	       "    -u|--uid <int uid>       - Default is caller's uid\n"
 	       "    -g|--gid <int gid>       - Default is caller's gid\n"
 	       "    -v|--verbose             - Print debugging output while executing the command\n"
+	       "    -t|--threadct <nthreads> - Threads used to randomize (default: one per cpu)\n"
+	       "    -R|--compat-random       - Randomize with the original (sequential) random\n"
+	       "                               stream format, which only one thread per file\n"
+	       "                               can generate\n"
 	       "\n"
 	       "Single-file create: (cannot mix with multi-create)\n"
 	       "    -s|--size <size>[kKmMgG] - Required file size\n"
@@ -1361,7 +1490,6 @@ famfs_creat_usage(int argc,
 	       "    -r|--randomize           - Optional - will randomize with provided seed\n"
 	       "\n"
 	       "Multi-file create: (cannot mix with single-create)\n"
-	       "    -t|--threadct <nthreads> - Thread count in --multi mode\n"
 	       "    -M|--multi <fname>,<size>[,<seed>]\n"
 	       "                             - This arg can repeat; will create each fiel\n"
 	       "                               if non-zero seed specified, will randomize\n"
@@ -1406,15 +1534,148 @@ free_multi_creat(struct multi_creat *mc, int multi_count)
 	free(mc);
 }
 
+/*
+ * File data for creat --randomize and verify
+ *
+ * By default the data comes from a counter-based generator
+ * (randomize_buffer_at()), where each word depends only on the seed and its
+ * offset. Each file is a range task on one work-stealing pool, which is
+ * split into RANDOM_CHUNK_SIZE pieces whenever threads are idle, so a
+ * single big file can use all the threads. Compat mode (-R) uses the
+ * original stream format (randomize_buffer()), which can only be generated
+ * front to back, so each file is one piece.
+ */
+#define RANDOM_CHUNK_SIZE (64ULL * 1024 * 1024)
+
+/* Non-compat data is generated into a cache-resident buffer this size, and
+ * streamed into the file with fcc_memcpy_nt() */
+#define RANDOM_BOUNCE_SIZE (64ULL * 1024)
+
+struct random_file {
+	char *addr;
+	size_t size;
+	s64 seed;
+	s64 bad_offset;  /* verify: first mismatch (or -1) */
+	int verify;
+	int compat;
+};
+
+/* Lower rf->bad_offset to @ofs; pieces may finish in any order */
+static void
+random_file_bad(struct random_file *rf, s64 ofs)
+{
+	s64 cur = __atomic_load_n(&rf->bad_offset, __ATOMIC_RELAXED);
+
+	while (cur < 0 || ofs < cur) {
+		if (__atomic_compare_exchange_n(&rf->bad_offset, &cur, ofs, 0,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			break;
+	}
+}
+
+static void
+threaded_random_range(void *arg, size_t start, size_t end)
+{
+	struct random_file *rf = arg;
+	char *p = rf->addr + start;
+	size_t len = end - start;
+	size_t pos, n;
+	char *bounce;
+	s64 ofs;
+
+	if (!rf->verify) {
+		bounce = (rf->compat) ? NULL : malloc(RANDOM_BOUNCE_SIZE);
+		if (!bounce) {
+			if (rf->compat)
+				randomize_buffer(p, len, rf->seed);
+			else
+				randomize_buffer_at(p, len, start, rf->seed);
+			flush_processor_cache(p, len);
+			return;
+		}
+		for (pos = 0; pos < len; pos += n) {
+			n = MIN(RANDOM_BOUNCE_SIZE, len - pos);
+			randomize_buffer_at(bounce, n, start + pos, rf->seed);
+			fcc_memcpy_nt(p + pos, bounce, n);
+		}
+		free(bounce);
+		return;
+	}
+
+	invalidate_processor_cache(p, len);
+	if (rf->compat)
+		ofs = validate_random_buffer(p, len, rf->seed);
+	else
+		ofs = validate_random_buffer_at(p, len, start, rf->seed);
+	if (ofs >= 0)
+		random_file_bad(rf, (s64)start + ofs);
+}
+
+/*
+ * Randomize or verify the mapped files @rf (files with a null addr are
+ * skipped). Work that can't be queued to the pool is done inline, so
+ * this can't fail; verify mismatches are reported in rf->bad_offset.
+ */
+static void
+random_files(
+	struct random_file *rf,
+	int nfiles,
+	int verify,
+	int compat,
+	int threadct)
+{
+	struct famfs_wsp_group group;
+	struct famfs_wsp *wsp = NULL;
+	size_t nchunks = 0;
+	int f;
+
+	for (f = 0; f < nfiles; f++) {
+		rf[f].bad_offset = -1;
+		rf[f].verify = verify;
+		rf[f].compat = compat;
+		if (!rf[f].addr || !rf[f].size)
+			continue;
+		nchunks += (compat) ? 1 :
+			(rf[f].size + RANDOM_CHUNK_SIZE - 1) / RANDOM_CHUNK_SIZE;
+	}
+	if (!nchunks)
+		return;
+
+	if (threadct > 1 && nchunks > 1)
+		wsp = famfs_wsp_create(MIN((size_t)threadct, nchunks));
+	famfs_wsp_group_init(&group);
+	for (f = 0; f < nfiles; f++) {
+		size_t grain = (compat) ? rf[f].size : RANDOM_CHUNK_SIZE;
+		size_t ofs;
+
+		if (!rf[f].addr || !rf[f].size)
+			continue;
+		if (wsp && famfs_wsp_submit_range(wsp, &group,
+						  threaded_random_range, NULL,
+						  &rf[f], 0, rf[f].size,
+						  grain) == 0)
+			continue;
+		for (ofs = 0; ofs < rf[f].size; ofs += grain)
+			threaded_random_range(&rf[f], ofs,
+					      MIN(ofs + grain, rf[f].size));
+	}
+	famfs_wsp_group_wait(&group);
+	famfs_wsp_group_destroy(&group);
+	famfs_wsp_destroy(wsp, 0);
+}
+
 static int
 randomize_one(
 	const char *filename,
 	size_t fsize,
-	s64 seed)
+	s64 seed,
+	int compat,
+	int threadct)
 {
+	struct random_file rf = { 0 };
 	size_t fsize_out;
 	void *addr;
-	char *buf;
 	int rc = 0;
 
 	if (!seed)
@@ -1432,10 +1693,11 @@ randomize_one(
 		rc = -1;
 		goto out;
 	}
-	buf = (char *)addr;
 
-	randomize_buffer(buf, fsize_out, seed);
-	flush_processor_cache(buf, fsize_out);
+	rf.addr = (char *)addr;
+	rf.size = fsize_out;
+	rf.seed = seed;
+	random_files(&rf, 1, 0, compat, threadct);
 	printf("randomized %ld bytes: %s\n", fsize_out, filename);
  out:
 	munmap(addr, fsize_out);
@@ -1560,26 +1822,15 @@ creat_multi(
 
 }
 
-static void
-threaded_randomize(void *arg)
-{
-	struct multi_creat *mc = arg;
-
-	assert(mc);
-	/* Only randomize if creation succeeded; preserve creation errors */
-	if (mc->rc == 0)
-		mc->rc = randomize_one(mc->fname, mc->fsize, mc->seed);
-}
-
-
 static int
 randomize_multi(
 	struct multi_creat *mc,
 	int multi_count,
+	int compat,
 	int threadct)
 {
+	struct random_file *rf;
 	int randomize_ct = 0;
-	threadpool thp;
 	int errs = 0;
 	int i;
 
@@ -1589,33 +1840,52 @@ randomize_multi(
 		return -1;
 	}
 
+	rf = calloc(multi_count, sizeof(*rf));
+	if (!rf)
+		return -1;
+
 	printf("%s: randomizing %d files via %d threads\n",
 	       __func__, multi_count, threadct);
-	if (threadct)
-		thp = thpool_init(threadct);
 	for (i = 0; i < multi_count; i++) {
-		/* Skip files that weren't created or don't have seeds */
-		if (!mc[i].seed)
+		size_t fsize;
+		void *addr;
+
+		/* Skip files that weren't created or don't have seeds;
+		 * only randomize if creation succeeded (preserve creation
+		 * errors) */
+		if (!mc[i].seed || mc[i].rc)
 			continue;
 
-		if (threadct)
-			thpool_add_work(thp, threaded_randomize,
-					(void *)&mc[i]);
-		else
-			threaded_randomize(&mc[i]);
+		addr = famfs_mmap_whole_file(mc[i].fname, 0, &fsize);
+		if (!addr) {
+			fprintf(stderr, "%s: randomize mmap failed: %s\n",
+				__func__, mc[i].fname);
+			mc[i].rc = -1;
+			continue;
+		}
+		if (mc[i].fsize && mc[i].fsize != fsize) {
+			fprintf(stderr, "%s: fsize horky %ld / %ld\n",
+				__func__, mc[i].fsize, fsize);
+			munmap(addr, fsize);
+			mc[i].rc = -1;
+			continue;
+		}
+		rf[i].addr = (char *)addr;
+		rf[i].size = fsize;
+		rf[i].seed = mc[i].seed;
 	}
 
-	if (threadct) {
-		thpool_wait(thp);
-		famfs_thpool_destroy(thp, 100000 /* 100ms */);
-	}
+	random_files(rf, multi_count, 0, compat, threadct);
 
 	for (i = 0; i < multi_count; i++) {
+		if (rf[i].addr)
+			munmap(rf[i].addr, rf[i].size);
 		if (mc[i].seed)
 			randomize_ct++;
 		if (mc[i].rc)
 			errs ++;
 	}
+	free(rf);
 
 	printf("Randomize complete for %d of %d files with %d errs\n",
 	       randomize_ct, multi_count, errs);
@@ -1637,6 +1907,7 @@ do_famfs_cli_creat(int argc, char *argv[])
 	int set_stripe = 0;
 	int randomize = 0;
 	int verbose = 0;
+	int compat = 0;
 	size_t fsize = 0;
 	s64 seed = 0;
 	int rc = 0;
@@ -1650,6 +1921,7 @@ do_famfs_cli_creat(int argc, char *argv[])
 		{"size",        required_argument,             0,  's'},
 		{"seed",        required_argument,             0,  'S'},
 		{"randomize",   no_argument,                   0,  'r'},
+		{"compat-random", no_argument,                 0,  'R'},
 		{"mode",        required_argument,             0,  'm'},
 		{"uid",         required_argument,             0,  'u'},
 		{"gid",         required_argument,             0,  'g'},
@@ -1670,7 +1942,7 @@ do_famfs_cli_creat(int argc, char *argv[])
 	 * to return -1 when it sees something that is not recognized option
 	 * (e.g. the command that will mux us off to the command handlers
 	 */
-	while ((c = getopt_long(argc, argv, "+s:S:m:u:g:rC:N:B:M:t:h?v",
+	while ((c = getopt_long(argc, argv, "+s:S:m:u:g:rRC:N:B:M:t:h?v",
 				creat_options, &optind)) != EOF) {
 		char *endptr;
 
@@ -1692,6 +1964,10 @@ do_famfs_cli_creat(int argc, char *argv[])
 			randomize++;
 			break;
 
+		case 'R':
+			compat = 1;
+			break;
+
 			/* General options */
 		case 'm':
 			mode = strtol(optarg, 0, 8); /* Must be valid octal */
@@ -1805,13 +2081,15 @@ do_famfs_cli_creat(int argc, char *argv[])
 			       (set_stripe) ? & interleave_param : NULL,
 			       mode, uid, gid, verbose, NULL);
 		if (!rc)
-			rc = randomize_one(filename, fsize, seed);
+			rc = randomize_one(filename, fsize, seed, compat,
+					   threadct);
 	} else {
 		rc = creat_multi(mc, multi_count,
 				 (set_stripe) ? & interleave_param : NULL,
 				 mode, uid, gid, verbose);
 		if (!rc)
-			rc = randomize_multi(mc, multi_count, threadct);
+			rc = randomize_multi(mc, multi_count, compat,
+					     threadct);
 
 	}
 
@@ -1937,7 +2215,10 @@ famfs_verify_usage(int argc,
 	       "    -m|--multi <filename>,<seed> - Verify multiple files in parallel\n"
 	       "                                   (specify with multiple instances of this arg)\n"
 	       "                                   (cannot combine with separate args)\n"
-	       "    -t|--threadct <nthreads>     - Thread count in --multi mode\n"
+	       "    -t|--threadct <nthreads>     - Thread count (default: one per cpu)\n"
+	       "    -q|--quiet                   - Only report failures\n"
+	       "    -R|--compat-random           - Verify data from the original random\n"
+	       "                                   stream format (see famfs creat -R)\n"
 	       "\n", progname);
 }
 
@@ -1962,14 +2243,34 @@ free_multi_verify(struct multi_verify *mv, int multi_count)
 	free(mv);
 }
 
+static void
+verify_report(
+	const char *filename,
+	const struct random_file *rf,
+	int quiet)
+{
+	if (rf->bad_offset < 0) {
+		if (!quiet)
+			printf("Success: verified %ld bytes in file %s\n",
+			       rf->size, filename);
+	} else {
+		fprintf(stderr,
+			"Verify fail: %s at offset %lld of %ld bytes\n",
+			filename, rf->bad_offset, rf->size);
+	}
+}
+
 static int
-verify_one(const char *filename, s64 seed, int quiet)
+verify_one(
+	const char *filename,
+	s64 seed,
+	int quiet,
+	int compat,
+	int threadct)
 {
+	struct random_file rf = { 0 };
 	size_t fsize;
 	void *addr;
-	char *buf;
-	int fd;
-	s64 rc;
 
 	if (filename == NULL) {
 		fprintf(stderr, "Must supply filename\n");
@@ -1980,51 +2281,31 @@ verify_one(const char *filename, s64 seed, int quiet)
 			"Must specify random seed to verify file data\n");
 		return 1;
 	}
-	fd = open(filename, O_RDWR, 0);
-	if (fd < 0) {
-		fprintf(stderr, "open %s failed; fd %d errno %d\n",
-			filename, fd, errno);
-		return 1;
-	}
 
 	addr = famfs_mmap_whole_file(filename, 0, &fsize);
 	if (!addr) {
-		fprintf(stderr, "%s: randomize mmap failed\n", __func__);
-		return 1;
-	}
-	invalidate_processor_cache(addr, fsize);
-	buf = (char *)addr;
-	rc = validate_random_buffer(buf, fsize, seed);
-	if (rc == -1) {
-		if (!quiet)
-			printf("Success: verified %ld bytes in file %s\n",
-			       fsize, filename);
-	} else {
-		fprintf(stderr,
-			"Verify fail: %s at offset %lld of %ld bytes\n",
-			filename, rc, fsize);
+		fprintf(stderr, "%s: verify mmap failed: %s\n", __func__,
+			filename);
 		return 1;
 	}
-	return 0;
-}
-
-static void
-threaded_verify(void *arg)
-{
-	struct multi_verify *mv = arg;
-
-	assert(mv);
-	mv->rc = verify_one(mv->fname, mv->seed, mv->quiet);
+	rf.addr = (char *)addr;
+	rf.size = fsize;
+	rf.seed = seed;
+	random_files(&rf, 1, 1, compat, threadct);
+	munmap(addr, fsize);
+	verify_report(filename, &rf, quiet);
+	return (rf.bad_offset < 0) ? 0 : 1;
 }
 
 static int
 verify_multi(
-	const struct multi_verify *mv,
+	struct multi_verify *mv,
 	int multi_count,
 	int threadct,
-	int quiet)
+	int quiet,
+	int compat)
 {
-	threadpool thp = NULL;
+	struct random_file *rf;
 	int errs = 0;
 	int i;
 
@@ -2038,23 +2319,47 @@ verify_multi(
 		printf("%s: threads=%d nfiles=%d\n",
 		       __func__, threadct,multi_count);
 
-	if (threadct)
-		thp = thpool_init(threadct);
+	rf = calloc(multi_count, sizeof(*rf));
+	if (!rf)
+		return -1;
+
 	for (i = 0; i < multi_count; i++) {
-		if (threadct)
-			thpool_add_work(thp, threaded_verify, (void *)&mv[i]);
-		else
-			threaded_verify((void *)&mv[i]);
+		size_t fsize;
+		void *addr;
+
+		if (!mv[i].seed) {
+			fprintf(stderr,
+				"Must specify random seed to verify file data\n");
+			mv[i].rc = 1;
+			continue;
+		}
+		addr = famfs_mmap_whole_file(mv[i].fname, 0, &fsize);
+		if (!addr) {
+			fprintf(stderr, "%s: verify mmap failed: %s\n",
+				__func__, mv[i].fname);
+			mv[i].rc = 1;
+			continue;
+		}
+		rf[i].addr = (char *)addr;
+		rf[i].size = fsize;
+		rf[i].seed = mv[i].seed;
 	}
 
-	if (threadct) {
-		thpool_wait(thp);
-		famfs_thpool_destroy(thp, 100000 /* 100ms */);
+	random_files(rf, multi_count, 1, compat, threadct);
+	for (i = 0; i < multi_count; i++) {
+		if (!rf[i].addr)
+			continue;
+		verify_report(mv[i].fname, &rf[i], mv[i].quiet);
+		mv[i].rc = (rf[i].bad_offset < 0) ? 0 : 1;
 	}
 
-	for (i = 0; i < multi_count; i++)
+	for (i = 0; i < multi_count; i++) {
+		if (rf[i].addr)
+			munmap(rf[i].addr, rf[i].size);
 		if (mv[i].rc)
 			errs++;
+	}
+	free(rf);
 
 	printf("Verify complete for %d files with %d errs\n",
 	       multi_count, errs);
@@ -2068,6 +2373,7 @@ do_famfs_cli_verify(int argc, char *argv[])
 	char *filename = NULL;
 	int multi_count = 0;
 	long threadct = sysconf(_SC_NPROCESSORS_ONLN);;
+	int compat = 0;
 	int quiet = 0;
 	s64 seed = 0;
 	s64 rc = 0;
@@ -2080,6 +2386,7 @@ do_famfs_cli_verify(int argc, char *argv[])
 		{"multi",       required_argument,             0,  'm'},
 		{"threadct",    required_argument,             0,  't'},
 		{"quiet",       no_argument,                   0,  'q'},
+		{"compat-random", no_argument,                 0,  'R'},
 		{0, 0, 0, 0}
 	};
 
@@ -2090,7 +2397,7 @@ do_famfs_cli_verify(int argc, char *argv[])
 	 * to return -1 when it sees something that is not recognized option
 	 * (e.g. the command that will mux us off to the command handlers
 	 */
-	while ((c = getopt_long(argc, argv, "+f:S:m:t:qh?",
+	while ((c = getopt_long(argc, argv, "+f:S:m:t:qRh?",
 				verify_options, &optind)) != EOF) {
 
 		switch (c) {
@@ -2153,6 +2460,10 @@ do_famfs_cli_verify(int argc, char *argv[])
 			quiet = 1;
 			break;
 
+		case 'R':
+			compat = 1;
+			break;
+
 		case 'h':
 		case '?':
 			famfs_verify_usage(argc, argv);
@@ -2161,9 +2472,9 @@ do_famfs_cli_verify(int argc, char *argv[])
 	}
 
 	if (!mv)
-		rc = verify_one(filename, seed, quiet);
+		rc = verify_one(filename, seed, quiet, compat, threadct);
 	else
-		rc = verify_multi(mv, multi_count, threadct, quiet);
+		rc = verify_multi(mv, multi_count, threadct, quiet, compat);
 
 multi_err:
 	free_multi_verify(mv, multi_count); /* ok if null */
@@ -2188,71 +2499,107 @@ famfs_flush_usage(int argc,
 	       "logplay also takes care of this, but if the log has not been played since the file\n"
 	       "was mutated, this operation may be needed.\n"
 	       "\n"
+	       "Large files are split across a pool of threads, which run on the cpus nearest\n"
+	       "the memory behind the file system (when its NUMA node is known).\n"
+	       "\n"
 	       "    %s flush [args] <file> [<file> ...]\n"
+	       "    %s flush [args] --multi <file> [--multi <file> ...]\n"
 	       "\n"
 	       "Arguments:\n"
-	       "    -v           - Verbose output\n"
-	       "    -h|-?        - Print this message\n"
+	       "    -M|--multi <file>    - A file to flush (may be repeated)\n"
+	       "    -t|--threads <n>     - Number of flush threads\n"
+	       "                           (default: one per cpu, up to 64)\n"
+	       "    -v                   - Verbose output (-v reports GB/s)\n"
+	       "    -h|-?                - Print this message\n"
 	       "\nNOTE: this creates a file system error and is for testing only!!\n"
-	       "\n", progname);
+	       "\n", progname, progname);
 }
 
 int
 do_famfs_cli_flush(int argc, char *argv[])
 {
+	struct famfs_flush_stats stats;
 	char fullpath[PATH_MAX];
-	char *file = NULL;
+	char **files = NULL;
+	int threadct = 0;
+	int nfiles = 0;
 	int verbose = 0;
 	int errs = 0;
-	int rc;
-	int c;
+	int c, i;
 
 	struct option flush_options[] = {
-		/* These options set a */
+		/* These options don't set a flag */
+		{"multi",       required_argument,             0,  'M'},
+		{"threads",     required_argument,             0,  't'},
 		{0, 0, 0, 0}
 	};
 
+	/* Every positional arg and --multi can be a file */
+	files = calloc(argc, sizeof(*files));
+	if (!files)
+		return -1;
+
 	/* Note: the "+" at the beginning of the arg string tells getopt_long
 	 * to return -1 when it sees something that is not recognized option
 	 * (e.g. the command that will mux us off to the command handlers
 	 */
-	while ((c = getopt_long(argc, argv, "+vh?",
+	while ((c = getopt_long(argc, argv, "+M:t:vh?",
 				flush_options, &optind)) != EOF) {
 
 		switch (c) {
 
+		case 'M':
+			files[nfiles++] = optarg;
+			break;
+		case 't':
+			threadct = atoi(optarg);
+			if (threadct < 0) {
+				fprintf(stderr, "%s: bad thread count %s\n",
+					__func__, optarg);
+				free(files);
+				return -1;
+			}
+			break;
 		case 'v':
 			verbose++;
 			break;
 		case 'h':
 		case '?':
 			famfs_flush_usage(argc, argv);
+			free(files);
 			return 0;
 		}
 	}
 
-	if (optind > (argc - 1)) {
-		fprintf(stderr,
-			"%s: source and destination filenames required\n",
-			__func__);
-		famfs_clone_usage(argc, argv);
+	while (optind < argc)
+		files[nfiles++] = argv[optind++];
+
+	if (nfiles == 0) {
+		fprintf(stderr, "%s: file name(s) required\n", __func__);
+		famfs_flush_usage(argc, argv);
+		free(files);
 		return -1;
 	}
-	while (optind < argc) {
-		file = argv[optind++];
-		if (realpath(file, fullpath) == NULL) {
+
+	/* Drop the files that don't exist (with an error) */
+	for (i = 0; i < nfiles; i++) {
+		if (realpath(files[i], fullpath) == NULL) {
 			fprintf(stderr, "%s: bad source path %s\n",
-				__func__, file);
+				__func__, files[i]);
 			errs++;
-			continue;
+			files[i--] = files[--nfiles];
 		}
-
-		rc = famfs_flush_file(file, verbose);
-		if (rc)
-			errs++;
 	}
+
+	errs += famfs_flush_files(nfiles, files, threadct, verbose, &stats);
+	if (verbose && stats.ns)
+		printf("famfs flush: %lld files, %.1f GiB in %.3f s "
+		       "(%.2f GB/s)\n",
+		       stats.nfiles, stats.bytes / (1024.0 * 1024 * 1024),
+		       stats.ns / 1e9, (double)stats.bytes / stats.ns);
 	if (errs)
 		printf("%s: %d errors were detected\n", __func__, errs);
+	free(files);
 	return -errs;
 }
 
@@ -2437,6 +2784,7 @@ famfs_cli_cmd famfs_cli_cmds[] = {
 	{"mount",   do_famfs_cli_mount,   famfs_mount_usage},
 	{"fsck",    do_famfs_cli_fsck,    famfs_fsck_usage},
 	{"check",   do_famfs_cli_check,   famfs_check_usage},
+	{"df",      do_famfs_cli_df,      famfs_df_usage},
 	{"mkdir",   do_famfs_cli_mkdir,   famfs_mkdir_usage},
 	{"cp",      do_famfs_cli_cp,      famfs_cp_usage},
 	{"creat",   do_famfs_cli_creat,   famfs_creat_usage},
@@ -27,6 +27,7 @@
 #include <pthread.h>
 #include <sys/file.h>
 #include <sys/xattr.h>
+#include <sys/param.h>
 #include <systemd/sd-journal.h>
 #include <signal.h>
 
@@ -37,6 +38,14 @@
 #include "famfs_fused.h"
 #include "famfs_fused_icache.h"
 #include "famfs_fused_rest.h"
+#include "famfs_fused_logtail.h"
+#include "famfs_fused_preload.h"
+#include "famfs_fused_io.h"
+#include "famfs_fused_stats.h"
+#include "famfs_fused_trace.h"
+#include "famfs_fused_affinity.h"
+#include "famfs_fused_dirp.h"
+#include "famfs_wspool.h"
 
 #ifdef FAMFS_COVERAGE
 extern void __gcov_dump(void);
@@ -90,6 +99,9 @@ struct _uintptr_to_must_hold_fuse_ino_t_dummy_struct \
  *     implemented.
  *   * famfs_get_inode_from_nodeid[_locked]() gets a ref which must be put
  *     with famfs_inode_putref[_locked]() or famfs_icache_unref_inode()
+ *   * FORGET and BATCH_FORGET drop the kernel's refs in batches with
+ *     famfs_icache_forget(), which frees released inodes (and parents)
+ *     after dropping the icache mutex
  *   * famfs_icache_find_get_from_ino[_locked]() also gets a ref
  *   * Note that the current flavor of this scheme is dentry-cache-like, but
  *     it doesn't separate dentries from inodes. As such, it does not support
@@ -112,6 +124,21 @@ famfs_dump_opts(const struct famfs_ctx *fd)
 		printf("    cache=%d\n", fd->cache);
 		printf("    timeout_set=%d\n", fd->timeout_set);
 		printf("    pass_yaml=%d\n", fd->pass_yaml);
+		printf("    logtail=%d\n", fd->logtail);
+		printf("    logtail_ms=%u\n", fd->logtail_ms);
+		printf("    negative_timeout=%f\n", fd->negative_timeout);
+		printf("    negcache_max=%u\n", fd->negcache_max);
+		printf("    dircache_mb=%u\n", fd->dircache_mb);
+		printf("    preload=%s\n", fd->preload);
+		printf("    preload_threads=%u\n", fd->preload_threads);
+		printf("    user_io=%d\n", fd->user_io);
+		printf("    op_stats=%d\n", fd->op_stats);
+		printf("    trace_records=%u\n", fd->trace_records);
+		printf("    async_log=%d\n", fd->async_log);
+		printf("    io_uring=%d\n", fd->io_uring);
+		printf("    io_uring_q_depth=%u\n", fd->io_uring_q_depth);
+		printf("    cpus=%s\n", fd->cpus);
+		printf("    numa_queues=%d\n", fd->numa_queues);
 	}
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s:\n", __func__);
@@ -124,6 +151,25 @@ famfs_dump_opts(const struct famfs_ctx *fd)
 	famfs_log(FAMFS_LOG_DEBUG, "    cache=%d\n", fd->cache);
 	famfs_log(FAMFS_LOG_DEBUG, "    timeout_set=%d\n", fd->timeout_set);
 	famfs_log(FAMFS_LOG_DEBUG, "    pass_yaml=%d\n", fd->pass_yaml);
+	famfs_log(FAMFS_LOG_DEBUG, "    logtail=%d\n", fd->logtail);
+	famfs_log(FAMFS_LOG_DEBUG, "    logtail_ms=%u\n", fd->logtail_ms);
+	famfs_log(FAMFS_LOG_DEBUG, "    negative_timeout=%f\n",
+		  fd->negative_timeout);
+	famfs_log(FAMFS_LOG_DEBUG, "    negcache_max=%u\n", fd->negcache_max);
+	famfs_log(FAMFS_LOG_DEBUG, "    dircache_mb=%u\n", fd->dircache_mb);
+	famfs_log(FAMFS_LOG_DEBUG, "    preload=%s\n", fd->preload);
+	famfs_log(FAMFS_LOG_DEBUG, "    preload_threads=%u\n",
+		  fd->preload_threads);
+	famfs_log(FAMFS_LOG_DEBUG, "    user_io=%d\n", fd->user_io);
+	famfs_log(FAMFS_LOG_DEBUG, "    op_stats=%d\n", fd->op_stats);
+	famfs_log(FAMFS_LOG_DEBUG, "    trace_records=%u\n",
+		  fd->trace_records);
+	famfs_log(FAMFS_LOG_DEBUG, "    async_log=%d\n", fd->async_log);
+	famfs_log(FAMFS_LOG_DEBUG, "    io_uring=%d\n", fd->io_uring);
+	famfs_log(FAMFS_LOG_DEBUG, "    io_uring_q_depth=%u\n",
+		  fd->io_uring_q_depth);
+	famfs_log(FAMFS_LOG_DEBUG, "    cpus=%s\n", fd->cpus);
+	famfs_log(FAMFS_LOG_DEBUG, "    numa_queues=%d\n", fd->numa_queues);
 }
 
 /*
@@ -156,6 +202,50 @@ static const struct fuse_opt famfs_opts[] = {
 	  offsetof(struct famfs_ctx, readdirplus), 1 },
 	{ "no_readdirplus",
 	  offsetof(struct famfs_ctx, readdirplus), 0 },
+	{ "logtail",
+	  offsetof(struct famfs_ctx, logtail), 1 },
+	{ "no_logtail",
+	  offsetof(struct famfs_ctx, logtail), 0 },
+	{ "logtail_ms=%u",
+	  offsetof(struct famfs_ctx, logtail_ms), 0 },
+	{ "negative_timeout=%lf",
+	  offsetof(struct famfs_ctx, negative_timeout), 0 },
+	{ "negative_timeout=",
+	  offsetof(struct famfs_ctx, negative_timeout_set), 1 },
+	{ "negcache_max=%u",
+	  offsetof(struct famfs_ctx, negcache_max), 0 },
+	{ "dircache_mb=%u",
+	  offsetof(struct famfs_ctx, dircache_mb), 0 },
+	{ "preload=%s",
+	  offsetof(struct famfs_ctx, preload), 0 },
+	{ "preload_threads=%u",
+	  offsetof(struct famfs_ctx, preload_threads), 0 },
+	{ "user_io",
+	  offsetof(struct famfs_ctx, user_io), 1 },
+	{ "no_user_io",
+	  offsetof(struct famfs_ctx, user_io), 0 },
+	{ "op_stats",
+	  offsetof(struct famfs_ctx, op_stats), 1 },
+	{ "no_op_stats",
+	  offsetof(struct famfs_ctx, op_stats), 0 },
+	{ "trace_records=%u",
+	  offsetof(struct famfs_ctx, trace_records), 0 },
+	{ "async_log",
+	  offsetof(struct famfs_ctx, async_log), 1 },
+	{ "no_async_log",
+	  offsetof(struct famfs_ctx, async_log), 0 },
+	{ "io_uring",
+	  offsetof(struct famfs_ctx, io_uring), 1 },
+	{ "no_io_uring",
+	  offsetof(struct famfs_ctx, io_uring), 0 },
+	{ "io_uring_q_depth=%u",
+	  offsetof(struct famfs_ctx, io_uring_q_depth), 0 },
+	{ "cpus=%s",
+	  offsetof(struct famfs_ctx, cpus), 0 },
+	{ "numa_queues",
+	  offsetof(struct famfs_ctx, numa_queues), 1 },
+	{ "no_numa_queues",
+	  offsetof(struct famfs_ctx, numa_queues), 0 },
 	{ "debug=%d",
 	  offsetof(struct famfs_ctx, debug), 0 },
 
@@ -187,7 +277,73 @@ static void famfs_fused_help(void)
 "    -o timeout=0/1         Timeout is set\n"
 "    -o cache=never         Disable cache\n"
 "    -o cache=auto          Auto enable cache\n"
-"    -o cache=always        Cache always\n");
+"    -o cache=always        Cache always\n"
+"    -o logtail             Tail the log (read from daxdev); invalidate\n"
+"                           kernel dentries when new files/dirs are logged\n"
+"    -o logtail_ms=100      Log tail poll interval (milliseconds)\n"
+"    -o negative_timeout=1.0 Negative lookup caching timeout\n"
+"                           (default: same as timeout with logtail,\n"
+"                           else 0; 0 disables)\n"
+"    -o negcache_max=16384  Max negative lookups cached in famfs_fused\n"
+"    -o dircache_mb=64      Memory for cached directory listings (MiB;\n"
+"                           0 disables)\n"
+"    -o preload=/subtree    Cache inodes and fmaps under subtree (relative\n"
+"                           to the mount root) before mounting\n"
+"    -o preload_threads=8   Threads used by preload\n"
+"    -o user_io             Serve read/write from the daemon (default:\n"
+"                           only if the kernel lacks DAX_FMAP)\n"
+"    -o no_user_io          Never serve read/write from the daemon\n"
+"    -o no_op_stats         Don't keep per-op latency histograms\n"
+"    -o trace_records=4096  Requests kept in each thread's trace ring\n"
+"                           (0 disables tracing)\n"
+"    -o async_log           Make syslog calls from a logger thread\n"
+"    -o io_uring            Use fuse-over-io_uring if libfuse and the kernel\n"
+"                           support it (else /dev/fuse reads)\n"
+"    -o io_uring_q_depth=8  Requests per io_uring queue (one queue per core)\n"
+"    -o cpus=0-7,16-23      Run the daemon (and allocate the icache) on\n"
+"                           these cpus\n"
+"    -o numa_queues         Spread worker threads (each with its own\n"
+"                           clone_fd queue) over the NUMA nodes in the\n"
+"                           cpu set\n");
+}
+
+/*
+ * fuse-over-io_uring
+ *
+ * With -o io_uring, requests are fetched and replied to through io_uring
+ * queues (one per core, with the queue's thread pinned to the core) rather
+ * than a read() and a write() on /dev/fuse per request. libfuse does the
+ * work (when built with io_uring support, FUSE_CAP_OVER_IO_URING); we just
+ * pass its session options through. If libfuse lacks io_uring we stay on
+ * /dev/fuse, and if the kernel lacks it libfuse falls back by itself.
+ */
+static int
+famfs_uring_args(struct famfs_ctx *lo, struct fuse_args *args)
+{
+#ifdef FUSE_CAP_OVER_IO_URING
+	char opt[64];
+
+	if (!lo->io_uring)
+		return 0;
+
+	if (fuse_opt_add_arg(args, "-oio_uring"))
+		return -1;
+	if (lo->io_uring_q_depth) {
+		snprintf(opt, sizeof(opt), "-oio_uring_q_depth=%u",
+			 lo->io_uring_q_depth);
+		if (fuse_opt_add_arg(args, opt))
+			return -1;
+	}
+#else
+	if (lo->io_uring) {
+		famfs_log(FAMFS_LOG_NOTICE,
+			  "%s: libfuse lacks io_uring; using /dev/fuse\n",
+			  __func__);
+		lo->io_uring = 0;
+	}
+	(void)args;
+#endif
+	return 0;
 }
 
 static struct famfs_ctx *famfs_ctx_from_req(fuse_req_t req)
@@ -232,6 +388,23 @@ static void famfs_init(
 				 __func__);
 		}
 	}
+
+#ifdef FUSE_CAP_OVER_IO_URING
+	/* libfuse requests io_uring itself (see famfs_uring_args()); this
+	 * just reports which transport we ended up with */
+	if (lo->io_uring)
+		famfs_log(FAMFS_LOG_NOTICE, "%s: transport: %s\n", __func__,
+			  (conn->want_ext & FUSE_CAP_OVER_IO_URING)
+			  ? "io_uring" : "/dev/fuse (kernel lacks io_uring)");
+#endif
+
+	/* Without DAX_FMAP, the kernel sends READ and WRITE to us */
+	if (lo->user_io < 0)
+		lo->user_io = !(conn->want_ext & FUSE_CAP_DAX_FMAP);
+	if (lo->user_io && famfs_dax_map(lo))
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: user_io disabled (cannot map daxdev)\n",
+			  __func__);
 }
 
 static void famfs_destroy(void *userdata)
@@ -264,7 +437,7 @@ famfs_getattr(
 			      AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
 		if (res == -1) {
 			famfs_inode_putref(inode);
-			return (void) fuse_reply_err(req, errno);
+			return (void) famfs_reply_err(req, errno);
 		}
 		inode->attr = buf;
 	}
@@ -321,7 +494,7 @@ famfs_setattr(
 
 	if (errs) {
 		famfs_log(FAMFS_LOG_DEBUG, "%s: ENOTSUP\n", __func__);
-		fuse_reply_err(req, EINVAL);
+		famfs_reply_err(req, EINVAL);
 	} else {
 		inode->attr = buf; /* replace with changed attr */
 		inode->pinned = 1;
@@ -353,25 +526,217 @@ famfs_check_inode(
 	return 0;
 }
 
+/*
+ * famfs_shadow_ent_load()
+ *
+ * Get the attributes (and the fmeta, for files) of a shadow entry. A single
+ * openat() serves both types: directories stay open (the fd will be cached in
+ * the famfs_inode), and regular files are read and closed.
+ *
+ * If @icache is non-null, it is checked once the inode number is known; on a
+ * hit the shadow yaml is not parsed and ent->inode holds a ref.
+ *
+ * Returns 0 or an errno (which is also stored in ent->err)
+ */
+int
+famfs_shadow_ent_load(
+	int parentfd,
+	struct famfs_shadow_ent *ent,
+	struct famfs_icache *icache)
+{
+	void *yaml_buf = NULL;
+	ssize_t yaml_size;
+	struct stat st;
+	int fd;
+	int rc;
+
+	fd = openat(parentfd, ent->name,
+		    O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY);
+	if (fd == -1) {
+		/* A symlink is neither file nor dir */
+		ent->err = (errno == ELOOP) ? ENOENT : errno;
+		if (ent->err != ENOENT)
+			famfs_log(FAMFS_LOG_ERR, "%s: open failed errno=%d\n",
+				  __func__, ent->err);
+		return ent->err;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		ent->err = errno;
+		goto out_close;
+	}
+
+	if (icache) {
+		ent->inode = famfs_icache_find_get_from_ino(icache, st.st_ino);
+		if (ent->inode) {
+			close(fd);
+			return 0;
+		}
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		famfs_log(FAMFS_LOG_DEBUG,
+			 "               : inode=%d is a directory\n",
+			 st.st_ino);
+		ent->ftype = FAMFS_FDIR;
+		ent->attr = st;
+		ent->fd = fd;
+		return 0;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		famfs_log(FAMFS_LOG_DEBUG,
+			 "               : inode=%d is neither file nor dir\n",
+			 st.st_ino);
+		ent->err = ENOENT;
+		goto out_close;
+	}
+
+	ent->ftype = FAMFS_FREG;
+	yaml_buf = famfs_read_fd_to_buf(fd, FAMFS_YAML_MAX, &yaml_size);
+
+	/* Don't keep regular files open - only directories */
+	close(fd);
+
+	if (!yaml_buf) {
+		famfs_log(FAMFS_LOG_ERR, "failed to read to yaml_buf\n");
+		ent->err = EIO;
+		return ent->err;
+	}
+
+	ent->fmeta = calloc(1, sizeof(*ent->fmeta));
+	if (!ent->fmeta) {
+		free(yaml_buf);
+		ent->err = ENOMEM;
+		return ent->err;
+	}
+
+	/* Famfs gets the stat struct from the shadow yaml */
+	rc = famfs_shadow_to_stat(yaml_buf, yaml_size, &st, &ent->attr,
+				  ent->fmeta, 0);
+	free(yaml_buf);
+	if (rc) {
+		free(ent->fmeta);
+		ent->fmeta = NULL;
+		ent->err = EINVAL;
+		return ent->err;
+	}
+	ent->attr.st_ino = st.st_ino; /* Inode number from file, not yaml */
+	return 0;
+
+out_close:
+	close(fd);
+	return ent->err;
+}
+
+/*
+ * famfs_shadow_ent_commit_locked()
+ *
+ * Find or insert the famfs_inode for a loaded shadow entry. On return,
+ * ent->inode holds one ref, which becomes the kernel's lookup ref when the
+ * entry is sent. The entry's fd is either handed to a new inode or released;
+ * the inode keeps a compact copy of the entry's fmeta.
+ *
+ * Caller must hold the icache mutex.
+ */
+struct famfs_inode *
+famfs_shadow_ent_commit_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *parent_inode,
+	struct famfs_shadow_ent *ent)
+{
+	struct famfs_inode *inode = ent->inode;
+
+	if (!inode)
+		inode = famfs_icache_find_get_from_ino_locked(icache,
+							      ent->attr.st_ino);
+	if (inode) {
+		famfs_log(FAMFS_LOG_DEBUG,
+			  "%s: inode=%d already cached\n",
+			  __func__, inode->ino);
+
+		if (ent->fmeta && famfs_check_inode(inode, ent->fmeta, NULL)) {
+			/* Recover by replacing the stale metadata... */
+			free(inode->fmap);
+			inode->fmap = NULL;
+			free(inode->fmap_msg);
+			inode->fmap_msg = NULL;
+			inode->fmap_msg_size = 0;
+		}
+		if (inode->ftype == FAMFS_FREG && !inode->fmap &&
+		    ent->fmeta) {
+			famfs_log(FAMFS_LOG_ERR,
+				 "%s: null fmap for ino=%ld; populating\n",
+				 __func__, inode->ino);
+			inode->fmap = famfs_cfmap_alloc(ent->fmeta);
+		}
+		famfs_shadow_ent_release(ent);
+		ent->inode = inode;
+		return inode;
+	}
+
+	inode = famfs_inode_alloc(icache,
+				  ent->fd,    /* valid for dirs, -1 for files */
+				  ent->name,
+				  ent->attr.st_ino, /* inode number */
+				  ent->attr.st_dev,
+				  ent->fmeta, /* valid only for files */
+				  &ent->attr,
+				  ent->ftype,
+				  parent_inode);
+	if (!inode) {
+		ent->err = ENOMEM;
+		return NULL;
+	}
+	/* The inode owns the fd now */
+	ent->fd = -1;
+
+	famfs_log(FAMFS_LOG_DEBUG, "               : Caching inode %d\n",
+		  ent->attr.st_ino);
+	famfs_icache_insert_locked(icache, inode);
+
+	/* Insert leaves base+1; we only keep the lookup ref */
+	famfs_inode_putref_locked(inode, 1);
+	ent->inode = inode;
+	return inode;
+}
+
+/*
+ * Fill in a fuse_entry_param from a committed shadow entry
+ */
+static void
+famfs_shadow_ent_to_entry(
+	struct famfs_ctx *lo,
+	const struct famfs_shadow_ent *ent,
+	struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->attr_timeout = lo->timeout;
+	e->entry_timeout = lo->timeout;
+
+	/* Use cached attrs (preserves chown/chmod changes) */
+	e->attr = ent->inode->attr;
+
+	/* The address of the famfs_inode is a valid "nodeid" because it is
+	 * unique */
+	e->ino = (uintptr_t) ent->inode;
+}
+
 static int
 famfs_do_lookup(
 	fuse_req_t req,
 	fuse_ino_t parent,
 	const char *name,
-	struct fuse_entry_param *e,
-	struct famfs_log_file_meta **fmeta_out)
+	struct fuse_entry_param *e)
 {
-	enum famfs_fuse_ftype ftype = FAMFS_FINVALID;
-	struct famfs_log_file_meta *fmeta = NULL;
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *parent_inode = famfs_get_inode_from_nodeid(&lo->icache,
 								       parent);
-	struct famfs_inode *inode = NULL;
-	struct stat st;
+	struct famfs_shadow_ent ent = { .fd = -1, .d_type = DT_UNKNOWN };
+	struct famfs_inode *inode;
+	uint64_t neg_gen;
 	int parentfd;
-	int saverr;
-	int newfd;
-	int res;
+	int err;
 
 	famfs_log(FAMFS_LOG_DEBUG,
 		 "%s: parent_inode=%lx ino=%ld ref=%lld "
@@ -391,157 +756,54 @@ famfs_do_lookup(
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: name=%s (%s)\n", __func__, name,
 	       (parentfd < 0) ? "ERROR bad parentfd" : "good parentfd");
-	if (parentfd < 0)
-		goto out_err;
-
-	newfd = openat(parentfd, name, O_PATH | O_NOFOLLOW, O_RDONLY);
-	if (newfd == -1) {
-		if (errno != ENOENT)
-			famfs_log(FAMFS_LOG_ERR, "%s: open failed errno=%d\n",
-				  __func__, errno);
-		goto out_err;
+	if (parentfd < 0) {
+		err = EBADF;
+		goto out;
 	}
+	if (strlen(name) > NAME_MAX) {
+		err = ENAMETOOLONG;
+		goto out;
+	}
+	strcpy(ent.name, name);
 
-	/* Gotta check if this is a file or directory */
-	res = fstatat(newfd, "", &st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
-	if (res == -1)
-		goto out_err;
-
-	e->attr = st;
-	if (S_ISDIR(st.st_mode)) {
-		ftype = FAMFS_FDIR;
-		famfs_log(FAMFS_LOG_DEBUG,
-			 "               : inode=%d is a directory\n",
-			 e->attr.st_ino);
-	} else if (S_ISREG(st.st_mode)) {
-		void *yaml_buf = NULL;
-		ssize_t yaml_size;
-		ino_t ino = st.st_ino; /* Inode number from file, not yaml */
-
-		ftype = FAMFS_FREG;
-
-		/* Now that we know it's a regular file, we must
-		 * close and re-open without O_PATH to get to the
-		 * shadow yaml */
-		close(newfd);
-		newfd = openat(parentfd, name, O_NOFOLLOW, O_RDONLY);
-		if (newfd == -1) {
-			goto out_err;
-		}
-
-		fmeta = calloc(1, sizeof(*fmeta));
-		if (!fmeta)
-			goto out_err;
-		
-		yaml_buf = famfs_read_fd_to_buf(newfd, FAMFS_YAML_MAX,
-						&yaml_size);
-		if (!yaml_buf) {
-			famfs_log(FAMFS_LOG_ERR,
-				  "failed to read to yaml_buf\n");
-			goto out_err;
-		}
-
-		/* Don't keep regular files open - only directories */
-		close(newfd);
-		newfd = -1;
-
-		/* Famfs gets the stat struct from the shadow yaml */
-		res = famfs_shadow_to_stat(yaml_buf, yaml_size, &st,
-					   &e->attr, fmeta, 0);
-		if (res)
-			goto out_err;
-		st.st_ino = ino;
-
-		if (yaml_buf)
-			free(yaml_buf);
-
-	} else {
-		famfs_log(FAMFS_LOG_DEBUG,
-			 "               : inode=%d is neither file nor dir\n",
-			 e->attr.st_ino);
-		saverr = ENOENT;
-		goto out_err;
+	/* Known not to exist? Sample the generation first, so a negative
+	 * entry is not cached if a new entry is logged while we search */
+	neg_gen = famfs_negcache_gen(&lo->negcache);
+	if (famfs_negcache_lookup(&lo->negcache, parent_inode->ino, name)) {
+		famfs_trace_flags(FAMFS_TRACE_NEG_HIT);
+		err = ENOENT;
+		e->entry_timeout = lo->negative_timeout;
+		goto out;
 	}
 
 	/* We don't have the nodeid of the file being looked up - if it was
 	 * in our cache, the kernel probably would not need to look it up.
-	 * But we need to check, which is a search by inode number (ino)
-	 * This is an actual search of the icache
+	 * But we need to check, which is a search by inode number (ino).
+	 * The load checks the icache before parsing any shadow yaml.
 	 */
-	inode = NULL;
-	if (!inode) {
-		pthread_mutex_lock(&lo->icache.mutex);
-		inode = famfs_icache_find_get_from_ino_locked(&lo->icache,
-							      e->attr.st_ino);
-		if (inode) {
-			/* inode refcount counts lookups. Add +1 to the refcount
-			 * in addition to the +1 from find_get above so we can
-			 * unconditionally drop 1 ref on exit
-			 */
-			famfs_inode_getref_locked(inode);
-			pthread_mutex_unlock(&lo->icache.mutex);
-			goto found_inode;
-		} else {
-			saverr = ENOMEM;
-
-			inode = famfs_inode_alloc(
-					&lo->icache,
-					newfd /* valid for dirs, -1 for files */,
-					name,
-					e->attr.st_ino /* inode number */,
-					e->attr.st_dev,
-					fmeta,         /* valid only for files */
-					&e->attr,
-					ftype,
-					parent_inode);
-
-			if (!inode) {
-				pthread_mutex_unlock(&lo->icache.mutex);
-				goto out_err;
-			}
-			famfs_log(FAMFS_LOG_DEBUG,
-				  "               : Caching inode %d\n",
-				  e->attr.st_ino);
-			famfs_icache_insert_locked(&lo->icache, inode);
-		}
-		pthread_mutex_unlock(&lo->icache.mutex);
-	} else {
-		int rc;
-found_inode:
-
-		famfs_log(FAMFS_LOG_DEBUG,
-			  "s: inode=%d already cached\n", inode->ino);
-
-		/* Use cached attrs (preserves chown/chmod changes) */
-		e->attr = inode->attr;
+	err = famfs_shadow_ent_load(parentfd, &ent, &lo->icache);
+	if (err == ENOENT) {
+		/* Only let the kernel cache it if we cached it too */
+		e->entry_timeout = 0;
+		if (!famfs_negcache_insert(&lo->negcache, parent_inode->ino,
+					   name, neg_gen))
+			e->entry_timeout = lo->negative_timeout;
+		goto out;
+	}
+	if (err)
+		goto out;
+	famfs_trace_flags((ent.inode) ? FAMFS_TRACE_ICACHE_HIT
+			  : FAMFS_TRACE_ICACHE_MISS);
 
-		close(newfd);
-		newfd = -1;
-		rc = famfs_check_inode(inode, fmeta, e);
-		if (rc) {
-			/* Recover by replacing the stale metadata... */
-			if (inode->fmeta) {
-				free(inode->fmeta);
-				inode->fmeta = NULL;
-			}
-		}
-		if (inode->ftype == FAMFS_FREG && !inode->fmeta) {
-			famfs_log(FAMFS_LOG_ERR,
-				 "%s: null fmeta for ino=%ld; populating\n",
-				 __func__, e->attr.st_ino);
-			inode->fmeta = fmeta;
-		} else {
-			/* XXX: should we verify that fmeta matches inode? */
-			free(fmeta);
-			fmeta = NULL;
-		}
+	pthread_mutex_lock(&lo->icache.mutex);
+	inode = famfs_shadow_ent_commit_locked(&lo->icache, parent_inode, &ent);
+	pthread_mutex_unlock(&lo->icache.mutex);
+	if (!inode) {
+		err = ent.err;
+		goto out;
 	}
 
-	/* The address of the famfs_inode is a valid "nodeid" because it is
-	 * unique */
-	e->ino = (uintptr_t) inode;
-	if (fmeta_out)
-		*fmeta_out = inode->fmeta;
+	famfs_shadow_ent_to_entry(lo, &ent, e);
 
 	/* Note that the "nodeid" is used in-kernel, as fi->nodeid. It is the
 	 * "key" used for looking up the famfs_inode. The inode number
@@ -555,26 +817,14 @@ found_inode:
 	 * have been freed and/or reused. So we still have to look up the inode
 	 * in our cache...
 	 */
-	dump_inode(__func__, inode, FAMFS_LOG_NOTICE);
+	dump_inode(__func__, inode, FAMFS_LOG_DEBUG);
 
-	/* TODO: a vectorized famfs_inode_putref would be nice */
+out:
+	famfs_shadow_ent_release(&ent);
 	if (parent_inode)
 		famfs_inode_putref(parent_inode);
-	if (inode)
-		famfs_inode_putref(inode);
-
-	return 0;
-
-out_err:
-	if (parent_inode)
-		famfs_inode_putref(parent_inode);
-	saverr = errno;
-	if (newfd != -1)
-		close(newfd);
-	if (fmeta)
-		free(fmeta);
 
-	return saverr;
+	return err;
 }
 
 static void
@@ -583,15 +833,111 @@ famfs_lookup(
 	fuse_ino_t parent,
 	const char *name)
 {
-	struct famfs_log_file_meta *fmeta = NULL;
 	struct fuse_entry_param e;
 	int err;
 
-	err = famfs_do_lookup(req, parent, name, &e, &fmeta);
-	if (err)
-		fuse_reply_err(req, err);
-	else
+	err = famfs_do_lookup(req, parent, name, &e);
+	if (err == ENOENT && e.entry_timeout > 0) {
+		/* A zero nodeid with an entry timeout is a negative entry,
+		 * which the kernel can cache */
+		e.ino = 0;
+		e.attr_timeout = 0;
 		fuse_reply_entry(req, &e);
+	} else if (err) {
+		famfs_reply_err(req, err);
+	} else {
+		fuse_reply_entry(req, &e);
+	}
+}
+
+/*
+ * famfs_negcache_invalidate_all() callback: tell the kernel to drop its
+ * negative dentry for a name that was in our negative cache
+ */
+void
+famfs_negcache_notify_kernel(
+	uint64_t parent_ino,
+	const char *name,
+	void *arg)
+{
+	struct famfs_ctx *lo = arg;
+	struct famfs_inode *parent;
+	fuse_ino_t nodeid;
+
+	if (!lo->se)
+		return;
+
+	parent = famfs_icache_find_get_from_ino(&lo->icache, parent_ino);
+	if (!parent)
+		return; /* Kernel can't have a dentry under an uncached dir */
+
+	nodeid = (parent == &lo->icache.root) ? FUSE_ROOT_ID
+					      : (uintptr_t)parent;
+	fuse_lowlevel_notify_inval_entry(lo->se, nodeid, name, strlen(name));
+	famfs_inode_putref(parent);
+}
+
+/*
+ * famfs_inode_cache_fmap_msg()
+ *
+ * Serialize a file's fmap into a GET_FMAP reply message and cache it on the
+ * inode, so it is built once rather than on every GET_FMAP.
+ *
+ * Returns the message size, or a negative errno
+ */
+ssize_t
+famfs_inode_cache_fmap_msg(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	struct famfs_log_file_meta fmeta;
+	ssize_t fmap_size;
+	char *msg, *small;
+	int rc = -ENOENT;
+
+	/* Expand the compact fmap under the mutex, in case it is replaced */
+	pthread_mutex_lock(&icache->mutex);
+	fmap_size = (inode->fmap_msg) ? (ssize_t)inode->fmap_msg_size : 0;
+	if (!fmap_size && inode->fmap)
+		rc = famfs_cfmap_to_fmeta(inode->fmap, &inode->attr, &fmeta);
+	pthread_mutex_unlock(&icache->mutex);
+
+	if (fmap_size)
+		return fmap_size;
+	if (rc)
+		return rc;
+
+	msg = calloc(1, FMAP_MSG_MAX);
+	if (!msg)
+		return -ENOMEM;
+
+	/* XXX: FUSE_FAMFS_FILE_REG - mark sb and log correctly */
+	fmap_size = famfs_log_file_meta_to_msg(msg, FMAP_MSG_MAX,
+					       FUSE_FAMFS_FILE_REG, &fmeta);
+	if (fmap_size <= 0) {
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: %ld error putting fmap in message\n",
+			  __func__, fmap_size);
+		free(msg);
+		return -EINVAL;
+	}
+
+	/* Most fmaps are far smaller than FMAP_MSG_MAX */
+	small = realloc(msg, fmap_size);
+	if (small)
+		msg = small;
+
+	pthread_mutex_lock(&icache->mutex);
+	if (!inode->fmap_msg) {
+		inode->fmap_msg = msg;
+		inode->fmap_msg_size = fmap_size;
+		msg = NULL;
+	}
+	fmap_size = inode->fmap_msg_size;
+	pthread_mutex_unlock(&icache->mutex);
+
+	free(msg); /* Another thread cached it first */
+	return fmap_size;
 }
 
 static void
@@ -601,19 +947,12 @@ famfs_get_fmap(
 	size_t size)
 {
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
-	ssize_t fmap_bufsize = FMAP_MSG_MAX;
 	struct famfs_inode *inode = NULL;
-	char *fmap_message = NULL;
+	char fmap_message[FMAP_MSG_MAX];
 	ssize_t fmap_size;
 	int err = 0;
 	(void)size;
 
-	fmap_message = calloc(1, fmap_bufsize);
-	if (!fmap_message) {
-		err = ENOMEM;
-		goto out_err;
-	}
-
 	/* The nodeid is the address of the famfs_inode. Retrieving it
 	 * this way validates that there is indeed an inode at that address.
 	 */
@@ -626,32 +965,38 @@ famfs_get_fmap(
 		goto out_err;
 	}
 
-	if (!inode->fmeta) {
+	/* The message is usually cached already (by preload or a previous
+	 * GET_FMAP) */
+	fmap_size = famfs_inode_cache_fmap_msg(&lo->icache, inode);
+	if (fmap_size == -ENOENT) {
 		famfs_log(FAMFS_LOG_ERR, "%s: no fmap on inode\n", __func__);
 		err = ENOENT;
 		goto out_err;
 	}
-
-	/* XXX: FUSE_FAMFS_FILE_REG - mark sb and log correctly */
-	fmap_size = famfs_log_file_meta_to_msg(fmap_message, fmap_bufsize,
-					       FUSE_FAMFS_FILE_REG,
-					       inode->fmeta);
 	if (fmap_size <= 0) {
 		/* Send reply without fmap */
-		famfs_log(FAMFS_LOG_ERR,
-			  "%s: %ld error putting fmap in message\n",
-			 __func__, fmap_size);
-		err = EINVAL;
+		err = -fmap_size;
 		goto out_err;
 	}
 
-	err = fuse_reply_buf(req, fmap_message, fmap_size /* FMAP_MSG_MAX */);
+	/* Copy under the mutex, in case the fmap is replaced */
+	pthread_mutex_lock(&lo->icache.mutex);
+	fmap_size = MIN((size_t)fmap_size, inode->fmap_msg_size);
+	if (inode->fmap_msg)
+		memcpy(fmap_message, inode->fmap_msg, fmap_size);
+	else
+		fmap_size = 0;
+	pthread_mutex_unlock(&lo->icache.mutex);
+	if (!fmap_size) {
+		err = ENOENT;
+		goto out_err;
+	}
+
+	err = fuse_reply_buf(req, fmap_message, fmap_size);
 	if (err)
 		famfs_log(FAMFS_LOG_ERR, "%s: fuse_reply_buf returned err %d\n",
 			 __func__, err);
 
-	free(fmap_message);
-
 	famfs_inode_putref(inode);
 	return;
 
@@ -659,10 +1004,7 @@ out_err:
 	if (inode)
 		famfs_inode_putref(inode);
 
-	if (fmap_message)
-		free(fmap_message);
-
-	fuse_reply_err(req, err);
+	famfs_reply_err(req, err);
 }
 
 static void
@@ -703,24 +1045,7 @@ famfs_get_daxdev(
 	return;
 
 out_err:
-	fuse_reply_err(req, err);
-}
-
-static void
-famfs_forget_one(
-	fuse_req_t req,
-	fuse_ino_t nodeid,
-	uint64_t nlookup)
-{
-	struct famfs_ctx *lo = famfs_ctx_from_req(req);
-	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
-							    nodeid);
-
-	famfs_log(FAMFS_LOG_DEBUG, "%s: ino=%lld refcount=%lld count=%lld\n",
-		  __func__, inode->ino, inode->refcount, nlookup);
-
-	/* +1 because we got a ref when we looked it up here */
-	famfs_icache_unref_inode(&lo->icache, inode, nlookup + 1);
+	famfs_reply_err(req, err);
 }
 
 static void
@@ -729,8 +1054,15 @@ famfs_forget(
 	fuse_ino_t nodeid,
 	uint64_t nlookup)
 {
-	famfs_log(FAMFS_LOG_DEBUG, "%s:\n", __func__);
-	famfs_forget_one(req, nodeid, nlookup);
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	struct fuse_forget_data forget = {
+		.ino = nodeid,
+		.nlookup = nlookup,
+	};
+
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%llx nlookup=%lld\n",
+		  __func__, (u64)nodeid, (u64)nlookup);
+	famfs_icache_forget(&lo->icache, &forget, 1);
 	fuse_reply_none(req);
 }
 
@@ -740,21 +1072,15 @@ famfs_forget_multi(
 	size_t count,
 	struct fuse_forget_data *forgets)
 {
-	size_t i;
-
-	famfs_log(FAMFS_LOG_DEBUG, "%s:\n", __func__);
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	size_t nfreed;
 
-	for (i = 0; i < count; i++)
-		famfs_forget_one(req, forgets[i].ino, forgets[i].nlookup);
+	nfreed = famfs_icache_forget(&lo->icache, forgets, count);
+	famfs_log(FAMFS_LOG_DEBUG, "%s: count=%ld freed=%ld\n",
+		  __func__, count, nfreed);
 	fuse_reply_none(req);
 }
 
-struct famfs_dirp {
-	DIR *dp;
-	struct dirent *entry;
-	off_t offset;
-};
-
 static struct famfs_dirp *
 famfs_dirp(struct fuse_file_info *fi)
 {
@@ -799,44 +1125,361 @@ famfs_opendir(
 	famfs_inode_putref(inode);
 	return;
 
-out_errno:
-	error = errno;
-out_err:
-	famfs_inode_putref(inode);
-	if (d) {
-		if (fd != -1)
-			close(fd);
-		free(d);
+out_errno:
+	error = errno;
+out_err:
+	famfs_inode_putref(inode);
+	if (d) {
+		if (fd != -1)
+			close(fd);
+		free(d);
+	}
+	famfs_reply_err(req, error);
+}
+
+static int
+is_dot_or_dotdot(const char *name)
+{
+	return name[0] == '.' && (name[1] == '\0' ||
+				  (name[1] == '.' && name[2] == '\0'));
+}
+
+/*
+ * Directory listing cache
+ *
+ * A readdir pass that starts at offset 0 gets the directory's encoded
+ * listing from the dircache, or reads the whole shadow directory into a new
+ * listing (and caches it). The rest of the pass is served from the
+ * listing with one memcpy per reply. The handle keeps its ref to the
+ * listing until the next pass, so the pass sees one consistent snapshot.
+ *
+ * Readdirplus isn't served from listings, because each of its entries
+ * carries a lookup ref and fresh attributes.
+ */
+static struct famfs_dirlist *
+famfs_dirlist_build(
+	fuse_req_t req,
+	struct famfs_ctx *lo,
+	struct famfs_dirp *d)
+{
+	struct famfs_dirlist *dl;
+	struct timespec now;
+	uint64_t version;
+	struct stat st;
+	int64_t age;
+
+	/* The version must be sampled before the directory is read */
+	if (fstat(dirfd(d->dp), &st))
+		return NULL;
+	version = famfs_dircache_version(&st.st_mtim, &st.st_ctim);
+
+	dl = famfs_dircache_get(&lo->dircache, st.st_ino, version);
+	if (dl)
+		return dl;
+
+	dl = famfs_dirlist_alloc(st.st_ino, version);
+	if (!dl)
+		return NULL;
+
+	d->dp_stale = 1;
+	rewinddir(d->dp);
+	while (1) {
+		struct dirent *de;
+		size_t entsize;
+		char *p;
+
+		errno = 0;
+		de = readdir(d->dp);
+		if (!de) {
+			if (errno)
+				goto err_out;
+			break;
+		}
+
+		struct stat est = {
+			.st_ino = de->d_ino,
+			.st_mode = de->d_type << 12,
+		};
+		entsize = fuse_add_direntry(req, NULL, 0, de->d_name, NULL, 0);
+		p = famfs_dirlist_reserve(dl, entsize);
+		if (!p)
+			goto err_out;
+		fuse_add_direntry(req, p, entsize, de->d_name, &est, de->d_off);
+		if (famfs_dirlist_add(dl, entsize, de->d_off))
+			goto err_out;
+	}
+
+	/* Don't cache a directory that changed within the last timestamp
+	 * tick; a second change in the same tick wouldn't change its
+	 * version */
+	clock_gettime(CLOCK_REALTIME, &now);
+	age = (int64_t)(now.tv_sec - st.st_ctim.tv_sec) * 1000000000LL +
+		(now.tv_nsec - st.st_ctim.tv_nsec);
+	if (age >= (int64_t)FAMFS_DIRCACHE_SETTLE_NS)
+		famfs_dircache_insert(&lo->dircache, dl);
+	return dl;
+
+err_out:
+	famfs_log(FAMFS_LOG_DEBUG, "%s: ino=%ld errno=%d\n",
+		  __func__, st.st_ino, errno);
+	famfs_dirlist_put(&lo->dircache, dl);
+	return NULL;
+}
+
+/*
+ * Serve a readdir from the handle's listing. Returns 0 if a reply was sent,
+ * or -1 if the caller should read the shadow directory.
+ */
+static int
+famfs_do_readdir_cached(
+	fuse_req_t req,
+	struct famfs_ctx *lo,
+	struct famfs_dirp *d,
+	size_t size,
+	off_t offset)
+{
+	int64_t first;
+	uint32_t nents;
+	size_t len;
+
+	if (offset == 0) {
+		famfs_dirlist_put(&lo->dircache, d->dl);
+		d->dl = famfs_dirlist_build(req, lo, d);
+		d->dl_next = 0;
+		d->dl_offset = 0;
+	}
+	if (!d->dl)
+		return -1;
+
+	if (offset == d->dl_offset) {
+		first = d->dl_next;
+	} else {
+		first = famfs_dirlist_find(d->dl, offset);
+		if (first < 0) {
+			famfs_dirlist_put(&lo->dircache, d->dl);
+			d->dl = NULL;
+			return -1;
+		}
+	}
+
+	len = famfs_dirlist_span(d->dl, first, size, &nents);
+	fuse_reply_buf(req, d->dl->buf + d->dl->pos[first], len);
+	if (nents) {
+		d->dl_next = first + nents;
+		d->dl_offset = d->dl->off[d->dl_next - 1];
+	}
+	return 0;
+}
+
+static void
+famfs_do_readdir(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info *fi)
+{
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
+	struct famfs_dirp *d = famfs_dirp(fi);
+	char *buf;
+	char *p;
+	size_t rem = size;
+	int err;
+
+	(void) nodeid;
+
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld ofs=%ld\n",
+		 __func__, nodeid, size, offset);
+
+	/* A readdirplus window is ahead of where readdir reads */
+	famfs_rdp_window_drop(&lo->icache, d->rdp);
+	if (lo->dircache.max_bytes &&
+	    famfs_do_readdir_cached(req, lo, d, size, offset) == 0)
+		return;
+
+	buf = calloc(1, size);
+	if (!buf) {
+		err = ENOMEM;
+		goto error;
+	}
+	p = buf;
+
+	famfs_dirp_readdir_begin(&lo->icache, d, offset);
+	while (1) {
+		struct dirent *de;
+		size_t entsize;
+
+		de = famfs_dirp_readdir_peek(d, &err);
+		if (!de) {
+			if (err)
+				goto error;
+			break; /* End of stream */
+		}
+		struct stat st = {
+			.st_ino = de->d_ino,
+			.st_mode = de->d_type << 12,
+		};
+		entsize = fuse_add_direntry(req, p, rem, de->d_name, &st,
+					    de->d_off);
+		if (entsize > rem)
+			break;
+
+		p += entsize;
+		rem -= entsize;
+		famfs_dirp_readdir_next(d);
+	}
+
+    err = 0;
+error:
+    /*
+     * If there's an error, we can only signal it if we haven't stored
+     * any entries yet - otherwise we'd end up with wrong lookup
+     * counts for the entries that are already in the buffer. So we
+     * return what we've collected until that point.
+     */
+    if (err && rem == size)
+	    famfs_reply_err(req, err);
+    else
+	    fuse_reply_buf(req, buf, size - rem);
+    free(buf);
+}
+
+/*
+ * Batched readdirplus
+ *
+ * Readdirplus reads a window of up to FAMFS_RDP_WINDOW directory entries
+ * at a time, and resolves the whole window before replying:
+ *
+ * * One locked pass over the icache finds entries that are already cached
+ *   (by d_ino), without touching the shadow files
+ * * The misses are loaded with a single openat() each (see
+ *   famfs_shadow_ent_load()); when there are many misses, they are loaded
+ *   (and their shadow yaml parsed) as a range task on lo->rdp_pool, a
+ *   work-stealing pool started with the session
+ * * The new inodes are inserted into the icache in one locked batch
+ *
+ * Each resolved entry holds one icache ref. Entries that don't fit in a reply
+ * stay in the window for the next readdirplus; if the window is discarded
+ * (seek, readdir or releasedir) the refs of the unsent entries are dropped.
+ * The window itself is kept with the handle (see famfs_fused_dirp.h).
+ */
+#define FAMFS_RDP_PARALLEL_MIN 32 /* Misses needed to load in parallel */
+#define FAMFS_RDP_THREADS 4
+
+struct famfs_rdp_loader {
+	int parentfd;
+	struct famfs_shadow_ent **miss;
+};
+
+static void
+famfs_rdp_load_range(void *arg, size_t start, size_t end)
+{
+	struct famfs_rdp_loader *ldr = arg;
+
+	for (; start < end; start++)
+		famfs_shadow_ent_load(ldr->parentfd, ldr->miss[start], NULL);
+}
+
+static void
+famfs_rdp_load_misses(
+	struct famfs_wsp *pool,
+	int parentfd,
+	struct famfs_shadow_ent **miss,
+	int nmiss)
+{
+	struct famfs_rdp_loader ldr = {
+		.parentfd = parentfd,
+		.miss = miss,
+	};
+	struct famfs_wsp_group g;
+
+	if (pool && nmiss >= FAMFS_RDP_PARALLEL_MIN) {
+		famfs_wsp_group_init(&g);
+		if (famfs_wsp_submit_range(pool, &g, famfs_rdp_load_range,
+					   NULL, &ldr, 0, nmiss,
+					   FAMFS_RDP_PARALLEL_MIN / 2) == 0) {
+			famfs_wsp_group_wait(&g);
+			famfs_wsp_group_destroy(&g);
+			return;
+		}
+		famfs_wsp_group_destroy(&g);
 	}
-	fuse_reply_err(req, error);
+
+	famfs_rdp_load_range(&ldr, 0, nmiss);
 }
 
-static int
-is_dot_or_dotdot(const char *name)
+struct famfs_rdp_resolver {
+	struct famfs_ctx *lo;
+	struct famfs_inode *dir_inode;
+};
+
+/*
+ * Resolve a newly read window of directory entries
+ */
+static void
+famfs_rdp_window_resolve(void *arg, struct famfs_rdp_window *w)
 {
-	return name[0] == '.' && (name[1] == '\0' ||
-				  (name[1] == '.' && name[2] == '\0'));
+	struct famfs_rdp_resolver *r = arg;
+	struct famfs_shadow_ent *miss[FAMFS_RDP_WINDOW];
+	struct famfs_ctx *lo = r->lo;
+	int nmiss = 0;
+	int i;
+
+	/* Pass 1: icache hits, one lock round trip */
+	pthread_mutex_lock(&lo->icache.mutex);
+	for (i = 0; i < w->count; i++) {
+		struct famfs_shadow_ent *ent = &w->ent[i];
+
+		if (is_dot_or_dotdot(ent->name))
+			continue;
+		if (ent->d_ino)
+			ent->inode = famfs_icache_find_get_from_ino_locked(
+				&lo->icache, ent->d_ino);
+		if (!ent->inode)
+			miss[nmiss++] = ent;
+	}
+	pthread_mutex_unlock(&lo->icache.mutex);
+
+	if (!nmiss)
+		return;
+
+	/* Pass 2: load the misses (no locks held) */
+	famfs_rdp_load_misses(lo->rdp_pool, r->dir_inode->fd, miss, nmiss);
+
+	/* Pass 3: insert the misses, one lock round trip */
+	pthread_mutex_lock(&lo->icache.mutex);
+	for (i = 0; i < nmiss; i++) {
+		if (miss[i]->err)
+			continue;
+		famfs_shadow_ent_commit_locked(&lo->icache, r->dir_inode,
+					       miss[i]);
+	}
+	pthread_mutex_unlock(&lo->icache.mutex);
 }
 
 static void
-famfs_do_readdir(
+famfs_do_readdirplus(
 	fuse_req_t req,
 	fuse_ino_t nodeid,
 	size_t size,
 	off_t offset,
-	struct fuse_file_info *fi,
-	int plus)
+	struct fuse_file_info *fi)
 {
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_dirp *d = famfs_dirp(fi);
-	char *buf;
-	char *p;
+	struct famfs_rdp_resolver r = { .lo = lo };
+	struct famfs_inode *dir_inode = NULL;
 	size_t rem = size;
-	int err;
+	char *buf = NULL;
+	char *p;
+	int err = 0;
 
-	(void) nodeid;
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld ofs=%ld\n",
+		 __func__, nodeid, size, offset);
 
-	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld ofs=%ld plus=%d\n",
-		 __func__, nodeid, size, offset, plus);
+	err = famfs_dirp_readdirplus_begin(&lo->icache, d, offset);
+	if (err)
+		goto error;
 
 	buf = calloc(1, size);
 	if (!buf) {
@@ -845,82 +1488,67 @@ famfs_do_readdir(
 	}
 	p = buf;
 
-	if (offset != d->offset) {
-		seekdir(d->dp, offset);
-		d->entry = NULL;
-		d->offset = offset;
+	dir_inode = famfs_get_inode_from_nodeid(&lo->icache, nodeid);
+	if (!dir_inode) {
+		err = ENOENT;
+		goto error;
 	}
+	r.dir_inode = dir_inode;
+
 	while (1) {
+		struct famfs_shadow_ent *ent;
+		struct fuse_entry_param e;
 		size_t entsize;
-		off_t nextoff;
-		const char *name;
-
-		if (!d->entry) {
-			errno = 0;
-			d->entry = readdir(d->dp);
-			if (!d->entry) {
-				if (errno) {  /* Error */
-					err = errno;
-					goto error;
-				} else {  /* End of stream */
-					break; 
-				}
-			}
+
+		ent = famfs_dirp_readdirplus_peek(d, famfs_rdp_window_resolve,
+						  &r, &err);
+		if (!ent) {
+			if (err)
+				goto error;
+			break;
 		}
-		nextoff = d->entry->d_off;
-		name = d->entry->d_name;
-		fuse_ino_t entry_ino = 0;
-		if (plus) {
-			struct fuse_entry_param e;
-			if (is_dot_or_dotdot(name)) {
-				e = (struct fuse_entry_param) {
-					.attr.st_ino = d->entry->d_ino,
-					.attr.st_mode = d->entry->d_type << 12,
-				};
-			} else {
-				err = famfs_do_lookup(req, nodeid,
-						      name, &e, NULL);
-				if (err)
-					goto error;
-				entry_ino = e.ino;
-			}
-
-			entsize = fuse_add_direntry_plus(req, p, rem, name,
-							 &e, nextoff);
-		} else {
-			struct stat st = {
-				.st_ino = d->entry->d_ino,
-				.st_mode = d->entry->d_type << 12,
+
+		if (is_dot_or_dotdot(ent->name)) {
+			e = (struct fuse_entry_param) {
+				.attr.st_ino = ent->d_ino,
+				.attr.st_mode = ent->d_type << 12,
 			};
-			entsize = fuse_add_direntry(req, p, rem, name,
-						    &st, nextoff);
-		}
-		if (entsize > rem) {
-			if (entry_ino != 0) 
-				famfs_forget_one(req, entry_ino, 1);
-			break;
+		} else if (ent->err == ENOENT) {
+			/* Not a file or dir; skip it */
+			famfs_dirp_readdirplus_next(d);
+			continue;
+		} else if (ent->err) {
+			err = ent->err;
+			goto error;
+		} else {
+			famfs_shadow_ent_to_entry(lo, ent, &e);
 		}
-		
+
+		entsize = fuse_add_direntry_plus(req, p, rem, ent->name,
+						 &e, ent->nextoff);
+		if (entsize > rem)
+			break; /* Stays in the window for the next call */
+
+		/* The entry's icache ref is now the kernel's lookup ref */
+		ent->inode = NULL;
 		p += entsize;
 		rem -= entsize;
-
-		d->entry = NULL;
-		d->offset = nextoff;
+		famfs_dirp_readdirplus_next(d);
 	}
+	err = 0;
 
-    err = 0;
 error:
-    /*
-     * If there's an error, we can only signal it if we haven't stored
-     * any entries yet - otherwise we'd end up with wrong lookup
-     * counts for the entries that are already in the buffer. So we
-     * return what we've collected until that point.
-     */
-    if (err && rem == size)
-	    fuse_reply_err(req, err);
-    else
-	    fuse_reply_buf(req, buf, size - rem);
-    free(buf);
+	famfs_dirp_readdirplus_end(d);
+	if (dir_inode)
+		famfs_inode_putref(dir_inode);
+
+	/* As with readdir, errors can only be signaled if no entries have been
+	 * stored yet - otherwise the lookup counts would be wrong */
+	if (err && rem == size)
+		famfs_reply_err(req, err);
+	else
+		fuse_reply_buf(req, buf, size - rem);
+	free(buf);
 }
 
 static void
@@ -933,7 +1561,7 @@ famfs_readdir(
 {
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld offset=%ld\n",
 		  __func__, nodeid, size, offset);
-	famfs_do_readdir(req, nodeid, size, offset, fi, 0);
+	famfs_do_readdir(req, nodeid, size, offset, fi);
 }
 
 static void famfs_readdirplus(
@@ -943,9 +1571,9 @@ static void famfs_readdirplus(
 	off_t offset,
 	struct fuse_file_info *fi)
 {
-	famfs_log(FAMFS_LOG_ERR, "%s: nodeid=%lx size=%ld offset=%ld\n",
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx size=%ld offset=%ld\n",
 		  __func__, nodeid, size, offset);
-	famfs_do_readdir(req, nodeid, size, offset, fi, 1);
+	famfs_do_readdirplus(req, nodeid, size, offset, fi);
 }
 
 static void
@@ -954,11 +1582,14 @@ famfs_releasedir(
 	fuse_ino_t nodeid,
 	struct fuse_file_info *fi)
 {
+	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_dirp *d = famfs_dirp(fi);
 	(void) nodeid;
-	closedir(d->dp);
+
+	famfs_dirlist_put(&lo->dircache, d->dl);
+	famfs_dirp_release(&lo->icache, d);
 	free(d);
-	fuse_reply_err(req, 0);
+	famfs_reply_err(req, 0);
 }
 
 static void
@@ -975,7 +1606,7 @@ famfs_create(
 	(void)fi;
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: ENOTSUP\n", __func__);
-	fuse_reply_err(req, ENOTSUP);
+	famfs_reply_err(req, ENOTSUP);
 }
 
 static void
@@ -1026,18 +1657,19 @@ famfs_release(
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
-	(void) fi;
 
 	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx\n", __func__, nodeid);
 
-	fuse_reply_err(req, 0);
-
-	if (inode->flock_held) {
-		famfs_icache_unflock(inode);
+	/* The kernel sets flock_release on the last close of a file that
+	 * was flock'ed; drop the lock held via this open file */
+	if (fi->flock_release &&
+	    famfs_icache_flock_release(inode, fi->lock_owner))
 		famfs_log(FAMFS_LOG_NOTICE,
 			  "%s: ino=%lld name=%s released flock\n",
 			  __func__, inode->ino, inode->name);
-	}
+
+	famfs_reply_err(req, 0);
+
 	pthread_mutex_lock(&lo->icache.mutex);
 	/* Release 2 refs: one for from the get in this function,
 	 * and one for the open that this closes */
@@ -1052,6 +1684,7 @@ famfs_statfs(
 {
 	int res;
 	struct statvfs stbuf;
+	struct famfs_alloc_summary as;
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
@@ -1060,11 +1693,22 @@ famfs_statfs(
 
 	res = fstatvfs(inode->fd, &stbuf);
 	famfs_inode_putref(inode);
-	if (res == -1)
-		fuse_reply_err(req, errno);
-	else
-		fuse_reply_statfs(req, &stbuf);
-	
+	if (res == -1) {
+		famfs_reply_err(req, errno);
+		return;
+	}
+
+	/* Space comes from the allocation summary, which is brought up to
+	 * date with any new log entries (inode counts still come from the
+	 * shadow fs). Without a daxdev, we only have the shadow fs numbers */
+	if (famfs_logtail_get_alloc(lo, &as) == 0) {
+		stbuf.f_bsize = as.alloc_unit;
+		stbuf.f_frsize = as.alloc_unit;
+		stbuf.f_blocks = as.total / as.alloc_unit;
+		stbuf.f_bfree = as.free / as.alloc_unit;
+		stbuf.f_bavail = stbuf.f_bfree;
+	}
+	fuse_reply_statfs(req, &stbuf);
 }
 
 #define FAMFS_XATTR_SHADOW "user.famfs.shadow"
@@ -1087,12 +1731,12 @@ famfs_getxattr(
 
 	/* Only support the shadow xattr for now */
 	if (strcmp(name, FAMFS_XATTR_SHADOW) != 0) {
-		fuse_reply_err(req, ENODATA);
+		famfs_reply_err(req, ENODATA);
 		return;
 	}
 
 	if (!shadow_path) {
-		fuse_reply_err(req, ENODATA);
+		famfs_reply_err(req, ENODATA);
 		return;
 	}
 
@@ -1103,13 +1747,19 @@ famfs_getxattr(
 		fuse_reply_xattr(req, shadow_len);
 	} else if (size < shadow_len) {
 		/* Buffer too small */
-		fuse_reply_err(req, ERANGE);
+		famfs_reply_err(req, ERANGE);
 	} else {
 		/* Return the value */
 		fuse_reply_buf(req, shadow_path, shadow_len);
 	}
 }
 
+static int
+famfs_flock_interrupted(void *arg)
+{
+	return fuse_req_interrupted((fuse_req_t)arg);
+}
+
 static void
 famfs_flock(
 	fuse_req_t req,
@@ -1117,54 +1767,247 @@ famfs_flock(
 	struct fuse_file_info *fi,
 	int op)
 {
-	(void) fi;
-	int rc = 0;
 	struct famfs_ctx *lo = famfs_ctx_from_req(req);
 	struct famfs_inode *inode = famfs_get_inode_from_nodeid(&lo->icache,
 								nodeid);
+	int rc;
 
-	famfs_log(FAMFS_LOG_NOTICE, "%s: nodeid=%lx op=%d\n",
-		 __func__, nodeid, op);
+	famfs_log(FAMFS_LOG_DEBUG, "%s: nodeid=%lx op=%d owner=%llx\n",
+		 __func__, nodeid, op, fi->lock_owner);
 
-	switch (op) {
-	case LOCK_EX:
-		if (inode->flock_held) {
-			famfs_log(FAMFS_LOG_ERR,
-				  "%s: nodeid=%lx op=%d LOCK_EX but flock already held\n",
-				  __func__, nodeid, op);
-			rc = EINVAL;
-			goto err_out;
-		}
-		famfs_icache_flock(inode);
-		break;
-	case LOCK_UN:
-		if (!inode->flock_held) {
-			famfs_log(FAMFS_LOG_ERR, "%s: nodeid=%lx op=%d LOCK_UN but flock not held\n",
-				  __func__, nodeid, op);
-			rc = EINVAL;
-			goto err_out;
-		}
-		famfs_icache_unflock(inode);
-		break;
-	case LOCK_SH:
-		famfs_log(FAMFS_LOG_ERR, "%s: nodeid=%lx op=%d LOCK_SH not supported\n",
-			  __func__, nodeid, op);
-		rc = EINVAL;
-		goto err_out;
-		break;
-	}
+	if (!inode)
+		return (void) famfs_reply_err(req, EINVAL);
 
-err_out:
-	fuse_reply_err(req, rc); /* if rc=0, this is a successful reply */
+	/* Blocking requests tie up this thread until granted or interrupted */
+	rc = famfs_icache_flock(inode, fi->lock_owner, op,
+				famfs_flock_interrupted, req);
+	if (rc && rc != EWOULDBLOCK)
+		famfs_log(FAMFS_LOG_ERR, "%s: nodeid=%lx op=%d err=%d\n",
+			  __func__, nodeid, op, rc);
+
+	famfs_inode_putref(inode);
+	famfs_reply_err(req, rc); /* if rc=0, this is a successful reply */
+}
+
+/*
+ * Timed handlers
+ *
+ * Each handler in famfs_oper is wrapped to record its count and latency
+ * (see famfs_fused_stats.c) and a trace record (see famfs_fused_trace.c).
+ * The time includes sending the reply, and for flock, the time blocked
+ * waiting for the lock.
+ */
+#define FAMFS_OP_TIMED(_op, _nodeid, _name, _call)		\
+	do {							\
+		uint64_t _start = 0, _end = 0;			\
+		int _timed = famfs_op_stats_enabled ||		\
+			famfs_trace_enabled;			\
+								\
+		famfs_affinity_thread();			\
+		if (_timed)					\
+			_start = famfs_op_now();		\
+		famfs_trace_begin(_op, _nodeid, _name, _start);	\
+		_call;						\
+		if (_timed)					\
+			_end = famfs_op_now();			\
+		famfs_trace_end(_end);				\
+		if (_timed && famfs_op_stats_enabled)		\
+			famfs_op_record(_op, _end - _start);	\
+	} while (0)
+
+static void
+famfs_lookup_timed(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_LOOKUP, parent, name,
+		       famfs_lookup(req, parent, name));
+}
+
+static void
+famfs_forget_timed(fuse_req_t req, fuse_ino_t nodeid, uint64_t nlookup)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_FORGET, nodeid, NULL,
+		       famfs_forget(req, nodeid, nlookup));
+}
+
+static void
+famfs_forget_multi_timed(
+	fuse_req_t req,
+	size_t count,
+	struct fuse_forget_data *forgets)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_FORGET_MULTI, 0, NULL,
+		       famfs_forget_multi(req, count, forgets));
+}
+
+static void
+famfs_getattr_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_GETATTR, nodeid, NULL,
+		       famfs_getattr(req, nodeid, fi));
+}
+
+static void
+famfs_setattr_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct stat *attr,
+	int valid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_SETATTR, nodeid, NULL,
+		       famfs_setattr(req, nodeid, attr, valid, fi));
+}
+
+static void
+famfs_open_timed(fuse_req_t req, fuse_ino_t nodeid, struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_OPEN, nodeid, NULL,
+		       famfs_open(req, nodeid, fi));
+}
+
+static void
+famfs_read_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t off,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_READ, nodeid, NULL,
+		       famfs_read(req, nodeid, size, off, fi));
+}
+
+static void
+famfs_write_buf_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_bufvec *bufv,
+	off_t off,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_WRITE, nodeid, NULL,
+		       famfs_write_buf(req, nodeid, bufv, off, fi));
+}
+
+static void
+famfs_release_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_RELEASE, nodeid, NULL,
+		       famfs_release(req, nodeid, fi));
+}
+
+static void
+famfs_opendir_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_OPENDIR, nodeid, NULL,
+		       famfs_opendir(req, nodeid, fi));
+}
+
+static void
+famfs_readdir_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_READDIR, nodeid, NULL,
+		       famfs_readdir(req, nodeid, size, offset, fi));
+}
+
+static void
+famfs_readdirplus_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_READDIRPLUS, nodeid, NULL,
+		       famfs_readdirplus(req, nodeid, size, offset, fi));
+}
+
+static void
+famfs_releasedir_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_RELEASEDIR, nodeid, NULL,
+		       famfs_releasedir(req, nodeid, fi));
+}
+
+static void
+famfs_statfs_timed(fuse_req_t req, fuse_ino_t nodeid)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_STATFS, nodeid, NULL,
+		       famfs_statfs(req, nodeid));
+}
+
+static void
+famfs_getxattr_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	const char *name,
+	size_t size)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_GETXATTR, nodeid, name,
+		       famfs_getxattr(req, nodeid, name, size));
+}
+
+static void
+famfs_create_timed(
+	fuse_req_t req,
+	fuse_ino_t parent,
+	const char *name,
+	mode_t mode,
+	struct fuse_file_info *fi)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_CREATE, parent, name,
+		       famfs_create(req, parent, name, mode, fi));
+}
+
+static void
+famfs_flock_timed(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_file_info *fi,
+	int op)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_FLOCK, nodeid, NULL,
+		       famfs_flock(req, nodeid, fi, op));
+}
+
+static void
+famfs_get_fmap_timed(fuse_req_t req, fuse_ino_t nodeid, size_t size)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_GET_FMAP, nodeid, NULL,
+		       famfs_get_fmap(req, nodeid, size));
+}
+
+static void
+famfs_get_daxdev_timed(fuse_req_t req, int daxdev_index)
+{
+	FAMFS_OP_TIMED(FAMFS_OP_GET_DAXDEV, 0, NULL,
+		       famfs_get_daxdev(req, daxdev_index));
 }
 
 static const struct fuse_lowlevel_ops famfs_oper = {
 	.init		= famfs_init,
 	.destroy	= famfs_destroy,
-	.lookup		= famfs_lookup,
-	.forget		= famfs_forget,
-	.getattr	= famfs_getattr,
-	.setattr	= famfs_setattr,
+	.lookup		= famfs_lookup_timed,
+	.forget		= famfs_forget_timed,
+	.getattr	= famfs_getattr_timed,
+	.setattr	= famfs_setattr_timed,
 	/* .readlink */
 	/* .mknod */
 	/* .mkdir */
@@ -1173,39 +2016,39 @@ static const struct fuse_lowlevel_ops famfs_oper = {
 	/* .symlink */
 	/* .rename */
 	/* .link */
-	.open		= famfs_open,
-	/* .read */
+	.open		= famfs_open_timed,
+	.read		= famfs_read_timed,
 	/* .write */
 	/* .flush */
-	.release	= famfs_release,
+	.release	= famfs_release_timed,
 	/* .fsync */
-	.opendir	= famfs_opendir,
-	.readdir	= famfs_readdir,
-	.releasedir	= famfs_releasedir,
+	.opendir	= famfs_opendir_timed,
+	.readdir	= famfs_readdir_timed,
+	.releasedir	= famfs_releasedir_timed,
 	/* .fsyncdir */
-	.statfs		= famfs_statfs,
+	.statfs		= famfs_statfs_timed,
 	/* .setxattr */
-	.getxattr	= famfs_getxattr,
+	.getxattr	= famfs_getxattr_timed,
 	/* .listxattr */
 	/* .removexattr */
 	/* .access */
-	.create		= famfs_create,
+	.create		= famfs_create_timed,
 	/* .getlk */
 	/* .setlk */
 	/* .ioctl */
 	/* .poll */
-	/* .write_buf */
+	.write_buf	= famfs_write_buf_timed,
 	/* .retrieve_reply */
-	.forget_multi	= famfs_forget_multi,
-	.flock		= famfs_flock,
+	.forget_multi	= famfs_forget_multi_timed,
+	.flock		= famfs_flock_timed,
 	/* .fallocate */
-	.readdirplus	= famfs_readdirplus,
+	.readdirplus	= famfs_readdirplus_timed,
 #ifdef HAVE_COPY_FILE_RANGE
 	/* .copy_file_range */
 #endif
 	/* .lseek */
-	.get_fmap       = famfs_get_fmap,
-	.get_daxdev     = famfs_get_daxdev,
+	.get_fmap       = famfs_get_fmap_timed,
+	.get_daxdev     = famfs_get_daxdev_timed,
 };
 
 void jg_print_fuse_opts(struct fuse_cmdline_opts *opts)
@@ -1306,10 +2149,26 @@ int main(int argc, char *argv[])
 	/*
 	 * This parses famfs_context from the -o opts
 	 */
+	lo->negcache_max = FAMFS_NEGCACHE_DEFAULT_MAX;
+	lo->dircache_mb = FAMFS_DIRCACHE_DEFAULT_MB;
+	lo->logtail_ms = FAMFS_LOGTAIL_DEFAULT_MS;
+	lo->preload_threads = FAMFS_PRELOAD_DEFAULT_THREADS;
+	lo->user_io = -1;
+	lo->op_stats = 1;
+	lo->trace_records = FAMFS_TRACE_DEFAULT_RECORDS;
 	if (fuse_opt_parse(&args, lo, famfs_opts, NULL)== -1) {
 		ret = -1;
 		goto err_out1;
 	}
+	famfs_op_stats_enabled = lo->op_stats;
+	famfs_trace_init(lo->trace_records);
+
+	/* Before the icache is allocated and any threads are started */
+	if (famfs_affinity_init(lo->cpus, lo->numa_queues)) {
+		fprintf(stderr, "%s: invalid cpus=%s\n", PROGNAME, lo->cpus);
+		ret = 1;
+		goto err_out1;
+	}
 
 	lo->debug = opts.debug;
 
@@ -1363,8 +2222,21 @@ int main(int argc, char *argv[])
 		ret = 1;
 		goto err_out1;
 	}
+	if (!lo->negative_timeout_set) {
+		/* Nothing but the log tail drops a negative entry when a name
+		 * is created (e.g. by the famfs CLI on this host, which looks
+		 * the name up first), so only cache them by default when the
+		 * log is being tailed */
+		lo->negative_timeout = (lo->logtail) ? lo->timeout : 0;
+	} else if (lo->negative_timeout < 0) {
+		famfs_log(FAMFS_LOG_ERR, "negative_timeout is negative (%lf)\n",
+			 lo->negative_timeout);
+		ret = 1;
+		goto err_out1;
+	}
 	if (lo->debug)
-		printf("timeout=%f\n", lo->timeout);
+		printf("timeout=%f negative_timeout=%f\n",
+		       lo->timeout, lo->negative_timeout);
 
 	ret = famfs_icache_init((void *)lo, &lo->icache, shadow_root);
 	if (ret) {
@@ -1373,6 +2245,33 @@ int main(int argc, char *argv[])
 		goto err_out1;
 	}
 
+	if (famfs_negcache_init(&lo->negcache, lo->negcache_max,
+				lo->negative_timeout))
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: negative lookup cache disabled\n", __func__);
+	if (famfs_dircache_init(&lo->dircache,
+				(uint64_t)lo->dircache_mb << 20))
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: directory listing cache disabled\n", __func__);
+
+	/* Warm the icache before the mount becomes visible. A failure is
+	 * not fatal; we just start (partly) cold */
+	if (lo->preload) {
+		struct famfs_preload_stats ps;
+
+		famfs_preload(lo, lo->preload, lo->preload_threads, &ps);
+		if (lo->debug)
+			printf("preload %s: %" PRIu64 " dirs %" PRIu64
+			       " files in %" PRIu64 " ms\n",
+			       lo->preload, ps.dirs, ps.files,
+			       ps.elapsed_ns / 1000000);
+	}
+
+	if (famfs_uring_args(lo, &args)) {
+		ret = 1;
+		goto err_out1;
+	}
+
 	/*
 	 * this creates the fuse session
 	 */
@@ -1392,14 +2291,32 @@ int main(int argc, char *argv[])
 	/* This daemonizes if !opts.foreground */
 	fuse_daemonize(opts.foreground);
 
+	/* The logger thread must be started after the fork */
+	if (lo->async_log && famfs_log_enable_async(FAMFS_ASYNC_LOG_MSGS))
+		famfs_log(FAMFS_LOG_ERR, "%s: async_log failed\n", PROGNAME);
+
 	famfs_diag_server_start(shadow_root);
 
+	lo->se = se;
+	lo->mpt = opts.mountpoint;
+	/* Like the logger thread, the pool must be started after the fork */
+	if (lo->readdirplus) {
+		lo->rdp_pool = famfs_wsp_create(FAMFS_RDP_THREADS);
+		if (!lo->rdp_pool)
+			famfs_log(FAMFS_LOG_WARNING,
+				  "%s: no readdirplus pool; loading inline\n",
+				  PROGNAME);
+	}
+	if (lo->logtail)
+		famfs_logtail_start(lo);
+
 	/* Block until ctrl+c or fusermount -u */
 	if (opts.singlethread)
 		ret = fuse_session_loop(se);
 	else {
 		config = fuse_loop_cfg_create();
-		fuse_loop_cfg_set_clone_fd(config, opts.clone_fd);
+		fuse_loop_cfg_set_clone_fd(config, opts.clone_fd ||
+					   famfs_numa_nqueues);
 		fuse_loop_cfg_set_max_threads(config, opts.max_threads);
 		ret = fuse_session_loop_mt(se, config);
 		fuse_loop_cfg_destroy(config);
@@ -1412,7 +2329,17 @@ int main(int argc, char *argv[])
 
 	fuse_session_unmount(se);
 
+	/* The tail thread notifies the session, so it is stopped (and the
+	 * log unmapped) before the session is destroyed */
+	famfs_logtail_stop();
+	famfs_log_disable_async();
+	famfs_wsp_destroy(lo->rdp_pool, 0);
+	lo->rdp_pool = NULL;
+
 	famfs_icache_destroy(&lo->icache);
+	famfs_negcache_destroy(&lo->negcache);
+	famfs_dircache_destroy(&lo->dircache);
+	famfs_dax_unmap(lo);
 
 err_out3:
 	fuse_remove_signal_handlers(se);
@@ -1428,6 +2355,7 @@ err_out1:
 		free(lo->daxdev_table);
 
 	free(lo->source);
+	free(lo->preload);
 
 #ifdef FAMFS_COVERAGE
 	__gcov_dump();
@@ -8,6 +8,9 @@
 
 #include <assert.h>
 #include "famfs_fused_icache.h"
+#include "famfs_fused_negcache.h"
+#include "famfs_fused_dircache.h"
+#include "famfs_fused_trace.h"
 
 enum {
 	CACHE_NEVER,
@@ -28,7 +31,75 @@ struct famfs_ctx {
 	int timeout_set;
 	int pass_yaml; /* pass the shadow yaml through */
 	int readdirplus;
+	int logtail;           /* tail the log and invalidate kernel dentries */
+	unsigned int logtail_ms; /* log tail poll interval */
+	char *mpt;
+	struct fuse_session *se;
+	double negative_timeout;  /* kernel and daemon negative entry timeout */
+	int negative_timeout_set;
+	unsigned int negcache_max; /* max negative entries cached (0=off) */
+	unsigned int dircache_mb;  /* directory listing cache size (0=off) */
+	char *preload;             /* subtree to preload into the icache */
+	unsigned int preload_threads;
+	int user_io;               /* serve read/write (-1: if no DAX_FMAP) */
+	char *dax_base;            /* daxdev mapping for user_io */
+	size_t dax_size;
+	int dax_writable;
+	int op_stats;              /* per-op counts and latency histograms */
+	unsigned int trace_records; /* per-thread trace ring size (0=off) */
+	int async_log;             /* syslog from a logger thread */
+	int io_uring;              /* fuse-over-io_uring transport */
+	unsigned int io_uring_q_depth; /* per-core queue depth (0=default) */
+	char *cpus;                /* cpu list the daemon runs on */
+	int numa_queues;           /* spread workers over NUMA nodes */
 	struct famfs_icache icache;
+	struct famfs_negcache negcache;
+	struct famfs_dircache dircache;
+	struct famfs_wsp *rdp_pool; /* readdirplus miss loaders */
 };
 
+/*
+ * fuse_reply_err(), noting the errno in the request's trace record
+ */
+static inline int famfs_reply_err(fuse_req_t req, int err)
+{
+	famfs_trace_err(err);
+	return fuse_reply_err(req, err);
+}
+
+#define FAMFS_NEGCACHE_DEFAULT_MAX 16384
+#define FAMFS_ASYNC_LOG_MSGS 4096
+#define FAMFS_PRELOAD_DEFAULT_THREADS 8
+
+/*
+ * A shadow directory entry being looked up. This is used by
+ * famfs_do_lookup() for one entry, and by readdirplus and preload for
+ * batches of entries.
+ */
+struct famfs_shadow_ent {
+	char name[NAME_MAX + 1];
+	ino_t d_ino;                 /* From readdir (0 if unknown) */
+	unsigned char d_type;        /* From readdir (DT_UNKNOWN if unknown) */
+	off_t nextoff;               /* Readdir offset of the following entry */
+	int err;                     /* errno from loading the entry */
+	int fd;                      /* Open fd (directories only) */
+	enum famfs_fuse_ftype ftype;
+	struct stat attr;
+	struct famfs_log_file_meta *fmeta; /* Parsed shadow yaml (files only) */
+	struct famfs_inode *inode;   /* Cached inode, holding one ref */
+};
+
+void famfs_shadow_ent_release(struct famfs_shadow_ent *ent);
+int famfs_shadow_ent_load(int parentfd, struct famfs_shadow_ent *ent,
+			  struct famfs_icache *icache);
+struct famfs_inode *famfs_shadow_ent_commit_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *parent_inode,
+	struct famfs_shadow_ent *ent);
+ssize_t famfs_inode_cache_fmap_msg(struct famfs_icache *icache,
+				   struct famfs_inode *inode);
+
+void famfs_negcache_notify_kernel(uint64_t parent_ino, const char *name,
+				  void *arg);
+
 #endif /* FAMFS_FUSED_H */
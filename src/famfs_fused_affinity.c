@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "famfs_log.h"
+#include "famfs_fused_affinity.h"
+
+/*
+ * Worker thread placement
+ *
+ * -o cpus=<list> sets the affinity of the whole daemon before the icache is
+ * created. Every thread started afterward (preload, logtail, REST, and the
+ * libfuse workers) inherits it, and since Linux places pages on the node of
+ * the cpu that first touches them, the icache slabs, fmaps and famfs_inodes
+ * are allocated on the node(s) of the cpu set.
+ *
+ * -o numa_queues (which implies clone_fd, so each worker has its own
+ * /dev/fuse fd) spreads the workers across the NUMA nodes in the cpu set:
+ * on its first request, a worker binds itself to the cpus of the next node,
+ * round robin. A worker's queue and the memory it allocates then stay on
+ * one node.
+ */
+
+int famfs_numa_nqueues;
+__thread int famfs_thread_placed;
+
+static cpu_set_t famfs_node_cpus[FAMFS_MAX_NUMA_NODES];
+static unsigned int famfs_numa_next;
+
+/**
+ * famfs_cpulist_parse()
+ *
+ * Parse a cpu list in the kernel's format ("0-3,8,10-11"; ranges may have a
+ * ":stride" as in "0-15:2")
+ *
+ * Returns 0, or -1 if the list is invalid or names a cpu >= CPU_SETSIZE
+ */
+int famfs_cpulist_parse(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+	if (!list || !*list)
+		return -1;
+
+	while (*p) {
+		unsigned long first, last, stride = 1, cpu;
+		char *end;
+
+		if (!isdigit((unsigned char)*p))
+			return -1;
+		first = last = strtoul(p, &end, 10);
+		p = end;
+		if (*p == '-') {
+			p++;
+			if (!isdigit((unsigned char)*p))
+				return -1;
+			last = strtoul(p, &end, 10);
+			p = end;
+			if (*p == ':') {
+				p++;
+				if (!isdigit((unsigned char)*p))
+					return -1;
+				stride = strtoul(p, &end, 10);
+				p = end;
+			}
+		}
+		if (last < first || last >= CPU_SETSIZE || !stride)
+			return -1;
+		for (cpu = first; cpu <= last; cpu += stride)
+			CPU_SET(cpu, set);
+
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return -1;
+		else
+			break;
+	}
+	return 0;
+}
+
+/* Read the cpus of a NUMA node from sysfs. Returns -1 if there is no node */
+static int famfs_numa_node_cpus(int node, cpu_set_t *set)
+{
+	char path[128];
+	char buf[4096];
+	FILE *fp;
+	int rc = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	if (fgets(buf, sizeof(buf), fp))
+		rc = famfs_cpulist_parse(buf, set);
+	fclose(fp);
+	return rc;
+}
+
+/**
+ * famfs_affinity_init()
+ *
+ * Apply -o cpus= to the daemon, and set up the per-node cpu sets for
+ * -o numa_queues. Call this early in main(), before the icache is created
+ * or any threads are started.
+ *
+ * Returns 0, or -1 if the cpu list is invalid or can't be applied
+ */
+int famfs_affinity_init(const char *cpus, int numa_queues)
+{
+	cpu_set_t allowed;
+	int node, nnodes = 0;
+
+	if (cpus) {
+		if (famfs_cpulist_parse(cpus, &allowed)) {
+			famfs_log(FAMFS_LOG_ERR, "%s: bad cpu list (%s)\n",
+				  __func__, cpus);
+			return -1;
+		}
+		if (sched_setaffinity(0, sizeof(allowed), &allowed)) {
+			famfs_log(FAMFS_LOG_ERR,
+				  "%s: sched_setaffinity(%s) failed, errno %d\n",
+				  __func__, cpus, errno);
+			return -1;
+		}
+	}
+
+	if (!numa_queues)
+		return 0;
+
+	/* The cpus we may run on (after -o cpus, and any cpuset/taskset) */
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		famfs_log(FAMFS_LOG_ERR, "%s: sched_getaffinity failed\n",
+			  __func__);
+		return -1;
+	}
+
+	for (node = 0; node < FAMFS_MAX_NUMA_NODES; node++) {
+		cpu_set_t ncpus;
+
+		if (famfs_numa_node_cpus(node, &ncpus))
+			continue;
+		CPU_AND(&famfs_node_cpus[nnodes], &ncpus, &allowed);
+		if (CPU_COUNT(&famfs_node_cpus[nnodes]))
+			nnodes++;
+	}
+
+	if (nnodes < 2) {
+		famfs_log(FAMFS_LOG_NOTICE,
+			  "%s: numa_queues: %d node(s) in the cpu set; ignored\n",
+			  __func__, nnodes);
+		return 0;
+	}
+	famfs_log(FAMFS_LOG_NOTICE,
+		  "%s: numa_queues: workers spread over %d nodes\n",
+		  __func__, nnodes);
+	famfs_numa_nqueues = nnodes;
+	return 0;
+}
+
+void famfs_affinity_thread_slow(void)
+{
+	unsigned int q;
+
+	famfs_thread_placed = 1;
+	q = __atomic_fetch_add(&famfs_numa_next, 1, __ATOMIC_RELAXED) %
+		famfs_numa_nqueues;
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				   &famfs_node_cpus[q]))
+		famfs_log(FAMFS_LOG_ERR, "%s: pthread_setaffinity_np failed\n",
+			  __func__);
+}
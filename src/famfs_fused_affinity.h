@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_AFFINITY
+#define _H_FAMFS_FUSED_AFFINITY
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+
+#define FAMFS_MAX_NUMA_NODES 64
+
+int famfs_cpulist_parse(const char *list, cpu_set_t *set);
+int famfs_affinity_init(const char *cpus, int numa_queues);
+void famfs_affinity_thread_slow(void);
+
+extern int famfs_numa_nqueues;
+extern __thread int famfs_thread_placed;
+
+/*
+ * Called at the start of each fuse request; places the calling worker
+ * thread on its first request (if -o numa_queues)
+ */
+static inline void famfs_affinity_thread(void)
+{
+	if (__builtin_expect(famfs_numa_nqueues && !famfs_thread_placed, 0))
+		famfs_affinity_thread_slow();
+}
+
+#endif /* _H_FAMFS_FUSED_AFFINITY */
@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "famfs_log.h"
+#include "famfs_fused_dircache.h"
+
+/* Expected bytes per cached listing, for sizing the hash table */
+#define FAMFS_DIRCACHE_AVG_BYTES (16 * 1024)
+
+static inline uint64_t
+famfs_dircache_bucket(const struct famfs_dircache *dc, uint64_t ino)
+{
+	return (ino * 0x9e3779b97f4a7c15ULL) >> 32 & (dc->nbuckets - 1);
+}
+
+static inline size_t
+famfs_dirlist_bytes(const struct famfs_dirlist *dl)
+{
+	return sizeof(*dl) + dl->buf_size +
+		dl->max_count * (sizeof(*dl->off) + sizeof(*dl->pos));
+}
+
+static void
+famfs_dirlist_free(struct famfs_dirlist *dl)
+{
+	free(dl->buf);
+	free(dl->pos);
+	free(dl->off);
+	free(dl);
+}
+
+static void
+famfs_dircache_lru_del(struct famfs_dircache *dc, struct famfs_dirlist *dl)
+{
+	if (dl->lru_prev)
+		dl->lru_prev->lru_next = dl->lru_next;
+	else
+		dc->lru_head = dl->lru_next;
+	if (dl->lru_next)
+		dl->lru_next->lru_prev = dl->lru_prev;
+	else
+		dc->lru_tail = dl->lru_prev;
+	dl->lru_next = dl->lru_prev = NULL;
+}
+
+static void
+famfs_dircache_lru_add_head(struct famfs_dircache *dc, struct famfs_dirlist *dl)
+{
+	dl->lru_prev = NULL;
+	dl->lru_next = dc->lru_head;
+	if (dc->lru_head)
+		dc->lru_head->lru_prev = dl;
+	else
+		dc->lru_tail = dl;
+	dc->lru_head = dl;
+}
+
+/*
+ * Take a listing out of the cache, and return the cache's ref to it (or the
+ * listing, if the caller should free it). Caller holds the mutex.
+ */
+static struct famfs_dirlist *
+famfs_dircache_remove_locked(
+	struct famfs_dircache *dc,
+	struct famfs_dirlist *dl)
+{
+	struct famfs_dirlist **pp = &dc->hash[famfs_dircache_bucket(dc, dl->ino)];
+
+	for (; *pp; pp = &(*pp)->hnext) {
+		if (*pp == dl) {
+			*pp = dl->hnext;
+			break;
+		}
+	}
+	dl->hnext = NULL;
+	famfs_dircache_lru_del(dc, dl);
+	dl->cached = 0;
+	dc->count--;
+	dc->bytes -= famfs_dirlist_bytes(dl);
+
+	return (--dl->refcount == 0) ? dl : NULL;
+}
+
+int
+famfs_dircache_init(
+	struct famfs_dircache *dc,
+	uint64_t max_bytes)
+{
+	memset(dc, 0, sizeof(*dc));
+	pthread_mutex_init(&dc->mutex, NULL);
+
+	if (max_bytes == 0)
+		return 0; /* disabled */
+
+	dc->nbuckets = 64;
+	while (dc->nbuckets < max_bytes / FAMFS_DIRCACHE_AVG_BYTES)
+		dc->nbuckets <<= 1;
+
+	dc->hash = calloc(dc->nbuckets, sizeof(*dc->hash));
+	if (!dc->hash) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to allocate %ld buckets\n",
+			  __func__, dc->nbuckets);
+		dc->nbuckets = 0;
+		return -1;
+	}
+	dc->max_bytes = max_bytes;
+	return 0;
+}
+
+void
+famfs_dircache_destroy(struct famfs_dircache *dc)
+{
+	famfs_dircache_invalidate_all(dc);
+	free(dc->hash);
+	dc->hash = NULL;
+	dc->max_bytes = 0;
+}
+
+/**
+ * famfs_dircache_version()
+ *
+ * The version of a directory's contents, from its mtime and ctime
+ */
+uint64_t
+famfs_dircache_version(
+	const struct timespec *mtime,
+	const struct timespec *ctime)
+{
+	uint64_t m = (uint64_t)mtime->tv_sec * 1000000000ULL + mtime->tv_nsec;
+	uint64_t c = (uint64_t)ctime->tv_sec * 1000000000ULL + ctime->tv_nsec;
+
+	return m ^ (c * 0x9e3779b97f4a7c15ULL);
+}
+
+/**
+ * famfs_dircache_get()
+ *
+ * Returns the cached listing of @ino with ref held, or NULL if there isn't
+ * one at @version. A listing at any other version is dropped.
+ */
+struct famfs_dirlist *
+famfs_dircache_get(
+	struct famfs_dircache *dc,
+	uint64_t ino,
+	uint64_t version)
+{
+	struct famfs_dirlist *dl;
+	struct famfs_dirlist *dead = NULL;
+
+	if (!dc->max_bytes)
+		return NULL;
+
+	pthread_mutex_lock(&dc->mutex);
+	for (dl = dc->hash[famfs_dircache_bucket(dc, ino)]; dl; dl = dl->hnext)
+		if (dl->ino == ino)
+			break;
+
+	if (dl && dl->version != version) {
+		dead = famfs_dircache_remove_locked(dc, dl);
+		dc->stale++;
+		dl = NULL;
+	}
+	if (dl) {
+		famfs_dircache_lru_del(dc, dl);
+		famfs_dircache_lru_add_head(dc, dl);
+		dl->refcount++;
+		dc->hits++;
+	} else {
+		dc->misses++;
+	}
+	pthread_mutex_unlock(&dc->mutex);
+
+	if (dead)
+		famfs_dirlist_free(dead);
+	return dl;
+}
+
+/**
+ * famfs_dircache_insert()
+ *
+ * Cache a complete listing (replacing any listing of the same directory).
+ * The caller keeps its own ref.
+ *
+ * Returns 0 if the listing was cached, or -1 if the cache is disabled or the
+ * listing is too big to be worth caching
+ */
+int
+famfs_dircache_insert(
+	struct famfs_dircache *dc,
+	struct famfs_dirlist *dl)
+{
+	struct famfs_dirlist *victims = NULL;
+	struct famfs_dirlist *old;
+	size_t bytes = famfs_dirlist_bytes(dl);
+	uint64_t b;
+
+	if (!dc->max_bytes || bytes > dc->max_bytes / 4)
+		return -1;
+
+	pthread_mutex_lock(&dc->mutex);
+	if (dl->cached) {
+		pthread_mutex_unlock(&dc->mutex);
+		return 0;
+	}
+
+	b = famfs_dircache_bucket(dc, dl->ino);
+	for (old = dc->hash[b]; old; old = old->hnext) {
+		if (old->ino == dl->ino) {
+			if (famfs_dircache_remove_locked(dc, old)) {
+				old->hnext = victims;
+				victims = old;
+			}
+			break;
+		}
+	}
+
+	while (dc->lru_tail && dc->bytes + bytes > dc->max_bytes) {
+		old = famfs_dircache_remove_locked(dc, dc->lru_tail);
+		if (old) {
+			old->hnext = victims;
+			victims = old;
+		}
+		dc->evictions++;
+	}
+
+	dl->hnext = dc->hash[b];
+	dc->hash[b] = dl;
+	famfs_dircache_lru_add_head(dc, dl);
+	dl->cached = 1;
+	dl->refcount++;
+	dc->count++;
+	dc->bytes += bytes;
+	dc->inserts++;
+	pthread_mutex_unlock(&dc->mutex);
+
+	while ((old = victims)) {
+		victims = old->hnext;
+		famfs_dirlist_free(old);
+	}
+	return 0;
+}
+
+/**
+ * famfs_dircache_invalidate()
+ *
+ * Drop the listing of @ino (e.g. a directory that log tailing just added to)
+ */
+void
+famfs_dircache_invalidate(
+	struct famfs_dircache *dc,
+	uint64_t ino)
+{
+	struct famfs_dirlist *dl;
+	struct famfs_dirlist *dead = NULL;
+
+	if (!dc->max_bytes)
+		return;
+
+	pthread_mutex_lock(&dc->mutex);
+	for (dl = dc->hash[famfs_dircache_bucket(dc, ino)]; dl; dl = dl->hnext)
+		if (dl->ino == ino)
+			break;
+	if (dl) {
+		dead = famfs_dircache_remove_locked(dc, dl);
+		dc->invalidations++;
+	}
+	pthread_mutex_unlock(&dc->mutex);
+
+	if (dead)
+		famfs_dirlist_free(dead);
+}
+
+/**
+ * famfs_dircache_invalidate_all()
+ *
+ * Returns the number of listings dropped
+ */
+uint64_t
+famfs_dircache_invalidate_all(struct famfs_dircache *dc)
+{
+	struct famfs_dirlist *victims = NULL;
+	struct famfs_dirlist *dl;
+	uint64_t n = 0;
+
+	if (!dc->hash)
+		return 0;
+
+	pthread_mutex_lock(&dc->mutex);
+	while (dc->lru_head) {
+		dl = famfs_dircache_remove_locked(dc, dc->lru_head);
+		if (dl) {
+			dl->hnext = victims;
+			victims = dl;
+		}
+		n++;
+	}
+	dc->invalidations += n;
+	pthread_mutex_unlock(&dc->mutex);
+
+	while ((dl = victims)) {
+		victims = dl->hnext;
+		famfs_dirlist_free(dl);
+	}
+	return n;
+}
+
+/**
+ * famfs_dirlist_alloc()
+ *
+ * Start building the listing of @ino at @version. The caller holds the only
+ * ref.
+ */
+struct famfs_dirlist *
+famfs_dirlist_alloc(
+	uint64_t ino,
+	uint64_t version)
+{
+	struct famfs_dirlist *dl = calloc(1, sizeof(*dl));
+
+	if (!dl)
+		return NULL;
+
+	dl->ino = ino;
+	dl->version = version;
+	dl->refcount = 1;
+	dl->pos = calloc(1, sizeof(*dl->pos));
+	if (!dl->pos) {
+		free(dl);
+		return NULL;
+	}
+	return dl;
+}
+
+/**
+ * famfs_dirlist_reserve()
+ *
+ * Returns space for @len more bytes of dirents at the end of the listing,
+ * which famfs_dirlist_add() appends once it's filled in; or NULL.
+ */
+char *
+famfs_dirlist_reserve(
+	struct famfs_dirlist *dl,
+	size_t len)
+{
+	if (dl->len + len > dl->buf_size) {
+		size_t size = (dl->buf_size) ? dl->buf_size :
+			FAMFS_DIRCACHE_INIT_BYTES;
+		char *buf;
+
+		while (size < dl->len + len)
+			size *= 2;
+		buf = realloc(dl->buf, size);
+		if (!buf)
+			return NULL;
+		dl->buf = buf;
+		dl->buf_size = size;
+	}
+	return dl->buf + dl->len;
+}
+
+/**
+ * famfs_dirlist_add()
+ *
+ * Append the entry (@len bytes) just encoded at famfs_dirlist_reserve();
+ * @nextoff is its dirent offset (the cookie of the next entry)
+ */
+int
+famfs_dirlist_add(
+	struct famfs_dirlist *dl,
+	size_t len,
+	off_t nextoff)
+{
+	if (dl->count == dl->max_count) {
+		uint32_t max = (dl->max_count) ? dl->max_count * 2 : 64;
+		size_t *pos;
+		off_t *off;
+
+		pos = realloc(dl->pos, (max + 1) * sizeof(*pos));
+		if (!pos)
+			return -1;
+		dl->pos = pos;
+		off = realloc(dl->off, max * sizeof(*off));
+		if (!off)
+			return -1;
+		dl->off = off;
+		dl->max_count = max;
+	}
+	dl->off[dl->count] = nextoff;
+	dl->len += len;
+	dl->pos[++dl->count] = dl->len;
+	return 0;
+}
+
+/**
+ * famfs_dirlist_put()
+ *
+ * Drop a ref to a listing (from famfs_dirlist_alloc() or famfs_dircache_get())
+ */
+void
+famfs_dirlist_put(
+	struct famfs_dircache *dc,
+	struct famfs_dirlist *dl)
+{
+	int last;
+
+	if (!dl)
+		return;
+
+	pthread_mutex_lock(&dc->mutex);
+	last = (--dl->refcount == 0);
+	pthread_mutex_unlock(&dc->mutex);
+
+	if (last)
+		famfs_dirlist_free(dl);
+}
+
+/**
+ * famfs_dirlist_find()
+ *
+ * Returns the index of the entry that follows readdir offset @offset (0 is
+ * the start), or -1 if @offset isn't an offset in this listing
+ */
+int64_t
+famfs_dirlist_find(
+	const struct famfs_dirlist *dl,
+	off_t offset)
+{
+	uint32_t i;
+
+	if (offset == 0)
+		return 0;
+	for (i = 0; i < dl->count; i++)
+		if (dl->off[i] == offset)
+			return i + 1;
+	return -1;
+}
+
+/**
+ * famfs_dirlist_span()
+ *
+ * Returns the number of bytes of whole entries, starting at entry @first,
+ * that fit in @size bytes; the number of entries is returned in @nents
+ */
+size_t
+famfs_dirlist_span(
+	const struct famfs_dirlist *dl,
+	uint32_t first,
+	size_t size,
+	uint32_t *nents)
+{
+	uint32_t lo = first;
+	uint32_t hi = dl->count;
+
+	if (first >= dl->count) {
+		*nents = 0;
+		return 0;
+	}
+
+	/* Last entry boundary within size */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo + 1) / 2;
+
+		if (dl->pos[mid] - dl->pos[first] <= size)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	*nents = lo - first;
+	return dl->pos[lo] - dl->pos[first];
+}
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef FAMFS_FUSED_DIRCACHE
+#define FAMFS_FUSED_DIRCACHE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * Directory listing cache
+ *
+ * Caches the complete readdir reply stream of a shadow directory, already
+ * encoded as fuse dirents, keyed by the directory's ino. Each listing is
+ * stamped with the directory's version (the shadow dir's mtime and ctime);
+ * a listing only hits if the version still matches a fresh fstat of the
+ * directory, so changes made by anyone (logplay, log tailing) are picked
+ * up. Log tailing also invalidates listings so they don't linger.
+ *
+ * Listings are immutable and refcounted: an open directory handle holds a
+ * ref to the listing it is walking, so a directory that changes while it is
+ * being read (or a listing that is evicted) doesn't disturb readers. The
+ * cache is bounded by the total size of the listings (LRU eviction).
+ *
+ * The dirent offsets in a listing are the shadow readdir offsets, so a
+ * handle can switch between cached and uncached reads (e.g. seekdir).
+ */
+
+struct famfs_dirlist {
+	struct famfs_dirlist *hnext;     /* hash chain */
+	struct famfs_dirlist *lru_next;  /* toward least recently used */
+	struct famfs_dirlist *lru_prev;
+	int refcount;                    /* the cache holds one while cached */
+	int cached;
+	uint64_t ino;                    /* shadow directory */
+	uint64_t version;
+	uint32_t count;                  /* entries */
+	uint32_t max_count;              /* pos/off capacity */
+	size_t len;                      /* bytes of encoded dirents */
+	size_t buf_size;
+	size_t *pos;                     /* count + 1 entry start positions */
+	off_t *off;                      /* count entry offsets (next cookie) */
+	char *buf;
+};
+
+struct famfs_dircache {
+	pthread_mutex_t mutex;
+	struct famfs_dirlist **hash;
+	uint64_t nbuckets;               /* power of 2 */
+	struct famfs_dirlist *lru_head;  /* most recently used */
+	struct famfs_dirlist *lru_tail;
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t max_bytes;              /* 0 = disabled */
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stale;                  /* found, but the version changed */
+	uint64_t inserts;
+	uint64_t evictions;
+	uint64_t invalidations;
+};
+
+#define FAMFS_DIRCACHE_DEFAULT_MB 64
+#define FAMFS_DIRCACHE_INIT_BYTES 4096
+
+/*
+ * Directories changed more recently than this are listed but not cached:
+ * the mtime is only updated once per timestamp tick, so a listing built
+ * within a tick of a change could miss a second change in the same tick
+ * and still look current.
+ */
+#define FAMFS_DIRCACHE_SETTLE_NS (100ULL * 1000 * 1000)
+
+int famfs_dircache_init(struct famfs_dircache *dc, uint64_t max_bytes);
+void famfs_dircache_destroy(struct famfs_dircache *dc);
+uint64_t famfs_dircache_version(const struct timespec *mtime,
+				const struct timespec *ctime);
+struct famfs_dirlist *famfs_dircache_get(struct famfs_dircache *dc,
+					 uint64_t ino, uint64_t version);
+int famfs_dircache_insert(struct famfs_dircache *dc,
+			  struct famfs_dirlist *dl);
+void famfs_dircache_invalidate(struct famfs_dircache *dc, uint64_t ino);
+uint64_t famfs_dircache_invalidate_all(struct famfs_dircache *dc);
+
+struct famfs_dirlist *famfs_dirlist_alloc(uint64_t ino, uint64_t version);
+char *famfs_dirlist_reserve(struct famfs_dirlist *dl, size_t len);
+int famfs_dirlist_add(struct famfs_dirlist *dl, size_t len, off_t nextoff);
+void famfs_dirlist_put(struct famfs_dircache *dc, struct famfs_dirlist *dl);
+int64_t famfs_dirlist_find(const struct famfs_dirlist *dl, off_t offset);
+size_t famfs_dirlist_span(const struct famfs_dirlist *dl, uint32_t first,
+			  size_t size, uint32_t *nents);
+
+#endif /* FAMFS_FUSED_DIRCACHE */
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "famfs_fused_dirp.h"
+
+void
+famfs_shadow_ent_release(struct famfs_shadow_ent *ent)
+{
+	if (ent->fd >= 0)
+		close(ent->fd);
+	ent->fd = -1;
+	free(ent->fmeta);
+	ent->fmeta = NULL;
+}
+
+/*
+ * Drop the unsent entries of the window (and their icache refs)
+ */
+void
+famfs_rdp_window_drop(
+	struct famfs_icache *icache,
+	struct famfs_rdp_window *w)
+{
+	int i;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&icache->mutex);
+	for (i = w->next; i < w->count; i++) {
+		if (w->ent[i].inode) {
+			famfs_inode_putref_locked(w->ent[i].inode, 1);
+			w->ent[i].inode = NULL;
+		}
+	}
+	pthread_mutex_unlock(&icache->mutex);
+
+	for (i = w->next; i < w->count; i++)
+		famfs_shadow_ent_release(&w->ent[i]);
+
+	w->count = w->next = 0;
+	w->eof = 0;
+}
+
+/*
+ * Position the stream at @offset, discarding all read-ahead
+ */
+void
+famfs_dirp_seek(
+	struct famfs_icache *icache,
+	struct famfs_dirp *d,
+	off_t offset)
+{
+	famfs_rdp_window_drop(icache, d->rdp);
+	seekdir(d->dp, offset);
+	d->entry = NULL;
+	d->offset = offset;
+	d->dp_stale = 0;
+}
+
+/*
+ * Start a readdir at @offset. The readdirplus window is dropped: its
+ * entries are ahead of the stream position readdir needs
+ */
+void
+famfs_dirp_readdir_begin(
+	struct famfs_icache *icache,
+	struct famfs_dirp *d,
+	off_t offset)
+{
+	famfs_rdp_window_drop(icache, d->rdp);
+	if (offset != d->offset || d->dp_stale)
+		famfs_dirp_seek(icache, d, offset);
+}
+
+/*
+ * The next entry for readdir, which stays the read-ahead entry until
+ * famfs_dirp_readdir_next(). Returns NULL at the end of the directory
+ * (*err = 0) or on error (*err = errno)
+ */
+struct dirent *
+famfs_dirp_readdir_peek(struct famfs_dirp *d, int *err)
+{
+	*err = 0;
+	if (!d->entry) {
+		errno = 0;
+		d->entry = readdir(d->dp);
+		if (!d->entry)
+			*err = errno;
+	}
+	return d->entry;
+}
+
+/* The peeked entry was sent */
+void
+famfs_dirp_readdir_next(struct famfs_dirp *d)
+{
+	d->offset = d->entry->d_off;
+	d->entry = NULL;
+}
+
+/*
+ * Start a readdirplus at @offset. Unsent entries in the window are kept if
+ * the call continues where the last readdirplus stopped.
+ *
+ * Returns 0, or ENOMEM
+ */
+int
+famfs_dirp_readdirplus_begin(
+	struct famfs_icache *icache,
+	struct famfs_dirp *d,
+	off_t offset)
+{
+	struct famfs_rdp_window *w;
+
+	if (!d->rdp) {
+		d->rdp = calloc(1, sizeof(*d->rdp));
+		if (!d->rdp)
+			return ENOMEM;
+	}
+	w = d->rdp;
+
+	/* dp_stale with unsent window entries just means the stream is past
+	 * the window, which is where the window continues */
+	if (offset != d->offset || d->entry ||
+	    (d->dp_stale && w->next == w->count))
+		famfs_dirp_seek(icache, d, offset);
+	return 0;
+}
+
+/* Read the next window of directory entries. Returns 0, or an errno if
+ * readdir failed before any entries were read */
+static int
+famfs_rdp_window_read(DIR *dp, struct famfs_rdp_window *w)
+{
+	w->count = w->next = 0;
+	while (w->count < FAMFS_RDP_WINDOW) {
+		struct famfs_shadow_ent *ent = &w->ent[w->count];
+		struct dirent *de;
+
+		errno = 0;
+		de = readdir(dp);
+		if (!de) {
+			if (errno && w->count == 0)
+				return errno;
+			w->eof = 1;
+			break;
+		}
+
+		strcpy(ent->name, de->d_name);
+		ent->d_ino = de->d_ino;
+		ent->d_type = de->d_type;
+		ent->nextoff = de->d_off;
+		ent->fd = -1;
+		ent->err = 0;
+		ent->fmeta = NULL;
+		ent->inode = NULL;
+		w->count++;
+	}
+	return 0;
+}
+
+/*
+ * The next entry for readdirplus. When the window is used up, the next one
+ * is read and passed to @resolve (if non-null). Returns NULL at the end of
+ * the directory (*err = 0) or on error (*err = errno)
+ */
+struct famfs_shadow_ent *
+famfs_dirp_readdirplus_peek(
+	struct famfs_dirp *d,
+	famfs_rdp_resolve_fn resolve,
+	void *arg,
+	int *err)
+{
+	struct famfs_rdp_window *w = d->rdp;
+
+	*err = 0;
+	if (w->next == w->count) {
+		if (w->eof)
+			return NULL;
+		*err = famfs_rdp_window_read(d->dp, w);
+		if (*err || w->count == 0)
+			return NULL;
+		if (resolve)
+			resolve(arg, w);
+	}
+	return &w->ent[w->next];
+}
+
+/* The peeked entry was sent (or skipped) */
+void
+famfs_dirp_readdirplus_next(struct famfs_dirp *d)
+{
+	struct famfs_rdp_window *w = d->rdp;
+
+	d->offset = w->ent[w->next].nextoff;
+	w->next++;
+}
+
+/* End a readdirplus call: if the window still holds entries that were not
+ * sent, the stream is ahead of d->offset */
+void
+famfs_dirp_readdirplus_end(struct famfs_dirp *d)
+{
+	if (d->rdp)
+		d->dp_stale = (d->rdp->next < d->rdp->count);
+}
+
+/* Free the handle's stream and window (not its cached listing) */
+void
+famfs_dirp_release(struct famfs_icache *icache, struct famfs_dirp *d)
+{
+	famfs_rdp_window_drop(icache, d->rdp);
+	free(d->rdp);
+	closedir(d->dp);
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef FAMFS_FUSED_DIRP
+#define FAMFS_FUSED_DIRP
+
+#include <dirent.h>
+#include <sys/types.h>
+
+#include "famfs_fused.h"
+
+/*
+ * Open directory handles
+ *
+ * A handle has one shadow directory stream, which readdir and readdirplus
+ * share (with READDIRPLUS_AUTO the kernel mixes them on one handle). Each
+ * reads ahead of what it has replied with: readdir by one entry
+ * (d->entry), readdirplus by a window of up to FAMFS_RDP_WINDOW entries.
+ * d->offset is the offset of the next entry to reply with, and the stream
+ * is only positioned there (without seeking) if d->dp_stale is clear:
+ *
+ * * readdir drops the readdirplus window (and its icache refs), and seeks
+ *   if the window held entries that were not sent
+ * * readdirplus seeks if readdir left a read-ahead entry, and keeps its
+ *   window across calls as long as the offsets line up
+ */
+#define FAMFS_RDP_WINDOW 128
+
+struct famfs_rdp_window {
+	struct famfs_shadow_ent ent[FAMFS_RDP_WINDOW];
+	int count;     /* Number of valid entries */
+	int next;      /* Next entry to send */
+	int eof;       /* readdir has reached the end of the directory */
+};
+
+struct famfs_dirp {
+	DIR *dp;
+	struct dirent *entry; /* readdir read-ahead (not yet sent) */
+	off_t offset;
+	int dp_stale;       /* dp isn't at offset (a listing or window was read) */
+	struct famfs_rdp_window *rdp; /* readdirplus window (allocated on use) */
+	struct famfs_dirlist *dl;     /* cached listing being read (ref held) */
+	uint32_t dl_next;   /* next entry of dl to send */
+	off_t dl_offset;    /* readdir offset of dl_next */
+};
+
+/* Resolves the entries of a newly read readdirplus window */
+typedef void (*famfs_rdp_resolve_fn)(void *arg, struct famfs_rdp_window *w);
+
+void famfs_rdp_window_drop(struct famfs_icache *icache,
+			   struct famfs_rdp_window *w);
+void famfs_dirp_seek(struct famfs_icache *icache, struct famfs_dirp *d,
+		     off_t offset);
+
+void famfs_dirp_readdir_begin(struct famfs_icache *icache,
+			      struct famfs_dirp *d, off_t offset);
+struct dirent *famfs_dirp_readdir_peek(struct famfs_dirp *d, int *err);
+void famfs_dirp_readdir_next(struct famfs_dirp *d);
+
+int famfs_dirp_readdirplus_begin(struct famfs_icache *icache,
+				 struct famfs_dirp *d, off_t offset);
+struct famfs_shadow_ent *famfs_dirp_readdirplus_peek(
+	struct famfs_dirp *d, famfs_rdp_resolve_fn resolve, void *arg,
+	int *err);
+void famfs_dirp_readdirplus_next(struct famfs_dirp *d);
+void famfs_dirp_readdirplus_end(struct famfs_dirp *d);
+
+void famfs_dirp_release(struct famfs_icache *icache, struct famfs_dirp *d);
+
+#endif /* FAMFS_FUSED_DIRP */
@@ -10,6 +10,83 @@
 #include "famfs_fused_icache.h"
 #include "famfs_fused.h"
 
+#define FAMFS_ICACHE_HASH_MIN 1024
+
+static void famfs_flock_free(struct famfs_flock *fl);
+
+static inline uint64_t
+famfs_ino_hash(struct famfs_icache *icache, uint64_t ino)
+{
+	/* Fibonacci hashing; shadow inode numbers are often sequential */
+	return (ino * 0x9e3779b97f4a7c15ULL) >> 32 & (icache->ino_hash_size - 1);
+}
+
+/*
+ * Grow the ino hash table when the chains get long. Caller holds the mutex.
+ * If the allocation fails we just keep the current (slower) table.
+ */
+static void
+famfs_icache_hash_grow_locked(struct famfs_icache *icache)
+{
+	uint64_t old_size = icache->ino_hash_size;
+	struct famfs_inode **old_hash = icache->ino_hash;
+	struct famfs_inode **new_hash;
+	uint64_t i;
+
+	new_hash = calloc(old_size * 2, sizeof(*new_hash));
+	if (!new_hash)
+		return;
+
+	icache->ino_hash = new_hash;
+	icache->ino_hash_size = old_size * 2;
+	for (i = 0; i < old_size; i++) {
+		struct famfs_inode *p = old_hash[i];
+
+		while (p) {
+			struct famfs_inode *next = p->hnext;
+			uint64_t b = famfs_ino_hash(icache, p->ino);
+
+			p->hnext = new_hash[b];
+			new_hash[b] = p;
+			p = next;
+		}
+	}
+	free(old_hash);
+}
+
+static void
+famfs_icache_hash_insert_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	uint64_t b;
+
+	if (icache->count > 2 * icache->ino_hash_size)
+		famfs_icache_hash_grow_locked(icache);
+
+	b = famfs_ino_hash(icache, inode->ino);
+	inode->hnext = icache->ino_hash[b];
+	icache->ino_hash[b] = inode;
+}
+
+static void
+famfs_icache_hash_remove_locked(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	struct famfs_inode **pp;
+
+	pp = &icache->ino_hash[famfs_ino_hash(icache, inode->ino)];
+	for (; *pp; pp = &(*pp)->hnext) {
+		if (*pp == inode) {
+			*pp = inode->hnext;
+			inode->hnext = NULL;
+			return;
+		}
+	}
+	FAMFS_ASSERT(__func__, 0); /* inode was not hashed */
+}
+
 int famfs_icache_init(
 	void *owner,
 	struct famfs_icache *icache,
@@ -17,7 +94,7 @@ int famfs_icache_init(
 {
 	memset(icache, 0, sizeof(*icache));
 	pthread_mutex_init(&icache->mutex, NULL);
-	pthread_mutex_init(&icache->flock_mutex, NULL);
+	pthread_mutex_init(&icache->slab_mutex, NULL);
 	icache->owner = owner;
 	
 	/* Root inode setup */
@@ -25,16 +102,26 @@ int famfs_icache_init(
 	icache->root.flags = FAMFS_ROOTDIR;
 	icache->root.ftype = FAMFS_FDIR;
 	icache->root.ino = FUSE_ROOT_ID;
-	icache->root.name = strdup(".");
+	strcpy(icache->root.iname, ".");
+	icache->root.name = icache->root.iname;
 	icache->root.icache = icache;
 	icache->root.refcount = 2;
 	icache->root.fd = -1;
 
+	icache->ino_hash = calloc(FAMFS_ICACHE_HASH_MIN,
+				  sizeof(*icache->ino_hash));
+	if (!icache->ino_hash)
+		return -1;
+	icache->ino_hash_size = FAMFS_ICACHE_HASH_MIN;
+
 	if (shadow_root) {
 		icache->root.fd = open(shadow_root, O_PATH);
 		if (icache->root.fd == -1) {
 			famfs_log(FAMFS_LOG_ERR, "open(\"%s\", O_PATH): %m\n",
 				  shadow_root);
+			free(icache->ino_hash);
+			icache->ino_hash = NULL;
+			icache->ino_hash_size = 0;
 			return -1;
 		}
 		icache->shadow_root = strdup(shadow_root);
@@ -52,15 +139,37 @@ void famfs_icache_destroy(struct famfs_icache *icache)
 		if (next && next != &icache->root)
 			famfs_inode_free(next);
 	}
+	icache->root.prev = &icache->root;
+
+	/* All inodes are back on the free list; release the slabs */
+	pthread_mutex_lock(&icache->slab_mutex);
+	while (icache->slabs) {
+		struct famfs_inode_slab *slab = icache->slabs;
+
+		icache->slabs = slab->next;
+		free(slab);
+	}
+	icache->free_inodes = NULL;
+	icache->nslabs = 0;
+	pthread_mutex_unlock(&icache->slab_mutex);
+
 	if (icache->shadow_root) {
 		free(icache->shadow_root);
 		icache->shadow_root = NULL; /* Prevent double-free */
 	}
+	free(icache->ino_hash);
+	icache->ino_hash = NULL;
+	icache->ino_hash_size = 0;
 	/* Clean up root inode resources */
 	if (icache->root.fd >= 0)
 		close(icache->root.fd);
-	if (icache->root.name)
+	if (icache->root.flock) {
+		famfs_flock_free(icache->root.flock);
+		icache->root.flock = NULL;
+	}
+	if (icache->root.name && icache->root.name != icache->root.iname)
 		free(icache->root.name);
+	icache->root.name = NULL;
 
 	pthread_mutex_unlock(&icache->mutex);
 	/*
@@ -70,25 +179,291 @@ void famfs_icache_destroy(struct famfs_icache *icache)
 	 */
 }
 
-void famfs_icache_flock(struct famfs_inode *inode)
+/*
+ * flock
+ */
+
+#define FAMFS_FLOCK_POLL_NS 100000000 /* check for interrupts every 100ms */
+
+static uint64_t
+famfs_flock_now_ns(void)
 {
-	struct famfs_icache *icache = inode->icache;
+	struct timespec ts;
 
-	pthread_mutex_lock(&icache->flock_mutex);
-	inode->flock_held = 1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-void famfs_icache_unflock(struct famfs_inode *inode)
+static struct famfs_flock *
+famfs_inode_flock_get(struct famfs_inode *inode)
 {
 	struct famfs_icache *icache = inode->icache;
+	struct famfs_flock *fl;
+
+	pthread_mutex_lock(&icache->mutex);
+	fl = inode->flock;
+	if (!fl) {
+		fl = calloc(1, sizeof(*fl));
+		if (fl) {
+			pthread_condattr_t ca;
+
+			pthread_mutex_init(&fl->mutex, NULL);
+			pthread_condattr_init(&ca);
+			pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+			pthread_cond_init(&fl->cond, &ca);
+			pthread_condattr_destroy(&ca);
+			fl->wait_tail = &fl->wait_head;
+			inode->flock = fl;
+		}
+	}
+	pthread_mutex_unlock(&icache->mutex);
+	return fl;
+}
+
+static void
+famfs_flock_free(struct famfs_flock *fl)
+{
+	while (fl->holders) {
+		struct famfs_flock_holder *h = fl->holders;
+
+		fl->holders = h->next;
+		free(h);
+	}
+	pthread_cond_destroy(&fl->cond);
+	pthread_mutex_destroy(&fl->mutex);
+	free(fl);
+}
+
+static inline int
+famfs_flock_compatible_locked(struct famfs_flock *fl, int excl)
+{
+	if (fl->excl)
+		return 0;
+	return (excl) ? (fl->nshared == 0) : 1;
+}
+
+static void
+famfs_flock_add_holder_locked(
+	struct famfs_flock *fl,
+	struct famfs_flock_holder *h)
+{
+	h->next = fl->holders;
+	fl->holders = h;
+	if (h->excl)
+		fl->excl = 1;
+	else
+		fl->nshared++;
+}
+
+/* Unlink the owner's holder; returns it (or NULL if the owner has no lock) */
+static struct famfs_flock_holder *
+famfs_flock_remove_holder_locked(
+	struct famfs_flock *fl,
+	uint64_t owner)
+{
+	struct famfs_flock_holder **pp;
+
+	for (pp = &fl->holders; *pp; pp = &(*pp)->next) {
+		struct famfs_flock_holder *h = *pp;
 
-	if (!inode->flock_held) {
-		famfs_log(FAMFS_LOG_ERR, "%s: ino %d name %s flock not held\n",
-			  __func__, inode->ino, inode->name);
+		if (h->owner != owner)
+			continue;
+		*pp = h->next;
+		if (h->excl)
+			fl->excl = 0;
+		else
+			fl->nshared--;
+		return h;
+	}
+	return NULL;
+}
+
+/* Grant the head of the wait queue while it is compatible */
+static void
+famfs_flock_grant_locked(struct famfs_flock *fl)
+{
+	int granted = 0;
+
+	while (fl->wait_head &&
+	       famfs_flock_compatible_locked(fl, fl->wait_head->holder->excl)) {
+		struct famfs_flock_waiter *w = fl->wait_head;
+
+		fl->wait_head = w->next;
+		if (!fl->wait_head)
+			fl->wait_tail = &fl->wait_head;
+		famfs_flock_add_holder_locked(fl, w->holder);
+		w->granted = 1;
+		granted++;
+	}
+	if (granted)
+		pthread_cond_broadcast(&fl->cond);
+}
+
+static void
+famfs_flock_unqueue_locked(
+	struct famfs_flock *fl,
+	struct famfs_flock_waiter *w)
+{
+	struct famfs_flock_waiter **pp;
+
+	for (pp = &fl->wait_head; *pp; pp = &(*pp)->next) {
+		if (*pp != w)
+			continue;
+		*pp = w->next;
+		if (!*pp)
+			fl->wait_tail = pp;
 		return;
 	}
-	inode->flock_held = 0;
-	pthread_mutex_unlock(&icache->flock_mutex);
+}
+
+/**
+ * famfs_icache_flock()
+ *
+ * flock(2) semantics on a famfs_inode
+ *
+ * @owner:       lock owner (from fuse_file_info)
+ * @op:          LOCK_SH, LOCK_EX or LOCK_UN, optionally with LOCK_NB
+ * @interrupted: if non-null, polled while blocked; a non-zero return abandons
+ *               the wait with EINTR
+ *
+ * As with flock(2), converting a shared lock to exclusive is not atomic (the
+ * shared lock is dropped first); exclusive to shared is.
+ *
+ * Returns 0 or an errno (EWOULDBLOCK, EINTR, ENOMEM, EINVAL)
+ */
+int
+famfs_icache_flock(
+	struct famfs_inode *inode,
+	uint64_t owner,
+	int op,
+	int (*interrupted)(void *arg),
+	void *arg)
+{
+	struct famfs_icache *icache = inode->icache;
+	struct famfs_flock_waiter w = { 0 };
+	struct famfs_flock_holder *h;
+	struct famfs_flock *fl;
+	int nb = op & LOCK_NB;
+	uint64_t start;
+	int excl;
+
+	op &= ~LOCK_NB;
+	if (op == LOCK_UN) {
+		famfs_icache_flock_release(inode, owner);
+		return 0; /* Unlocking an unlocked file is not an error */
+	}
+	if (op != LOCK_SH && op != LOCK_EX)
+		return EINVAL;
+	excl = (op == LOCK_EX);
+
+	fl = famfs_inode_flock_get(inode);
+	if (!fl)
+		return ENOMEM;
+
+	pthread_mutex_lock(&fl->mutex);
+	h = famfs_flock_remove_holder_locked(fl, owner);
+	if (h) {
+		if (h->excl == excl || h->excl) {
+			/* Same mode, or an (atomic) downgrade */
+			h->excl = excl;
+			famfs_flock_add_holder_locked(fl, h);
+			famfs_flock_grant_locked(fl);
+			pthread_mutex_unlock(&fl->mutex);
+			return 0;
+		}
+		/* Upgrade: the shared lock is gone; others may proceed */
+		famfs_flock_grant_locked(fl);
+	} else {
+		h = calloc(1, sizeof(*h));
+		if (!h) {
+			pthread_mutex_unlock(&fl->mutex);
+			return ENOMEM;
+		}
+		h->owner = owner;
+	}
+	h->excl = excl;
+
+	if (!fl->wait_head && famfs_flock_compatible_locked(fl, excl)) {
+		famfs_flock_add_holder_locked(fl, h);
+		pthread_mutex_unlock(&fl->mutex);
+		__atomic_add_fetch(&icache->flock_acquired, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	if (nb) {
+		pthread_mutex_unlock(&fl->mutex);
+		free(h);
+		__atomic_add_fetch(&icache->flock_wouldblock, 1,
+				   __ATOMIC_RELAXED);
+		return EWOULDBLOCK;
+	}
+
+	/* Queue up and wait our turn */
+	__atomic_add_fetch(&icache->flock_contended, 1, __ATOMIC_RELAXED);
+	start = famfs_flock_now_ns();
+	w.holder = h;
+	*fl->wait_tail = &w;
+	fl->wait_tail = &w.next;
+
+	while (!w.granted) {
+		uint64_t deadline = famfs_flock_now_ns() + FAMFS_FLOCK_POLL_NS;
+		struct timespec ts = {
+			.tv_sec = deadline / 1000000000ULL,
+			.tv_nsec = deadline % 1000000000ULL,
+		};
+
+		pthread_cond_timedwait(&fl->cond, &fl->mutex, &ts);
+		if (w.granted || !interrupted || !interrupted(arg))
+			continue;
+
+		/* Give up; whoever was queued behind us may now proceed */
+		famfs_flock_unqueue_locked(fl, &w);
+		famfs_flock_grant_locked(fl);
+		pthread_mutex_unlock(&fl->mutex);
+		free(h);
+		__atomic_add_fetch(&icache->flock_interrupted, 1,
+				   __ATOMIC_RELAXED);
+		return EINTR;
+	}
+	pthread_mutex_unlock(&fl->mutex);
+
+	__atomic_add_fetch(&icache->flock_wait_ns, famfs_flock_now_ns() - start,
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&icache->flock_acquired, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * famfs_icache_flock_release()
+ *
+ * Drop the lock (if any) held by @owner, and wake whoever can now have it
+ *
+ * Returns 1 if a lock was dropped, else 0
+ */
+int
+famfs_icache_flock_release(
+	struct famfs_inode *inode,
+	uint64_t owner)
+{
+	struct famfs_flock_holder *h;
+	struct famfs_flock *fl;
+	int found;
+
+	pthread_mutex_lock(&inode->icache->mutex);
+	fl = inode->flock;
+	pthread_mutex_unlock(&inode->icache->mutex);
+	if (!fl)
+		return 0;
+
+	pthread_mutex_lock(&fl->mutex);
+	h = famfs_flock_remove_holder_locked(fl, owner);
+	found = (h != NULL);
+	if (found)
+		famfs_flock_grant_locked(fl);
+	pthread_mutex_unlock(&fl->mutex);
+
+	free(h);
+	return found;
 }
 
 void dump_inode(const char *caller, struct famfs_inode *inode, int loglevel)
@@ -104,9 +479,9 @@ void dump_inode(const char *caller, struct famfs_inode *inode, int loglevel)
 		  (inode->parent) ? inode->parent->ino : 0,
 		  inode->pinned,
 		  inode->name);
-	if (inode->ftype == FAMFS_FDIR && inode->fmeta)
-		famfs_log(FAMFS_LOG_ERR, "%s: dir inode has fmeta %p\n",
-			  __func__, inode->fmeta);
+	if (inode->ftype == FAMFS_FDIR && inode->fmap)
+		famfs_log(FAMFS_LOG_ERR, "%s: dir inode has fmap %p\n",
+			  __func__, inode->fmap);
 }
 
 void dump_icache(struct famfs_icache *icache, int loglevel)
@@ -128,8 +503,245 @@ void dump_icache(struct famfs_icache *icache, int loglevel)
 }
 
 /*
- * Move to new: famfs_icache.c
+ * Compact fmaps
+ */
+
+/**
+ * famfs_cfmap_alloc()
+ *
+ * Make a compact copy of the fmap in @fmeta
+ *
+ * Returns the cfmap (which must be freed), or NULL
+ */
+struct famfs_cfmap *
+famfs_cfmap_alloc(const struct famfs_log_file_meta *fmeta)
+{
+	const struct famfs_log_fmap *lf = &fmeta->fm_fmap;
+	const struct famfs_simple_extent *src;
+	struct famfs_cfmap *cf;
+	u64 chunk_size = 0;
+	u32 n;
+
+	switch (lf->fmap_ext_type) {
+	case FAMFS_EXT_SIMPLE:
+		n = lf->fmap_nextents;
+		if (n > FAMFS_MAX_SIMPLE_EXTENTS)
+			return NULL;
+		src = lf->se;
+		break;
+	case FAMFS_EXT_INTERLEAVE:
+		if (lf->fmap_niext != 1) /* FAMFS_MAX_INTERLEAVED_EXTENTS */
+			return NULL;
+		n = lf->ie[0].ie_nstrips;
+		if (n > FAMFS_MAX_SIMPLE_EXTENTS)
+			return NULL;
+		src = lf->ie[0].ie_strips;
+		chunk_size = lf->ie[0].ie_chunk_size;
+		break;
+	default:
+		return NULL;
+	}
+
+	cf = malloc(sizeof(*cf) + n * sizeof(cf->ext[0]));
+	if (!cf)
+		return NULL;
+
+	cf->size = fmeta->fm_size;
+	cf->ext_type = lf->fmap_ext_type;
+	cf->nextents = n;
+	cf->chunk_size = chunk_size;
+	memcpy(cf->ext, src, n * sizeof(cf->ext[0]));
+	return cf;
+}
+
+/**
+ * famfs_cfmap_to_fmeta()
+ *
+ * Expand a compact fmap back into a famfs_log_file_meta (e.g. for
+ * famfs_log_file_meta_to_msg()). The relpath is not kept, so it is empty.
+ *
+ * @attr: if non-null, supplies the uid, gid and mode
+ */
+int
+famfs_cfmap_to_fmeta(
+	const struct famfs_cfmap *cf,
+	const struct stat *attr,
+	struct famfs_log_file_meta *fmeta)
+{
+	struct famfs_log_fmap *lf = &fmeta->fm_fmap;
+
+	memset(fmeta, 0, sizeof(*fmeta));
+	if (cf->nextents > FAMFS_MAX_SIMPLE_EXTENTS)
+		return -EINVAL;
+
+	fmeta->fm_size = cf->size;
+	if (attr) {
+		fmeta->fm_uid = attr->st_uid;
+		fmeta->fm_gid = attr->st_gid;
+		fmeta->fm_mode = attr->st_mode;
+	}
+	lf->fmap_ext_type = cf->ext_type;
+
+	switch (cf->ext_type) {
+	case FAMFS_EXT_SIMPLE:
+		lf->fmap_nextents = cf->nextents;
+		memcpy(lf->se, cf->ext, cf->nextents * sizeof(cf->ext[0]));
+		break;
+	case FAMFS_EXT_INTERLEAVE:
+		lf->fmap_niext = 1;
+		lf->ie[0].ie_nstrips = cf->nextents;
+		lf->ie[0].ie_chunk_size = cf->chunk_size;
+		memcpy(lf->ie[0].ie_strips, cf->ext,
+		       cf->nextents * sizeof(cf->ext[0]));
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * famfs_cfmap_map_range()
+ *
+ * Translate the file range [@off, @off + @len) into the memory that backs it,
+ * where @base is the start of a mapping of the whole dax device. The range is
+ * clamped to the file size.
+ *
+ * @dev_size: size of the device mapping (every range must be within it)
+ * @iov:      out: one iovec per contiguous piece of the range
+ * @maxiov:   size of @iov; if it is too small, a prefix of the range is mapped
+ * @mapped:   out: number of bytes mapped (0 at or beyond EOF)
+ *
+ * Returns the number of iovecs used, or a negative errno if the fmap is
+ * invalid or refers to a device other than the primary
+ */
+int
+famfs_cfmap_map_range(
+	const struct famfs_cfmap *cf,
+	char *base,
+	u64 dev_size,
+	u64 off,
+	size_t len,
+	struct iovec *iov,
+	int maxiov,
+	size_t *mapped)
+{
+	u64 end = (off + len > cf->size) ? cf->size : off + len;
+	int n = 0;
+
+	*mapped = 0;
+	while (off < end && n < maxiov) {
+		const struct famfs_simple_extent *se = NULL;
+		u64 ext_off = 0;   /* offset within the extent / strip */
+		u64 seg;
+		u32 i;
+
+		if (cf->ext_type == FAMFS_EXT_SIMPLE) {
+			u64 pos = 0;
+
+			for (i = 0; i < cf->nextents; i++) {
+				if (off < pos + cf->ext[i].se_len) {
+					se = &cf->ext[i];
+					ext_off = off - pos;
+					break;
+				}
+				pos += cf->ext[i].se_len;
+			}
+			if (!se)
+				return -EINVAL; /* extents shorter than size */
+			seg = se->se_len - ext_off;
+		} else if (cf->ext_type == FAMFS_EXT_INTERLEAVE) {
+			u64 chunk_num, stripe;
+
+			if (!cf->chunk_size || !cf->nextents)
+				return -EINVAL;
+			chunk_num = off / cf->chunk_size;
+			stripe = chunk_num / cf->nextents;
+			se = &cf->ext[chunk_num % cf->nextents];
+			ext_off = stripe * cf->chunk_size + off % cf->chunk_size;
+			if (ext_off >= se->se_len)
+				return -EINVAL;
+			seg = cf->chunk_size - off % cf->chunk_size;
+		} else {
+			return -EINVAL;
+		}
+
+		if (se->se_devindex != 0)
+			return -EINVAL; /* XXX multi-device */
+		if (seg > end - off)
+			seg = end - off;
+		if (se->se_offset + ext_off + seg > dev_size)
+			return -EINVAL;
+
+		/* Merge with the previous piece if it is contiguous */
+		if (n && (char *)iov[n - 1].iov_base + iov[n - 1].iov_len ==
+		    base + se->se_offset + ext_off) {
+			iov[n - 1].iov_len += seg;
+		} else {
+			iov[n].iov_base = base + se->se_offset + ext_off;
+			iov[n].iov_len = seg;
+			n++;
+		}
+		off += seg;
+		*mapped += seg;
+	}
+	return n;
+}
+
+/*
+ * Inode slabs
+ *
+ * famfs_inodes are carved out of slabs of FAMFS_INODE_SLAB_COUNT and
+ * recycled through a free list; slabs are only freed when the icache is
+ * destroyed. Besides avoiding malloc overhead and scattering, this means the
+ * memory at a stale nodeid is always a famfs_inode (with a null icache
+ * pointer once freed), which is what famfs_get_inode_from_nodeid() checks.
  */
+static struct famfs_inode *
+famfs_inode_slab_get(struct famfs_icache *icache)
+{
+	struct famfs_inode *inode;
+
+	pthread_mutex_lock(&icache->slab_mutex);
+	if (!icache->free_inodes) {
+		struct famfs_inode_slab *slab;
+		int i;
+
+		slab = aligned_alloc(FAMFS_CACHELINE, sizeof(*slab));
+		if (!slab) {
+			pthread_mutex_unlock(&icache->slab_mutex);
+			return NULL;
+		}
+		slab->next = icache->slabs;
+		icache->slabs = slab;
+		icache->nslabs++;
+		for (i = FAMFS_INODE_SLAB_COUNT - 1; i >= 0; i--) {
+			slab->inodes[i].icache = NULL;
+			slab->inodes[i].next = icache->free_inodes;
+			icache->free_inodes = &slab->inodes[i];
+		}
+	}
+	inode = icache->free_inodes;
+	icache->free_inodes = inode->next;
+	pthread_mutex_unlock(&icache->slab_mutex);
+
+	memset(inode, 0, sizeof(*inode));
+	return inode;
+}
+
+static void
+famfs_inode_slab_put(
+	struct famfs_icache *icache,
+	struct famfs_inode *inode)
+{
+	inode->icache = NULL;
+	inode->refcount = 0;
+
+	pthread_mutex_lock(&icache->slab_mutex);
+	inode->next = icache->free_inodes;
+	icache->free_inodes = inode;
+	pthread_mutex_unlock(&icache->slab_mutex);
+}
 
 struct famfs_inode *
 famfs_inode_alloc(
@@ -144,26 +756,47 @@ famfs_inode_alloc(
 	struct famfs_inode *parent)
 {
 	struct famfs_inode *inode;
+	size_t namelen = strlen(name);
 
-	inode = calloc(1, sizeof(*inode));
+	inode = famfs_inode_slab_get(icache);
 	if (!inode)
 		return NULL;
 
+	if (namelen < FAMFS_INODE_INAME_LEN) {
+		memcpy(inode->iname, name, namelen + 1);
+		inode->name = inode->iname;
+	} else {
+		inode->name = strdup(name);
+		if (!inode->name)
+			goto err_out;
+	}
+
+	/* The caller still owns fmeta; we keep a compact copy */
+	if (fmeta) {
+		inode->fmap = famfs_cfmap_alloc(fmeta);
+		if (!inode->fmap)
+			goto err_out;
+	}
+
 	inode->icache = (void *)icache;
 	inode->refcount = 1;
 
 	inode->fd = fd;
 	inode->ino = inode_num;
 	inode->dev = dev;
-	inode->fmeta = fmeta;
 	inode->attr = *attrp;
 	inode->ftype = ftype;
-	inode->name = strdup(name);
 	inode->parent = parent;
 
 	/* Ref will be put on parent when the inode is inserted into icache */
 
 	return inode;
+
+err_out:
+	if (inode->name != inode->iname)
+		free(inode->name);
+	famfs_inode_slab_put(icache, inode);
+	return NULL;
 }
 
 /**
@@ -175,7 +808,6 @@ struct famfs_inode *
 famfs_icache_find_get_from_ino_locked(
 	struct famfs_icache *icache, uint64_t ino)
 {
-	/* TODO: replace this lookup mechanism with Bernd's wbtree lookup code */
 	struct famfs_inode *p;
 	struct famfs_inode *inode = NULL;
 
@@ -186,8 +818,8 @@ famfs_icache_find_get_from_ino_locked(
 	}
 
 	icache->search_count++;
-	for (p = icache->root.next; p != &icache->root; p = p->next) {
-		/* Nodeid is the address of the entry we're looking for */
+	for (p = icache->ino_hash[famfs_ino_hash(icache, ino)]; p;
+	     p = p->hnext) {
 		icache->nodes_scanned++;
 		if (p->ino == ino) {
 			FAMFS_ASSERT(__func__, p->refcount > 0 || p->pinned);
@@ -220,10 +852,8 @@ famfs_icache_insert_locked(
 	struct famfs_icache *icache,
 	struct famfs_inode *inode)
 {
-	/* TODO make this an insertion sort that aborts if the
-	 * inode number is already present. That makes insertion
-	 * "order n", but lookup is still order 1 because the nodeid is
-	 * the address of the famfs_inode
+	/* Caller must have checked (under the same hold of the mutex) that
+	 * the inode number is not already present
 	 */
 	struct famfs_inode *prev, *next;
 
@@ -246,6 +876,21 @@ famfs_icache_insert_locked(
 	famfs_inode_getref_locked(inode->parent);
 
 	icache->count++;
+	famfs_icache_hash_insert_locked(icache, inode);
+}
+
+/* Release everything an inode holds, except its slab slot */
+static void
+famfs_inode_free_contents(struct famfs_inode *inode)
+{
+	if (inode->fd > 0)
+		close(inode->fd);
+	free(inode->fmap);
+	free(inode->fmap_msg);
+	if (inode->flock)
+		famfs_flock_free(inode->flock);
+	if (inode->name != inode->iname)
+		free(inode->name);
 }
 
 void
@@ -254,46 +899,108 @@ famfs_inode_free(struct famfs_inode *inode)
 	if (inode->ino == FUSE_ROOT_ID)
 		return;
 
-	if (inode->fd > 0)
-		close(inode->fd);
-	if (inode->fmeta)
-		free(inode->fmeta);
-	if (inode->name)
-		free(inode->name);
-	free(inode);
+	famfs_inode_free_contents(inode);
+	famfs_inode_slab_put(inode->icache, inode);
 }
 
-void famfs_inode_putref_locked(struct famfs_inode *inode, uint64_t count)
+/*
+ * Free a list (linked through ->next) of released inodes, returning them
+ * to the slabs with one slab_mutex hold. This does not need the icache
+ * mutex.
+ *
+ * Returns the number of inodes freed
+ */
+static size_t
+famfs_inode_free_list(
+	struct famfs_icache *icache,
+	struct famfs_inode *list)
 {
-	FAMFS_ASSERT(__func__, inode);
-	FAMFS_ASSERT(__func__, inode->refcount >= count);
-	inode->refcount -= count;
-
-	if (!inode->refcount && !inode->pinned && inode->ino != FUSE_ROOT_ID) {
-		struct famfs_inode *prev, *next;
+	struct famfs_inode *inode, *next, *rev = NULL, *last = NULL;
+	size_t n = 0;
 
-		prev = inode->prev;
+	/* @list is in reverse release order; the slot released first goes
+	 * on top of the free list (and is reused first), as it would if each
+	 * inode were freed with famfs_inode_free() when released */
+	for (inode = list; inode; inode = next) {
 		next = inode->next;
-		next->prev = prev;
-		prev->next = next;
-		inode->icache->count--;
+		famfs_inode_free_contents(inode);
 		inode->icache = NULL;
+		inode->refcount = 0;
+		inode->next = rev;
+		rev = inode;
+		if (!last)
+			last = inode;
+		n++;
+	}
+	if (!last)
+		return 0;
 
-		if (inode->parent)
-			famfs_inode_putref_locked(inode->parent, 1);
+	pthread_mutex_lock(&icache->slab_mutex);
+	last->next = icache->free_inodes;
+	icache->free_inodes = rev;
+	pthread_mutex_unlock(&icache->slab_mutex);
+	return n;
+}
 
-		inode->parent = 0;
-		famfs_inode_free(inode);
+/*
+ * Drop @count refs on an inode. If that releases it, unlink it from the
+ * icache and push it onto @freelist, and drop the ref it held on its
+ * parent (which may release the parent too, and so on up the tree).
+ *
+ * A released inode has refcount 0 and is not hashed, so it can no longer
+ * be found by nodeid or by ino, and it can be freed after the icache mutex
+ * is dropped.
+ */
+static void
+famfs_inode_release_locked(
+	struct famfs_inode *inode,
+	uint64_t count,
+	struct famfs_inode **freelist)
+{
+	while (inode) {
+		struct famfs_inode *parent;
+
+		FAMFS_ASSERT(__func__, inode->refcount >= count);
+		inode->refcount -= count;
+		if (inode->refcount || inode->pinned ||
+		    inode->ino == FUSE_ROOT_ID)
+			return;
+
+		inode->next->prev = inode->prev;
+		inode->prev->next = inode->next;
+		famfs_icache_hash_remove_locked(inode->icache, inode);
+		inode->icache->count--;
+
+		parent = inode->parent;
+		inode->parent = NULL;
+		inode->next = *freelist;
+		*freelist = inode;
+
+		inode = parent;
+		count = 1;
 	}
-};
+}
+
+void famfs_inode_putref_locked(struct famfs_inode *inode, uint64_t count)
+{
+	struct famfs_icache *icache;
+	struct famfs_inode *freelist = NULL;
+
+	FAMFS_ASSERT(__func__, inode);
+	icache = inode->icache;
+	famfs_inode_release_locked(inode, count, &freelist);
+	famfs_inode_free_list(icache, freelist);
+}
 
 void famfs_inode_putref(
 	struct famfs_inode *inode)
 {
-	FAMFS_ASSERT(__func__, inode->icache);
-	pthread_mutex_lock(&inode->icache->mutex);
-	famfs_inode_putref_locked(inode, 1);
-	pthread_mutex_unlock(&inode->icache->mutex);
+	struct famfs_icache *icache = inode->icache;
+
+	FAMFS_ASSERT(__func__, icache);
+	pthread_mutex_lock(&icache->mutex);
+	famfs_inode_putref_locked(inode, 1); /* may free the inode */
+	pthread_mutex_unlock(&icache->mutex);
 }
 
 void
@@ -316,8 +1023,9 @@ famfs_icache_unref_inode(
 	pthread_mutex_unlock(&icache->mutex);
 }
 
-struct famfs_inode *
-famfs_get_inode_from_nodeid_locked(
+/* Resolve a nodeid to a live inode (without getting a ref) */
+static struct famfs_inode *
+famfs_nodeid_to_inode_locked(
 	struct famfs_icache *icache,
 	fuse_ino_t nodeid)
 {
@@ -328,15 +1036,73 @@ famfs_get_inode_from_nodeid_locked(
 	else
 		inode = (struct famfs_inode *)(uintptr_t)nodeid;
 
-	if ((inode->icache != icache) || (inode->refcount < 1)) {
-		inode = NULL;
-		goto unlock_out;
-	}
-unlock_out:
+	if ((inode->icache != icache) || (inode->refcount < 1))
+		return NULL;
+	return inode;
+}
+
+struct famfs_inode *
+famfs_get_inode_from_nodeid_locked(
+	struct famfs_icache *icache,
+	fuse_ino_t nodeid)
+{
+	struct famfs_inode *inode;
+
+	inode = famfs_nodeid_to_inode_locked(icache, nodeid);
 	famfs_inode_getref_locked(inode);
 	return inode;
 }
 
+/**
+ * famfs_icache_forget()
+ *
+ * Drop the kernel's lookup refs for a batch of nodeids (FORGET and
+ * BATCH_FORGET)
+ *
+ * The refs are dropped under one hold of the icache mutex per
+ * FAMFS_FORGET_BATCH entries (so a huge batch doesn't stall other requests
+ * for long), and the released inodes and parents are freed after the mutex
+ * is dropped.
+ *
+ * Returns the number of inodes freed
+ */
+size_t
+famfs_icache_forget(
+	struct famfs_icache *icache,
+	const struct fuse_forget_data *forgets,
+	size_t count)
+{
+	size_t i = 0, nfreed = 0;
+
+	while (i < count) {
+		size_t end = (count - i > FAMFS_FORGET_BATCH)
+			? i + FAMFS_FORGET_BATCH : count;
+		struct famfs_inode *freelist = NULL;
+
+		pthread_mutex_lock(&icache->mutex);
+		for (; i < end; i++) {
+			struct famfs_inode *inode;
+
+			inode = famfs_nodeid_to_inode_locked(icache,
+							     forgets[i].ino);
+			if (!inode || inode->refcount < forgets[i].nlookup) {
+				famfs_log(FAMFS_LOG_ERR,
+					  "%s: bad forget nodeid=%llx "
+					  "nlookup=%lld\n", __func__,
+					  (u64)forgets[i].ino,
+					  (u64)forgets[i].nlookup);
+				continue;
+			}
+			famfs_inode_release_locked(inode, forgets[i].nlookup,
+						   &freelist);
+		}
+		pthread_mutex_unlock(&icache->mutex);
+
+		nfreed += famfs_inode_free_list(icache, freelist);
+	}
+	return nfreed;
+}
+
 /**
  * famfs_get_inode_from_nodeid()
  *
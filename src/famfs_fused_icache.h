@@ -20,6 +20,7 @@
 #include <pthread.h>
 #include <sys/file.h>
 #include <sys/xattr.h>
+#include <sys/uio.h>
 #include <systemd/sd-journal.h>
 
 #include <fuse_lowlevel.h>
@@ -35,25 +36,94 @@ enum famfs_fuse_ftype {
 /* flags */
 
 #define FAMFS_ROOTDIR 1
+#define FAMFS_PRELOADED 2 /* holds a preload ref (icache mutex) */
 
 struct famfs_icache;
 
+/*
+ * Per-inode flock state (allocated on first use)
+ *
+ * Locks are held by lock owners (the kernel's lock_owner for the open file),
+ * in shared or exclusive mode. Blocked lockers queue in FIFO order, and the
+ * head of the queue is granted as soon as it is compatible (consecutive
+ * shared waiters are granted together). A new locker never jumps the queue,
+ * so writers are not starved by a stream of readers.
+ */
+struct famfs_flock_holder {
+	struct famfs_flock_holder *next;
+	uint64_t owner;
+	int excl;
+};
+
+struct famfs_flock_waiter {
+	struct famfs_flock_waiter *next;
+	struct famfs_flock_holder *holder; /* linked into holders when granted */
+	int granted;
+};
+
+struct famfs_flock {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct famfs_flock_holder *holders;
+	uint32_t nshared;
+	int excl;                          /* an exclusive lock is held */
+	struct famfs_flock_waiter *wait_head;
+	struct famfs_flock_waiter **wait_tail;
+};
+
+/*
+ * Compact fmap
+ *
+ * struct famfs_log_file_meta (the log entry format) has room for the largest
+ * possible fmap plus the relative path, most of which is unused by a typical
+ * file. Cached inodes keep only the extents that exist. For interleaved
+ * fmaps, ext[] holds the strips of the (single) interleaved extent.
+ */
+struct famfs_cfmap {
+	u64 size;                          /* file size */
+	u32 ext_type;                      /* enum famfs_log_ext_type */
+	u32 nextents;                      /* extents, or strips if interleaved */
+	u64 chunk_size;                    /* interleaved only */
+	struct famfs_simple_extent ext[];
+};
+
+#define FAMFS_CACHELINE 64
+#define FAMFS_INODE_INAME_LEN 48           /* names this short are inline */
+#define FAMFS_INODE_SLAB_COUNT 256         /* inodes per slab */
+#define FAMFS_FORGET_BATCH 1024            /* forgets per icache mutex hold */
+
+/*
+ * The fields used by hash lookups and nodeid validation come first, so they
+ * share one cache line. famfs_inodes come from slabs (see
+ * famfs_inode_alloc()) and are cache line aligned.
+ */
 struct famfs_inode {
-	struct famfs_inode *next;          /* protected by lo->mutex */
-	struct famfs_inode *prev;          /* protected by lo->mutex */
-	int fd;                            /* fd must be closed if > 0 */
+	struct famfs_inode *hnext;         /* ino hash chain (icache mutex) */
 	ino_t ino;
-	dev_t dev;
-	int flags;
 	uint64_t refcount;                 /* protected by lo->mutex */
 	struct famfs_icache *icache;
-	struct famfs_log_file_meta *fmeta; /* fmeta must be freed */
-	struct stat attr;
-	int pinned;      /* We pin in the cache if attrs have been mutated */
+	int flags;
 	enum famfs_fuse_ftype ftype;
+	int fd;                            /* fd must be closed if > 0 */
+	int pinned;      /* We pin in the cache if attrs have been mutated */
 	struct famfs_inode *parent;        /* parent ref must be dropped */
-	char *name;                        /* name must be freed */
-	int flock_held;
+	char *name;                        /* iname, or must be freed */
+
+	/* Colder fields */
+	struct famfs_cfmap *fmap;          /* files only (icache mutex) */
+	void *fmap_msg;                    /* serialized fmap (icache mutex) */
+	size_t fmap_msg_size;
+	struct famfs_inode *next;          /* protected by lo->mutex */
+	struct famfs_inode *prev;          /* protected by lo->mutex */
+	dev_t dev;
+	struct famfs_flock *flock;         /* alloc'd on first flock */
+	struct stat attr;
+	char iname[FAMFS_INODE_INAME_LEN];
+} __attribute__((aligned(FAMFS_CACHELINE)));
+
+struct famfs_inode_slab {
+	struct famfs_inode_slab *next;
+	struct famfs_inode inodes[FAMFS_INODE_SLAB_COUNT];
 };
 
 struct famfs_icache {
@@ -62,11 +132,25 @@ struct famfs_icache {
 	uint64_t count;
 	char *shadow_root;
 	void *owner;
-	pthread_mutex_t flock_mutex; /* only one flock per file system!! */
+
+	struct famfs_inode **ino_hash; /* inodes hashed by ino */
+	uint64_t ino_hash_size;        /* number of buckets (power of 2) */
+
+	pthread_mutex_t slab_mutex;
+	struct famfs_inode_slab *slabs;   /* all slabs (freed at destroy) */
+	struct famfs_inode *free_inodes;  /* free list, linked by ->next */
+	uint64_t nslabs;
 
 	uint64_t search_count;   /* How many times did we find_get an inode */
 	uint64_t nodes_scanned;  /* how many nodes scanned in find_get ops */
 	uint64_t search_fail_ct; /* How many searches failed */
+
+	/* flock stats (atomic) */
+	uint64_t flock_acquired;    /* locks granted */
+	uint64_t flock_contended;   /* lockers that had to wait */
+	uint64_t flock_wouldblock;  /* LOCK_NB requests that failed */
+	uint64_t flock_interrupted; /* waits interrupted by a signal */
+	uint64_t flock_wait_ns;     /* total time spent waiting */
 };
 
 static inline uint64_t
@@ -96,6 +180,9 @@ void dump_icache(struct famfs_icache *icache, int loglevel);
 
 struct famfs_inode *famfs_get_inode_from_nodeid(
 	struct famfs_icache *icache, fuse_ino_t nodeid);
+size_t famfs_icache_forget(struct famfs_icache *icache,
+			   const struct fuse_forget_data *forgets,
+			   size_t count);
 struct famfs_inode *famfs_get_inode_from_nodeid_locked(
 	struct famfs_icache *icache, fuse_ino_t nodeid);
 
@@ -111,6 +198,15 @@ static inline void famfs_inode_getref_locked(struct famfs_inode *inode)
 };
 void famfs_inode_free(struct famfs_inode *inode);
 
+struct famfs_cfmap *famfs_cfmap_alloc(
+	const struct famfs_log_file_meta *fmeta);
+int famfs_cfmap_to_fmeta(const struct famfs_cfmap *cf,
+			 const struct stat *attr,
+			 struct famfs_log_file_meta *fmeta);
+int famfs_cfmap_map_range(const struct famfs_cfmap *cf, char *base,
+			  u64 dev_size, u64 off, size_t len,
+			  struct iovec *iov, int maxiov, size_t *mapped);
+
 static inline void famfs_inode_getref(
 	struct famfs_icache *icache,
 	struct famfs_inode *inode)
@@ -123,7 +219,8 @@ static inline void famfs_inode_getref(
 void famfs_inode_putref_locked(struct famfs_inode *inode, uint64_t count);
 void famfs_inode_putref(struct famfs_inode *inode);
 
-void famfs_icache_flock(struct famfs_inode *inode);
-void famfs_icache_unflock(struct famfs_inode *inode);
+int famfs_icache_flock(struct famfs_inode *inode, uint64_t owner, int op,
+		       int (*interrupted)(void *arg), void *arg);
+int famfs_icache_flock_release(struct famfs_inode *inode, uint64_t owner);
 
 #endif /* FAMFS_FUSED_ICACHE */
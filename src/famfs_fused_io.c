@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION FUSE_MAKE_VERSION(3, 12)
+
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/param.h> /* MIN()/MAX() */
+
+#include "famfs_lib.h"
+#include "famfs_log.h"
+#include "famfs_fused.h"
+#include "famfs_fused_icache.h"
+#include "famfs_fused_io.h"
+#include "libfcc.h"
+
+/*
+ * User space data path
+ *
+ * With a DAX_FMAP-capable kernel, famfs file data never passes through
+ * famfs_fused: the kernel gets each file's fmap (GET_FMAP) and maps the
+ * dax device directly. On other kernels, the fuse READ and WRITE requests
+ * come here instead. We map the whole dax device (or the backing file in
+ * dummy mode) once, translate file offsets through the inode's fmap, and
+ * reply with buffers that point into the mapping, so reads are not copied
+ * in user space.
+ *
+ * This is enabled by -o user_io, or automatically (the default) when the
+ * kernel does not support DAX_FMAP. Files cannot be extended this way;
+ * writes are clamped to the allocated size of the file.
+ */
+
+#define FAMFS_IO_MAX_IOV 64
+
+/**
+ * famfs_dax_map()
+ *
+ * Map the dax device (lo->daxdev) for the user space data path
+ *
+ * Returns 0 or a negative errno
+ */
+int
+famfs_dax_map(struct famfs_ctx *lo)
+{
+	struct stat st;
+	size_t size;
+	void *addr;
+	int prot = PROT_READ | PROT_WRITE;
+	int fd;
+	int rc;
+
+	if (lo->dax_base)
+		return 0;
+	if (!lo->daxdev) {
+		famfs_log(FAMFS_LOG_ERR, "%s: no daxdev\n", __func__);
+		return -EINVAL;
+	}
+
+	fd = open(lo->daxdev, O_RDWR);
+	if (fd < 0) {
+		/* Read-only access is better than none */
+		prot = PROT_READ;
+		fd = open(lo->daxdev, O_RDONLY);
+	}
+	if (fd < 0) {
+		rc = -errno;
+		famfs_log(FAMFS_LOG_ERR, "%s: open(%s) failed (%d)\n",
+			  __func__, lo->daxdev, rc);
+		return rc;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		goto out_close;
+	}
+	if (S_ISREG(st.st_mode)) {
+		size = st.st_size; /* Dummy mode: a regular backing file */
+	} else {
+		rc = famfs_get_device_size(lo->daxdev, &size, true, 0);
+		if (rc)
+			goto out_close;
+	}
+
+	addr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		rc = -errno;
+		famfs_log(FAMFS_LOG_ERR, "%s: mmap(%s, %ld) failed (%d)\n",
+			  __func__, lo->daxdev, size, rc);
+		goto out_close;
+	}
+
+	lo->dax_base = addr;
+	lo->dax_size = size;
+	lo->dax_writable = (prot & PROT_WRITE) ? 1 : 0;
+	famfs_log(FAMFS_LOG_NOTICE, "%s: mapped %s (%ld bytes, %s)\n",
+		  __func__, lo->daxdev, size,
+		  (lo->dax_writable) ? "read/write" : "read-only");
+	rc = 0;
+
+out_close:
+	close(fd); /* The mapping doesn't need the fd */
+	return rc;
+}
+
+void
+famfs_dax_unmap(struct famfs_ctx *lo)
+{
+	if (!lo->dax_base)
+		return;
+	munmap(lo->dax_base, lo->dax_size);
+	lo->dax_base = NULL;
+	lo->dax_size = 0;
+}
+
+/*
+ * Get the file inode for a read or write, and map the range
+ *
+ * Returns the number of iovecs (0 at EOF) with a ref on *inodep, or a
+ * negative errno
+ */
+static int
+famfs_io_map(
+	struct famfs_ctx *lo,
+	fuse_ino_t nodeid,
+	off_t off,
+	size_t size,
+	struct iovec *iov,
+	size_t *mapped,
+	struct famfs_inode **inodep)
+{
+	struct famfs_inode *inode;
+	int n;
+
+	*inodep = NULL;
+	if (!lo->dax_base)
+		return -ENOSYS;
+	if (off < 0)
+		return -EINVAL;
+
+	inode = famfs_get_inode_from_nodeid(&lo->icache, nodeid);
+	if (!inode)
+		return -EINVAL;
+	if (inode->ftype != FAMFS_FREG) {
+		famfs_inode_putref(inode);
+		return -EISDIR;
+	}
+
+	/* The fmap can only be replaced under the mutex */
+	pthread_mutex_lock(&lo->icache.mutex);
+	if (inode->fmap)
+		n = famfs_cfmap_map_range(inode->fmap, lo->dax_base,
+					  lo->dax_size, off, size, iov,
+					  FAMFS_IO_MAX_IOV, mapped);
+	else
+		n = -EIO;
+	pthread_mutex_unlock(&lo->icache.mutex);
+
+	if (n < 0) {
+		famfs_log(FAMFS_LOG_ERR, "%s: ino=%ld bad fmap (%d)\n",
+			  __func__, inode->ino, n);
+		famfs_inode_putref(inode);
+		return -EIO;
+	}
+	*inodep = inode;
+	return n;
+}
+
+void
+famfs_read(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	size_t size,
+	off_t off,
+	struct fuse_file_info *fi)
+{
+	struct famfs_ctx *lo = fuse_req_userdata(req);
+	struct iovec iov[FAMFS_IO_MAX_IOV];
+	struct famfs_inode *inode;
+	size_t mapped;
+	int n;
+
+	(void)fi;
+
+	n = famfs_io_map(lo, nodeid, off, size, iov, &mapped, &inode);
+	if (n < 0)
+		return (void) famfs_reply_err(req, -n);
+
+	/* Another host may have written this memory since we last cached it */
+	invalidate_processor_cache_v(iov, n);
+
+	if (n <= 1) {
+		struct fuse_bufvec bv = FUSE_BUFVEC_INIT(mapped);
+
+		/* One piece (the usual case) is sent straight from the
+		 * mapping */
+		bv.buf[0].mem = (n) ? iov[0].iov_base : NULL;
+		fuse_reply_data(req, &bv, FUSE_BUF_NO_SPLICE);
+	} else {
+		/* fuse_reply_data() would copy a multi-buffer vector */
+		fuse_reply_iov(req, iov, n);
+	}
+
+	/* Files are never truncated or freed while mounted, so the mapped
+	 * memory stays valid after we drop the ref */
+	famfs_inode_putref(inode);
+}
+
+void
+famfs_write_buf(
+	fuse_req_t req,
+	fuse_ino_t nodeid,
+	struct fuse_bufvec *bufv,
+	off_t off,
+	struct fuse_file_info *fi)
+{
+	struct famfs_ctx *lo = fuse_req_userdata(req);
+	size_t size = fuse_buf_size(bufv);
+	struct iovec iov[FAMFS_IO_MAX_IOV];
+	struct fuse_bufvec *dst;
+	struct famfs_inode *inode;
+	size_t mapped;
+	ssize_t res;
+	int n, i;
+
+	(void)fi;
+
+	if (lo->dax_base && !lo->dax_writable)
+		return (void) famfs_reply_err(req, EROFS);
+
+	n = famfs_io_map(lo, nodeid, off, size, iov, &mapped, &inode);
+	if (n < 0)
+		return (void) famfs_reply_err(req, -n);
+	if (n == 0) {
+		famfs_inode_putref(inode);
+		/* famfs files can't grow */
+		if (size)
+			return (void) famfs_reply_err(req, EFBIG);
+		return (void) fuse_reply_write(req, 0);
+	}
+
+	dst = calloc(1, sizeof(*dst) + (n - 1) * sizeof(dst->buf[0]));
+	if (!dst) {
+		famfs_inode_putref(inode);
+		return (void) famfs_reply_err(req, ENOMEM);
+	}
+	dst->count = n;
+	for (i = 0; i < n; i++) {
+		dst->buf[i].mem = iov[i].iov_base;
+		dst->buf[i].size = iov[i].iov_len;
+		dst->buf[i].fd = -1;
+	}
+
+	res = fuse_buf_copy(dst, bufv, 0);
+	free(dst);
+
+	/* Write back what was stored, so other hosts can see it */
+	if (res > 0) {
+		size_t left = res;
+
+		for (i = 0; i < n && left; i++) {
+			iov[i].iov_len = MIN(iov[i].iov_len, left);
+			left -= iov[i].iov_len;
+		}
+		flush_processor_cache_v(iov, i);
+	}
+	famfs_inode_putref(inode);
+
+	if (res < 0)
+		famfs_reply_err(req, -res);
+	else
+		fuse_reply_write(req, (size_t)res);
+}
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_IO
+#define _H_FAMFS_FUSED_IO
+
+#include <fuse_lowlevel.h>
+
+struct famfs_ctx;
+
+int famfs_dax_map(struct famfs_ctx *lo);
+void famfs_dax_unmap(struct famfs_ctx *lo);
+
+void famfs_read(fuse_req_t req, fuse_ino_t nodeid, size_t size, off_t off,
+		struct fuse_file_info *fi);
+void famfs_write_buf(fuse_req_t req, fuse_ino_t nodeid,
+		     struct fuse_bufvec *bufv, off_t off,
+		     struct fuse_file_info *fi);
+
+#endif /* _H_FAMFS_FUSED_IO */
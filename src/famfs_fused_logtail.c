@@ -0,0 +1,535 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION FUSE_MAKE_VERSION(3, 12)
+
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "famfs_lib.h"
+#include "famfs_lib_internal.h"
+#include "famfs_meta.h"
+#include "famfs_log.h"
+#include "libfcc.h"
+#include "famfs_fused.h"
+#include "famfs_fused_icache.h"
+#include "famfs_fused_logtail.h"
+
+/*
+ * Log tailing
+ *
+ * Without this, a file created on the master becomes visible on a client
+ * only after somebody runs logplay into the shadow tree, and the kernel
+ * relies on entry timeouts to notice. With log tailing enabled
+ * (-o logtail), a thread polls the famfs_log_next_index field of the log
+ * header. Only the header cache line(s) are invalidated on each poll, so an
+ * idle poll is cheap. When new entries appear they are played into the
+ * shadow tree, any negative lookup cache entries for the new names are
+ * dropped, and the kernel is told to drop any cached (including negative)
+ * dentries for the new names (and cached attrs/readdir data of their parent
+ * directories).
+ * That allows clients to run with long entry/attr timeouts.
+ *
+ * The log is mapped (read-only) once, on first use, straight from the
+ * backing device (lo->daxdev: the dax device, or the backing file in dummy
+ * mode) rather than through our own mount. The log doesn't move or change
+ * size while mounted, so each poll only reads the header, and log entries
+ * are only touched when famfs_log_next_index has moved.
+ *
+ * The same mapping backs an allocation bitmap of the file system, with or
+ * without log tailing. statfs and REST /alloc_stats apply any log entries
+ * that are new since the last call (see famfs_logtail_get_alloc()) and
+ * return a summary of it (total, used, free and largest free extent), so
+ * they never have to scan the whole log.
+ */
+
+static pthread_t logtail_thread;
+static pthread_mutex_t logtail_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logtail_cond = PTHREAD_COND_INITIALIZER;
+static int logtail_shutdown_requested;
+static int logtail_running;
+static struct famfs_logtail_stats logtail_stats; /* protected by logtail_mutex */
+
+/* The log mapping and allocation map */
+static pthread_mutex_t logtail_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct famfs_log *logtail_logp;  /* set once, under logtail_map_mutex */
+static int logtail_map_failed;
+static u64 logtail_log_len;
+static u64 logtail_alloc_unit;          /* from the superblock */
+static u64 logtail_dev_size;
+static struct famfs_alloc_map logtail_amap; /* protected by logtail_map_mutex */
+static int logtail_alloc_failed;
+
+void famfs_logtail_get_stats(struct famfs_logtail_stats *stats)
+{
+	pthread_mutex_lock(&logtail_mutex);
+	*stats = logtail_stats;
+	pthread_mutex_unlock(&logtail_mutex);
+}
+
+/*
+ * Map the superblock and log from the backing device, read-only. Only the
+ * geometry is kept from the superblock (it doesn't change while mounted).
+ */
+static int
+famfs_logtail_map(struct famfs_ctx *lo)
+{
+	struct famfs_superblock *sb;
+	struct stat st;
+	void *addr;
+	int fd, rc;
+
+	if (!lo->daxdev) {
+		famfs_log(FAMFS_LOG_ERR, "%s: no daxdev\n", __func__);
+		return -1;
+	}
+	fd = open(lo->daxdev, O_RDONLY);
+	if (fd < 0) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to open %s (errno=%d)\n",
+			  __func__, lo->daxdev, errno);
+		return -1;
+	}
+
+	sb = mmap(0, FAMFS_SUPERBLOCK_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (sb == MAP_FAILED) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to mmap %s (errno=%d)\n",
+			  __func__, lo->daxdev, errno);
+		close(fd);
+		return -1;
+	}
+	invalidate_processor_cache(sb, FAMFS_SUPERBLOCK_SIZE);
+
+	rc = famfs_check_super(sb, NULL, NULL);
+	if (!rc) {
+		logtail_log_len = sb->ts_log_len;
+		logtail_alloc_unit = sb->ts_alloc_unit;
+		logtail_dev_size = sb->ts_daxdev.dd_size;
+	}
+	munmap(sb, FAMFS_SUPERBLOCK_SIZE);
+	if (rc) {
+		famfs_log(FAMFS_LOG_ERR, "%s: bad superblock on %s (rc=%d)\n",
+			  __func__, lo->daxdev, rc);
+		close(fd);
+		return -1;
+	}
+
+	/* In dummy mode, don't map past the end of the backing file */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (u64)st.st_size < FAMFS_LOG_OFFSET + logtail_log_len) {
+		famfs_log(FAMFS_LOG_ERR, "%s: %s is too small for the log\n",
+			  __func__, lo->daxdev);
+		close(fd);
+		return -1;
+	}
+
+	addr = mmap(0, logtail_log_len, PROT_READ, MAP_SHARED, fd,
+		    FAMFS_LOG_OFFSET);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to mmap the log (errno=%d)\n",
+			  __func__, errno);
+		return -1;
+	}
+	logtail_logp = addr;
+	return 0;
+}
+
+static void
+famfs_logtail_unmap(void)
+{
+	if (!logtail_logp)
+		return;
+	munmap(logtail_logp, logtail_log_len);
+	logtail_logp = NULL;
+	logtail_log_len = 0;
+}
+
+/*
+ * Get the log, mapping it on first use. A failure is logged once.
+ */
+static const struct famfs_log *
+famfs_logtail_get_log(struct famfs_ctx *lo)
+{
+	pthread_mutex_lock(&logtail_map_mutex);
+	if (!logtail_logp && !logtail_map_failed)
+		logtail_map_failed = (famfs_logtail_map(lo) != 0);
+	pthread_mutex_unlock(&logtail_map_mutex);
+	return logtail_logp;
+}
+
+/*
+ * Check famfs_log_next_index (read from the header) against the index we
+ * have already applied up to. Returns 0 if it is sane.
+ */
+static int
+famfs_logtail_check_index(const struct famfs_log *logp, u64 next,
+			  u64 next_index)
+{
+	if (next_index < next ||
+	    next_index > logp->famfs_log_last_index + 1 ||
+	    offsetof(struct famfs_log, entries) +
+	    next_index * sizeof(logp->entries[0]) > logtail_log_len) {
+		famfs_log(FAMFS_LOG_ERR, "%s: bogus next_index %lld\n",
+			  __func__, next_index);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * famfs_logtail_get_alloc()
+ *
+ * Get the allocation summary, after applying any log entries that are new
+ * since the last call. The first call builds the map from the whole log.
+ *
+ * Returns 0, or -1 if there is no summary (no daxdev, or the superblock
+ * is bad)
+ */
+int
+famfs_logtail_get_alloc(struct famfs_ctx *lo, struct famfs_alloc_summary *as)
+{
+	struct famfs_alloc_map *am = &logtail_amap;
+	const struct famfs_log *logp;
+	u64 next_index;
+	int rc = -1;
+
+	logp = famfs_logtail_get_log(lo);
+	if (!logp)
+		return -1;
+
+	pthread_mutex_lock(&logtail_map_mutex);
+	if (logtail_alloc_failed)
+		goto out;
+	if (!am->bitmap &&
+	    famfs_alloc_map_init(am, logtail_alloc_unit, logtail_dev_size,
+				 logtail_log_len)) {
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: no allocation stats (bad geometry)\n", __func__);
+		logtail_alloc_failed = 1;
+		goto out;
+	}
+
+	invalidate_processor_cache((void *)logp,
+				   offsetof(struct famfs_log, entries));
+	next_index = logp->famfs_log_next_index;
+	if (next_index > am->next_index &&
+	    famfs_logtail_check_index(logp, am->next_index, next_index) == 0) {
+		invalidate_processor_cache(
+			(void *)&logp->entries[am->next_index],
+			(next_index - am->next_index) *
+			sizeof(logp->entries[0]));
+		famfs_alloc_map_apply(am, logp, am->next_index, next_index);
+	}
+	famfs_alloc_map_summary(am, as);
+	rc = 0;
+out:
+	pthread_mutex_unlock(&logtail_map_mutex);
+	return rc;
+}
+
+/*
+ * Resolve the parent directory of a new entry: its icache inode number
+ * (which is the shadow inode number, except for the root which is
+ * FUSE_ROOT_ID), and its nodeid. Gets a ref on the parent famfs_inode.
+ *
+ * If the parent is not in the icache, the kernel cannot have it cached
+ * either (it would have had to look it up through us), so there is nothing to
+ * invalidate in the kernel and NULL is returned. *parent_ino is valid even
+ * then, unless it is 0.
+ */
+static struct famfs_inode *
+famfs_logtail_get_parent(
+	struct famfs_ctx *lo,
+	const char *parent_relpath,
+	uint64_t *parent_ino,
+	fuse_ino_t *nodeid)
+{
+	struct famfs_icache *icache = &lo->icache;
+	struct famfs_inode *inode;
+	struct stat st;
+
+	*parent_ino = 0;
+	if (parent_relpath[0] == '\0') {
+		*parent_ino = FUSE_ROOT_ID;
+		*nodeid = FUSE_ROOT_ID;
+		return famfs_get_inode_from_nodeid(icache, FUSE_ROOT_ID);
+	}
+
+	if (fstatat(icache->root.fd, parent_relpath, &st,
+		    AT_SYMLINK_NOFOLLOW) < 0)
+		return NULL;
+	*parent_ino = st.st_ino;
+
+	inode = famfs_icache_find_get_from_ino(icache, st.st_ino);
+	if (!inode)
+		return NULL;
+
+	*nodeid = (inode == &icache->root) ? FUSE_ROOT_ID : (uintptr_t)inode;
+	return inode;
+}
+
+/*
+ * Tell the kernel about a new log entry. The parent dir inode is only
+ * invalidated once for a run of entries in the same directory, which is
+ * the common case.
+ */
+static void
+famfs_logtail_notify(
+	struct famfs_ctx *lo,
+	const char *relpath,
+	char *last_parent)
+{
+	char parent_relpath[PATH_MAX];
+	struct famfs_inode *parent;
+	uint64_t parent_ino;
+	const char *name;
+	fuse_ino_t nodeid = 0;
+	const char *slash;
+	size_t len;
+	int rc;
+
+	slash = strrchr(relpath, '/');
+	if (slash) {
+		len = slash - relpath;
+		if (len >= sizeof(parent_relpath))
+			return;
+		memcpy(parent_relpath, relpath, len);
+		parent_relpath[len] = '\0';
+		name = slash + 1;
+	} else {
+		parent_relpath[0] = '\0';
+		name = relpath;
+	}
+
+	parent = famfs_logtail_get_parent(lo, parent_relpath, &parent_ino,
+					  &nodeid);
+
+	/* Our own caches first, so the kernel's re-lookup (or re-read of
+	 * the directory) doesn't hit them */
+	if (parent_ino) {
+		famfs_negcache_invalidate(&lo->negcache, parent_ino, name);
+		famfs_dircache_invalidate(&lo->dircache, parent_ino);
+	}
+
+	if (!parent)
+		return;
+
+	rc = fuse_lowlevel_notify_inval_entry(lo->se, nodeid, name,
+					      strlen(name));
+	famfs_log(FAMFS_LOG_DEBUG, "%s: inval_entry(%s) rc=%d\n",
+		  __func__, relpath, rc);
+	if (rc == 0) {
+		pthread_mutex_lock(&logtail_mutex);
+		logtail_stats.inval_entry++;
+		pthread_mutex_unlock(&logtail_mutex);
+	}
+
+	if (strcmp(parent_relpath, last_parent) != 0) {
+		rc = fuse_lowlevel_notify_inval_inode(lo->se, nodeid, 0, 0);
+		if (rc == 0) {
+			pthread_mutex_lock(&logtail_mutex);
+			logtail_stats.inval_inode++;
+			pthread_mutex_unlock(&logtail_mutex);
+		}
+		strcpy(last_parent, parent_relpath);
+	}
+
+	famfs_inode_putref(parent);
+}
+
+/*
+ * Apply log entries [start, end) to the daemon's view: play them into the
+ * shadow tree, then invalidate the affected kernel dentries.
+ */
+static void
+famfs_logtail_apply(
+	struct famfs_ctx *lo,
+	const struct famfs_log *logp,
+	u64 start,
+	u64 end)
+{
+	struct famfs_log_stats ls = { 0 };
+	char last_parent[PATH_MAX] = { 0 };
+	u64 i;
+	int rc;
+
+	invalidate_processor_cache((void *)&logp->entries[start],
+				   (end - start) * sizeof(logp->entries[0]));
+
+	rc = __famfs_logplay_range(lo->source, logp, start, end,
+				   0 /* dry_run */, 1 /* shadow */,
+				   0 /* shadowtest */, FAMFS_CLIENT, &ls, 0);
+	if (rc < 0) {
+		famfs_log(FAMFS_LOG_ERR,
+			  "%s: logplay of entries %lld-%lld failed\n",
+			  __func__, start, end - 1);
+		pthread_mutex_lock(&logtail_mutex);
+		logtail_stats.errors++;
+		pthread_mutex_unlock(&logtail_mutex);
+		return;
+	}
+
+	famfs_log(FAMFS_LOG_NOTICE,
+		  "%s: entries %lld-%lld: %lld files and %lld dirs created "
+		  "(%d errors)\n", __func__, start, end - 1,
+		  ls.f_created, ls.d_created, rc);
+
+	/* Some invalidations may be no-ops if the kernel
+	 * has nothing cached; that's fine */
+	last_parent[0] = '/'; /* never matches a relpath */
+	for (i = start; i < end; i++) {
+		const struct famfs_log_entry *le = &logp->entries[i];
+
+		switch (le->famfs_log_entry_type) {
+		case FAMFS_LOG_FILE:
+			famfs_logtail_notify(lo,
+					     (const char *)le->famfs_fm.fm_relpath,
+					     last_parent);
+			break;
+		case FAMFS_LOG_MKDIR:
+			famfs_logtail_notify(lo,
+					     (const char *)le->famfs_md.md_relpath,
+					     last_parent);
+			break;
+		default:
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&logtail_mutex);
+	logtail_stats.passes++;
+	logtail_stats.entries += (end - start);
+	logtail_stats.errors += rc;
+	logtail_stats.next_index = end;
+	pthread_mutex_unlock(&logtail_mutex);
+}
+
+/*
+ * One poll of the log header. Returns the next index to apply.
+ */
+static u64
+famfs_logtail_poll(struct famfs_ctx *lo, u64 next)
+{
+	const struct famfs_log *logp = logtail_logp;
+	u64 next_index;
+
+	/* Cheap check: only the header lines */
+	invalidate_processor_cache((void *)logp,
+				   offsetof(struct famfs_log, entries));
+
+	pthread_mutex_lock(&logtail_mutex);
+	logtail_stats.polls++;
+	pthread_mutex_unlock(&logtail_mutex);
+
+	next_index = logp->famfs_log_next_index;
+	if (next_index == next ||
+	    famfs_logtail_check_index(logp, next, next_index))
+		return next;
+
+	famfs_logtail_apply(lo, logp, next, next_index);
+	return next_index;
+}
+
+static void *famfs_logtail_thread_fn(void *arg)
+{
+	struct famfs_ctx *lo = arg;
+	struct timespec deadline;
+	u64 next = 0; /* the first pass catches up with the whole log */
+
+	famfs_log(FAMFS_LOG_NOTICE, "%s: tailing the log on %s every %ums\n",
+		  __func__, lo->daxdev, lo->logtail_ms);
+
+	pthread_mutex_lock(&logtail_mutex);
+	while (!logtail_shutdown_requested) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += lo->logtail_ms / 1000;
+		deadline.tv_nsec += (lo->logtail_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&logtail_cond, &logtail_mutex,
+				       &deadline);
+		if (logtail_shutdown_requested)
+			break;
+
+		pthread_mutex_unlock(&logtail_mutex);
+		next = famfs_logtail_poll(lo, next);
+		pthread_mutex_lock(&logtail_mutex);
+	}
+	pthread_mutex_unlock(&logtail_mutex);
+
+	famfs_log(FAMFS_LOG_NOTICE, "%s: exiting\n", __func__);
+	return NULL;
+}
+
+int famfs_logtail_start(struct famfs_ctx *lo)
+{
+	pthread_condattr_t attr;
+	int rc;
+
+	if (logtail_running)
+		return 0;
+
+	if (!lo->se || !lo->mpt) {
+		famfs_log(FAMFS_LOG_ERR, "%s: no session or mount point\n",
+			  __func__);
+		return -1;
+	}
+	if (lo->logtail_ms == 0)
+		lo->logtail_ms = FAMFS_LOGTAIL_DEFAULT_MS;
+	if (!famfs_logtail_get_log(lo))
+		return -1;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&logtail_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	logtail_shutdown_requested = 0;
+	rc = pthread_create(&logtail_thread, NULL, famfs_logtail_thread_fn, lo);
+	if (rc) {
+		famfs_log(FAMFS_LOG_ERR, "%s: pthread_create failed (%d)\n",
+			  __func__, rc);
+		return -1;
+	}
+	logtail_running = 1;
+	return 0;
+}
+
+/*
+ * Stop the tail thread (if running), and drop the allocation map and the log
+ * mapping. Called once the session loop has exited, so nothing else is using
+ * them.
+ */
+void famfs_logtail_stop(void)
+{
+	if (logtail_running) {
+		famfs_log(FAMFS_LOG_NOTICE, "Stopping log tail thread\n");
+		pthread_mutex_lock(&logtail_mutex);
+		logtail_shutdown_requested = 1;
+		pthread_cond_signal(&logtail_cond);
+		pthread_mutex_unlock(&logtail_mutex);
+
+		pthread_join(logtail_thread, NULL);
+		logtail_running = 0;
+	}
+
+	famfs_alloc_map_free(&logtail_amap);
+	logtail_alloc_failed = 0;
+	famfs_logtail_unmap();
+	logtail_map_failed = 0;
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_LOGTAIL
+#define _H_FAMFS_FUSED_LOGTAIL
+
+#include <stdint.h>
+
+struct famfs_ctx;
+struct famfs_alloc_summary;
+
+#define FAMFS_LOGTAIL_DEFAULT_MS 100
+
+struct famfs_logtail_stats {
+	uint64_t polls;          /* header polls */
+	uint64_t passes;         /* polls that found new entries */
+	uint64_t entries;        /* entries applied */
+	uint64_t errors;         /* logplay errors */
+	uint64_t inval_entry;    /* entry invalidations sent to the kernel */
+	uint64_t inval_inode;    /* dir inode invalidations sent to the kernel */
+	uint64_t next_index;     /* next log index to be applied */
+};
+
+int famfs_logtail_start(struct famfs_ctx *lo);
+void famfs_logtail_stop(void);
+void famfs_logtail_get_stats(struct famfs_logtail_stats *stats);
+int famfs_logtail_get_alloc(struct famfs_ctx *lo,
+			    struct famfs_alloc_summary *as);
+
+#endif /* _H_FAMFS_FUSED_LOGTAIL */
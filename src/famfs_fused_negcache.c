@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "famfs_log.h"
+#include "famfs_fused_negcache.h"
+
+static uint64_t
+famfs_negcache_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+famfs_negcache_hash(uint64_t parent_ino, const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ (parent_ino * 0x9e3779b97f4a7c15ULL);
+
+	/* FNV-1a */
+	for (; *name; name++) {
+		h ^= (unsigned char)*name;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static inline void
+famfs_neg_lru_del(struct famfs_neg_ent *ne)
+{
+	ne->lru.prev->next = ne->lru.next;
+	ne->lru.next->prev = ne->lru.prev;
+}
+
+static inline void
+famfs_neg_lru_add_head(struct famfs_negcache *nc, struct famfs_neg_ent *ne)
+{
+	ne->lru.next = nc->lru.next;
+	ne->lru.prev = &nc->lru;
+	nc->lru.next->prev = &ne->lru;
+	nc->lru.next = &ne->lru;
+}
+
+/*
+ * Find an entry; on return *ppp points at the hash chain link that
+ * references it (for removal). Caller holds the mutex.
+ */
+static struct famfs_neg_ent *
+famfs_negcache_find_locked(
+	struct famfs_negcache *nc,
+	uint64_t parent_ino,
+	const char *name,
+	uint64_t hash,
+	struct famfs_neg_ent ***ppp)
+{
+	struct famfs_neg_ent **pp = &nc->hash[hash & (nc->nbuckets - 1)];
+
+	for (; *pp; pp = &(*pp)->hnext) {
+		struct famfs_neg_ent *ne = *pp;
+
+		if (ne->hash == hash && ne->parent_ino == parent_ino &&
+		    strcmp(ne->name, name) == 0) {
+			*ppp = pp;
+			return ne;
+		}
+	}
+	return NULL;
+}
+
+static void
+famfs_negcache_remove_locked(
+	struct famfs_negcache *nc,
+	struct famfs_neg_ent **pp)
+{
+	struct famfs_neg_ent *ne = *pp;
+
+	*pp = ne->hnext;
+	famfs_neg_lru_del(ne);
+	nc->count--;
+	free(ne);
+}
+
+int
+famfs_negcache_init(
+	struct famfs_negcache *nc,
+	uint64_t max,
+	double ttl_secs)
+{
+	memset(nc, 0, sizeof(*nc));
+	pthread_mutex_init(&nc->mutex, NULL);
+	nc->lru.next = nc->lru.prev = &nc->lru;
+
+	if (max == 0 || ttl_secs <= 0)
+		return 0; /* disabled */
+
+	/* Size the table for ~1 entry per bucket when full */
+	nc->nbuckets = 64;
+	while (nc->nbuckets < max)
+		nc->nbuckets <<= 1;
+
+	nc->hash = calloc(nc->nbuckets, sizeof(*nc->hash));
+	if (!nc->hash) {
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to allocate %ld buckets\n",
+			  __func__, nc->nbuckets);
+		nc->nbuckets = 0;
+		return -1;
+	}
+	nc->max = max;
+	nc->ttl_ns = (uint64_t)(ttl_secs * 1e9);
+	return 0;
+}
+
+void
+famfs_negcache_destroy(struct famfs_negcache *nc)
+{
+	famfs_negcache_invalidate_all(nc, NULL, NULL);
+	free(nc->hash);
+	nc->hash = NULL;
+	nc->max = 0;
+}
+
+uint64_t
+famfs_negcache_gen(struct famfs_negcache *nc)
+{
+	return __atomic_load_n(&nc->gen, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * famfs_negcache_lookup()
+ *
+ * Returns 1 if (@parent_ino, @name) is known not to exist, else 0
+ */
+int
+famfs_negcache_lookup(
+	struct famfs_negcache *nc,
+	uint64_t parent_ino,
+	const char *name)
+{
+	uint64_t hash = famfs_negcache_hash(parent_ino, name);
+	struct famfs_neg_ent **pp;
+	struct famfs_neg_ent *ne;
+	int found = 0;
+
+	if (!nc->max)
+		return 0;
+
+	pthread_mutex_lock(&nc->mutex);
+	ne = famfs_negcache_find_locked(nc, parent_ino, name, hash, &pp);
+	if (ne && ne->expires_ns <= famfs_negcache_now_ns()) {
+		famfs_negcache_remove_locked(nc, pp);
+		nc->expirations++;
+		ne = NULL;
+	}
+	if (ne) {
+		famfs_neg_lru_del(ne);
+		famfs_neg_lru_add_head(nc, ne);
+		nc->hits++;
+		found = 1;
+	} else {
+		nc->misses++;
+	}
+	pthread_mutex_unlock(&nc->mutex);
+
+	return found;
+}
+
+/**
+ * famfs_negcache_insert()
+ *
+ * @gen: value of famfs_negcache_gen() sampled before the failed lookup
+ *
+ * Returns 0 if the entry was cached (or refreshed), or -1 if the cache is
+ * disabled, out of memory, or there was an invalidation since @gen was
+ * sampled.
+ */
+int
+famfs_negcache_insert(
+	struct famfs_negcache *nc,
+	uint64_t parent_ino,
+	const char *name,
+	uint64_t gen)
+{
+	uint64_t hash = famfs_negcache_hash(parent_ino, name);
+	struct famfs_neg_ent **pp;
+	struct famfs_neg_ent *ne;
+	size_t len = strlen(name);
+	int rc = 0;
+
+	if (!nc->max)
+		return -1;
+
+	pthread_mutex_lock(&nc->mutex);
+	if (nc->gen != gen) {
+		rc = -1;
+		goto out;
+	}
+
+	ne = famfs_negcache_find_locked(nc, parent_ino, name, hash, &pp);
+	if (ne) {
+		ne->expires_ns = famfs_negcache_now_ns() + nc->ttl_ns;
+		famfs_neg_lru_del(ne);
+		famfs_neg_lru_add_head(nc, ne);
+		goto out;
+	}
+
+	if (nc->count >= nc->max) {
+		struct famfs_neg_ent *victim =
+			(struct famfs_neg_ent *)nc->lru.prev;
+
+		/* Find the victim's chain link and remove it */
+		famfs_negcache_find_locked(nc, victim->parent_ino,
+					   victim->name, victim->hash, &pp);
+		famfs_negcache_remove_locked(nc, pp);
+		nc->evictions++;
+	}
+
+	ne = malloc(sizeof(*ne) + len + 1);
+	if (!ne) {
+		rc = -1;
+		goto out;
+	}
+	ne->parent_ino = parent_ino;
+	ne->hash = hash;
+	ne->expires_ns = famfs_negcache_now_ns() + nc->ttl_ns;
+	memcpy(ne->name, name, len + 1);
+
+	pp = &nc->hash[hash & (nc->nbuckets - 1)];
+	ne->hnext = *pp;
+	*pp = ne;
+	famfs_neg_lru_add_head(nc, ne);
+	nc->count++;
+	nc->inserts++;
+out:
+	pthread_mutex_unlock(&nc->mutex);
+	return rc;
+}
+
+/**
+ * famfs_negcache_invalidate()
+ *
+ * Invalidate one name (e.g. a file or dir that was just logged)
+ */
+void
+famfs_negcache_invalidate(
+	struct famfs_negcache *nc,
+	uint64_t parent_ino,
+	const char *name)
+{
+	uint64_t hash = famfs_negcache_hash(parent_ino, name);
+	struct famfs_neg_ent **pp;
+
+	if (!nc->max)
+		return;
+
+	pthread_mutex_lock(&nc->mutex);
+	__atomic_add_fetch(&nc->gen, 1, __ATOMIC_RELEASE);
+	if (famfs_negcache_find_locked(nc, parent_ino, name, hash, &pp)) {
+		famfs_negcache_remove_locked(nc, pp);
+		nc->invalidations++;
+	}
+	pthread_mutex_unlock(&nc->mutex);
+}
+
+/**
+ * famfs_negcache_invalidate_all()
+ *
+ * Drop all entries. If @cb is non-null, it is called (without the negcache
+ * mutex held) for each entry that was dropped, so the caller can tell the
+ * kernel to forget its negative dentries too.
+ *
+ * Returns the number of entries dropped
+ */
+uint64_t
+famfs_negcache_invalidate_all(
+	struct famfs_negcache *nc,
+	famfs_negcache_cb cb,
+	void *arg)
+{
+	struct famfs_neg_ent *list = NULL;
+	struct famfs_neg_ent *ne;
+	uint64_t n = 0;
+	uint64_t i;
+
+	if (!nc->hash)
+		return 0;
+
+	pthread_mutex_lock(&nc->mutex);
+	__atomic_add_fetch(&nc->gen, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < nc->nbuckets; i++) {
+		while ((ne = nc->hash[i])) {
+			nc->hash[i] = ne->hnext;
+			ne->hnext = list;
+			list = ne;
+			n++;
+		}
+	}
+	nc->lru.next = nc->lru.prev = &nc->lru;
+	nc->count = 0;
+	nc->invalidations += n;
+	pthread_mutex_unlock(&nc->mutex);
+
+	while ((ne = list)) {
+		list = ne->hnext;
+		if (cb)
+			cb(ne->parent_ino, ne->name, arg);
+		free(ne);
+	}
+	return n;
+}
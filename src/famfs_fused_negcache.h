@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef FAMFS_FUSED_NEGCACHE
+#define FAMFS_FUSED_NEGCACHE
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Negative lookup cache
+ *
+ * Caches lookups that failed with ENOENT, keyed by (parent ino, name).
+ * The cache is bounded (LRU eviction) and entries expire after a ttl.
+ * Entries must be invalidated when log play or log tailing adds files or
+ * directories.
+ *
+ * Every invalidation bumps a generation number. A lookup should sample the
+ * generation before it searches the shadow tree, and pass it to
+ * famfs_negcache_insert(), which refuses to insert if anything was
+ * invalidated in the meantime (otherwise a lookup that raced with a new
+ * log entry could cache a stale negative entry).
+ */
+
+struct famfs_neg_lru {
+	struct famfs_neg_lru *next;      /* toward least recently used */
+	struct famfs_neg_lru *prev;
+};
+
+struct famfs_neg_ent {
+	struct famfs_neg_lru lru;        /* must be first */
+	struct famfs_neg_ent *hnext;     /* hash chain */
+	uint64_t parent_ino;
+	uint64_t hash;
+	uint64_t expires_ns;             /* CLOCK_MONOTONIC */
+	char name[];
+};
+
+struct famfs_negcache {
+	pthread_mutex_t mutex;
+	struct famfs_neg_ent **hash;
+	uint64_t nbuckets;          /* power of 2 */
+	struct famfs_neg_lru lru;   /* list head; lru.next is the newest */
+	uint64_t count;
+	uint64_t max;               /* 0 = disabled */
+	uint64_t ttl_ns;
+	uint64_t gen;               /* bumped by every invalidation */
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t evictions;
+	uint64_t expirations;
+	uint64_t invalidations;
+};
+
+typedef void (*famfs_negcache_cb)(uint64_t parent_ino, const char *name,
+				  void *arg);
+
+int famfs_negcache_init(struct famfs_negcache *nc, uint64_t max,
+			double ttl_secs);
+void famfs_negcache_destroy(struct famfs_negcache *nc);
+uint64_t famfs_negcache_gen(struct famfs_negcache *nc);
+int famfs_negcache_lookup(struct famfs_negcache *nc, uint64_t parent_ino,
+			  const char *name);
+int famfs_negcache_insert(struct famfs_negcache *nc, uint64_t parent_ino,
+			  const char *name, uint64_t gen);
+void famfs_negcache_invalidate(struct famfs_negcache *nc,
+			       uint64_t parent_ino, const char *name);
+uint64_t famfs_negcache_invalidate_all(struct famfs_negcache *nc,
+				       famfs_negcache_cb cb, void *arg);
+
+#endif /* FAMFS_FUSED_NEGCACHE */
@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION FUSE_MAKE_VERSION(3, 12)
+
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "famfs_log.h"
+#include "famfs_fused.h"
+#include "famfs_fused_icache.h"
+#include "famfs_fused_preload.h"
+
+/*
+ * Icache preload
+ *
+ * Without preload, the first access to each file pays for a LOOKUP (which
+ * parses the shadow yaml) and a GET_FMAP (which serializes the fmap). When
+ * thousands of ranks of a job open the same dataset at the same time, all of
+ * that work lands on the daemon at once.
+ *
+ * Preload (-o preload=<subtree>, or the /preload REST call) walks a subtree
+ * of the shadow tree with several threads, and caches a famfs_inode for each
+ * file and directory, including attrs, fmap and the serialized fmap message.
+ * Preloaded inodes are flagged FAMFS_PRELOADED and hold a ref of their own,
+ * so they stay cached when the kernel forgets them. Lookups still go through
+ * famfs_do_lookup(), but they hit the icache instead of parsing yaml, and
+ * readdirplus and GET_FMAP are served entirely from the cache.
+ *
+ * When preload is a mount option, it runs before the fuse session is mounted,
+ * so the mount is not visible until the cache is warm.
+ */
+
+struct famfs_preload_work {
+	struct famfs_icache *icache;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct famfs_inode **queue;  /* dirs to scan; each holds a ref */
+	size_t qlen;
+	size_t qmax;
+	size_t busy;                 /* threads scanning a dir */
+	struct famfs_preload_stats stats;
+};
+
+static pthread_mutex_t preload_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct famfs_preload_stats preload_stats; /* cumulative */
+
+void famfs_preload_get_stats(struct famfs_preload_stats *stats)
+{
+	pthread_mutex_lock(&preload_stats_mutex);
+	*stats = preload_stats;
+	pthread_mutex_unlock(&preload_stats_mutex);
+}
+
+static void
+famfs_preload_stats_add(
+	struct famfs_preload_stats *to,
+	const struct famfs_preload_stats *from)
+{
+	to->dirs += from->dirs;
+	to->files += from->files;
+	to->cached += from->cached;
+	to->errors += from->errors;
+	to->fmap_bytes += from->fmap_bytes;
+}
+
+/*
+ * Cache one shadow entry and mark it preloaded.
+ *
+ * Returns the inode with a (working) ref that the caller must put, or NULL
+ */
+static struct famfs_inode *
+famfs_preload_ent(
+	struct famfs_icache *icache,
+	struct famfs_inode *parent,
+	const char *name,
+	struct famfs_preload_stats *st)
+{
+	struct famfs_shadow_ent ent = { .fd = -1, .d_type = DT_UNKNOWN };
+	struct famfs_inode *inode;
+	ssize_t fmap_size;
+	int err;
+
+	if (strlen(name) > NAME_MAX) {
+		st->errors++;
+		return NULL;
+	}
+	strcpy(ent.name, name);
+
+	err = famfs_shadow_ent_load(parent->fd, &ent, icache);
+	if (err) {
+		if (err != ENOENT) /* Not a file or dir: not an error */
+			st->errors++;
+		famfs_shadow_ent_release(&ent);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&icache->mutex);
+	inode = famfs_shadow_ent_commit_locked(icache, parent, &ent);
+	if (inode) {
+		/* The commit ref becomes the preload ref, unless the inode
+		 * already has one */
+		if (inode->flags & FAMFS_PRELOADED) {
+			famfs_inode_putref_locked(inode, 1);
+			st->cached++;
+		} else {
+			inode->flags |= FAMFS_PRELOADED;
+		}
+		famfs_inode_getref_locked(inode);
+	}
+	pthread_mutex_unlock(&icache->mutex);
+	famfs_shadow_ent_release(&ent);
+
+	if (!inode) {
+		st->errors++;
+		return NULL;
+	}
+
+	if (inode->ftype == FAMFS_FDIR) {
+		st->dirs++;
+		return inode;
+	}
+
+	st->files++;
+	fmap_size = famfs_inode_cache_fmap_msg(icache, inode);
+	if (fmap_size < 0)
+		st->errors++;
+	else
+		st->fmap_bytes += fmap_size;
+
+	return inode;
+}
+
+/*
+ * Queue a directory to be scanned; takes over the caller's ref
+ */
+static void
+famfs_preload_push(
+	struct famfs_preload_work *w,
+	struct famfs_inode *dir,
+	struct famfs_preload_stats *st)
+{
+	pthread_mutex_lock(&w->mutex);
+	if (w->qlen == w->qmax) {
+		size_t qmax = (w->qmax) ? w->qmax * 2 : 256;
+		struct famfs_inode **q;
+
+		q = realloc(w->queue, qmax * sizeof(*q));
+		if (!q) {
+			pthread_mutex_unlock(&w->mutex);
+			st->errors++;
+			famfs_inode_putref(dir);
+			return;
+		}
+		w->queue = q;
+		w->qmax = qmax;
+	}
+	w->queue[w->qlen++] = dir;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void
+famfs_preload_dir(
+	struct famfs_preload_work *w,
+	struct famfs_inode *dir,
+	struct famfs_preload_stats *st)
+{
+	struct dirent *de;
+	DIR *dp;
+	int fd;
+
+	/* The root fd is O_PATH; get one we can read */
+	fd = openat(dir->fd, ".", O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		st->errors++;
+		return;
+	}
+	dp = fdopendir(fd);
+	if (!dp) {
+		close(fd);
+		st->errors++;
+		return;
+	}
+
+	while ((de = readdir(dp))) {
+		struct famfs_inode *inode;
+		const char *name = de->d_name;
+
+		if (name[0] == '.' && (name[1] == '\0' ||
+				       (name[1] == '.' && name[2] == '\0')))
+			continue;
+		if (de->d_type != DT_REG && de->d_type != DT_DIR &&
+		    de->d_type != DT_UNKNOWN)
+			continue;
+
+		inode = famfs_preload_ent(w->icache, dir, name, st);
+		if (!inode)
+			continue;
+
+		if (inode->ftype == FAMFS_FDIR)
+			famfs_preload_push(w, inode, st);
+		else
+			famfs_inode_putref(inode);
+	}
+	closedir(dp);
+}
+
+static void *
+famfs_preload_worker(void *arg)
+{
+	struct famfs_preload_work *w = arg;
+	struct famfs_preload_stats st = { 0 };
+	struct famfs_inode *dir;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		/* A busy thread may still queue more dirs */
+		while (!w->qlen && w->busy)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (!w->qlen)
+			break;
+
+		dir = w->queue[--w->qlen];
+		w->busy++;
+		pthread_mutex_unlock(&w->mutex);
+
+		famfs_preload_dir(w, dir, &st);
+		famfs_inode_putref(dir);
+
+		pthread_mutex_lock(&w->mutex);
+		w->busy--;
+	}
+	famfs_preload_stats_add(&w->stats, &st);
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+/*
+ * Resolve @subtree (relative to the mount root), caching and preloading each
+ * directory along the way.
+ *
+ * Returns the inode with a ref, or NULL with errno set
+ */
+static struct famfs_inode *
+famfs_preload_resolve(
+	struct famfs_icache *icache,
+	const char *subtree,
+	struct famfs_preload_stats *st)
+{
+	struct famfs_inode *cur, *next;
+	char *path, *comp, *save = NULL;
+
+	path = strdup(subtree);
+	if (!path) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	cur = famfs_icache_find_get_from_ino(icache, FUSE_ROOT_ID);
+	for (comp = strtok_r(path, "/", &save); comp;
+	     comp = strtok_r(NULL, "/", &save)) {
+		if (strcmp(comp, ".") == 0)
+			continue;
+		if (strcmp(comp, "..") == 0) {
+			errno = EINVAL;
+			goto err_out;
+		}
+		if (cur->ftype != FAMFS_FDIR) {
+			errno = ENOTDIR;
+			goto err_out;
+		}
+		next = famfs_preload_ent(icache, cur, comp, st);
+		famfs_inode_putref(cur);
+		cur = next;
+		if (!cur) {
+			errno = ENOENT;
+			goto err_out;
+		}
+	}
+	free(path);
+	return cur;
+
+err_out:
+	if (cur)
+		famfs_inode_putref(cur);
+	free(path);
+	return NULL;
+}
+
+/**
+ * famfs_preload()
+ *
+ * Preload the icache with a subtree of the shadow tree
+ *
+ * @lo:       famfs context
+ * @subtree:  path relative to the mount root ("/" or "" for everything)
+ * @nthreads: number of threads that scan directories
+ * @stats:    if non-null, the stats of this pass are returned here
+ *
+ * This is safe to call while the fuse session is running.
+ *
+ * Returns 0, or a negative errno
+ */
+int
+famfs_preload(
+	struct famfs_ctx *lo,
+	const char *subtree,
+	unsigned int nthreads,
+	struct famfs_preload_stats *stats)
+{
+	struct famfs_preload_work w = { .icache = &lo->icache };
+	struct famfs_preload_stats st = { 0 };
+	struct timespec start, end;
+	struct famfs_inode *top;
+	pthread_t *tid = NULL;
+	unsigned int nstarted = 0;
+	unsigned int i;
+	int rc = 0;
+
+	if (!subtree)
+		subtree = "/";
+	if (nthreads == 0)
+		nthreads = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_init(&w.mutex, NULL);
+	pthread_cond_init(&w.cond, NULL);
+
+	top = famfs_preload_resolve(&lo->icache, subtree, &st);
+	if (!top) {
+		rc = -errno;
+		famfs_log(FAMFS_LOG_ERR, "%s: failed to resolve %s (%d)\n",
+			  __func__, subtree, rc);
+		goto out;
+	}
+
+	if (top->ftype != FAMFS_FDIR) {
+		/* Just one file */
+		famfs_inode_putref(top);
+		goto out;
+	}
+	famfs_preload_push(&w, top, &st);
+
+	tid = calloc(nthreads, sizeof(*tid));
+	for (i = 1; tid && i < nthreads; i++) {
+		if (pthread_create(&tid[nstarted], NULL,
+				   famfs_preload_worker, &w))
+			break;
+		nstarted++;
+	}
+
+	/* This thread scans too (and scans everything if no threads started) */
+	famfs_preload_worker(&w);
+
+	for (i = 0; i < nstarted; i++)
+		pthread_join(tid[i], NULL);
+	free(tid);
+	free(w.queue);
+
+out:
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	famfs_preload_stats_add(&st, &w.stats);
+	st.runs = 1;
+	st.elapsed_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL
+		+ end.tv_nsec - start.tv_nsec;
+
+	famfs_log(FAMFS_LOG_NOTICE,
+		  "%s: %s: %lld dirs %lld files (%lld already cached) "
+		  "%lld errors in %lld.%03lld s (%u threads)\n",
+		  __func__, subtree, st.dirs, st.files, st.cached, st.errors,
+		  st.elapsed_ns / 1000000000ULL,
+		  (st.elapsed_ns / 1000000ULL) % 1000, nstarted + 1);
+
+	pthread_mutex_lock(&preload_stats_mutex);
+	famfs_preload_stats_add(&preload_stats, &st);
+	preload_stats.runs++;
+	preload_stats.elapsed_ns = st.elapsed_ns;
+	pthread_mutex_unlock(&preload_stats_mutex);
+
+	if (stats)
+		*stats = st;
+
+	pthread_cond_destroy(&w.cond);
+	pthread_mutex_destroy(&w.mutex);
+	return rc;
+}
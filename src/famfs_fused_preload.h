@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_PRELOAD
+#define _H_FAMFS_FUSED_PRELOAD
+
+#include <stdint.h>
+
+struct famfs_ctx;
+
+struct famfs_preload_stats {
+	uint64_t runs;           /* preload passes (cumulative stats only) */
+	uint64_t dirs;           /* directories cached */
+	uint64_t files;          /* files cached (with serialized fmaps) */
+	uint64_t cached;         /* entries that were already preloaded */
+	uint64_t errors;
+	uint64_t fmap_bytes;     /* size of the serialized fmaps */
+	uint64_t elapsed_ns;     /* time taken (of the last pass, if cumulative) */
+};
+
+int famfs_preload(struct famfs_ctx *lo, const char *subtree,
+		  unsigned int nthreads, struct famfs_preload_stats *stats);
+void famfs_preload_get_stats(struct famfs_preload_stats *stats);
+
+#endif /* _H_FAMFS_FUSED_PRELOAD */
@@ -21,6 +21,10 @@
 
 #include "famfs_log.h"
 #include "famfs_fused.h"
+#include "famfs_fused_logtail.h"
+#include "famfs_fused_preload.h"
+#include "famfs_fused_stats.h"
+#include "famfs_fused_trace.h"
 
 static pthread_t diag_thread;
 static volatile int diag_shutdown_requested = 0;
@@ -34,7 +38,17 @@ static char *sock_path = NULL;
  *
  * * log_level/ - (GET, POST or PUT) - get or set log_level
  * * icache_dump - (GET) dump icache into syslog
- * * icache_stats - (GET) return icache stats in yaml format
+ * * icache_stats - (GET) return icache (flock, negcache, dircache) stats in
+ *   yaml format
+ * * logtail_stats - (GET) return log tail stats in yaml format
+ * * negcache_invalidate - (GET) drop all negative lookup cache entries
+ * * preload?path=<subtree> - (GET) preload the icache with a subtree
+ * * preload_stats - (GET) return cumulative preload stats in yaml format
+ * * op_stats?format=json - (GET) per fuse op counts and latency percentiles
+ *   in yaml (default) or json format
+ * * metrics - (GET) op latency histograms in Prometheus text format
+ * * trace_dump?seconds=<n> - (GET) binary dump of the request trace rings
+ *   (the last n seconds, or everything); see scripts/famfs_trace2chrome.py
  * * pid - (GET) Return pid of famfs_fused in yaml format
  */
 static void famfs_dispatch_http(
@@ -107,14 +121,218 @@ static void famfs_dispatch_http(
 	} else if (mg_match(hm->uri, mg_str("/icache_stats"), NULL)) {
 		extern struct famfs_ctx famfs_context;
 		struct famfs_icache *icache = &famfs_context.icache;
+		struct famfs_negcache *nc = &famfs_context.negcache;
+		struct famfs_dircache *dc = &famfs_context.dircache;
 		mg_http_reply(c, 200,
 			      "Content-Type: text/yaml\r\nConnection: close\r\n",
 			      "icache_stats:\n"
 			      "  search_count:   %lld\n"
 			      "  nodes_scanned:  %lld\n"
-			      "  search_fail_ct: %lld\n",
+			      "  search_fail_ct: %lld\n"
+			      "flock_stats:\n"
+			      "  acquired:       %lld\n"
+			      "  contended:      %lld\n"
+			      "  wouldblock:     %lld\n"
+			      "  interrupted:    %lld\n"
+			      "  wait_ms:        %lld\n"
+			      "negcache_stats:\n"
+			      "  count:          %lld\n"
+			      "  max:            %lld\n"
+			      "  hits:           %lld\n"
+			      "  misses:         %lld\n"
+			      "  inserts:        %lld\n"
+			      "  evictions:      %lld\n"
+			      "  expirations:    %lld\n"
+			      "  invalidations:  %lld\n"
+			      "dircache_stats:\n"
+			      "  count:          %lld\n"
+			      "  bytes:          %lld\n"
+			      "  max_bytes:      %lld\n"
+			      "  hits:           %lld\n"
+			      "  misses:         %lld\n"
+			      "  stale:          %lld\n"
+			      "  inserts:        %lld\n"
+			      "  evictions:      %lld\n"
+			      "  invalidations:  %lld\n",
 			      icache->search_count, icache->nodes_scanned,
-			      icache->search_fail_ct);
+			      icache->search_fail_ct,
+			      icache->flock_acquired, icache->flock_contended,
+			      icache->flock_wouldblock,
+			      icache->flock_interrupted,
+			      icache->flock_wait_ns / 1000000,
+			      nc->count, nc->max, nc->hits, nc->misses,
+			      nc->inserts, nc->evictions, nc->expirations,
+			      nc->invalidations,
+			      dc->count, dc->bytes, dc->max_bytes, dc->hits,
+			      dc->misses, dc->stale, dc->inserts, dc->evictions,
+			      dc->invalidations);
+
+	} else if (mg_match(hm->uri, mg_str("/negcache_invalidate"), NULL)) {
+		/* Logplay added entries: drop all negative entries, here and
+		 * in the kernel */
+		extern struct famfs_ctx famfs_context;
+		uint64_t n;
+
+		n = famfs_negcache_invalidate_all(&famfs_context.negcache,
+						  famfs_negcache_notify_kernel,
+						  &famfs_context);
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "negcache_invalidated: %lld\n", n);
+
+	} else if (mg_match(hm->uri, mg_str("/preload"), NULL)) {
+		/* Runs synchronously; the reply reports how long it took */
+		extern struct famfs_ctx famfs_context;
+		struct famfs_preload_stats ps;
+		char path[PATH_MAX] = "/";
+		int rc;
+
+		if (mg_http_get_var(&hm->query, "path", path, sizeof(path)) <= 0)
+			strcpy(path, "/");
+		rc = famfs_preload(&famfs_context, path,
+				   famfs_context.preload_threads, &ps);
+		mg_http_reply(c, (rc) ? 400 : 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "preload:\n"
+			      "  path:       %s\n"
+			      "  status:     %d\n"
+			      "  dirs:       %lld\n"
+			      "  files:      %lld\n"
+			      "  cached:     %lld\n"
+			      "  errors:     %lld\n"
+			      "  fmap_bytes: %lld\n"
+			      "  elapsed_ms: %lld\n",
+			      path, rc, ps.dirs, ps.files, ps.cached, ps.errors,
+			      ps.fmap_bytes, ps.elapsed_ns / 1000000ULL);
+
+	} else if (mg_match(hm->uri, mg_str("/preload_stats"), NULL)) {
+		struct famfs_preload_stats ps;
+
+		famfs_preload_get_stats(&ps);
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "preload_stats:\n"
+			      "  runs:            %lld\n"
+			      "  dirs:            %lld\n"
+			      "  files:           %lld\n"
+			      "  cached:          %lld\n"
+			      "  errors:          %lld\n"
+			      "  fmap_bytes:      %lld\n"
+			      "  last_elapsed_ms: %lld\n",
+			      ps.runs, ps.dirs, ps.files, ps.cached, ps.errors,
+			      ps.fmap_bytes, ps.elapsed_ns / 1000000ULL);
+
+	} else if (mg_match(hm->uri, mg_str("/op_stats"), NULL)) {
+		char fmt[16] = "";
+		int json;
+		char *out;
+
+		mg_http_get_var(&hm->query, "format", fmt, sizeof(fmt));
+		json = (strcmp(fmt, "json") == 0);
+		out = famfs_op_stats_format((json) ? FAMFS_STATS_JSON
+					    : FAMFS_STATS_YAML);
+		if (!out) {
+			mg_http_reply(c, 500, "Connection: close\r\n",
+				      "Out of memory\n");
+		} else {
+			mg_http_reply(c, 200, (json)
+				      ? "Content-Type: application/json\r\n"
+					"Connection: close\r\n"
+				      : "Content-Type: text/yaml\r\n"
+					"Connection: close\r\n",
+				      "%s", out);
+			free(out);
+		}
+
+	} else if (mg_match(hm->uri, mg_str("/metrics"), NULL)) {
+		char *out = famfs_op_stats_format(FAMFS_STATS_PROMETHEUS);
+
+		if (!out) {
+			mg_http_reply(c, 500, "Connection: close\r\n",
+				      "Out of memory\n");
+		} else {
+			mg_http_reply(c, 200,
+				      "Content-Type: text/plain; version=0.0.4\r\n"
+				      "Connection: close\r\n",
+				      "%s", out);
+			free(out);
+		}
+
+	} else if (mg_match(hm->uri, mg_str("/trace_dump"), NULL)) {
+		char secs[32] = "";
+		uint64_t since = 0;
+		struct timespec now;
+		size_t len;
+		void *dump;
+
+		if (mg_http_get_var(&hm->query, "seconds", secs,
+				    sizeof(secs)) > 0) {
+			uint64_t ns = strtoull(secs, NULL, 0) * 1000000000ULL;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			since = (uint64_t)now.tv_sec * 1000000000ULL
+				+ now.tv_nsec;
+			since = (ns < since) ? since - ns : 0;
+		}
+		dump = famfs_trace_dump(since, &len);
+		if (!dump) {
+			mg_http_reply(c, 500, "Connection: close\r\n",
+				      "Out of memory\n");
+		} else {
+			/* Binary body: mg_http_reply() is printf-based */
+			mg_printf(c, "HTTP/1.1 200 OK\r\n"
+				  "Content-Type: application/octet-stream\r\n"
+				  "Content-Length: %lu\r\n"
+				  "Connection: close\r\n\r\n",
+				  (unsigned long)len);
+			mg_send(c, dump, len);
+			free(dump);
+		}
+
+	} else if (mg_match(hm->uri, mg_str("/logtail_stats"), NULL)) {
+		extern struct famfs_ctx famfs_context;
+		struct famfs_logtail_stats lts;
+
+		famfs_logtail_get_stats(&lts);
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "logtail_stats:\n"
+			      "  enabled:     %d\n"
+			      "  poll_ms:     %u\n"
+			      "  polls:       %lld\n"
+			      "  passes:      %lld\n"
+			      "  entries:     %lld\n"
+			      "  errors:      %lld\n"
+			      "  inval_entry: %lld\n"
+			      "  inval_inode: %lld\n"
+			      "  next_index:  %lld\n",
+			      famfs_context.logtail, famfs_context.logtail_ms,
+			      lts.polls, lts.passes, lts.entries, lts.errors,
+			      lts.inval_entry, lts.inval_inode, lts.next_index);
+
+	} else if (mg_match(hm->uri, mg_str("/alloc_stats"), NULL)) {
+		extern struct famfs_ctx famfs_context;
+		struct famfs_alloc_summary as;
+		int valid;
+
+		valid = (famfs_logtail_get_alloc(&famfs_context, &as) == 0);
+		if (!valid)
+			memset(&as, 0, sizeof(as));
+		mg_http_reply(c, 200,
+			      "Content-Type: text/yaml\r\nConnection: close\r\n",
+			      "alloc_stats:\n"
+			      "  valid:        %d\n"
+			      "  alloc_unit:   %lld\n"
+			      "  total:        %lld\n"
+			      "  used:         %lld\n"
+			      "  free:         %lld\n"
+			      "  largest_free: %lld\n"
+			      "  files:        %lld\n"
+			      "  log_index:    %lld\n"
+			      "  errors:       %lld\n",
+			      valid, as.alloc_unit, as.total, as.used, as.free,
+			      as.largest_free, as.nfiles, as.log_index,
+			      as.errors);
 
 	} else if (mg_match(hm->uri, mg_str("/pid"), NULL)) {
 		pid_t pid = getpid();
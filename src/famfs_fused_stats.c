@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "famfs_fused_stats.h"
+
+/*
+ * Fuse op stats
+ *
+ * Each fuse handler is wrapped (see FAMFS_OP_TIMED in famfs_fused.c) to
+ * call famfs_op_record(), which records a count and a latency histogram
+ * for the op. Stats are kept per thread, so recording takes no
+ * locks and shares no cache lines; readers sum over all threads. A reader
+ * may see a thread's counters mid-update, which is fine for stats.
+ *
+ * Fuse worker threads come and go, so when a thread exits its stats are
+ * folded into famfs_op_retired and the per-thread struct is freed.
+ *
+ * Stats are served by the REST diag server in yaml or json (/op_stats) and
+ * in the Prometheus text format (/metrics).
+ */
+
+int famfs_op_stats_enabled = 1;
+
+struct famfs_op_tstats {
+	struct famfs_op_tstats *next;
+	struct famfs_op_tstats *prev;
+	struct famfs_op_hist op[FAMFS_OP_MAX];
+};
+
+static pthread_mutex_t famfs_op_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t famfs_op_once = PTHREAD_ONCE_INIT;
+static pthread_key_t famfs_op_key;
+static struct famfs_op_tstats famfs_op_threads = {    /* list head */
+	.next = &famfs_op_threads,
+	.prev = &famfs_op_threads,
+};
+static struct famfs_op_hist famfs_op_retired[FAMFS_OP_MAX];
+static __thread struct famfs_op_tstats *famfs_op_mine;
+
+static const char *famfs_op_names[FAMFS_OP_MAX] = {
+	[FAMFS_OP_LOOKUP]       = "lookup",
+	[FAMFS_OP_FORGET]       = "forget",
+	[FAMFS_OP_FORGET_MULTI] = "forget_multi",
+	[FAMFS_OP_GETATTR]      = "getattr",
+	[FAMFS_OP_SETATTR]      = "setattr",
+	[FAMFS_OP_OPEN]         = "open",
+	[FAMFS_OP_READ]         = "read",
+	[FAMFS_OP_WRITE]        = "write",
+	[FAMFS_OP_RELEASE]      = "release",
+	[FAMFS_OP_OPENDIR]      = "opendir",
+	[FAMFS_OP_READDIR]      = "readdir",
+	[FAMFS_OP_READDIRPLUS]  = "readdirplus",
+	[FAMFS_OP_RELEASEDIR]   = "releasedir",
+	[FAMFS_OP_STATFS]       = "statfs",
+	[FAMFS_OP_GETXATTR]     = "getxattr",
+	[FAMFS_OP_CREATE]       = "create",
+	[FAMFS_OP_FLOCK]        = "flock",
+	[FAMFS_OP_GET_FMAP]     = "get_fmap",
+	[FAMFS_OP_GET_DAXDEV]   = "get_daxdev",
+};
+
+const char *famfs_op_name(enum famfs_fuse_op op)
+{
+	if (op < 0 || op >= FAMFS_OP_MAX)
+		return "unknown";
+	return famfs_op_names[op];
+}
+
+/*
+ * Histogram buckets
+ */
+int famfs_hist_bucket(uint64_t ns)
+{
+	int msb, shift;
+
+	if (ns < FAMFS_HIST_SUB)
+		return (int)ns;
+	msb = 63 - __builtin_clzll(ns);
+	if (msb > FAMFS_HIST_MAX_MSB)
+		return FAMFS_HIST_BUCKETS - 1;
+	shift = msb - FAMFS_HIST_SUB_BITS;
+	return (shift + 1) * FAMFS_HIST_SUB
+		+ (int)((ns >> shift) & (FAMFS_HIST_SUB - 1));
+}
+
+uint64_t famfs_hist_bucket_low(int bucket)
+{
+	int shift;
+
+	if (bucket < FAMFS_HIST_SUB)
+		return bucket;
+	shift = bucket / FAMFS_HIST_SUB - 1;
+	return (uint64_t)(FAMFS_HIST_SUB + bucket % FAMFS_HIST_SUB) << shift;
+}
+
+uint64_t famfs_hist_bucket_high(int bucket)
+{
+	if (bucket < FAMFS_HIST_SUB)
+		return bucket;
+	return famfs_hist_bucket_low(bucket)
+		+ (1ULL << (bucket / FAMFS_HIST_SUB - 1)) - 1;
+}
+
+/*
+ * Return the upper bound of the bucket containing the @pct percentile
+ * (0 < @pct <= 100), capped at the max seen
+ */
+uint64_t famfs_hist_percentile(const struct famfs_op_hist *h, double pct)
+{
+	uint64_t target, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+	target = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (target == 0)
+		target = 1;
+	for (i = 0; i < FAMFS_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target) {
+			uint64_t high = famfs_hist_bucket_high(i);
+
+			return (high < h->max_ns) ? high : h->max_ns;
+		}
+	}
+	return h->max_ns;
+}
+
+static void famfs_hist_add(struct famfs_op_hist *to,
+			   const struct famfs_op_hist *from)
+{
+	int i;
+
+	to->count += from->count;
+	to->sum_ns += from->sum_ns;
+	if (from->max_ns > to->max_ns)
+		to->max_ns = from->max_ns;
+	for (i = 0; i < FAMFS_HIST_BUCKETS; i++)
+		to->bucket[i] += from->bucket[i];
+}
+
+/*
+ * Per-thread stats
+ */
+static void famfs_op_thread_exit(void *arg)
+{
+	struct famfs_op_tstats *ts = arg;
+	int i;
+
+	pthread_mutex_lock(&famfs_op_mutex);
+	for (i = 0; i < FAMFS_OP_MAX; i++)
+		famfs_hist_add(&famfs_op_retired[i], &ts->op[i]);
+	ts->prev->next = ts->next;
+	ts->next->prev = ts->prev;
+	pthread_mutex_unlock(&famfs_op_mutex);
+	free(ts);
+}
+
+static void famfs_op_key_init(void)
+{
+	pthread_key_create(&famfs_op_key, famfs_op_thread_exit);
+}
+
+static struct famfs_op_tstats *famfs_op_thread_stats(void)
+{
+	struct famfs_op_tstats *ts;
+
+	pthread_once(&famfs_op_once, famfs_op_key_init);
+	ts = calloc(1, sizeof(*ts));
+	if (!ts)
+		return NULL;
+
+	pthread_mutex_lock(&famfs_op_mutex);
+	ts->next = famfs_op_threads.next;
+	ts->prev = &famfs_op_threads;
+	famfs_op_threads.next->prev = ts;
+	famfs_op_threads.next = ts;
+	pthread_mutex_unlock(&famfs_op_mutex);
+
+	pthread_setspecific(famfs_op_key, ts);
+	famfs_op_mine = ts;
+	return ts;
+}
+
+void famfs_op_record(enum famfs_fuse_op op, uint64_t ns)
+{
+	struct famfs_op_tstats *ts = famfs_op_mine;
+	struct famfs_op_hist *h;
+
+	if (op < 0 || op >= FAMFS_OP_MAX)
+		return;
+	if (!ts && !(ts = famfs_op_thread_stats()))
+		return;
+
+	h = &ts->op[op];
+	h->count++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->bucket[famfs_hist_bucket(ns)]++;
+}
+
+/**
+ * famfs_op_stats_snapshot()
+ *
+ * Sum the stats of all threads (live and exited)
+ *
+ * @hist: array of FAMFS_OP_MAX histograms (out)
+ */
+void famfs_op_stats_snapshot(struct famfs_op_hist *hist)
+{
+	struct famfs_op_tstats *ts;
+	int i;
+
+	pthread_mutex_lock(&famfs_op_mutex);
+	memcpy(hist, famfs_op_retired, sizeof(famfs_op_retired));
+	for (ts = famfs_op_threads.next; ts != &famfs_op_threads;
+	     ts = ts->next) {
+		for (i = 0; i < FAMFS_OP_MAX; i++)
+			famfs_hist_add(&hist[i], &ts->op[i]);
+	}
+	pthread_mutex_unlock(&famfs_op_mutex);
+}
+
+/*
+ * Formatting
+ */
+static const double famfs_op_pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+static const char *famfs_op_pct_names[] = { "p50", "p90", "p99", "p999" };
+#define FAMFS_OP_NPCTS (sizeof(famfs_op_pcts) / sizeof(famfs_op_pcts[0]))
+
+static void famfs_op_format_yaml(FILE *f, const struct famfs_op_hist *hist)
+{
+	size_t p;
+	int i;
+
+	fprintf(f, "op_stats:\n");
+	for (i = 0; i < FAMFS_OP_MAX; i++) {
+		const struct famfs_op_hist *h = &hist[i];
+
+		fprintf(f, "  %s:\n", famfs_op_name(i));
+		fprintf(f, "    count:   %" PRIu64 "\n", h->count);
+		fprintf(f, "    sum_ns:  %" PRIu64 "\n", h->sum_ns);
+		fprintf(f, "    mean_ns: %" PRIu64 "\n",
+			(h->count) ? h->sum_ns / h->count : 0);
+		fprintf(f, "    max_ns:  %" PRIu64 "\n", h->max_ns);
+		for (p = 0; p < FAMFS_OP_NPCTS; p++)
+			fprintf(f, "    %s_ns:%*s%" PRIu64 "\n",
+				famfs_op_pct_names[p],
+				(int)(5 - strlen(famfs_op_pct_names[p])), "",
+				famfs_hist_percentile(h, famfs_op_pcts[p]));
+	}
+}
+
+static void famfs_op_format_json(FILE *f, const struct famfs_op_hist *hist)
+{
+	size_t p;
+	int i;
+
+	fprintf(f, "{\"op_stats\": {");
+	for (i = 0; i < FAMFS_OP_MAX; i++) {
+		const struct famfs_op_hist *h = &hist[i];
+
+		fprintf(f, "%s\n  \"%s\": {\"count\": %" PRIu64
+			", \"sum_ns\": %" PRIu64 ", \"mean_ns\": %" PRIu64
+			", \"max_ns\": %" PRIu64,
+			(i) ? "," : "", famfs_op_name(i), h->count, h->sum_ns,
+			(h->count) ? h->sum_ns / h->count : 0, h->max_ns);
+		for (p = 0; p < FAMFS_OP_NPCTS; p++)
+			fprintf(f, ", \"%s_ns\": %" PRIu64,
+				famfs_op_pct_names[p],
+				famfs_hist_percentile(h, famfs_op_pcts[p]));
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n}}\n");
+}
+
+/*
+ * Prometheus histograms have cumulative buckets; we report one bucket per
+ * power of two (the boundaries of our sub-buckets would make for a very
+ * long scrape), up to 2^FAMFS_HIST_MAX_MSB ns. Every op gets the same
+ * buckets, so series don't come and go between scrapes. Our last bucket
+ * also holds anything larger, so it is only counted in +Inf.
+ */
+static void famfs_op_format_prometheus(FILE *f,
+				       const struct famfs_op_hist *hist)
+{
+	int i, b;
+
+	fprintf(f, "# HELP famfs_fuse_op_duration_seconds "
+		"Latency of famfs_fused fuse handlers\n");
+	fprintf(f, "# TYPE famfs_fuse_op_duration_seconds histogram\n");
+	for (i = 0; i < FAMFS_OP_MAX; i++) {
+		const struct famfs_op_hist *h = &hist[i];
+		const char *name = famfs_op_name(i);
+		uint64_t cum = 0;
+
+		for (b = 0; b < FAMFS_HIST_BUCKETS - FAMFS_HIST_SUB; b++) {
+			cum += h->bucket[b];
+			/* Emit at each power of two boundary */
+			if ((b + 1) % FAMFS_HIST_SUB != 0)
+				continue;
+			fprintf(f, "famfs_fuse_op_duration_seconds_bucket"
+				"{op=\"%s\",le=\"%.9g\"} %" PRIu64 "\n",
+				name, (famfs_hist_bucket_high(b) + 1) / 1e9,
+				cum);
+		}
+		fprintf(f, "famfs_fuse_op_duration_seconds_bucket"
+			"{op=\"%s\",le=\"+Inf\"} %" PRIu64 "\n",
+			name, h->count);
+		fprintf(f, "famfs_fuse_op_duration_seconds_sum{op=\"%s\"} %.9f\n",
+			name, h->sum_ns / 1e9);
+		fprintf(f, "famfs_fuse_op_duration_seconds_count{op=\"%s\"} %"
+			PRIu64 "\n", name, h->count);
+	}
+}
+
+/**
+ * famfs_op_stats_format()
+ *
+ * Format a snapshot of the op stats
+ *
+ * Returns a string that the caller must free, or NULL
+ */
+char *famfs_op_stats_format(enum famfs_stats_format format)
+{
+	struct famfs_op_hist *hist;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	hist = calloc(FAMFS_OP_MAX, sizeof(*hist));
+	if (!hist)
+		return NULL;
+	famfs_op_stats_snapshot(hist);
+
+	f = open_memstream(&buf, &len);
+	if (!f) {
+		free(hist);
+		return NULL;
+	}
+
+	switch (format) {
+	case FAMFS_STATS_JSON:
+		famfs_op_format_json(f, hist);
+		break;
+	case FAMFS_STATS_PROMETHEUS:
+		famfs_op_format_prometheus(f, hist);
+		break;
+	case FAMFS_STATS_YAML:
+	default:
+		famfs_op_format_yaml(f, hist);
+		break;
+	}
+
+	fclose(f);
+	free(hist);
+	return buf;
+}
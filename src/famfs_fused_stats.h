@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_STATS
+#define _H_FAMFS_FUSED_STATS
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Per-operation fuse handler stats
+ */
+enum famfs_fuse_op {
+	FAMFS_OP_LOOKUP = 0,
+	FAMFS_OP_FORGET,
+	FAMFS_OP_FORGET_MULTI,
+	FAMFS_OP_GETATTR,
+	FAMFS_OP_SETATTR,
+	FAMFS_OP_OPEN,
+	FAMFS_OP_READ,
+	FAMFS_OP_WRITE,
+	FAMFS_OP_RELEASE,
+	FAMFS_OP_OPENDIR,
+	FAMFS_OP_READDIR,
+	FAMFS_OP_READDIRPLUS,
+	FAMFS_OP_RELEASEDIR,
+	FAMFS_OP_STATFS,
+	FAMFS_OP_GETXATTR,
+	FAMFS_OP_CREATE,
+	FAMFS_OP_FLOCK,
+	FAMFS_OP_GET_FMAP,
+	FAMFS_OP_GET_DAXDEV,
+	FAMFS_OP_MAX,
+};
+
+/*
+ * Latency histogram buckets are log-linear (as in HdrHistogram): values
+ * below 2^FAMFS_HIST_SUB_BITS ns get a bucket each, and each power of two
+ * above that is split into 2^FAMFS_HIST_SUB_BITS linear buckets, so a bucket
+ * is within 12.5% of any value in it. Values of 2^FAMFS_HIST_MAX_MSB ns
+ * (~18 minutes) or more land in the last bucket.
+ */
+#define FAMFS_HIST_SUB_BITS 3
+#define FAMFS_HIST_SUB      (1 << FAMFS_HIST_SUB_BITS)
+#define FAMFS_HIST_MAX_MSB  40
+#define FAMFS_HIST_BUCKETS  \
+	((FAMFS_HIST_MAX_MSB - FAMFS_HIST_SUB_BITS + 2) * FAMFS_HIST_SUB)
+
+struct famfs_op_hist {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint64_t bucket[FAMFS_HIST_BUCKETS];
+};
+
+enum famfs_stats_format {
+	FAMFS_STATS_YAML = 0,
+	FAMFS_STATS_JSON,
+	FAMFS_STATS_PROMETHEUS,
+};
+
+extern int famfs_op_stats_enabled;
+
+int famfs_hist_bucket(uint64_t ns);
+uint64_t famfs_hist_bucket_low(int bucket);
+uint64_t famfs_hist_bucket_high(int bucket);
+uint64_t famfs_hist_percentile(const struct famfs_op_hist *h, double pct);
+
+const char *famfs_op_name(enum famfs_fuse_op op);
+void famfs_op_record(enum famfs_fuse_op op, uint64_t ns);
+void famfs_op_stats_snapshot(struct famfs_op_hist *hist /* [FAMFS_OP_MAX] */);
+char *famfs_op_stats_format(enum famfs_stats_format format);
+
+/* CLOCK_MONOTONIC in ns; handlers read it once at start and once at end,
+ * and share the timestamps between the op stats and the request trace */
+static inline uint64_t famfs_op_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif /* _H_FAMFS_FUSED_STATS */
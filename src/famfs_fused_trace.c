@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "famfs_fused_stats.h"
+#include "famfs_fused_trace.h"
+
+/*
+ * Request trace
+ *
+ * Each fuse handler (see FAMFS_OP_TIMED in famfs_fused.c) writes a binary
+ * record of its request into a ring owned by its thread: op, nodeid, name
+ * hash, start and end time, errno and icache hit/miss. Writing a record is
+ * a struct copy and a release store of the ring head, with no locks and
+ * no shared cache lines, so tracing can stay on all the time. The rings
+ * hold the last FAMFS_TRACE_DEFAULT_RECORDS (-o trace_records) requests of
+ * each thread.
+ *
+ * A dump (REST /trace_dump) copies the rings without stopping the writers:
+ * the head is re-read after copying, and records that may have been
+ * overwritten during the copy are dropped. scripts/famfs_trace2chrome.py
+ * converts a dump to Chrome trace JSON (chrome://tracing or Perfetto).
+ *
+ * Rings are not freed when a thread exits; the next new thread takes over
+ * the ring, so memory is bounded by the peak number of fuse threads.
+ */
+
+int famfs_trace_enabled = 1;
+
+struct famfs_trace_ring {
+	struct famfs_trace_ring *next;
+	int in_use;                     /* owned by a live thread */
+	uint64_t size;                  /* records (a power of 2) */
+	uint64_t head;                  /* records written (ever) */
+	struct famfs_trace_rec rec[];
+};
+
+static unsigned int famfs_trace_size = FAMFS_TRACE_DEFAULT_RECORDS;
+static pthread_mutex_t famfs_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t famfs_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t famfs_trace_key;
+static struct famfs_trace_ring *famfs_trace_rings;
+
+static __thread struct famfs_trace_ring *trace_ring;
+static __thread struct famfs_trace_rec trace_cur;
+static __thread int trace_active;
+static __thread uint32_t trace_tid;
+
+static inline uint64_t famfs_trace_now(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * famfs_trace_init()
+ *
+ * Set the per-thread ring size (rounded up to a power of 2); 0 disables
+ * tracing. Threads that already have a ring keep it.
+ */
+void famfs_trace_init(unsigned int nrecs)
+{
+	unsigned int size = 1;
+
+	if (!nrecs) {
+		famfs_trace_enabled = 0;
+		return;
+	}
+	while (size < nrecs && size < (1U << 24))
+		size <<= 1;
+	famfs_trace_size = size;
+	famfs_trace_enabled = 1;
+}
+
+uint32_t famfs_trace_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void famfs_trace_thread_exit(void *arg)
+{
+	struct famfs_trace_ring *ring = arg;
+
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void famfs_trace_key_init(void)
+{
+	pthread_key_create(&famfs_trace_key, famfs_trace_thread_exit);
+}
+
+static struct famfs_trace_ring *famfs_trace_get_ring(void)
+{
+	struct famfs_trace_ring *ring;
+
+	pthread_once(&famfs_trace_once, famfs_trace_key_init);
+
+	pthread_mutex_lock(&famfs_trace_mutex);
+	for (ring = famfs_trace_rings; ring; ring = ring->next)
+		if (!ring->in_use && ring->size == famfs_trace_size)
+			break;
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring) +
+			      famfs_trace_size * sizeof(ring->rec[0]));
+		if (!ring) {
+			pthread_mutex_unlock(&famfs_trace_mutex);
+			return NULL;
+		}
+		ring->size = famfs_trace_size;
+		ring->next = famfs_trace_rings;
+		famfs_trace_rings = ring;
+	}
+	ring->in_use = 1;
+	pthread_mutex_unlock(&famfs_trace_mutex);
+
+	pthread_setspecific(famfs_trace_key, ring);
+	trace_tid = (uint32_t)syscall(SYS_gettid);
+	trace_ring = ring;
+	return ring;
+}
+
+/* @now_ns is the CLOCK_MONOTONIC time the handler started (the caller
+ * shares it with the op stats) */
+void famfs_trace_begin(int op, uint64_t nodeid, const char *name,
+		       uint64_t now_ns)
+{
+	if (!famfs_trace_enabled)
+		return;
+
+	trace_cur.start_ns = now_ns;
+	trace_cur.end_ns = 0;
+	trace_cur.nodeid = nodeid;
+	trace_cur.name_hash = (name) ? famfs_trace_hash(name) : 0;
+	trace_cur.err = 0;
+	trace_cur.tid = trace_tid;
+	trace_cur.op = (uint16_t)op;
+	trace_cur.flags = 0;
+	trace_active = 1;
+}
+
+/* Note the errno of the reply (if a request is being traced) */
+void famfs_trace_err(int err)
+{
+	if (trace_active && err)
+		trace_cur.err = err;
+}
+
+void famfs_trace_flags(unsigned int flags)
+{
+	if (trace_active)
+		trace_cur.flags |= flags;
+}
+
+void famfs_trace_end(uint64_t now_ns)
+{
+	struct famfs_trace_ring *ring = trace_ring;
+	uint64_t head;
+
+	if (!trace_active)
+		return;
+	trace_active = 0;
+
+	if (!ring) {
+		ring = famfs_trace_get_ring();
+		if (!ring)
+			return;
+		trace_cur.tid = trace_tid;
+	}
+
+	trace_cur.end_ns = now_ns;
+	head = ring->head;
+	ring->rec[head & (ring->size - 1)] = trace_cur;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * famfs_trace_snapshot()
+ *
+ * Copy the records that ended at or after @since_ns (CLOCK_MONOTONIC) out of
+ * all rings, oldest first within each ring
+ *
+ * @recs:     out: up to @max records
+ * @nthreads: out: number of rings (threads) (optional)
+ *
+ * Returns the number of records copied
+ */
+size_t famfs_trace_snapshot(
+	struct famfs_trace_rec *recs,
+	size_t max,
+	uint64_t since_ns,
+	uint32_t *nthreads)
+{
+	struct famfs_trace_ring *ring;
+	uint32_t nrings = 0;
+	size_t n = 0;
+
+	pthread_mutex_lock(&famfs_trace_mutex);
+	for (ring = famfs_trace_rings; ring; ring = ring->next) {
+		const uint64_t size = ring->size;
+		uint64_t head, head2, first, seq;
+		size_t start = n;
+
+		nrings++;
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		first = (head > size) ? head - size : 0;
+		for (seq = first; seq < head && n < max; seq++)
+			recs[n++] = ring->rec[seq & (size - 1)];
+
+		/* The writer may have lapped us while we copied; drop the
+		 * records whose slots were (or may be being) rewritten. The
+		 * oldest record's slot is the next one written, so a ring of
+		 * N records never dumps more than N - 1 */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		head2 = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (head2 + 1 > first + size) {
+			uint64_t valid = head2 + 1 - size;  /* first good seq */
+			size_t drop = (valid > first) ? valid - first : 0;
+
+			if (drop > n - start)
+				drop = n - start;
+			memmove(&recs[start], &recs[start + drop],
+				(n - start - drop) * sizeof(*recs));
+			n -= drop;
+		}
+
+		/* Filter by time */
+		if (since_ns) {
+			size_t i, j = start;
+
+			for (i = start; i < n; i++)
+				if (recs[i].end_ns >= since_ns)
+					recs[j++] = recs[i];
+			n = j;
+		}
+	}
+	pthread_mutex_unlock(&famfs_trace_mutex);
+
+	if (nthreads)
+		*nthreads = nrings;
+	return n;
+}
+
+/**
+ * famfs_trace_dump()
+ *
+ * Build a trace dump (struct famfs_trace_hdr, op names and records) of the
+ * records that ended at or after @since_ns
+ *
+ * Returns a buffer that the caller must free, or NULL
+ */
+void *famfs_trace_dump(uint64_t since_ns, size_t *len)
+{
+	struct famfs_trace_hdr *hdr;
+	struct famfs_trace_ring *ring;
+	size_t max = 0, names, n;
+	char *buf;
+	int i;
+
+	pthread_mutex_lock(&famfs_trace_mutex);
+	for (ring = famfs_trace_rings; ring; ring = ring->next)
+		max += ring->size;
+	pthread_mutex_unlock(&famfs_trace_mutex);
+	max += famfs_trace_size; /* In case a thread starts meanwhile */
+
+	names = FAMFS_OP_MAX * FAMFS_TRACE_OPNAME_LEN;
+	buf = calloc(1, sizeof(*hdr) + names +
+		     max * sizeof(struct famfs_trace_rec));
+	if (!buf)
+		return NULL;
+
+	hdr = (struct famfs_trace_hdr *)buf;
+	memcpy(hdr->magic, FAMFS_TRACE_MAGIC, sizeof(hdr->magic));
+	hdr->version = FAMFS_TRACE_VERSION;
+	hdr->rec_size = sizeof(struct famfs_trace_rec);
+	hdr->nops = FAMFS_OP_MAX;
+	for (i = 0; i < FAMFS_OP_MAX; i++)
+		strncpy(buf + sizeof(*hdr) + i * FAMFS_TRACE_OPNAME_LEN,
+			famfs_op_name(i), FAMFS_TRACE_OPNAME_LEN - 1);
+
+	n = famfs_trace_snapshot(
+		(struct famfs_trace_rec *)(buf + sizeof(*hdr) + names),
+		max, since_ns, &hdr->nthreads);
+	hdr->nrecs = n;
+	hdr->mono_ns = famfs_trace_now(CLOCK_MONOTONIC);
+	hdr->real_ns = famfs_trace_now(CLOCK_REALTIME);
+
+	*len = sizeof(*hdr) + names + n * sizeof(struct famfs_trace_rec);
+	return buf;
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_FUSED_TRACE
+#define _H_FAMFS_FUSED_TRACE
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FAMFS_TRACE_MAGIC           "FAMFSTRC"
+#define FAMFS_TRACE_VERSION         1
+#define FAMFS_TRACE_DEFAULT_RECORDS 4096 /* per thread */
+#define FAMFS_TRACE_OPNAME_LEN      16
+
+/* Record flags */
+#define FAMFS_TRACE_ICACHE_HIT  0x01
+#define FAMFS_TRACE_ICACHE_MISS 0x02
+#define FAMFS_TRACE_NEG_HIT     0x04  /* negative lookup cache hit */
+
+/*
+ * One fuse request. scripts/famfs_trace2chrome.py knows this layout, so
+ * bump FAMFS_TRACE_VERSION if it changes.
+ */
+struct famfs_trace_rec {
+	uint64_t start_ns;      /* CLOCK_MONOTONIC */
+	uint64_t end_ns;
+	uint64_t nodeid;
+	uint32_t name_hash;     /* FNV-1a of the name looked up (0 if none) */
+	int32_t  err;           /* errno replied (0 on success) */
+	uint32_t tid;
+	uint16_t op;            /* enum famfs_fuse_op */
+	uint8_t  flags;
+	uint8_t  pad;
+};
+
+/*
+ * A trace dump is this header, followed by @nops op names
+ * (FAMFS_TRACE_OPNAME_LEN bytes each, nul-padded), followed by @nrecs
+ * records ordered by thread and then by time
+ */
+struct famfs_trace_hdr {
+	char     magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t nops;
+	uint32_t nthreads;
+	uint64_t nrecs;
+	uint64_t mono_ns;       /* CLOCK_MONOTONIC at dump time */
+	uint64_t real_ns;       /* CLOCK_REALTIME at dump time */
+};
+
+extern int famfs_trace_enabled;
+
+void famfs_trace_init(unsigned int nrecs);
+uint32_t famfs_trace_hash(const char *name);
+
+void famfs_trace_begin(int op, uint64_t nodeid, const char *name,
+		       uint64_t now_ns);
+void famfs_trace_err(int err);
+void famfs_trace_flags(unsigned int flags);
+void famfs_trace_end(uint64_t now_ns);
+
+size_t famfs_trace_snapshot(struct famfs_trace_rec *recs, size_t max,
+			    uint64_t since_ns, uint32_t *nthreads);
+void *famfs_trace_dump(uint64_t since_ns, size_t *len);
+
+#endif /* _H_FAMFS_FUSED_TRACE */
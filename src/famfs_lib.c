@@ -39,8 +39,9 @@
 #include "famfs_meta.h"
 #include "famfs_lib.h"
 #include "famfs_lib_internal.h"
-#include "thpool.h"
+#include "famfs_wspool.h"
 #include "libfcc.h"
+#include "famfs_uring.h"
 
 int mock_kmod = 0; /* unit tests can set this to avoid ioctl calls and whatnot */
 int mock_fstype = 0;
@@ -53,6 +54,8 @@ int mock_stripe = 0; /* relaxes stripe rules for unit tests */
 int mock_threadpool = 0; /* call threaded code rather than threading */
 
 int cp_compare = 0;
+int cp_cached = 0; /* copy through the cache and flush (not streaming) */
+int cp_qdepth = FAMFS_CP_QDEPTH; /* io_uring source reads in flight/thread */
 
 static int
 famfs_dir_create(
@@ -1665,7 +1668,60 @@ __famfs_logplay(
 	enum famfs_system_role  role,
 	int			verbose)
 {
+	struct famfs_log_stats ls = { 0 };
+	int rc;
+
+	if (verbose)
+		printf("%s: log contains %lld entries\n",
+		       __func__, logp->famfs_log_next_index);
+
+	rc = __famfs_logplay_range(mpt, logp, 0, logp->famfs_log_next_index,
+				   dry_run, shadow, shadowtest, role,
+				   &ls, verbose);
+	if (rc < 0)
+		return rc;
 
+	famfs_print_log_stats(shadow ?
+			      "famfs_logplay(shadow)" : "famfs_logplay(v1)",
+			      &ls, verbose);
+	return rc;
+}
+
+/**
+ * __famfs_logplay_range()
+ *
+ * Play log entries [@start, @end) into a file system or shadow tree.
+ * This is the body of __famfs_logplay(); it is also used by famfs_fused to
+ * incrementally apply entries that were appended after the last pass.
+ * Caller has already validated the superblock and log.
+ *
+ * @mpt:         mount point path (or shadow fs path if shadow==true)
+ * @logp:        pointer to a read-only copy or mmap of the log
+ * @start:       index of the first entry to play
+ * @end:         index past the last entry to play (clamped to next_index)
+ * @dry_run:     process the log but don't create the files & directories
+ * @shadow:      Play into shadow file system instead (for famfs-fuse)
+ * @shadowtest:  (see __famfs_logplay())
+ * @role:        system role
+ * @ls:          log stats, accumulated by this call (required)
+ * @verbose:     verbose flag
+ *
+ * Returns value: Number of errors detected (0=complete success), or -1
+ *                if the log or an entry is invalid
+ */
+int
+__famfs_logplay_range(
+	const char		*mpt,
+	const struct famfs_log	*logp,
+	u64                     start,
+	u64                     end,
+	int                     dry_run,
+	int                     shadow,
+	int                     shadowtest,
+	enum famfs_system_role  role,
+	struct famfs_log_stats *ls_out,
+	int			verbose)
+{
 	struct famfs_log_stats ls = { 0 };
 	char *shadow_root = NULL;
 	int bad_entries = 0;
@@ -1699,11 +1755,10 @@ __famfs_logplay(
 		}
 	}
 
-	if (verbose)
-		printf("%s: log contains %lld entries\n",
-		       __func__, logp->famfs_log_next_index);
+	if (end > logp->famfs_log_next_index)
+		end = logp->famfs_log_next_index;
 
-	for (i = 0; i < logp->famfs_log_next_index; i++) {
+	for (i = start; i < end; i++) {
 		struct famfs_log_entry le = logp->entries[i];
 
 		if (famfs_validate_log_entry(&le, i)) {
@@ -1712,6 +1767,8 @@ __famfs_logplay(
 				"%lld of %lld\n",
 				__func__, i, logp->famfs_log_next_index);
 			bad_entries = 1;
+			if (shadow_root)
+				free(shadow_root);
 			return -1;
 		}
 		ls.n_entries++;
@@ -1963,9 +2020,19 @@ bad_log_fmap:
 	if (shadow_root)
 		free(shadow_root);
 
-	famfs_print_log_stats(shadow ?
-			      "famfs_logplay(shadow)" : "famfs_logplay(v1)",
-			      &ls, verbose);
+	ls_out->n_entries += ls.n_entries;
+	ls_out->bad_entries += ls.bad_entries;
+	ls_out->f_logged += ls.f_logged;
+	ls_out->f_existed += ls.f_existed;
+	ls_out->f_created += ls.f_created;
+	ls_out->f_errs += ls.f_errs;
+	ls_out->d_logged += ls.d_logged;
+	ls_out->d_existed += ls.d_existed;
+	ls_out->d_created += ls.d_created;
+	ls_out->d_errs += ls.d_errs;
+	ls_out->yaml_errs += ls.yaml_errs;
+	ls_out->yaml_checked += ls.yaml_checked;
+
 	return (bad_entries + ls.f_errs + ls.d_errs + ls.yaml_errs);
 }
 
@@ -2142,6 +2209,36 @@ out_umount:
 	return rc;
 }
 
+/*
+ * After playing the log into the shadow tree of a mounted famfs-fuse file
+ * system, tell famfs_fused to drop its negative lookup cache entries (and the
+ * kernel's negative dentries). If there is no daemon listening on the shadow
+ * socket there is nothing to do; failures are not errors, since negative
+ * entries also expire on their own.
+ */
+static void
+famfs_fuse_negcache_invalidate(const char *shadow, int verbose)
+{
+	char sock_path[PATH_MAX];
+	char *response = NULL;
+	struct stat st;
+	long code = 0;
+	int rc;
+
+	rc = snprintf(sock_path, sizeof(sock_path), "%s/sock", shadow);
+	if (rc < 0 || rc >= (int)sizeof(sock_path))
+		return;
+	if (stat(sock_path, &st) || !S_ISSOCK(st.st_mode))
+		return;
+
+	rc = famfs_http_get_uds(sock_path, "/negcache_invalidate",
+				&response, NULL, &code);
+	if (verbose)
+		printf("%s: rc=%d http=%ld %s", __func__, rc, code,
+		       response ? response : "\n");
+	free(response);
+}
+
 /**
  * famfs_logplay()
  *
@@ -2285,12 +2382,14 @@ famfs_logplay(
 
 	role = (client_mode) ? FAMFS_CLIENT : famfs_get_role(sb);
 
-	if (strlen(shadow) > 0)
+	if (strlen(shadow) > 0) {
 		rc = __famfs_logplay(shadow, logp, dry_run,
 				     1 /* Shadow mode */,
 				     shadowtest,
 				     role, verbose);
-	else
+		if (rc >= 0 && !dry_run)
+			famfs_fuse_negcache_invalidate(shadow, verbose);
+	} else
 		rc = __famfs_logplay(mpt_out, logp, dry_run,
 				     0 /* not shadow mode */,
 				     0 /* not shadowtest mode */,
@@ -2314,18 +2413,42 @@ err_out:
  * Log maintenance / append
  */
 
+/**
+ * famfs_log_flush_tail()
+ *
+ * Flush the log header and the last @nentries log entries, with one fence
+ */
+static void
+famfs_log_flush_tail(struct famfs_log *logp, u64 nentries)
+{
+	struct iovec iov[2];
+
+	assert(nentries <= logp->famfs_log_next_index);
+
+	iov[0].iov_base = logp;
+	iov[0].iov_len = offsetof(struct famfs_log, entries);
+	iov[1].iov_base = &logp->entries[logp->famfs_log_next_index - nentries];
+	iov[1].iov_len = nentries * sizeof(struct famfs_log_entry);
+	flush_processor_cache_v(iov, 2);
+}
+
 /**
  * famfs_append_log()
  *
- * @logp: pointer to struct famfs_log in memory media
- * @e:    pointer to log entry in memory
+ * @logp:   pointer to struct famfs_log in memory media
+ * @e:      pointer to log entry in memory
+ * @nflush: number of log entries to flush, ending with this one (i.e. this
+ *          entry plus nflush - 1 entries whose flush was deferred), along
+ *          with the log header. If 0, the caller must flush later - see
+ *          famfs_log_batch_flush()
  *
  * NOTE: this function is not re-entrant. Must hold a lock or mutexj
  * when calling this function if there is any chance of re-entrancy.
  */
 static int
 famfs_append_log(struct famfs_log       *logp,
-		 struct famfs_log_entry *e)
+		 struct famfs_log_entry *e,
+		 u64                     nflush)
 {
 	assert(logp);
 	assert(e);
@@ -2340,19 +2463,64 @@ famfs_append_log(struct famfs_log       *logp,
 	logp->famfs_log_next_seqnum++;
 	logp->famfs_log_next_index++;
 
-	/* Could flush: 1) the log entry, 2) the log header
-	 * That would be less flushing, but would not guarantee that the entry
-	 * is visible before the log header. If the log header becomes visible
-	 * first (leading to reading a cache-incoherent log entry), the checksum
-	 * on the log entry will save us - and the logplay can be retried.
-	 *
-	 * But now we're just flushing the whole log every time...
+	/* Flush just the new entries and the log header, as one batch. This
+	 * does not guarantee that the entries are visible before the log
+	 * header. If the log header becomes visible first (leading to reading
+	 * a cache-incoherent log entry), the checksum on the log entry will
+	 * save us - and the logplay can be retried.
 	 */
-	flush_processor_cache(logp, logp->famfs_log_len);
+	if (nflush)
+		famfs_log_flush_tail(logp, nflush);
 
 	return 0;
 }
 
+/**
+ * famfs_log_batch_flush()
+ *
+ * Flush log entries whose flush was deferred by lp->log_batch
+ */
+void
+famfs_log_batch_flush(struct famfs_locked_log *lp)
+{
+	if (!lp->log_unflushed)
+		return;
+	famfs_log_flush_tail(lp->logp, lp->log_unflushed);
+	lp->log_unflushed = 0;
+}
+
+/**
+ * famfs_log_nflush()
+ *
+ * The nflush argument to famfs_append_log() under a locked log: 1, or 0
+ * (deferred) if lp->log_batch is set. Each deferred append that succeeds
+ * must be followed by famfs_log_appended().
+ */
+static u64
+famfs_log_nflush(const struct famfs_locked_log *lp)
+{
+	return (lp->log_batch) ? 0 : 1;
+}
+
+/**
+ * famfs_log_appended()
+ *
+ * Called after a successful append under a locked log. With lp->log_batch
+ * set, the entry's flush was deferred; every log_batch'th entry flushes the
+ * batch. The rest are flushed by famfs_log_batch_flush() (which
+ * famfs_release_locked_log() calls before dropping the lock). Until then,
+ * other hosts may not see the deferred entries yet. Failed appends are not
+ * counted, so the count always matches the unflushed tail of the log.
+ */
+static void
+famfs_log_appended(struct famfs_locked_log *lp)
+{
+	if (!lp->log_batch)
+		return;
+	if (++lp->log_unflushed >= lp->log_batch)
+		famfs_log_batch_flush(lp);
+}
+
 
 /**
  * famfs_relpath_from_fullpath()
@@ -2408,7 +2576,8 @@ famfs_log_file_creation(
 	uid_t                        uid,
 	gid_t                        gid,
 	size_t                       size,
-	int                          dump_meta)
+	int                          dump_meta,
+	u64                          nflush)
 {
 	struct famfs_log_entry le = {0};
 	struct famfs_log_file_meta *fm = &le.famfs_fm;
@@ -2442,7 +2611,7 @@ famfs_log_file_creation(
 	if (dump_meta)
 		famfs_emit_file_yaml(fm, stdout);
 
-	return famfs_append_log(logp, &le);
+	return famfs_append_log(logp, &le, nflush);
 }
 
 /**
@@ -2458,7 +2627,8 @@ famfs_log_dir_creation(
 	const char                 *relpath,
 	mode_t                      mode,
 	uid_t                       uid,
-	gid_t                       gid)
+	gid_t                       gid,
+	u64                         nflush)
 {
 	struct famfs_log_entry le = {0};
 	struct famfs_log_mkdir *md = &le.famfs_md;
@@ -2479,7 +2649,7 @@ famfs_log_dir_creation(
 	md->md_uid  = uid;
 	md->md_gid  = gid;
 
-	return famfs_append_log(logp, &le);
+	return famfs_append_log(logp, &le, nflush);
 }
 
 /**
@@ -3172,6 +3342,148 @@ out_umount:
 	return rc;
 }
 
+/*
+ * Get the allocation summary that famfs_fused keeps up to date from the log.
+ * Fails if there is no daemon, or it has no summary (e.g. no daxdev).
+ */
+static int
+famfs_df_from_daemon(
+	const char *path,
+	struct famfs_alloc_summary *as,
+	int verbose)
+{
+	char shadow[PATH_MAX];
+	char sock_path[PATH_MAX];
+	char *response = NULL;
+	char *line, *saveptr;
+	long code = 0;
+	int valid = 0;
+	int rc;
+
+	if (famfs_get_shadow_from_xattr(path, shadow, sizeof(shadow)) < 0)
+		return -1;
+	rc = snprintf(sock_path, sizeof(sock_path), "%s/sock", shadow);
+	if (rc < 0 || rc >= (int)sizeof(sock_path))
+		return -1;
+
+	rc = famfs_http_get_uds(sock_path, "/alloc_stats", &response, NULL,
+				&code);
+	if (rc || code != 200 || !response) {
+		if (verbose)
+			printf("%s: rc=%d http=%ld\n", __func__, rc, code);
+		free(response);
+		return -1;
+	}
+
+	memset(as, 0, sizeof(*as));
+	for (line = strtok_r(response, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		char key[32];
+		unsigned long long val;
+
+		if (sscanf(line, " %31[a-z_]: %llu", key, &val) != 2)
+			continue;
+		if (!strcmp(key, "valid"))
+			valid = (int)val;
+		else if (!strcmp(key, "alloc_unit"))
+			as->alloc_unit = val;
+		else if (!strcmp(key, "total"))
+			as->total = val;
+		else if (!strcmp(key, "used"))
+			as->used = val;
+		else if (!strcmp(key, "free"))
+			as->free = val;
+		else if (!strcmp(key, "largest_free"))
+			as->largest_free = val;
+		else if (!strcmp(key, "files"))
+			as->nfiles = val;
+		else if (!strcmp(key, "log_index"))
+			as->log_index = val;
+		else if (!strcmp(key, "errors"))
+			as->errors = val;
+	}
+	free(response);
+	return (valid && as->total) ? 0 : -1;
+}
+
+/**
+ * famfs_df()
+ *
+ * Get the allocation summary (total, used, free, largest free extent) of
+ * the famfs file system that contains @path
+ *
+ * On a famfs-fuse mount, famfs_fused keeps the summary up to date as it
+ * tails the log, and we just ask for it. Otherwise (or if the daemon isn't
+ * tailing the log) the log is scanned.
+ *
+ * @path:        any path within a mounted famfs file system
+ * @as:          output: the summary
+ * @from_daemon: output (optional): 1 if the summary came from famfs_fused
+ * @verbose:
+ */
+int
+famfs_df(
+	const char *path,
+	struct famfs_alloc_summary *as,
+	int *from_daemon,
+	int verbose)
+{
+	struct famfs_superblock *sb;
+	struct famfs_alloc_map am;
+	struct famfs_log *logp;
+	int famfs_type;
+	int rc;
+
+	if (from_daemon)
+		*from_daemon = 0;
+
+	famfs_type = file_is_famfs(path);
+	if (famfs_type == NOT_FAMFS) {
+		fprintf(stderr, "%s: %s is not in a famfs file system\n",
+			__func__, path);
+		return -1;
+	}
+
+	if (famfs_type == FAMFS_FUSE &&
+	    famfs_df_from_daemon(path, as, verbose) == 0) {
+		if (from_daemon)
+			*from_daemon = 1;
+		return 0;
+	}
+
+	sb = famfs_map_superblock_by_path(path, true /* check sb */,
+					  1 /* read only */);
+	if (!sb) {
+		fprintf(stderr, "%s: failed to map superblock from %s\n",
+			__func__, path);
+		return -1;
+	}
+	logp = famfs_map_log_by_path(path, 1 /* read only */,
+				     true /* check_log */, NO_LOCK);
+	if (!logp) {
+		fprintf(stderr, "%s: failed to map log from %s\n",
+			__func__, path);
+		munmap(sb, FAMFS_SUPERBLOCK_SIZE);
+		return -1;
+	}
+
+	rc = famfs_alloc_map_init(&am, sb->ts_alloc_unit,
+				  sb->ts_daxdev.dd_size, sb->ts_log_len);
+	if (rc) {
+		fprintf(stderr, "%s: bad superblock geometry (%d)\n",
+			__func__, rc);
+		goto out;
+	}
+	famfs_alloc_map_apply(&am, logp, 0, logp->famfs_log_next_index);
+	famfs_alloc_map_summary(&am, as);
+	famfs_alloc_map_free(&am);
+
+out:
+	munmap(logp, sb->ts_log_len);
+	munmap(sb, FAMFS_SUPERBLOCK_SIZE);
+	return rc;
+}
+
 /**
  * famfs_validate_superblock_by_path()
  *
@@ -3352,7 +3664,7 @@ __famfs_init_locked_log(
 	lp->logp = (struct famfs_log *)addr;
 
 	if (thread_ct > 0)
-		lp->thp = thpool_init(thread_ct);
+		lp->thp = famfs_wsp_create(thread_ct);
 
 #if 1
 	/* XXX Been occasionally hitting this assert; get more info */
@@ -3415,7 +3727,7 @@ err_out:
 	if (lp->lfd)
 		close(lp->lfd);
 	if (lp->thp)
-		famfs_thpool_destroy(lp->thp, 100000 /* 100ms */);
+		famfs_wsp_destroy(lp->thp, 1);
 	if (addr)
 		munmap(addr, log_size);
 	if (lp->shadow_root)
@@ -3459,6 +3771,8 @@ famfs_release_locked_log(struct famfs_locked_log *lp, int abort, int verbose)
 	if (lp->bitmap)
 		free(lp->bitmap);
 
+	famfs_log_batch_flush(lp);
+
 	assert(lp->lfd > 0);
 	rc = flock(lp->lfd, LOCK_UN);
 	if (rc)
@@ -3478,9 +3792,8 @@ famfs_release_locked_log(struct famfs_locked_log *lp, int abort, int verbose)
 			printf("%s: waiting for threadpool to complete\n",
 			       __func__);
 
-		if (!abort)
-			thpool_wait(lp->thp);
-		famfs_thpool_destroy(lp->thp, 100000);
+		/* Without abort, this waits for all queued work */
+		famfs_wsp_destroy(lp->thp, abort);
 		if (verbose)
 			printf("%s: threadpool work complete\n",
 			       __func__);	
@@ -3738,6 +4051,8 @@ famfs_shadow_file_create(
  * @open_existing: If true, and the file already exists and is the right size,
  *                 a file descriptor for the file will be returned. This is
  *                 useful for restarting failed __famfs_cp()
+ * @fmap_out:    - If non-NULL, receives the fmap of a newly allocated file
+ *                 (zeroed if an existing file was opened)
  * @verbose
  *
  * Returns an open file descriptor if successful.
@@ -3746,8 +4061,8 @@ famfs_shadow_file_create(
  * <0 - The operation failed due to a fatal condition like log full or out
  *      of space, so multi-file operations should abort
  */
-int
-__famfs_mkfile(
+static int
+__famfs_mkfile_fmap(
 	struct famfs_locked_log *lp,
 	const char              *filename,
 	mode_t                   mode,
@@ -3755,6 +4070,7 @@ __famfs_mkfile(
 	gid_t                    gid,
 	size_t                   size,
 	int                      open_existing,
+	struct famfs_log_fmap   *fmap_out,
 	int                      verbose)
 {
 	struct famfs_log_fmap *fmap = NULL;
@@ -3771,6 +4087,9 @@ __famfs_mkfile(
 	assert(size > 0);
 	assert(cwd);
 
+	if (fmap_out)
+		memset(fmap_out, 0, sizeof(*fmap_out));
+
 	if (verbose)
 		printf("%s: %d open files\n", __func__, count_open_fds());
 
@@ -3953,12 +4272,16 @@ __famfs_mkfile(
 	/* Log the file creation */
 	rc = famfs_log_file_creation(logp, fmap,
 				     relpath, mode, uid, gid, size,
-				     (verbose > 1) ? 1:0 /* dump metadata */);
+				     (verbose > 1) ? 1:0 /* dump metadata */,
+				     famfs_log_nflush(lp));
 	if (rc)
 		return rc;
+	famfs_log_appended(lp);
 
 
 out:
+	if (fmap && fmap_out && fd > 0)
+		*fmap_out = *fmap;
 	if (fmap)
 		free(fmap);
 	if (cwd)
@@ -3969,6 +4292,21 @@ out:
 	return fd;
 }
 
+int
+__famfs_mkfile(
+	struct famfs_locked_log *lp,
+	const char              *filename,
+	mode_t                   mode,
+	uid_t                    uid,
+	gid_t                    gid,
+	size_t                   size,
+	int                      open_existing,
+	int                      verbose)
+{
+	return __famfs_mkfile_fmap(lp, filename, mode, uid, gid, size,
+				   open_existing, NULL, verbose);
+}
+
 /**
  * famfs_mkfile()
  *
@@ -4175,7 +4513,10 @@ __famfs_mkdir(
 	}
 
 	/* Should it be logged before it's locally created? */
-	rc = famfs_log_dir_creation(lp->logp, relpath, mode, uid, gid);
+	rc = famfs_log_dir_creation(lp->logp, relpath, mode, uid, gid,
+				    famfs_log_nflush(lp));
+	if (rc == 0)
+		famfs_log_appended(lp);
 
 err_out:
 	if (dirdupe)
@@ -4351,63 +4692,172 @@ struct copy_files {
 	char *destp;
 	int nchunks;
 	int refcount;
+	size_t size;
 	int compare; /* rather than copying, compare src and dest */
+	int cached;  /* pread straight into dest and flush, not streaming */
+	int rc;      /* error from any unit */
 	pthread_mutex_t mutex;
 };
 
 struct copy_data {
 	struct copy_files *cf;
-	size_t offset;
-	size_t size;
+	struct famfs_cp_unit u;
 	int verbose;
+	int rc;
 };
 
-static int
-__famfs_copy_file_data(struct copy_data *cp)
+#define CP_READ_SIZE 0x100000 /* 1 MiB source reads */
+
+/* A unit being copied by the thread pool is split into ranges of this many
+ * bytes when other threads are idle (e.g. at the end of a cp, or when one
+ * big file is copied along with many small ones) */
+#define CP_SPLIT_GRAIN (16 * 0x100000)
+
+/* Source read and destination store totals of the current cp, for
+ * progress output */
+static struct {
+	uint64_t start_ns;
+	uint64_t bytes_read;
+	uint64_t bytes_stored;
+} cp_stats;
+
+static uint64_t
+famfs_cp_now(void)
 {
-	size_t chunksize, remainder, offset;
-	char *readbuf = NULL;
-	pid_t pid = gettid();
-	int cleanup = 0;
-	ssize_t bytes;
-	char *destp;
-	int rc = 0;
-	int i;
+	struct timespec ts;
 
-	assert(cp);
-	assert(cp->cf);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-	if (cp->cf->srcfd > 0 && cp->cf->destfd > 0)
-		goto files_are_open;
+static void
+famfs_cp_stats_reset(void)
+{
+	__atomic_store_n(&cp_stats.bytes_read, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cp_stats.bytes_stored, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cp_stats.start_ns, famfs_cp_now(), __ATOMIC_RELAXED);
+}
 
-	/* If this is the first thread to work on this file pair, the files
-	 * will not be open yet. Take care of that...
-	 */
-	pthread_mutex_lock(&cp->cf->mutex);
-	if (!cp->cf->srcfd) {
-		cp->cf->srcfd = open(cp->cf->srcname, O_RDONLY, 0);
-		if (cp->cf->srcfd < 0) {
-			fprintf(stderr, "%s: failed to open source file %s\n",
-				__func__, cp->cf->srcname);
-			/* XXX post the error somehow? */
-			goto out_locked;
-		}
+/* "read 1024 MiB at 2048 MiB/s, stored 1000 MiB at 2000 MiB/s" */
+static void
+famfs_cp_stats_str(char *buf, size_t len)
+{
+	uint64_t rd = __atomic_load_n(&cp_stats.bytes_read, __ATOMIC_RELAXED);
+	uint64_t st = __atomic_load_n(&cp_stats.bytes_stored,
+				      __ATOMIC_RELAXED);
+	uint64_t start = __atomic_load_n(&cp_stats.start_ns, __ATOMIC_RELAXED);
+	double secs = (start) ? (famfs_cp_now() - start) / 1e9 : 0;
+	double mib = 1024.0 * 1024.0;
+
+	if (secs <= 0)
+		secs = 1e-9;
+	if (cp_compare)
+		snprintf(buf, len, "read %.0f MiB at %.0f MiB/s",
+			 rd / mib, rd / mib / secs);
+	else
+		snprintf(buf, len, "read %.0f MiB at %.0f MiB/s, "
+			 "stored %.0f MiB at %.0f MiB/s",
+			 rd / mib, rd / mib / secs, st / mib, st / mib / secs);
+}
+
+/* Each copy thread gets its own io_uring reader the first time it copies
+ * something big enough to need one; it is freed when the thread exits */
+static __thread struct famfs_uring_reader *cp_reader;
+static __thread int cp_reader_unavailable;
+static pthread_once_t cp_reader_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cp_reader_key;
+
+static void
+famfs_cp_reader_free(void *arg)
+{
+	famfs_uring_reader_destroy(arg);
+	free(arg);
+}
+
+static void
+famfs_cp_reader_key_init(void)
+{
+	pthread_key_create(&cp_reader_key, famfs_cp_reader_free);
+}
+
+/* This thread's reader, or NULL if cp should use pread() */
+static struct famfs_uring_reader *
+famfs_cp_get_reader(void)
+{
+	struct famfs_uring_reader *rd;
+	int rc;
+
+	if (!cp_qdepth || cp_reader || cp_reader_unavailable)
+		return (cp_qdepth) ? cp_reader : NULL;
+
+	rd = calloc(1, sizeof(*rd));
+	if (!rd) {
+		cp_reader_unavailable = 1;
+		return NULL;
 	}
-	pthread_mutex_unlock(&cp->cf->mutex);
+	rc = famfs_uring_reader_init(rd, cp_qdepth, CP_READ_SIZE);
+	if (rc) {
+		famfs_log(FAMFS_LOG_DEBUG,
+			  "%s: io_uring unavailable (%d); using pread\n",
+			  __func__, rc);
+		free(rd);
+		cp_reader_unavailable = 1;
+		return NULL;
+	}
+	pthread_once(&cp_reader_once, famfs_cp_reader_key_init);
+	pthread_setspecific(cp_reader_key, rd);
+	cp_reader = rd;
+	return rd;
+}
 
-files_are_open:
-	/* Copy the data */
-	chunksize = 0x100000; /* 1 MiB copy chunks */
-	offset = cp->offset;
-	remainder = cp->size;
-	destp = cp->cf->destp;
+/* Store (or compare) one buffer of source data at @offset in the dest */
+static int
+famfs_cp_consume(void *arg, const char *buf, size_t len, off_t offset)
+{
+	struct copy_data *cp = arg;
+	char *destp = cp->cf->destp;
 
+	__atomic_add_fetch(&cp_stats.bytes_read, len, __ATOMIC_RELAXED);
 	if (cp->cf->compare) {
-		readbuf = malloc(chunksize);
-		assert(readbuf);
+		if (memcmp(&destp[offset], buf, len)) {
+			fprintf(stderr, "%s: %s: miscompare at offset %lx\n",
+				__func__, cp->cf->destname, offset);
+			return -1;
+		}
+		return 0;
 	}
 
-	for (i = 0 ; remainder > 0; i++) {
+	fcc_memcpy_nt(&destp[offset], buf, len);
+	__atomic_add_fetch(&cp_stats.bytes_stored, len, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Offset and length of piece @p of a unit (length 0 past the end of file) */
+static size_t
+famfs_cp_piece(const struct copy_data *cp, size_t p, size_t *offset)
+{
+	*offset = cp->u.offset + p * cp->u.stride;
+	if (*offset >= cp->cf->size)
+		return 0;
+	return MIN(cp->u.size, cp->cf->size - *offset);
+}
+
+/* Copy (or compare) one range with synchronous reads */
+static int
+famfs_cp_range_sync(
+	struct copy_data *cp,
+	char *readbuf,
+	size_t offset,
+	size_t size)
+{
+	size_t chunksize = CP_READ_SIZE;
+	size_t remainder = size;
+	char *destp = cp->cf->destp;
+	pid_t pid = gettid();
+	ssize_t bytes;
+	int rc;
+
+	while (remainder > 0) {
 		ssize_t cur_chunksize = MIN(chunksize, remainder);
 		char *tmp_readbuf = &destp[offset];
 
@@ -4415,11 +4865,11 @@ files_are_open:
 			printf("%s: %d copy %ld bytes at offset %lx\n",
 			       __func__, pid, cur_chunksize, offset);
 
-		if (cp->cf->compare)
+		if (readbuf)
 			tmp_readbuf = readbuf;
 
-		/* Read into mmapped destination for copy, or to a
-		 * local buffer for compare */
+		/* Read into the mmapped destination for a cached copy, or
+		 * to a local buffer */
 		bytes = pread(cp->cf->srcfd, tmp_readbuf, cur_chunksize,
 			      offset);
 		if (bytes < 0) {
@@ -4427,8 +4877,7 @@ files_are_open:
 				"ofs %ld cur_chunksize %ld remainder %ld\n",
 				__func__, offset, cur_chunksize, remainder);
 			fprintf(stderr, "rc=%ld errno=%d\n", bytes, errno);
-			rc = -1;
-			goto out;
+			return -1;
 		}
 		if (bytes < cur_chunksize) {
 			fprintf(stderr, "%s: short read: "
@@ -4437,32 +4886,153 @@ files_are_open:
 			assert(bytes == cur_chunksize);
 		}
 
-		if (cp->cf->compare) {
-			if (memcmp(&destp[offset], tmp_readbuf,
-				   cur_chunksize)) {
-				fprintf(stderr,
-					"%s: %s: miscompare in chunk %d\n",
-					__func__, cp->cf->destname, i);
-				rc = -1;
-				goto out;
-			}
-					
+		if (readbuf) {
+			rc = famfs_cp_consume(cp, readbuf, bytes, offset);
+			if (rc)
+				return rc;
+		} else {
+			__atomic_add_fetch(&cp_stats.bytes_read, bytes,
+					   __ATOMIC_RELAXED);
+			__atomic_add_fetch(&cp_stats.bytes_stored, bytes,
+					   __ATOMIC_RELAXED);
 		}
-			
 
 		/* Update offset and remainder */
 		offset += bytes;
 		remainder -= bytes;
 	}
-	if (!cp->cf->compare) {
-		/* Flush the processor cache for the dest file */
-		flush_processor_cache(destp, cp->size);
+	if (!cp->cf->compare && cp->cf->cached) {
+		/* Flush the processor cache for the dest range */
+		flush_processor_cache(&destp[offset - size], size);
+	}
+	return 0;
+}
+
+/* Bytes of source data in a unit */
+static size_t
+famfs_cp_unit_bytes(const struct copy_data *cp)
+{
+	size_t offset, total = 0;
+	size_t p;
+
+	for (p = 0; p < cp->u.npieces; p++)
+		total += famfs_cp_piece(cp, p, &offset);
+	return total;
+}
+
+/* If this is the first thread to work on this file pair, the source file
+ * will not be open yet. Take care of that... */
+static int
+famfs_cp_open_src(struct copy_data *cp)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&cp->cf->mutex);
+	if (!cp->cf->srcfd) {
+		cp->cf->srcfd = open(cp->cf->srcname, O_RDONLY, 0);
+		if (cp->cf->srcfd < 0) {
+			fprintf(stderr, "%s: failed to open source file %s\n",
+				__func__, cp->cf->srcname);
+			cp->cf->srcfd = 0;
+			rc = -1;
+		}
+	}
+	pthread_mutex_unlock(&cp->cf->mutex);
+	return rc;
+}
+
+/**
+ * famfs_cp_unit_range()
+ *
+ * Copy (or compare) bytes [@start, @end) of a unit, counting only the bytes
+ * of its pieces (i.e. @start and @end are not file offsets unless the unit
+ * is one piece). This is the body of a pool range task, so several threads
+ * may be working on different ranges of one unit.
+ */
+static int
+famfs_cp_unit_range(struct copy_data *cp, size_t start, size_t end)
+{
+	struct famfs_uring_range *ranges;
+	struct famfs_uring_reader *rd;
+	size_t offset, len, skip, p;
+	char *readbuf = NULL;
+	unsigned int n = 0;
+	int rc = 0;
+
+	if (start >= end)
+		return 0;
+	if (!cp->cf->srcfd && famfs_cp_open_src(cp))
+		return -1;
+
+	/* All pieces but the last are u.size bytes */
+	ranges = calloc(cp->u.npieces, sizeof(*ranges));
+	assert(ranges);
+	p = start / cp->u.size;
+	skip = start % cp->u.size;
+	for (; p < cp->u.npieces && start < end; p++) {
+		len = famfs_cp_piece(cp, p, &offset);
+		if (len <= skip)
+			break;
+		ranges[n].offset = offset + skip;
+		ranges[n].len = MIN(len - skip, end - start);
+		start += ranges[n].len;
+		skip = 0;
+		n++;
+	}
+
+	/* Ranges bigger than one read go through this thread's io_uring
+	 * reader (if there is one), which keeps cp_qdepth reads in flight
+	 * while completed buffers are stored. */
+	rd = (cp->cf->cached || n == 0 ||
+	      (n == 1 && ranges[0].len <= CP_READ_SIZE)) ?
+		NULL : famfs_cp_get_reader();
+	if (rd) {
+		rc = famfs_uring_read_ranges(rd, cp->cf->srcfd, ranges, n,
+					     famfs_cp_consume, cp);
+		if (rc) {
+			fprintf(stderr, "%s: %s failed: %s "
+				"ofs %ld rc=%d\n", __func__,
+				(cp->cf->compare) ? "compare" : "copy",
+				cp->cf->srcname, ranges[0].offset, rc);
+			rc = -1;
+		}
+		goto out;
+	}
+
+	/* Compare reads into a local buffer. Copy does too (unless cached),
+	 * and then streams the buffer into the destination with
+	 * non-temporal stores, which don't fill the cache with the
+	 * destination and leave nothing to flush. The buffer is reused for
+	 * every chunk, so it stays hot in this thread's cache. */
+	if (cp->cf->compare || !cp->cf->cached) {
+		rc = posix_memalign((void **)&readbuf, 64, CP_READ_SIZE);
+		assert(rc == 0);
+	}
+
+	for (p = 0; p < n; p++) {
+		rc = famfs_cp_range_sync(cp, readbuf, ranges[p].offset,
+					 ranges[p].len);
+		if (rc)
+			break;
 	}
 out:
+	free(readbuf);
+	free(ranges);
+	return rc;
+}
+
+/* Finish one unit: account for it and, if it was the last unit of the
+ * file, clean up the file pair. Frees @cp. */
+static int
+famfs_cp_unit_done(struct copy_data *cp)
+{
+	char *destp = cp->cf->destp;
+	int rc = cp->rc;
+	int cleanup = 0;
+
 	pthread_mutex_lock(&cp->cf->mutex);
-out_locked:
 	if (--cp->cf->refcount == 0) {
-		if (!rc)
+		if (!rc && !cp->cf->rc)
 			printf("famfs %s: 100%%: %s\n",
 			       (cp->cf->compare) ? "compare" : "cp",
 			       cp->cf->destname);
@@ -4472,44 +5042,143 @@ out_locked:
 				cp->cf->destname);
 		cleanup++;
 	} else if (cp->verbose) {
+		char stats[96];
 		int percent = ((cp->cf->nchunks - cp->cf->refcount) * 100) /
 			cp->cf->nchunks;
 
-		printf("progress:  %02d%%: %s\n", percent, cp->cf->destname);
+		famfs_cp_stats_str(stats, sizeof(stats));
+		printf("progress:  %02d%%: %s (%s)\n", percent,
+		       cp->cf->destname, stats);
 	}
-	pthread_mutex_unlock(&cp->cf->mutex);
-
 	if (rc)
-		fprintf(stderr, "famfs %s: error: %s\n",
-			(cp->cf->compare) ? "compare" : "cp",
-			cp->cf->destname);
+		cp->cf->rc = rc;
+	pthread_mutex_unlock(&cp->cf->mutex);
 
 	if (cleanup) {
 		/* cf is shared and can't be cleaned up until all threads
 		 * have finished with it */
 		free(cp->cf->srcname);
 		free(cp->cf->destname);
-		munmap(destp, cp->size);
+		munmap(destp, cp->cf->size);
 		if (cp->cf->srcfd > 0)
 			close(cp->cf->srcfd);
 		pthread_mutex_destroy(&cp->cf->mutex);
 		free(cp->cf);
 	}
 	free(cp); /* cp is not shared */
-	if (readbuf)
-		free(readbuf);
 	return rc;
 }
 
-/* This void/void wrapper is needed by the thread pool */
-void
-__famfs_threaded_copy(void *arg)
+static int
+__famfs_copy_file_data(struct copy_data *cp)
+{
+	assert(cp);
+	assert(cp->cf);
+
+	cp->rc = famfs_cp_unit_range(cp, 0, famfs_cp_unit_bytes(cp));
+	return famfs_cp_unit_done(cp);
+}
+
+/* Pool range task: copy part of a unit. Once one part fails, the rest of
+ * the unit is skipped. */
+static void
+famfs_cp_range_task(void *arg, size_t start, size_t end)
+{
+	struct copy_data *cp = arg;
+	int rc;
+
+	if (__atomic_load_n(&cp->rc, __ATOMIC_RELAXED))
+		return;
+	rc = famfs_cp_unit_range(cp, start, end);
+	if (rc)
+		__atomic_store_n(&cp->rc, rc, __ATOMIC_RELAXED);
+}
+
+/* Pool range completion: runs once, after every part of the unit */
+static void
+famfs_cp_range_done(void *arg)
 {
-	__famfs_copy_file_data((struct copy_data *)arg);
+	famfs_cp_unit_done(arg);
 }
 
 #define CP_CHUNKSIZE (128 * 0x100000) /* 128 MiB */
 
+/**
+ * famfs_cp_plan()
+ *
+ * Divide the copy of a file into units of work, in the order they should be
+ * queued to the copy threads.
+ *
+ * A file that is interleaved (per its @fmap) is divided into units that each
+ * copy a run of chunks of one strip - which is contiguous in dax memory -
+ * and consecutive units are on different strips. Copy threads take units in
+ * queue order, so the threads that are active at the same time are spread
+ * across strips (and the buckets or devices behind them) rather than
+ * piling onto one strip, which is what CP_CHUNKSIZE ranges of file offsets
+ * do when the interleave chunk is small. A run is about CP_CHUNKSIZE.
+ *
+ * Other files (or an unknown @fmap) are divided into CP_CHUNKSIZE ranges.
+ *
+ * @size:      file size
+ * @fmap:      the destination's fmap (may be NULL)
+ * @units:     out: the units (may be NULL to just count them)
+ * @max_units: capacity of @units
+ *
+ * Returns the number of units
+ */
+size_t
+famfs_cp_plan(
+	size_t size,
+	const struct famfs_log_fmap *fmap,
+	struct famfs_cp_unit *units,
+	size_t max_units)
+{
+	size_t nstrips = 0, chunk = 0, stripe, nstripes, run, g, s;
+	size_t n = 0;
+
+	if (fmap && fmap->fmap_ext_type == FAMFS_EXT_INTERLEAVE &&
+	    fmap->fmap_niext == 1) {
+		nstrips = fmap->ie[0].ie_nstrips;
+		chunk = fmap->ie[0].ie_chunk_size;
+	}
+
+	if (nstrips < 2 || !chunk) {
+		size_t offset;
+
+		for (offset = 0; offset < size; offset += CP_CHUNKSIZE) {
+			if (units && n < max_units) {
+				units[n].offset = offset;
+				units[n].size = MIN(CP_CHUNKSIZE, size - offset);
+				units[n].stride = 0;
+				units[n].npieces = 1;
+			}
+			n++;
+		}
+		return n;
+	}
+
+	stripe = nstrips * chunk;
+	nstripes = (size + stripe - 1) / stripe;
+	run = MAX(CP_CHUNKSIZE / chunk, 1); /* stripes per unit */
+
+	for (g = 0; g < nstripes; g += run) {
+		for (s = 0; s < nstrips; s++) {
+			size_t offset = g * stripe + s * chunk;
+
+			if (offset >= size)
+				break; /* The last stripe is partial */
+			if (units && n < max_units) {
+				units[n].offset = offset;
+				units[n].size = chunk;
+				units[n].stride = stripe;
+				units[n].npieces = MIN(run, nstripes - g);
+			}
+			n++;
+		}
+	}
+	return n;
+}
+
 static int
 famfs_copy_file_data(
 	struct famfs_locked_log *lp,
@@ -4518,12 +5187,14 @@ famfs_copy_file_data(
 	int srcfd,
 	int destfd,
 	size_t size,
+	const struct famfs_log_fmap *fmap,
 	int verbose)
 {
-	size_t chunk_size = (CP_CHUNKSIZE) ? CP_CHUNKSIZE : size;
-	size_t nchunks = (size + chunk_size - 1) / chunk_size;
+	struct famfs_cp_unit *units;
 	struct copy_files *cf;
 	struct copy_data *cp;
+	size_t nunits, i;
+	struct stat st;
 	int rc;
 
 	cf = calloc(1, sizeof(*cf));
@@ -4533,9 +5204,17 @@ famfs_copy_file_data(
 	cf->destname = strdup(destname);
 	cf->srcfd = srcfd;
 	cf->destfd = destfd;
+	cf->size = size;
 	cf->compare = (cp_compare) ? 1 : 0; /* compare mode... */
+	cf->cached = (cp_cached) ? 1 : 0;
 	pthread_mutex_init(&cf->mutex, NULL);
 
+	/* Storing to a mapping past the end of the dest file would SIGBUS;
+	 * pread() into the mapping fails the copy with EFAULT instead */
+	if (!cf->cached && !cf->compare &&
+	    (fstat(destfd, &st) || (size_t)st.st_size < size))
+		cf->cached = 1;
+
 	/* Memory map the entire file, to be used by the threadpool
 	 *
 	 * If it ever turns out that we can map all the files at once,
@@ -4550,14 +5229,14 @@ famfs_copy_file_data(
 			 MAP_SHARED, destfd, 0);
 	assert(cf->destp != MAP_FAILED);
 
-	/* if thpool_add_work returns an error, fall back */
 	if (lp->thp) {
-		size_t remainder, offset, this_chunk;
+		nunits = famfs_cp_plan(size, fmap, NULL, 0);
+		units = calloc(nunits, sizeof(*units));
+		assert(units);
+		famfs_cp_plan(size, fmap, units, nunits);
 
-		remainder = size;
-		offset = 0;
-		cf->refcount = nchunks;
-		cf->nchunks = nchunks;
+		cf->refcount = nunits;
+		cf->nchunks = nunits;
 
 		/* With threaded cp, we can have hundreds or thousands of
 		 * source/destination pairs queued to be copied by the
@@ -4575,36 +5254,33 @@ famfs_copy_file_data(
 		cf->srcfd = 0;
 		cf->destfd = 0;
 
-		if (verbose && nchunks > 1)
+		if (verbose && nunits > 1)
 			printf("famfs cp: %s: "
-			       "%ld bytes, %ld chunks in threaded copy\n",
-			       destname, size, nchunks);
+			       "%ld bytes, %ld chunks in threaded copy%s\n",
+			       destname, size, nunits,
+			       (units[0].stride) ? " (by strip)" : "");
 
-		for (; remainder > 0; ) {
+		for (i = 0; i < nunits; i++) {
 			cp = calloc(1, sizeof(*cp));
 			assert(cp);
 
-			this_chunk = MIN(remainder, chunk_size);
-
 			cp->cf = cf;
 			cp->verbose = verbose;
+			cp->u = units[i];
 
-			cp->offset = offset;
-			cp->size = this_chunk;
-
-			/* cp is freed by __famfs_threaded_copy() */
+			/* cp is freed by famfs_cp_range_done() */
 			if (mock_threadpool)
 				rc = __famfs_copy_file_data(cp);
 			else
-				rc = thpool_add_work(lp->thp,
-						     __famfs_threaded_copy,
-						     cp);
+				rc = famfs_wsp_submit_range(lp->thp, NULL,
+					famfs_cp_range_task,
+					famfs_cp_range_done, cp,
+					0, famfs_cp_unit_bytes(cp),
+					CP_SPLIT_GRAIN);
 
 			assert(rc == 0);
-
-			remainder -= this_chunk;
-			offset += this_chunk;
 		}
+		free(units);
 		return 0;
 	}
 
@@ -4613,8 +5289,9 @@ famfs_copy_file_data(
 
 	cf->refcount = 1;
 	cp->cf = cf;
-	cp->offset = 0;
-	cp->size = size;
+	cp->u.offset = 0;
+	cp->u.size = size;
+	cp->u.npieces = 1;
 	cp->verbose = verbose;
 
 	return __famfs_copy_file_data(cp);
@@ -4655,6 +5332,7 @@ __famfs_cp(
 	gid_t                     gid,
 	int                       verbose)
 {
+	struct famfs_log_fmap fmap;
 	int rc, srcfd, destfd;
 	struct stat srcstat;
 
@@ -4713,18 +5391,18 @@ __famfs_cp(
 	/* Create the destination file; if it exists and is the right size,
 	 * go ahead and copy into it...
 	 */
-	destfd = __famfs_mkfile(lp, destfile,
-				(mode == 0) ? (srcstat.st_mode & 0777) : mode,
-				uid, gid, srcstat.st_size,
-				1, /* accept existing file if size is right */
-				verbose);
+	destfd = __famfs_mkfile_fmap(lp, destfile,
+				     (mode == 0) ? (srcstat.st_mode & 0777) :
+				     mode, uid, gid, srcstat.st_size,
+				     1, /* accept existing file if size is right */
+				     &fmap, verbose);
 	if (destfd <= 0)
 		return destfd;
 
 	/* famfs_copy_file_data will close the file descriptors and unmap
 	 * the destination when it finishes */
 	return famfs_copy_file_data(lp, srcfile, destfile, srcfd, destfd,
-				    srcstat.st_size, verbose);
+				    srcstat.st_size, &fmap, verbose);
 }
 
 /**
@@ -4814,6 +5492,228 @@ famfs_cp(struct famfs_locked_log *lp,
 	return __famfs_cp(lp, srcfile, actual_destfile, mode, uid, gid, verbose);
 }
 
+/*
+ * famfs cp -r pipeline
+ *
+ * Walker threads read source directories (readdir and stat of every entry)
+ * and queue each directory's entries to the committer - the thread that
+ * called famfs_cp_dir(), which holds the locked log. The committer creates
+ * the destination directories and files in queue order and hands each
+ * file's data copy to the cp thread pool as soon as the file exists. A
+ * source subdirectory is queued to the walkers once its destination
+ * directory exists, so parents are always created before their children,
+ * and the walkers stay ahead of the committer on big trees.
+ *
+ * Log appends during the walk are flushed every CP_LOG_BATCH entries
+ * rather than one at a time (see famfs_log_appended()).
+ */
+#define CP_WALK_THREADS 4
+#define CP_LOG_BATCH    64
+
+struct cp_walk_ent {
+	char *name;
+	struct stat st;
+	int stat_err;
+};
+
+struct cp_walk;
+
+struct cp_walk_dir {
+	struct cp_walk_dir *next;
+	struct cp_walk *walk;
+	char *src;
+	char *dest;
+	mode_t mode;               /* passed to famfs_cp() for files */
+	struct cp_walk_ent *ents;
+	size_t nents;
+	int err;                   /* couldn't read the source dir */
+};
+
+struct cp_walk {
+	struct famfs_wsp *wsp;     /* walkers (NULL: the committer walks) */
+	struct famfs_wsp_group group;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct cp_walk_dir *head;  /* read, waiting for the committer */
+	struct cp_walk_dir **tail;
+	u64 outstanding;           /* queued to walkers, not read yet */
+	int abort;
+};
+
+static void
+famfs_cp_walk_dir_free(struct cp_walk_dir *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->nents; i++)
+		free(d->ents[i].name);
+	free(d->ents);
+	free(d->src);
+	free(d->dest);
+	free(d);
+}
+
+/* Walker: read a source directory and queue it to the committer */
+static void
+famfs_cp_walk_read(void *arg)
+{
+	struct cp_walk_dir *d = arg;
+	struct cp_walk *w = d->walk;
+	struct dirent *entry;
+	size_t max = 0;
+	DIR *directory;
+
+	if (__atomic_load_n(&w->abort, __ATOMIC_RELAXED))
+		goto queue;
+
+	directory = opendir(d->src);
+	if (directory == NULL) {
+		fprintf(stderr, "%s: failed to open src dir (%s)\n",
+			__func__, d->src);
+		d->err = 1;
+		goto queue;
+	}
+
+	while ((entry = readdir(directory)) != NULL) {
+		char srcfullpath[PATH_MAX];
+		struct cp_walk_ent *e;
+
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		if (d->nents == max) {
+			max = (max) ? max * 2 : 64;
+			d->ents = realloc(d->ents, max * sizeof(*d->ents));
+			assert(d->ents);
+		}
+		e = &d->ents[d->nents++];
+		memset(e, 0, sizeof(*e));
+		e->name = strdup(entry->d_name);
+		assert(e->name);
+
+		snprintf(srcfullpath, PATH_MAX - 1, "%s/%s",
+			 d->src, entry->d_name);
+		if (stat(srcfullpath, &e->st)) {
+			fprintf(stderr, "%s: failed to stat source path (%s)\n",
+				__func__, srcfullpath);
+			e->stat_err = 1;
+		}
+	}
+	closedir(directory);
+
+queue:
+	pthread_mutex_lock(&w->mutex);
+	*w->tail = d;
+	w->tail = &d->next;
+	w->outstanding--;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/* Queue source dir @src (whose destination @dest exists) to the walkers */
+static void
+famfs_cp_walk_queue(
+	struct cp_walk *w,
+	const char *src,
+	const char *dest,
+	mode_t mode)
+{
+	struct cp_walk_dir *d = calloc(1, sizeof(*d));
+
+	assert(d);
+	d->walk = w;
+	d->src = strdup(src);
+	d->dest = strdup(dest);
+	d->mode = mode;
+	assert(d->src && d->dest);
+
+	pthread_mutex_lock(&w->mutex);
+	w->outstanding++;
+	pthread_mutex_unlock(&w->mutex);
+
+	if (!w->wsp || famfs_wsp_submit(w->wsp, &w->group,
+					famfs_cp_walk_read, d))
+		famfs_cp_walk_read(d);
+}
+
+/**
+ * famfs_cp_commit_dir()
+ *
+ * Committer: create the destination files and directories for the entries
+ * of one source directory, and start the file data copies
+ *
+ * Returns 0, >0 if something failed but the copy should continue, or <0 if
+ * the copy should be aborted
+ */
+static int
+famfs_cp_commit_dir(
+	struct famfs_locked_log *lp,
+	struct cp_walk *w,
+	const struct cp_walk_dir *d,
+	uid_t uid,
+	gid_t gid,
+	int verbose)
+{
+	int err = d->err;
+	size_t i;
+	int rc;
+
+	for (i = 0; i < d->nents; i++) {
+		const struct cp_walk_ent *e = &d->ents[i];
+		char srcfullpath[PATH_MAX];
+
+		if (e->stat_err) {
+			err = 1;
+			continue;
+		}
+
+		snprintf(srcfullpath, PATH_MAX - 1, "%s/%s", d->src, e->name);
+		if (verbose)
+			printf("famfs cp:  %s/%s\n", d->dest, e->name);
+
+		switch (e->st.st_mode & S_IFMT) {
+		case S_IFREG:
+			rc = famfs_cp(lp, srcfullpath, d->dest,
+				      d->mode, uid, gid, verbose);
+			if (rc < 0)
+				return rc;
+			if (rc)
+				err = 1; /* if anything failed, return 1 */
+			break;
+
+		case S_IFDIR: {
+			char newdirpath[PATH_MAX];
+			struct stat st;
+
+			snprintf(newdirpath, PATH_MAX - 1, "%s/%s",
+				 d->dest, e->name);
+			if (stat(newdirpath, &st)) {
+				rc = __famfs_mkdir(lp, newdirpath,
+						   e->st.st_mode & 0777,
+						   uid, gid, verbose);
+				if (rc == -ENOMEM)
+					return rc; /* Log full */
+				if (rc) {
+					/* Skip the subtree */
+					err = 1;
+					break;
+				}
+			}
+			famfs_cp_walk_queue(w, srcfullpath, newdirpath,
+					    e->st.st_mode & 0777);
+			break;
+		}
+		default:
+			fprintf(stderr,
+				"%s: error: skipping non-file or directory %s\n",
+				__func__, srcfullpath);
+			return -EINVAL;
+		}
+	}
+	return err;
+}
+
 /**
  * famfs_cp_dir()
  *
@@ -4837,11 +5737,12 @@ int famfs_cp_dir(
 	gid_t gid,
 	int verbose)
 {
-	struct dirent *entry;
-	DIR *directory;
+	u64 log_batch = lp->log_batch;
+	struct cp_walk_dir *d;
+	struct cp_walk w;
 	struct stat st;
-	int rc;
 	int err = 0;
+	int rc;
 
 	assert(lp);
 	if (verbose > 1)
@@ -4858,73 +5759,52 @@ int famfs_cp_dir(
 		}
 	}
 
-	directory = opendir(src);
-	if (directory == NULL) {
-		/* XXX is it possible to get here since we
-		 * created the dir if it didn't exist? */
-		fprintf(stderr, "%s: failed to open src dir (%s)\n",
-			__func__, src);
-		return 1;
-	}
-
-	/* Loop through the directry entries */
-	while ((entry = readdir(directory)) != NULL) {
-		char srcfullpath[PATH_MAX];
-		struct stat src_stat;
-
-		if (strcmp(entry->d_name, ".") == 0 ||
-		    strcmp(entry->d_name, "..") == 0)
-			continue;
-
-		snprintf(srcfullpath, PATH_MAX - 1, "%s/%s", src, entry->d_name);
-		rc = stat(srcfullpath, &src_stat);
-		if (rc) {
-			fprintf(stderr, "%s: failed to stat source path (%s)\n",
-				__func__, srcfullpath);
-			err = 1;
-			continue;
+	memset(&w, 0, sizeof(w));
+	pthread_mutex_init(&w.mutex, NULL);
+	pthread_cond_init(&w.cond, NULL);
+	famfs_wsp_group_init(&w.group);
+	w.tail = &w.head;
+	/* Walk in parallel unless this is a single-threaded (-t0) cp */
+	if (lp->thp)
+		w.wsp = famfs_wsp_create(CP_WALK_THREADS);
+
+	lp->log_batch = CP_LOG_BATCH;
+
+	famfs_cp_walk_queue(&w, src, dest, mode);
+	for (;;) {
+		pthread_mutex_lock(&w.mutex);
+		while (!w.head && w.outstanding)
+			pthread_cond_wait(&w.cond, &w.mutex);
+		d = w.head;
+		if (d) {
+			w.head = d->next;
+			if (!w.head)
+				w.tail = &w.head;
 		}
+		pthread_mutex_unlock(&w.mutex);
+		if (!d)
+			break; /* Everything has been read and committed */
 
-		if (verbose)
-			printf("famfs cp:  %s/%s\n", dest, entry->d_name);
-
-		switch (src_stat.st_mode & S_IFMT) {
-		case S_IFREG:
-			rc = famfs_cp(lp, srcfullpath, dest,
-				      mode, uid, gid, verbose);
+		/* After an abort, just drain what the walkers queued */
+		if (!w.abort) {
+			rc = famfs_cp_commit_dir(lp, &w, d, uid, gid, verbose);
 			if (rc < 0) {
 				err = rc;
-				goto bailout;
+				__atomic_store_n(&w.abort, 1, __ATOMIC_RELAXED);
+			} else if (rc && !err) {
+				err = 1;
 			}
-			if (rc)
-				err = 1; /* if anything failed, return 1 */
-			break;
-
-		case S_IFDIR: {
-			char newdirpath[PATH_MAX];
-			char *src_copy = strdup(srcfullpath);
-
-			snprintf(newdirpath, PATH_MAX - 1, "%s/%s",
-				 dest, basename(src_copy));
-			/* Recurse :D
-			 * Parent of newdirpath is guaranteed to exist, because
-			 * that's a property of this recursion
-			 */
-			rc = famfs_cp_dir(lp, srcfullpath, newdirpath,
-					  src_stat.st_mode & 0777,
-					  uid, gid, verbose);
-			free(src_copy);
-			break;
-		}
-		default:
-			fprintf(stderr,
-				"%s: error: skipping non-file or directory %s\n",
-				__func__, srcfullpath);
-			return -EINVAL;
 		}
+		famfs_cp_walk_dir_free(d);
 	}
-bailout:
-	closedir(directory);
+
+	famfs_wsp_destroy(w.wsp, 0);
+	famfs_wsp_group_destroy(&w.group);
+	pthread_cond_destroy(&w.cond);
+	pthread_mutex_destroy(&w.mutex);
+
+	famfs_log_batch_flush(lp);
+	lp->log_batch = log_batch;
 	return err;
 }
 
@@ -5077,6 +5957,7 @@ famfs_cp_multi(
 		free(dirdupe);
 		return rc;
 	}
+	famfs_cp_stats_reset();
 
 	if (s) {
 		if (verbose)
@@ -5163,6 +6044,13 @@ err_out:
 	free(dirdupe);
 	famfs_release_locked_log(&ll, (err < 0) ? 1 : 0, /* abort on err < 0 */
 				 verbose);
+	if (verbose) {
+		char stats[96];
+
+		famfs_cp_stats_str(stats, sizeof(stats));
+		printf("famfs %s: %s\n", (cp_compare) ? "compare" : "cp",
+		       stats);
+	}
 	free(dest_parent_path);
 	return err;
 }
@@ -5359,7 +6247,7 @@ famfs_clone(const char *srcfile,
 	rc = famfs_log_file_creation(logp, &fmap,
 				     relpath, src_stat.st_mode & 0777,
 				     src_stat.st_uid, src_stat.st_gid,
-				     filemap.file_size, 0);
+				     filemap.file_size, 0, 1);
 	if (rc) {
 		fprintf(stderr,
 			"%s: failed to log caller-specified allocation\n",
@@ -5466,8 +6354,9 @@ __famfs_mkfs(const char              *daxdev,
 	/* Calculate superblock crc */
 	sb->ts_crc = famfs_gen_superblock_crc(sb); /* gotta do this last! */
 
-	/* Zero and setup the log */
-	memset(logp, 0, log_len);
+	/* Zero and setup the log; the zeroes go straight to memory, so only
+	 * the header needs a flush below */
+	fcc_memset_nt(logp, 0, log_len);
 	logp->famfs_log_magic      = FAMFS_LOG_MAGIC;
 	logp->famfs_log_len        = log_len;
 	logp->famfs_log_next_seqnum = 0;
@@ -5481,8 +6370,8 @@ __famfs_mkfs(const char              *daxdev,
 	/* Could call mprotect() to switch to PROT_READ since writing is done */
 	famfs_fsck_scan(sb, logp, 1, 0, 0);
 
-	/* Force a writeback of the log followed by the superblock */
-	flush_processor_cache(logp, logp->famfs_log_len);
+	/* Force a writeback of the log header followed by the superblock */
+	flush_processor_cache(logp, offsetof(struct famfs_log, entries));
 	flush_processor_cache(sb, FAMFS_SUPERBLOCK_SIZE);
 	return 0;
 }
@@ -31,6 +31,9 @@
 
 #define FAMFS_YAML_MAX 16384
 
+/* Default number of io_uring source reads in flight per famfs cp thread */
+#define FAMFS_CP_QDEPTH 4
+
 struct famfs_interleave_param {
 	u64 nbuckets; /* Single backing daxdev will be split into this many allocation buckets */
 	u64 nstrips;
@@ -91,6 +94,23 @@ int famfs_fsck(const char *devname, bool nodax,
 	       int use_mmap, int human,
 	       int nbuckets, int verbose);
 
+/*
+ * Allocation summary of a famfs file system (famfs df, and statfs on a
+ * famfs-fuse mount)
+ */
+struct famfs_alloc_summary {
+	u64 alloc_unit;
+	u64 total;          /* bytes */
+	u64 used;           /* bytes allocated (including superblock and log) */
+	u64 free;
+	u64 largest_free;   /* largest free extent (bytes) */
+	u64 nfiles;
+	u64 log_index;      /* log entries accounted for */
+	u64 errors;         /* allocation collisions */
+};
+int famfs_df(const char *path, struct famfs_alloc_summary *as,
+	     int *from_daemon, int verbose);
+
 int famfs_mkmeta_standalone(const char *devname, int verbose);
 int __famfs_mkmeta_superblock(const char *mpt, int shadow, int verbose);
 int __famfs_mkmeta_log(const char *mpt, u64 log_offset, u64 log_size,
@@ -118,7 +138,15 @@ int famfs_mkfs(const char *daxdev, u64 log_len, int kill, bool nodax,
 	int force, int verbose);
 int famfs_check(const char *path, int verbose);
 
+struct famfs_flush_stats {
+	u64 nfiles;  /* files flushed */
+	u64 bytes;
+	u64 ns;      /* elapsed */
+};
+
 int famfs_flush_file(const char *filename, int verbose);
+int famfs_flush_files(int nfiles, char * const *files, int threadct,
+		      int verbose, struct famfs_flush_stats *stats);
 
 int file_not_famfs(const char *fname);
 
@@ -50,9 +50,25 @@ struct famfs_locked_log {
 	 * smaller allocations will use fewer strips)
 	 */
 	struct famfs_interleave_param interleave_param;
-	struct thpool_ *thp;
+	struct famfs_wsp *thp;       /* cp thread pool */
 	char *mpt;
 	char *shadow_root;
+	/* If log_batch is set, log appends only flush the log every
+	 * log_batch entries (see famfs_log_appended()) */
+	u64               log_batch;
+	u64               log_unflushed;
+};
+
+/*
+ * A unit of famfs cp work: @npieces ranges of @size bytes, each @stride
+ * bytes after the previous one, starting at @offset. Pieces are clipped at
+ * the end of the file.
+ */
+struct famfs_cp_unit {
+	size_t offset;
+	size_t size;
+	size_t stride;
+	size_t npieces;
 };
 
 struct famfs_log_stats {
@@ -82,6 +98,31 @@ u8 *famfs_build_bitmap(
 int famfs_file_alloc(struct famfs_locked_log *lp, u64 size,
 		     struct famfs_log_fmap **fmap_out, int verbose);
 void mu_print_bitmap(u8 *bitmap, int num_bits);
+
+/*
+ * Allocation bitmap that is kept up to date by applying new log entries
+ * (see famfs_alloc_map_apply()), rather than rebuilt from the whole log
+ */
+struct famfs_alloc_map {
+	u8  *bitmap;
+	u64  nbits;
+	u64  alloc_unit;
+	u64  dev_size;
+	u64  used;           /* bytes */
+	u64  nfiles;
+	u64  errors;         /* allocation collisions */
+	u64  next_index;     /* next log entry to apply */
+	u64  lfree_start;    /* largest free run (bits) */
+	u64  lfree_len;
+	int  lfree_stale;    /* an allocation hit the largest free run */
+};
+int famfs_alloc_map_init(struct famfs_alloc_map *am, u64 alloc_unit,
+			 u64 dev_size, u64 log_len);
+void famfs_alloc_map_apply(struct famfs_alloc_map *am,
+			   const struct famfs_log *logp, u64 start, u64 end);
+void famfs_alloc_map_summary(const struct famfs_alloc_map *am,
+			     struct famfs_alloc_summary *as);
+void famfs_alloc_map_free(struct famfs_alloc_map *am);
 int famfs_validate_interleave_param(
 		struct famfs_interleave_param *interleave_param,
 		const u64 alloc_unit, u64 devsize, int verbose);
@@ -131,18 +172,29 @@ int
 __famfs_mkfile(struct famfs_locked_log *lp, const char *filename,
 	       mode_t mode, uid_t uid, gid_t gid, size_t size,
 	       int open_existing, int verbose);
+size_t famfs_cp_plan(size_t size, const struct famfs_log_fmap *fmap,
+		     struct famfs_cp_unit *units, size_t max_units);
 int __famfs_mkdir(struct famfs_locked_log *lp, const char *dirpath, mode_t mode,
 		  uid_t uid, gid_t gid, int verbose);
 int famfs_init_locked_log(struct famfs_locked_log *lp, const char *fspath,
 			  int thread_ct, int verbose);
 int famfs_release_locked_log(struct famfs_locked_log *lp, int abort,
 			     int verbose);
+void famfs_log_batch_flush(struct famfs_locked_log *lp);
 int
 __famfs_logplay(
 	const char *mpt,
 	const struct famfs_log *logp,
 	int dry_run, int shadow, int shadowtest,
 	enum famfs_system_role role, int verbose);
+int
+__famfs_logplay_range(
+	const char *mpt,
+	const struct famfs_log *logp,
+	u64 start, u64 end,
+	int dry_run, int shadow, int shadowtest,
+	enum famfs_system_role role,
+	struct famfs_log_stats *ls, int verbose);
 int famfs_fsck_scan(const struct famfs_superblock *sb,
 		    const struct famfs_log *logp,
 		    int human, int nbuckets, int verbose);
@@ -152,6 +204,8 @@ void famfs_print_role_string(int role);
 int famfs_validate_log_entry(const struct famfs_log_entry *le, u64 index);
 int famfs_cp(struct famfs_locked_log *lp, const char *srcfile, const char *destfile,
 		mode_t mode, uid_t uid, gid_t gid, int verbose);
+int famfs_cp_dir(struct famfs_locked_log *lp, const char *src, const char *dest,
+		 mode_t mode, uid_t uid, gid_t gid, int verbose);
 
 /* famfs_misc.c */
 int check_file_exists(const char *basepath, const char *relpath,
@@ -6,14 +6,51 @@
 
 #include "famfs_log.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <syslog.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <errno.h>
 
-static unsigned int famfs_log_level = FAMFS_LOG_NOTICE;
+/* Read (without a call) by the famfs_log() macro */
+unsigned int famfs_log_threshold = FAMFS_LOG_NOTICE;
 
 static bool to_syslog = true;
 
+/*
+ * Asynchronous syslog
+ *
+ * When enabled (famfs_log_enable_async()), the caller only formats the
+ * message into a bounded queue; a logger thread makes the syslog() calls,
+ * so hot threads don't wait for syslog's lock and socket write. If the
+ * queue is full, messages are dropped and counted, rather than blocking.
+ */
+#define FAMFS_LOG_MSG_MAX 512
+
+struct famfs_log_amsg {
+	int level;
+	char msg[FAMFS_LOG_MSG_MAX];
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct famfs_log_amsg *q;
+	unsigned int size;
+	unsigned int head;      /* next to write */
+	unsigned int count;
+	uint64_t dropped;
+	int running;
+	int stop;
+	pthread_t thread;
+} alog = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
 char *famfs_log_level_strings[] = {
 	"FAMFS_LOG_EMERG",
 	"FAMFS_LOG_ALERT",
@@ -25,11 +62,129 @@ char *famfs_log_level_strings[] = {
 	"FAMFS_LOG_DEBUG",
 };
 
+/* Queue a message for the logger thread; returns false if not running */
+static bool famfs_log_async(enum famfs_log_level level, const char *fmt,
+			    va_list ap)
+{
+	char buf[FAMFS_LOG_MSG_MAX];
+
+	if (!__atomic_load_n(&alog.running, __ATOMIC_ACQUIRE))
+		return false;
+
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+
+	pthread_mutex_lock(&alog.mutex);
+	if (!alog.running) {
+		pthread_mutex_unlock(&alog.mutex);
+		syslog(level, "%s", buf);
+		return true;
+	}
+	if (alog.count == alog.size) {
+		alog.dropped++;
+	} else {
+		struct famfs_log_amsg *m = &alog.q[alog.head];
+
+		m->level = level;
+		strcpy(m->msg, buf);
+		alog.head = (alog.head + 1) % alog.size;
+		if (alog.count++ == 0)
+			pthread_cond_signal(&alog.cond);
+	}
+	pthread_mutex_unlock(&alog.mutex);
+	return true;
+}
+
+static void *famfs_log_thread(void *arg)
+{
+	struct famfs_log_amsg m;
+	uint64_t dropped;
+
+	(void)arg;
+	pthread_mutex_lock(&alog.mutex);
+	for (;;) {
+		while (!alog.count && !alog.stop)
+			pthread_cond_wait(&alog.cond, &alog.mutex);
+		if (!alog.count)
+			break;
+
+		m = alog.q[(alog.head + alog.size - alog.count) % alog.size];
+		alog.count--;
+		dropped = alog.dropped;
+		alog.dropped = 0;
+		pthread_mutex_unlock(&alog.mutex);
+
+		syslog(m.level, "%s", m.msg);
+		if (dropped)
+			syslog(LOG_WARNING, "famfs_log: dropped %llu messages\n",
+			       (unsigned long long)dropped);
+
+		pthread_mutex_lock(&alog.mutex);
+	}
+	pthread_mutex_unlock(&alog.mutex);
+	return NULL;
+}
+
+/**
+ * famfs_log_enable_async()
+ *
+ * Start a logger thread that makes the syslog() calls, with a queue of
+ * @nmsgs messages. Threads don't survive fork(), so daemons must call this
+ * after daemonizing.
+ *
+ * Returns 0 or a negative errno
+ */
+int famfs_log_enable_async(unsigned int nmsgs)
+{
+	int rc;
+
+	if (!nmsgs)
+		return -EINVAL;
+	if (alog.running)
+		return 0;
+
+	alog.q = calloc(nmsgs, sizeof(*alog.q));
+	if (!alog.q)
+		return -ENOMEM;
+	alog.size = nmsgs;
+	alog.head = alog.count = 0;
+	alog.dropped = 0;
+	alog.stop = 0;
+
+	rc = pthread_create(&alog.thread, NULL, famfs_log_thread, NULL);
+	if (rc) {
+		free(alog.q);
+		alog.q = NULL;
+		return -rc;
+	}
+	__atomic_store_n(&alog.running, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Flush the queue and stop the logger thread */
+void famfs_log_disable_async(void)
+{
+	pthread_mutex_lock(&alog.mutex);
+	if (!alog.running) {
+		pthread_mutex_unlock(&alog.mutex);
+		return;
+	}
+	alog.running = 0;  /* New messages go straight to syslog */
+	alog.stop = 1;
+	pthread_cond_signal(&alog.cond);
+	pthread_mutex_unlock(&alog.mutex);
+
+	pthread_join(alog.thread, NULL);
+	free(alog.q);
+	alog.q = NULL;
+}
+
 static void default_log_func(
 	enum famfs_log_level level,
 	const char *fmt, va_list ap)
 {
-	if (to_syslog && level <= famfs_log_level)
+	if (!to_syslog || level > famfs_log_threshold)
+		return;
+	if (!famfs_log_async(level, fmt, ap))
 		vsyslog(level, fmt, ap);
 }
 
@@ -43,7 +198,11 @@ void famfs_set_log_func(famfs_log_func_t func)
 	log_func = func;
 }
 
-void famfs_log(enum famfs_log_level level, const char *fmt, ...)
+/*
+ * Call through the log function. This is normally reached through the
+ * famfs_log() macro, which has already checked the level.
+ */
+void famfs_log_msg(enum famfs_log_level level, const char *fmt, ...)
 {
 	va_list ap;
 
@@ -65,15 +224,15 @@ void famfs_log_set_level(int level)
 {
 	if (!log_level_valid(level)) {
 		famfs_log(FAMFS_LOG_ERR, "%s: invalid log level %d\n",
-			  __func__);
+			  __func__, level);
 		return;
 	}
-	famfs_log_level = level;
+	famfs_log_threshold = level;
 }
 
 int famfs_log_get_level(void)
 {
-	return famfs_log_level;
+	return famfs_log_threshold;
 }
 
 const char *
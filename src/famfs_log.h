@@ -38,11 +38,38 @@ typedef void (*famfs_log_func_t)(enum famfs_log_level level,
 void famfs_set_log_func(famfs_log_func_t func);
 void famfs_log_set_level(int def_level);
 int famfs_log_get_level(void);
-void famfs_log(enum famfs_log_level level, const char *fmt, ...);
+void famfs_log_msg(enum famfs_log_level level, const char *fmt, ...);
 void famfs_log_enable_syslog(const char *ident, int option, int facility);
 void famfs_log_disable_syslog(void);
 void famfs_log_close_syslog(void);
 const char *famfs_log_level_string(int level);
+int famfs_log_enable_async(unsigned int nmsgs);
+void famfs_log_disable_async(void);
+
+/*
+ * Messages less severe than FAMFS_LOG_MAX_LEVEL are compiled out. Release
+ * builds (see CMakeLists.txt) set it to FAMFS_LOG_INFO.
+ */
+#ifndef FAMFS_LOG_MAX_LEVEL
+#define FAMFS_LOG_MAX_LEVEL FAMFS_LOG_DEBUG
+#endif
+
+extern unsigned int famfs_log_threshold; /* current level */
+
+/**
+ * famfs_log()
+ *
+ * Log a message if @level is enabled. The level is checked before the
+ * arguments are evaluated, so a disabled message costs one compare (and a
+ * compiled-out level costs nothing).
+ */
+#define famfs_log(level, ...)						\
+	do {								\
+		if ((int)(level) <= (int)FAMFS_LOG_MAX_LEVEL &&		\
+		    __builtin_expect((unsigned int)(level) <=		\
+				     famfs_log_threshold, 0))		\
+			famfs_log_msg(level, __VA_ARGS__);		\
+	} while (0)
 
 static inline void
 famfs_nop_log_func(enum famfs_log_level level, const char *fmt, va_list ap)
@@ -34,6 +34,8 @@
 #include <time.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/utsname.h>
 #include <curl/curl.h>
@@ -45,6 +47,7 @@
 #include "famfs_lib_internal.h"
 #include "bitmap.h"
 #include "thpool.h"
+#include "famfs_wspool.h"
 #include "libfcc.h"
 #include <sys/user.h>
 
@@ -303,14 +306,188 @@ int famfs_create_sys_uuid_file(char *sys_uuid_file)
 	return 0;
 }
 
-int
-famfs_flush_file(const char *filename, int verbose)
+/*
+ * famfs flush
+ *
+ * Flushing a file means a clflushopt/clwb of every cache line, which for a
+ * multi-TiB file is billions of instructions. The files are divided into
+ * FLUSH_GRAIN pieces that are flushed by a work-stealing pool. Each piece
+ * is flushed by a thread running on the cpus nearest the memory behind the
+ * file's famfs device (if the device has a NUMA node and those cpus are
+ * allowed), so the flushes don't cross the interconnect.
+ */
+#define FLUSH_GRAIN (256ULL << 20) /* 256 MiB */
+#define FLUSH_MAX_THREADS 64
+#define FLUSH_MAX_NODES 64
+
+struct flush_file {
+	char *addr;
+	size_t size;
+	const cpu_set_t *cpus; /* NULL: don't place */
+};
+
+static __thread const cpu_set_t *flush_thread_cpus;
+
+/* Read a small integer from a sysfs file. Returns -1 if there isn't one */
+static int
+famfs_sysfs_int(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	int val = -1;
+
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -1;
+	fclose(fp);
+	return val;
+}
+
+/**
+ * famfs_dev_numa_node()
+ *
+ * NUMA node of the memory behind a dax or pmem device (e.g. /dev/dax1.0),
+ * or -1 if it isn't known
+ */
+static int
+famfs_dev_numa_node(const char *dev)
+{
+	const char *name = strrchr(dev, '/');
+	const char *fmt[] = {
+		"/sys/bus/dax/devices/%s/target_node",
+		"/sys/bus/dax/devices/%s/numa_node",
+		"/sys/class/block/%s/device/numa_node",
+	};
+	char path[PATH_MAX];
+	size_t i;
+	int node;
+
+	name = (name) ? name + 1 : dev;
+	for (i = 0; i < sizeof(fmt) / sizeof(fmt[0]); i++) {
+		snprintf(path, sizeof(path), fmt[i], name);
+		node = famfs_sysfs_int(path);
+		if (node >= 0)
+			return node;
+	}
+	return -1;
+}
+
+/* NUMA node of the memory behind the famfs file system of @filename */
+static int
+famfs_file_numa_node(const char *filename)
+{
+	char dev[PATH_MAX] = { 0 };
+	char *mpt;
+	int node = -1;
+
+	mpt = find_mount_point(filename);
+	if (!mpt)
+		return -1;
+	if (famfs_path_is_mount_pt(mpt, dev, NULL))
+		node = famfs_dev_numa_node(dev);
+	free(mpt);
+	return node;
+}
+
+/**
+ * famfs_numa_near_cpus()
+ *
+ * The allowed cpus of the nearest node (by the firmware's distance table)
+ * to @node that has any. CXL memory nodes, for example, have no cpus.
+ *
+ * Returns 0, or -1 if there are none
+ */
+static int
+famfs_numa_near_cpus(int node, cpu_set_t *set)
+{
+	int dist[FLUSH_MAX_NODES];
+	int done[FLUSH_MAX_NODES] = { 0 };
+	char path[128];
+	cpu_set_t allowed;
+	int ndist = 0;
+	FILE *fp;
+	int i, cpu;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/distance", node);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (ndist < FLUSH_MAX_NODES && fscanf(fp, "%d", &dist[ndist]) == 1)
+		ndist++;
+	fclose(fp);
+
+	for (;;) {
+		int near = -1;
+
+		for (i = 0; i < ndist; i++)
+			if (!done[i] && (near < 0 || dist[i] < dist[near]))
+				near = i;
+		if (near < 0)
+			return -1;
+		done[near] = 1;
+
+		CPU_ZERO(set);
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (!CPU_ISSET(cpu, &allowed))
+				continue;
+			snprintf(path, sizeof(path),
+				 "/sys/devices/system/cpu/cpu%d/node%d",
+				 cpu, near);
+			if (access(path, F_OK) == 0)
+				CPU_SET(cpu, set);
+		}
+		if (CPU_COUNT(set))
+			return 0;
+	}
+}
+
+/* Pool range task: flush part of a file */
+static void
+famfs_flush_range(void *arg, size_t start, size_t end)
+{
+	struct flush_file *f = arg;
+
+	if (f->cpus && flush_thread_cpus != f->cpus) {
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				       f->cpus);
+		flush_thread_cpus = f->cpus;
+	}
+
+	/* We don't know caller needs a flush or an invalidate, so barriers on
+	 * both sides */
+	hard_flush_processor_cache(f->addr + start, end - start);
+}
+
+/* Flush a whole file on the calling thread. It is placed like a pool
+ * worker for the flush, then gets its own affinity back */
+static void
+famfs_flush_inline(struct flush_file *f)
+{
+	cpu_set_t saved;
+
+	if (!f->cpus ||
+	    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved)) {
+		hard_flush_processor_cache(f->addr, f->size);
+		return;
+	}
+	famfs_flush_range(f, 0, f->size);
+	pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+	flush_thread_cpus = NULL;
+}
+
+/* Map a file to flush. Returns 0, 1 (can't map), 2 (not a regular file) or
+ * 3 (not found) */
+static int
+famfs_flush_map(const char *filename, struct flush_file *f, int verbose)
 {
 	struct stat st;
-	size_t size;
-	void *addr;
 	int rc;
 
+	memset(f, 0, sizeof(*f));
 	rc = stat(filename, &st);
 	if (rc < 0) {
 		fprintf(stderr, "%s: file not found (%s)\n", __func__, filename);
@@ -324,19 +501,152 @@ famfs_flush_file(const char *filename, int verbose)
 	}
 
 	/* Only flush regular files */
-
-	addr = famfs_mmap_whole_file(filename, 1, &size);
-	if (!addr)
+	if (st.st_size == 0)
+		return 0;
+	f->addr = famfs_mmap_whole_file(filename, 1, &f->size);
+	if (!f->addr)
 		return 1;
 
 	if (verbose > 1)
 		printf("%s: flushing: %s\n", __func__, filename);
-
-	/* We don't know caller needs a flush or an invalidate, so barriers on both sides */
-	hard_flush_processor_cache(addr, size);
 	return 0;
 }
 
+static int
+__famfs_flush_files(
+	int nfiles,
+	char * const *files,
+	int threadct,
+	int verbose,
+	struct famfs_flush_stats *stats,
+	int *rc_out)
+{
+	cpu_set_t node_cpus[FLUSH_MAX_NODES];
+	int node_state[FLUSH_MAX_NODES] = { 0 }; /* 1: have cpus, -1: none */
+	struct famfs_wsp_group group;
+	struct famfs_wsp *wsp = NULL;
+	struct flush_file *ff;
+	struct timespec t0, t1;
+	size_t npieces = 0;
+	u64 bytes = 0;
+	int errs = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ff = calloc(nfiles, sizeof(*ff));
+	if (!ff)
+		return nfiles;
+
+	for (i = 0; i < nfiles; i++) {
+		int node, rc;
+
+		rc = famfs_flush_map(files[i], &ff[i], verbose);
+		if (rc_out)
+			rc_out[i] = rc;
+		if (rc) {
+			errs++;
+			continue;
+		}
+		bytes += ff[i].size;
+		npieces += (ff[i].size + FLUSH_GRAIN - 1) / FLUSH_GRAIN;
+
+		node = famfs_file_numa_node(files[i]);
+		if (node < 0 || node >= FLUSH_MAX_NODES)
+			continue;
+		if (!node_state[node])
+			node_state[node] = (famfs_numa_near_cpus(
+					node, &node_cpus[node])) ? -1 : 1;
+		if (node_state[node] > 0)
+			ff[i].cpus = &node_cpus[node];
+		if (verbose > 1)
+			printf("%s: %s: memory on node %d; %d cpus\n",
+			       __func__, files[i], node,
+			       (ff[i].cpus) ? CPU_COUNT(ff[i].cpus) : 0);
+	}
+
+	if (threadct <= 0) {
+		cpu_set_t allowed;
+
+		threadct = 1;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+			threadct = MIN(CPU_COUNT(&allowed), FLUSH_MAX_THREADS);
+	}
+	if (threadct > 1 && npieces > 1)
+		wsp = famfs_wsp_create(MIN((size_t)threadct, npieces));
+
+	famfs_wsp_group_init(&group);
+	for (i = 0; i < nfiles; i++) {
+		if (!ff[i].addr)
+			continue;
+		if (wsp && famfs_wsp_submit_range(wsp, &group,
+						  famfs_flush_range, NULL,
+						  &ff[i], 0, ff[i].size,
+						  FLUSH_GRAIN) == 0)
+			continue;
+		famfs_flush_inline(&ff[i]);
+	}
+	famfs_wsp_group_wait(&group);
+	famfs_wsp_group_destroy(&group);
+	famfs_wsp_destroy(wsp, 0);
+
+	for (i = 0; i < nfiles; i++)
+		if (ff[i].addr)
+			munmap(ff[i].addr, ff[i].size);
+	free(ff);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (stats) {
+		stats->nfiles = nfiles - errs;
+		stats->bytes = bytes;
+		stats->ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+			t1.tv_nsec - t0.tv_nsec;
+	}
+	return errs;
+}
+
+/**
+ * famfs_flush_files()
+ *
+ * Flush the processor cache for the entire contents of @nfiles files
+ *
+ * @nfiles:
+ * @files:
+ * @threadct: Flush threads (0: one per allowed cpu, up to
+ *            FLUSH_MAX_THREADS)
+ * @verbose:
+ * @stats:    out: what was flushed, and how long it took (may be NULL)
+ *
+ * Returns the number of files that could not be flushed
+ */
+int
+famfs_flush_files(
+	int nfiles,
+	char * const *files,
+	int threadct,
+	int verbose,
+	struct famfs_flush_stats *stats)
+{
+	return __famfs_flush_files(nfiles, files, threadct, verbose, stats,
+				   NULL);
+}
+
+/**
+ * famfs_flush_file()
+ *
+ * Flush the processor cache for an entire file
+ *
+ * Returns 0, 1 (can't map), 2 (not a regular file) or 3 (not found)
+ */
+int
+famfs_flush_file(const char *filename, int verbose)
+{
+	char *file = (char *)filename;
+	int rc;
+
+	__famfs_flush_files(1, &file, 0, verbose, NULL, &rc);
+	return rc;
+}
+
 int
 kernel_symbol_exists(
 	const char *symbol_name,
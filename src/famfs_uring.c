@@ -0,0 +1,402 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/param.h> /* MIN()/MAX() */
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "famfs_uring.h"
+
+static int
+famfs_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+#ifdef __NR_io_uring_setup
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int
+famfs_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		  unsigned int flags)
+{
+#ifdef __NR_io_uring_enter
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, NULL, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int
+famfs_uring_register(int fd, unsigned int opcode, const void *arg,
+		     unsigned int nr)
+{
+#ifdef __NR_io_uring_register
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/**
+ * famfs_uring_init()
+ *
+ * Set up a ring with (at least) @entries submission queue entries
+ *
+ * Returns 0, or -errno (e.g. -ENOSYS or -EPERM where io_uring is not
+ * available, so the caller can fall back to synchronous I/O)
+ */
+int
+famfs_uring_init(struct famfs_uring *ur, unsigned int entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+	int rc;
+
+	memset(ur, 0, sizeof(*ur));
+	memset(&p, 0, sizeof(p));
+	ur->sq_ring = ur->cq_ring = ur->sqes = MAP_FAILED;
+
+	ur->fd = famfs_uring_setup(entries, &p);
+	if (ur->fd < 0)
+		return -errno;
+
+	ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	ur->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ur->sq_ring_size = ur->cq_ring_size =
+			MAX(ur->sq_ring_size, ur->cq_ring_size);
+
+	ur->sq_ring = mmap(0, ur->sq_ring_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->fd,
+			   IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(0, ur->cq_ring_size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ur->fd,
+				   IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED)
+			goto err;
+	}
+
+	ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(0, ur->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED)
+		goto err;
+
+	sq = ur->sq_ring;
+	cq = ur->cq_ring;
+	ur->sq_entries = p.sq_entries;
+	ur->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	ur->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ur->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	ur->sqe_tail = *ur->sq_tail;
+	ur->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ur->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+
+err:
+	rc = -errno;
+	famfs_uring_destroy(ur);
+	return rc;
+}
+
+void
+famfs_uring_destroy(struct famfs_uring *ur)
+{
+	if (ur->sqes && ur->sqes != MAP_FAILED)
+		munmap(ur->sqes, ur->sqes_size);
+	if (ur->cq_ring && ur->cq_ring != MAP_FAILED &&
+	    ur->cq_ring != ur->sq_ring)
+		munmap(ur->cq_ring, ur->cq_ring_size);
+	if (ur->sq_ring && ur->sq_ring != MAP_FAILED)
+		munmap(ur->sq_ring, ur->sq_ring_size);
+	if (ur->fd > 0)
+		close(ur->fd);
+	memset(ur, 0, sizeof(*ur));
+	ur->fd = -1;
+}
+
+/**
+ * famfs_uring_prep_read()
+ *
+ * Queue (but don't submit) a read. With @buf_index >= 0, @buf must be within
+ * that registered buffer.
+ *
+ * Returns 0, or -EBUSY if the submission queue is full
+ */
+int
+famfs_uring_prep_read(struct famfs_uring *ur, int fd, void *buf,
+		      unsigned int len, off_t offset, int buf_index,
+		      uint64_t user_data)
+{
+	unsigned int head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int idx = ur->sqe_tail & ur->sq_mask;
+	struct io_uring_sqe *sqe;
+
+	if (ur->sqe_tail - head >= ur->sq_entries)
+		return -EBUSY;
+
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (buf_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->buf_index = (buf_index >= 0) ? buf_index : 0;
+	sqe->user_data = user_data;
+	ur->sq_array[idx] = idx;
+	ur->sqe_tail++;
+	return 0;
+}
+
+/**
+ * famfs_uring_submit()
+ *
+ * Submit the queued requests, and wait until at least @wait_nr completions
+ * are available
+ *
+ * Returns 0, or -errno
+ */
+int
+famfs_uring_submit(struct famfs_uring *ur, unsigned int wait_nr)
+{
+	unsigned int to_submit;
+	int rc;
+
+	__atomic_store_n(ur->sq_tail, ur->sqe_tail, __ATOMIC_RELEASE);
+	do {
+		to_submit = ur->sqe_tail -
+			__atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+		if (!to_submit && !wait_nr)
+			return 0;
+		rc = famfs_uring_enter(ur->fd, to_submit, wait_nr,
+				       (wait_nr) ? IORING_ENTER_GETEVENTS : 0);
+	} while (rc < 0 && errno == EINTR);
+
+	return (rc < 0) ? -errno : 0;
+}
+
+/**
+ * famfs_uring_reap()
+ *
+ * Take one completion, if there is one
+ *
+ * Returns 1 (and the request's user_data and result), or 0 if none
+ */
+int
+famfs_uring_reap(struct famfs_uring *ur, uint64_t *user_data, int *res)
+{
+	unsigned int head = *ur->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	cqe = &ur->cqes[head & ur->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(ur->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**
+ * famfs_uring_reader_init()
+ *
+ * Set up a ring and @depth read buffers of @bufsize bytes. The buffers are
+ * registered with the ring if possible (fixed buffers save the kernel from
+ * pinning the pages on every read); otherwise plain reads are used.
+ *
+ * Returns 0, or -errno if io_uring can't be used
+ */
+int
+famfs_uring_reader_init(struct famfs_uring_reader *rd, unsigned int depth,
+			size_t bufsize)
+{
+	struct iovec *iov;
+	unsigned int i;
+	int rc;
+
+	memset(rd, 0, sizeof(*rd));
+	if (!depth || !bufsize || bufsize > UINT32_MAX)
+		return -EINVAL;
+
+	rc = famfs_uring_init(&rd->ring, depth);
+	if (rc)
+		return rc;
+
+	rd->depth = depth;
+	rd->bufsize = bufsize;
+	rd->slots = calloc(depth, sizeof(*rd->slots));
+	iov = calloc(depth, sizeof(*iov));
+	if (!rd->slots || !iov ||
+	    posix_memalign((void **)&rd->bufs, 64, depth * bufsize)) {
+		free(iov);
+		famfs_uring_reader_destroy(rd);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < depth; i++) {
+		rd->slots[i].buf = rd->bufs + i * bufsize;
+		iov[i].iov_base = rd->slots[i].buf;
+		iov[i].iov_len = bufsize;
+	}
+	if (famfs_uring_register(rd->ring.fd, IORING_REGISTER_BUFFERS,
+				 iov, depth) == 0)
+		rd->fixed = 1;
+	free(iov);
+	return 0;
+}
+
+void
+famfs_uring_reader_destroy(struct famfs_uring_reader *rd)
+{
+	/* Closing the ring unregisters the buffers */
+	famfs_uring_destroy(&rd->ring);
+	free(rd->bufs);
+	free(rd->slots);
+	memset(rd, 0, sizeof(*rd));
+}
+
+static int
+famfs_uring_reader_issue(struct famfs_uring_reader *rd, int fd,
+			 unsigned int s)
+{
+	struct famfs_uring_slot *slot = &rd->slots[s];
+
+	return famfs_uring_prep_read(&rd->ring, fd, slot->buf + slot->done,
+				     slot->len - slot->done,
+				     slot->offset + slot->done,
+				     (rd->fixed) ? (int)s : -1, s);
+}
+
+/* Walks a list of ranges in pieces of at most rd->bufsize bytes */
+struct famfs_uring_cursor {
+	const struct famfs_uring_range *ranges;
+	unsigned int nranges;
+	unsigned int r;
+	size_t pos;
+};
+
+static int
+famfs_uring_next(struct famfs_uring_reader *rd, struct famfs_uring_cursor *c,
+		 struct famfs_uring_slot *slot)
+{
+	while (c->r < c->nranges && c->pos >= c->ranges[c->r].len) {
+		c->r++;
+		c->pos = 0;
+	}
+	if (c->r >= c->nranges)
+		return 0;
+
+	slot->offset = c->ranges[c->r].offset + c->pos;
+	slot->len = MIN(rd->bufsize, c->ranges[c->r].len - c->pos);
+	slot->done = 0;
+	c->pos += slot->len;
+	return 1;
+}
+
+/**
+ * famfs_uring_read_ranges()
+ *
+ * Read @nranges ranges of @fd with up to rd->depth reads in flight, passing
+ * each buffer to @consume as it completes. Buffers complete (and are
+ * consumed) in no particular order. Short reads are continued; hitting EOF
+ * before the end of a range fails with -ENODATA.
+ *
+ * Returns 0, -errno from a read (or the ring), or the nonzero return of
+ * @consume. Nothing is left in flight when this returns (unless the ring
+ * itself failed).
+ */
+int
+famfs_uring_read_ranges(struct famfs_uring_reader *rd, int fd,
+			const struct famfs_uring_range *ranges,
+			unsigned int nranges,
+			famfs_uring_consume_fn consume, void *arg)
+{
+	struct famfs_uring_cursor cur = { ranges, nranges, 0, 0 };
+	unsigned int inflight = 0;
+	uint64_t s;
+	int res;
+	int rc = 0;
+
+	for (s = 0; s < rd->depth; s++) {
+		if (!famfs_uring_next(rd, &cur, &rd->slots[s]))
+			break;
+		famfs_uring_reader_issue(rd, fd, s);
+		inflight++;
+	}
+
+	while (inflight) {
+		int err = famfs_uring_submit(&rd->ring, 1);
+
+		if (err)
+			return err;
+
+		while (famfs_uring_reap(&rd->ring, &s, &res)) {
+			struct famfs_uring_slot *slot = &rd->slots[s];
+
+			inflight--;
+			if (rc)
+				continue; /* Draining after an error */
+			if (res <= 0) {
+				rc = (res < 0) ? res : -ENODATA;
+				continue;
+			}
+
+			slot->done += res;
+			if (slot->done < slot->len) {
+				famfs_uring_reader_issue(rd, fd, s);
+				inflight++;
+				famfs_uring_submit(&rd->ring, 0);
+				continue;
+			}
+
+			rc = consume(arg, slot->buf, slot->len, slot->offset);
+			if (rc || !famfs_uring_next(rd, &cur, slot))
+				continue;
+
+			/* Refill the slot; submit now so the read overlaps
+			 * with consuming the other completed buffers */
+			famfs_uring_reader_issue(rd, fd, s);
+			inflight++;
+			famfs_uring_submit(&rd->ring, 0);
+		}
+	}
+	return rc;
+}
+
+int
+famfs_uring_read_range(struct famfs_uring_reader *rd, int fd, off_t offset,
+		       size_t len, famfs_uring_consume_fn consume, void *arg)
+{
+	struct famfs_uring_range range = { offset, len };
+
+	return famfs_uring_read_ranges(rd, fd, &range, 1, consume, arg);
+}
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_URING
+#define _H_FAMFS_URING
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Minimal io_uring support (raw syscalls; no liburing dependency)
+ *
+ * struct famfs_uring is a ring with no special setup flags. The reader on
+ * top of it keeps up to @depth reads of @bufsize bytes in flight on one
+ * file, and hands each buffer to a consumer as its read completes, so
+ * consuming one buffer overlaps with reading the next ones.
+ */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct famfs_uring {
+	int fd;
+	unsigned int sq_entries;
+	unsigned int sqe_tail;           /* sqes prepared (ours) */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+int famfs_uring_init(struct famfs_uring *ur, unsigned int entries);
+void famfs_uring_destroy(struct famfs_uring *ur);
+int famfs_uring_prep_read(struct famfs_uring *ur, int fd, void *buf,
+			  unsigned int len, off_t offset, int buf_index,
+			  uint64_t user_data);
+int famfs_uring_submit(struct famfs_uring *ur, unsigned int wait_nr);
+int famfs_uring_reap(struct famfs_uring *ur, uint64_t *user_data, int *res);
+
+struct famfs_uring_slot {
+	char *buf;
+	off_t offset;
+	size_t len;
+	size_t done;
+};
+
+struct famfs_uring_reader {
+	struct famfs_uring ring;
+	unsigned int depth;
+	size_t bufsize;
+	int fixed;                       /* buffers are registered */
+	char *bufs;                      /* depth * bufsize, 64-byte aligned */
+	struct famfs_uring_slot *slots;
+};
+
+struct famfs_uring_range {
+	off_t offset;
+	size_t len;
+};
+
+/* Return nonzero to stop reading (the value is returned by read_range) */
+typedef int (*famfs_uring_consume_fn)(void *arg, const char *buf,
+				      size_t len, off_t offset);
+
+int famfs_uring_reader_init(struct famfs_uring_reader *rd,
+			    unsigned int depth, size_t bufsize);
+void famfs_uring_reader_destroy(struct famfs_uring_reader *rd);
+int famfs_uring_read_ranges(struct famfs_uring_reader *rd, int fd,
+			    const struct famfs_uring_range *ranges,
+			    unsigned int nranges,
+			    famfs_uring_consume_fn consume, void *arg);
+int famfs_uring_read_range(struct famfs_uring_reader *rd, int fd,
+			   off_t offset, size_t len,
+			   famfs_uring_consume_fn consume, void *arg);
+
+#endif /* _H_FAMFS_URING */
@@ -0,0 +1,526 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h> /* MIN()/MAX() */
+
+#include "famfs_wspool.h"
+
+struct famfs_wsp_task {
+	famfs_wsp_fn fn;
+	void *arg;
+	struct famfs_wsp_group *group;
+};
+
+/*
+ * A deque of tasks. The owner pushes and pops at the bottom, thieves take
+ * from the top. Tasks are coarse (megabytes of copying), so a mutex per
+ * deque costs nothing measurable and keeps this simple.
+ */
+struct famfs_wsp_deque {
+	pthread_mutex_t mutex;
+	struct famfs_wsp_task **ring;
+	size_t cap;                      /* power of 2 */
+	size_t top;                      /* oldest */
+	size_t bottom;                   /* newest */
+};
+
+struct famfs_wsp_worker {
+	struct famfs_wsp *wsp;
+	pthread_t thread;
+	unsigned int id;
+	unsigned int seed;
+	struct famfs_wsp_deque dq;
+};
+
+struct famfs_wsp {
+	unsigned int nthreads;
+	struct famfs_wsp_worker *workers;
+	struct famfs_wsp_deque inject;   /* FIFO of submitted tasks */
+	pthread_mutex_t mutex;           /* for sleeping and waking */
+	pthread_cond_t cond;
+	uint64_t nqueued;                /* tasks in all queues */
+	unsigned int nidle;              /* workers asleep */
+	int shutdown;
+	int abort;
+};
+
+struct famfs_wsp_range_root {
+	famfs_wsp_range_fn fn;
+	famfs_wsp_fn done;
+	void *arg;
+	size_t grain;
+	uint64_t refs;                   /* range tasks not finished */
+};
+
+struct famfs_wsp_range {
+	struct famfs_wsp_range_root *root;
+	size_t start;
+	size_t end;
+};
+
+static __thread struct famfs_wsp_worker *wsp_self;
+static __thread struct famfs_wsp_group *wsp_cur_group;
+
+static void famfs_wsp_run_range(void *arg);
+
+static int
+famfs_wsp_deque_init(struct famfs_wsp_deque *dq)
+{
+	memset(dq, 0, sizeof(*dq));
+	dq->cap = 64;
+	dq->ring = calloc(dq->cap, sizeof(*dq->ring));
+	if (!dq->ring)
+		return -1;
+	pthread_mutex_init(&dq->mutex, NULL);
+	return 0;
+}
+
+static void
+famfs_wsp_deque_destroy(struct famfs_wsp_deque *dq)
+{
+	free(dq->ring);
+	pthread_mutex_destroy(&dq->mutex);
+}
+
+static int
+famfs_wsp_push(struct famfs_wsp_deque *dq, struct famfs_wsp_task *t)
+{
+	pthread_mutex_lock(&dq->mutex);
+	if (dq->bottom - dq->top == dq->cap) {
+		struct famfs_wsp_task **ring;
+		size_t i;
+
+		ring = calloc(dq->cap * 2, sizeof(*ring));
+		if (!ring) {
+			pthread_mutex_unlock(&dq->mutex);
+			return -1;
+		}
+		for (i = dq->top; i != dq->bottom; i++)
+			ring[i & (dq->cap * 2 - 1)] = dq->ring[i & (dq->cap - 1)];
+		free(dq->ring);
+		dq->ring = ring;
+		dq->cap *= 2;
+	}
+	dq->ring[dq->bottom++ & (dq->cap - 1)] = t;
+	pthread_mutex_unlock(&dq->mutex);
+	return 0;
+}
+
+static struct famfs_wsp_task *
+famfs_wsp_pop_bottom(struct famfs_wsp_deque *dq)
+{
+	struct famfs_wsp_task *t = NULL;
+
+	pthread_mutex_lock(&dq->mutex);
+	if (dq->bottom != dq->top)
+		t = dq->ring[--dq->bottom & (dq->cap - 1)];
+	pthread_mutex_unlock(&dq->mutex);
+	return t;
+}
+
+static struct famfs_wsp_task *
+famfs_wsp_pop_top(struct famfs_wsp_deque *dq)
+{
+	struct famfs_wsp_task *t = NULL;
+
+	pthread_mutex_lock(&dq->mutex);
+	if (dq->bottom != dq->top)
+		t = dq->ring[dq->top++ & (dq->cap - 1)];
+	pthread_mutex_unlock(&dq->mutex);
+	return t;
+}
+
+static void
+famfs_wsp_group_add(struct famfs_wsp_group *g)
+{
+	if (!g)
+		return;
+	pthread_mutex_lock(&g->mutex);
+	g->pending++;
+	pthread_mutex_unlock(&g->mutex);
+}
+
+static void
+famfs_wsp_group_done(struct famfs_wsp_group *g)
+{
+	if (!g)
+		return;
+	pthread_mutex_lock(&g->mutex);
+	if (--g->pending == 0)
+		pthread_cond_broadcast(&g->cond);
+	pthread_mutex_unlock(&g->mutex);
+}
+
+/* Queue a task on @dq and wake a worker */
+static int
+famfs_wsp_enqueue(struct famfs_wsp *wsp, struct famfs_wsp_deque *dq,
+		  famfs_wsp_fn fn, void *arg, struct famfs_wsp_group *g)
+{
+	struct famfs_wsp_task *t = malloc(sizeof(*t));
+
+	if (!t)
+		return -1;
+	t->fn = fn;
+	t->arg = arg;
+	t->group = g;
+
+	famfs_wsp_group_add(g);
+	if (famfs_wsp_push(dq, t)) {
+		famfs_wsp_group_done(g);
+		free(t);
+		return -1;
+	}
+
+	/* Count it before taking the mutex: a worker about to sleep checks
+	 * nqueued under the mutex, so it either sees this task or gets the
+	 * signal */
+	__atomic_add_fetch(&wsp->nqueued, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&wsp->mutex);
+	if (wsp->nidle)
+		pthread_cond_signal(&wsp->cond);
+	pthread_mutex_unlock(&wsp->mutex);
+	return 0;
+}
+
+static struct famfs_wsp_task *
+famfs_wsp_get_task(struct famfs_wsp_worker *w)
+{
+	struct famfs_wsp *wsp = w->wsp;
+	struct famfs_wsp_task *t;
+	unsigned int i, victim;
+
+	t = famfs_wsp_pop_bottom(&w->dq);
+	if (!t)
+		t = famfs_wsp_pop_top(&wsp->inject);
+	if (!t && wsp->nthreads > 1) {
+		victim = rand_r(&w->seed) % wsp->nthreads;
+		for (i = 0; i < wsp->nthreads && !t; i++) {
+			unsigned int v = (victim + i) % wsp->nthreads;
+
+			if (v != w->id)
+				t = famfs_wsp_pop_top(&wsp->workers[v].dq);
+		}
+	}
+	if (t)
+		__atomic_sub_fetch(&wsp->nqueued, 1, __ATOMIC_SEQ_CST);
+	return t;
+}
+
+static void *
+famfs_wsp_worker_fn(void *arg)
+{
+	struct famfs_wsp_worker *w = arg;
+	struct famfs_wsp *wsp = w->wsp;
+	struct famfs_wsp_task *t;
+
+	pthread_mutex_lock(&wsp->mutex);
+	pthread_mutex_unlock(&wsp->mutex);
+
+	wsp_self = w;
+	for (;;) {
+		if (__atomic_load_n(&wsp->abort, __ATOMIC_ACQUIRE))
+			break;
+
+		t = famfs_wsp_get_task(w);
+		if (t) {
+			wsp_cur_group = t->group;
+			t->fn(t->arg);
+			wsp_cur_group = NULL;
+			famfs_wsp_group_done(t->group);
+			free(t);
+			continue;
+		}
+
+		pthread_mutex_lock(&wsp->mutex);
+		if (__atomic_load_n(&wsp->nqueued, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_unlock(&wsp->mutex);
+			continue;
+		}
+		if (wsp->shutdown) {
+			pthread_mutex_unlock(&wsp->mutex);
+			break;
+		}
+		__atomic_add_fetch(&wsp->nidle, 1, __ATOMIC_SEQ_CST);
+		pthread_cond_wait(&wsp->cond, &wsp->mutex);
+		__atomic_sub_fetch(&wsp->nidle, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&wsp->mutex);
+	}
+	wsp_self = NULL;
+	return NULL;
+}
+
+/*
+ * Abort: release a queued task that won't run. A range task skips the rest
+ * of its range, but still calls done (which frees what the submitter hung
+ * on it) once its last piece is released. Other tasks are just dropped.
+ */
+static void
+famfs_wsp_drop_task(struct famfs_wsp_task *t)
+{
+	if (t->fn == famfs_wsp_run_range) {
+		struct famfs_wsp_range *r = t->arg;
+
+		r->start = r->end;
+		famfs_wsp_run_range(r);
+	}
+	famfs_wsp_group_done(t->group);
+	free(t);
+}
+
+static void
+famfs_wsp_drain(struct famfs_wsp_deque *dq)
+{
+	struct famfs_wsp_task *t;
+
+	while ((t = famfs_wsp_pop_top(dq)))
+		famfs_wsp_drop_task(t);
+}
+
+/**
+ * famfs_wsp_create()
+ *
+ * Start a pool of @nthreads workers
+ *
+ * Returns the pool, or NULL
+ */
+struct famfs_wsp *
+famfs_wsp_create(unsigned int nthreads)
+{
+	struct famfs_wsp *wsp;
+	unsigned int i;
+
+	if (!nthreads)
+		return NULL;
+
+	wsp = calloc(1, sizeof(*wsp));
+	if (!wsp)
+		return NULL;
+	wsp->workers = calloc(nthreads, sizeof(*wsp->workers));
+	if (!wsp->workers || famfs_wsp_deque_init(&wsp->inject)) {
+		free(wsp->workers);
+		free(wsp);
+		return NULL;
+	}
+	pthread_mutex_init(&wsp->mutex, NULL);
+	pthread_cond_init(&wsp->cond, NULL);
+
+	/* Workers wait for the mutex before they look at the pool, so they
+	 * see the final nthreads */
+	pthread_mutex_lock(&wsp->mutex);
+	for (i = 0; i < nthreads; i++) {
+		struct famfs_wsp_worker *w = &wsp->workers[i];
+
+		w->wsp = wsp;
+		w->id = i;
+		w->seed = i * 2654435761U + 1;
+		if (famfs_wsp_deque_init(&w->dq))
+			break;
+		if (pthread_create(&w->thread, NULL, famfs_wsp_worker_fn, w)) {
+			famfs_wsp_deque_destroy(&w->dq);
+			break;
+		}
+		wsp->nthreads++;
+	}
+	pthread_mutex_unlock(&wsp->mutex);
+	if (!wsp->nthreads) {
+		famfs_wsp_destroy(wsp, 1);
+		return NULL;
+	}
+	return wsp;
+}
+
+/**
+ * famfs_wsp_destroy()
+ *
+ * Stop the pool: without @abort, after all queued work (and anything it
+ * spawns) is done; with @abort, after the running tasks return. Queued
+ * tasks are then dropped, but range tasks still get their done callbacks,
+ * and groups still complete.
+ */
+void
+famfs_wsp_destroy(struct famfs_wsp *wsp, int abort)
+{
+	unsigned int i;
+
+	if (!wsp)
+		return;
+
+	pthread_mutex_lock(&wsp->mutex);
+	wsp->shutdown = 1;
+	if (abort)
+		__atomic_store_n(&wsp->abort, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&wsp->cond);
+	pthread_mutex_unlock(&wsp->mutex);
+
+	for (i = 0; i < wsp->nthreads; i++)
+		pthread_join(wsp->workers[i].thread, NULL);
+	for (i = 0; i < wsp->nthreads; i++)
+		famfs_wsp_drain(&wsp->workers[i].dq);
+	famfs_wsp_drain(&wsp->inject);
+	for (i = 0; i < wsp->nthreads; i++)
+		famfs_wsp_deque_destroy(&wsp->workers[i].dq);
+	famfs_wsp_deque_destroy(&wsp->inject);
+	pthread_cond_destroy(&wsp->cond);
+	pthread_mutex_destroy(&wsp->mutex);
+	free(wsp->workers);
+	free(wsp);
+}
+
+unsigned int
+famfs_wsp_nthreads(const struct famfs_wsp *wsp)
+{
+	return (wsp) ? wsp->nthreads : 0;
+}
+
+void
+famfs_wsp_group_init(struct famfs_wsp_group *g)
+{
+	pthread_mutex_init(&g->mutex, NULL);
+	pthread_cond_init(&g->cond, NULL);
+	g->pending = 0;
+}
+
+/* Wait until every task of the group (and everything they spawned) is done */
+void
+famfs_wsp_group_wait(struct famfs_wsp_group *g)
+{
+	pthread_mutex_lock(&g->mutex);
+	while (g->pending)
+		pthread_cond_wait(&g->cond, &g->mutex);
+	pthread_mutex_unlock(&g->mutex);
+}
+
+void
+famfs_wsp_group_destroy(struct famfs_wsp_group *g)
+{
+	pthread_cond_destroy(&g->cond);
+	pthread_mutex_destroy(&g->mutex);
+}
+
+/**
+ * famfs_wsp_submit()
+ *
+ * Queue fn(arg) to run on the pool, as part of group @g (optional)
+ *
+ * Returns 0, or -1 if out of memory
+ */
+int
+famfs_wsp_submit(struct famfs_wsp *wsp, struct famfs_wsp_group *g,
+		 famfs_wsp_fn fn, void *arg)
+{
+	return famfs_wsp_enqueue(wsp, &wsp->inject, fn, arg, g);
+}
+
+/**
+ * famfs_wsp_should_split()
+ *
+ * For a running task: returns nonzero if there are idle workers and no
+ * queued work for them, so splitting off part of the task would help
+ */
+int
+famfs_wsp_should_split(void)
+{
+	struct famfs_wsp_worker *w = wsp_self;
+
+	if (!w)
+		return 0;
+	return __atomic_load_n(&w->wsp->nidle, __ATOMIC_RELAXED) &&
+		!__atomic_load_n(&w->wsp->nqueued, __ATOMIC_RELAXED);
+}
+
+static void
+famfs_wsp_run_range(void *arg)
+{
+	struct famfs_wsp_range *r = arg;
+	struct famfs_wsp_range_root *root = r->root;
+	size_t grain = root->grain;
+
+	while (r->start < r->end) {
+		size_t pieces = (r->end - r->start + grain - 1) / grain;
+		size_t len;
+
+		/* Split off the upper half of what's left for an idle worker;
+		 * it goes on this worker's deque, where it can be stolen */
+		if (pieces > 1 && famfs_wsp_should_split()) {
+			struct famfs_wsp_range *hi = malloc(sizeof(*hi));
+			size_t mid = r->start + (pieces / 2) * grain;
+
+			if (hi) {
+				hi->root = root;
+				hi->start = mid;
+				hi->end = r->end;
+				__atomic_add_fetch(&root->refs, 1,
+						   __ATOMIC_SEQ_CST);
+				if (famfs_wsp_enqueue(wsp_self->wsp,
+						      &wsp_self->dq,
+						      famfs_wsp_run_range, hi,
+						      wsp_cur_group) == 0) {
+					/* hi may already be gone */
+					r->end = mid;
+					continue;
+				}
+				__atomic_sub_fetch(&root->refs, 1,
+						   __ATOMIC_SEQ_CST);
+				free(hi);
+			}
+		}
+
+		len = MIN(grain, r->end - r->start);
+		root->fn(root->arg, r->start, r->start + len);
+		r->start += len;
+	}
+
+	if (__atomic_sub_fetch(&root->refs, 1, __ATOMIC_SEQ_CST) == 0) {
+		if (root->done)
+			root->done(root->arg);
+		free(root);
+	}
+	free(r);
+}
+
+/**
+ * famfs_wsp_submit_range()
+ *
+ * Queue a range task: fn(arg, s, e) is called on disjoint pieces that
+ * cover [@start, @end), possibly in parallel. Pieces start at @start plus a
+ * multiple of @grain, and are at most @grain long. done(arg) (optional) is
+ * called once, after the whole range is done.
+ *
+ * Returns 0, or -1 if out of memory
+ */
+int
+famfs_wsp_submit_range(struct famfs_wsp *wsp, struct famfs_wsp_group *g,
+		       famfs_wsp_range_fn fn, famfs_wsp_fn done, void *arg,
+		       size_t start, size_t end, size_t grain)
+{
+	struct famfs_wsp_range_root *root = calloc(1, sizeof(*root));
+	struct famfs_wsp_range *r = calloc(1, sizeof(*r));
+
+	if (!root || !r || !grain)
+		goto err;
+
+	root->fn = fn;
+	root->done = done;
+	root->arg = arg;
+	root->grain = grain;
+	root->refs = 1;
+	r->root = root;
+	r->start = start;
+	r->end = end;
+	if (famfs_wsp_submit(wsp, g, famfs_wsp_run_range, r))
+		goto err;
+	return 0;
+
+err:
+	free(root);
+	free(r);
+	return -1;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright (C) 2025 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef _H_FAMFS_WSPOOL
+#define _H_FAMFS_WSPOOL
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Work-stealing thread pool
+ *
+ * Work submitted from outside the pool goes into a FIFO injection queue.
+ * Work spawned by a task (e.g. the split-off half of a range) goes onto the
+ * bottom of the running worker's own deque; the worker pops its own deque
+ * from the bottom (newest first, while its data is cache-warm), and idle
+ * workers steal from the top of other workers' deques (oldest, i.e.
+ * biggest, pieces first). Idle workers sleep on a condition variable.
+ *
+ * A range task covers [start, end) and calls fn on grain-sized pieces. Each
+ * time it finishes a piece, it splits off the upper half of what remains if
+ * a worker is idle, so idle workers can pick up part of a big job instead
+ * of waiting for the worker that dequeued it. (perf/wsp_bench compares
+ * this with unsplit tasks; it needs several cpus to show a difference.)
+ *
+ * A famfs_wsp_group is a completion future for a set of tasks (including
+ * everything they spawn): famfs_wsp_group_wait() blocks until they are all
+ * done.
+ */
+
+struct famfs_wsp;
+
+struct famfs_wsp_group {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint64_t pending;
+};
+
+typedef void (*famfs_wsp_fn)(void *arg);
+typedef void (*famfs_wsp_range_fn)(void *arg, size_t start, size_t end);
+
+struct famfs_wsp *famfs_wsp_create(unsigned int nthreads);
+void famfs_wsp_destroy(struct famfs_wsp *wsp, int abort);
+unsigned int famfs_wsp_nthreads(const struct famfs_wsp *wsp);
+
+void famfs_wsp_group_init(struct famfs_wsp_group *g);
+void famfs_wsp_group_wait(struct famfs_wsp_group *g);
+void famfs_wsp_group_destroy(struct famfs_wsp_group *g);
+
+int famfs_wsp_submit(struct famfs_wsp *wsp, struct famfs_wsp_group *g,
+		     famfs_wsp_fn fn, void *arg);
+int famfs_wsp_submit_range(struct famfs_wsp *wsp, struct famfs_wsp_group *g,
+			   famfs_wsp_range_fn fn, famfs_wsp_fn done,
+			   void *arg, size_t start, size_t end,
+			   size_t grain);
+int famfs_wsp_should_split(void);
+
+#endif /* _H_FAMFS_WSPOOL */
@@ -13,12 +13,16 @@
 
 #include "libfcc.h"
 #include <emmintrin.h>   /* _mm_sfence (SFENCE) and _mm_clflush */
+#include <immintrin.h>   /* streaming (non-temporal) stores */
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
 #include <cpuid.h>       /* __get_cpuid_count for feature detection */
 #include <stdint.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <inttypes.h>
-#include <assert.h>
 #include "famfs_log.h"
 
 static const uintptr_t CACHELINE_SIZE = 64;
@@ -26,13 +30,23 @@ static const uintptr_t CACHELINE_SIZE = 64;
 /* Define types for internal function pointers */
 typedef void (*fcc_func_ptr)(uintptr_t addr);
 typedef void (*fence_fn_t)(void);
+typedef void (*memcpy_nt_fn_t)(char *dst, const char *src, size_t len);
+typedef void (*memset_nt_fn_t)(char *dst, int c, size_t len);
 
 /* Function pointers for the chosen cache flush instructions and fence */
 static fcc_func_ptr flush_cacheline_func = NULL;
 static fcc_func_ptr invalidate_cacheline_func = NULL;
 static fence_fn_t fence_func = NULL;
+static memcpy_nt_fn_t memcpy_nt_func = NULL;
+static memset_nt_fn_t memset_nt_func = NULL;
 static pthread_once_t initialized = PTHREAD_ONCE_INIT;
 
+/* Write-back for flush_processor_cache() ranges of at least
+ * strategy.large_threshold bytes */
+static fcc_func_ptr large_flush_func = NULL;
+static struct fcc_strategy strategy;
+static int insn_supported[FCC_NINSN];
+
 /* Use CLFLUSH to flush and invalidate a cache line */
 static inline void x86_flush_clflush(uintptr_t addr)
 {
@@ -52,11 +66,25 @@ x86_flush_clflushopt(uintptr_t addr)
 /* Use CLWB to write back a cache line without invalidating it */
 static inline void x86_flush_clwb(uintptr_t addr)
 {
-	/* CLWB has opcode 66 0F AE /6 */
-	__asm__ volatile(".byte 0x66, 0x0f, 0xae, 0x30" : "+m" (*(volatile char *)addr));
+	/* CLWB has opcode 66 0F AE /6; ModRM 0x30 encodes [rax], so the
+	 * address must be in rax */
+	__asm__ volatile(".byte 0x66, 0x0f, 0xae, 0x30"
+			 : "+m" (*(volatile char *)addr) : "a" (addr));
 	/* No invalidation: the cache line remains in cache in a clean state. */
 }
 
+static const fcc_func_ptr insn_func[FCC_NINSN] = {
+	[FCC_INSN_CLFLUSH]    = x86_flush_clflush,
+	[FCC_INSN_CLFLUSHOPT] = x86_flush_clflushopt,
+	[FCC_INSN_CLWB]       = x86_flush_clwb,
+};
+
+static const char * const insn_name[FCC_NINSN] = {
+	[FCC_INSN_CLFLUSH]    = "clflush",
+	[FCC_INSN_CLFLUSHOPT] = "clflushopt",
+	[FCC_INSN_CLWB]       = "clwb",
+};
+
 /* Memory barrier implementations: */
 static inline void x86_sfence(void)
 {
@@ -64,6 +92,269 @@ static inline void x86_sfence(void)
 	_mm_sfence();
 }
 
+/*
+ * Non-temporal copy kernels: @dst is cacheline aligned and @len is a
+ * multiple of the cacheline size. The stores bypass the cache (and are
+ * weakly ordered; the caller fences).
+ */
+static void x86_memcpy_nt_sse2(char *dst, const char *src, size_t len)
+{
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE,
+		     src += CACHELINE_SIZE) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+
+		_mm_stream_si128((__m128i *)dst, a);
+		_mm_stream_si128((__m128i *)(dst + 16), b);
+		_mm_stream_si128((__m128i *)(dst + 32), c);
+		_mm_stream_si128((__m128i *)(dst + 48), d);
+	}
+}
+
+static void __attribute__((target("avx")))
+x86_memcpy_nt_avx(char *dst, const char *src, size_t len)
+{
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE,
+		     src += CACHELINE_SIZE) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)src);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+
+		_mm256_stream_si256((__m256i *)dst, a);
+		_mm256_stream_si256((__m256i *)(dst + 32), b);
+	}
+}
+
+static void __attribute__((target("avx512f")))
+x86_memcpy_nt_avx512(char *dst, const char *src, size_t len)
+{
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE,
+		     src += CACHELINE_SIZE)
+		_mm512_stream_si512((void *)dst,
+				    _mm512_loadu_si512((const void *)src));
+}
+
+/* MOVDIR64B writes a whole cacheline to memory as one 64-byte direct
+ * store (weakly ordered, like the streaming stores) */
+static inline void x86_movdir64b(char *dst, const char *src)
+{
+	/* MOVDIR64B rdi, [rsi] has opcode 66 0F 38 F8 /r */
+	__asm__ volatile(".byte 0x66, 0x0f, 0x38, 0xf8, 0x3e"
+			 : "=m" (*(char (*)[64])dst)
+			 : "D" (dst), "S" (src), "m" (*(const char (*)[64])src));
+}
+
+static void x86_memcpy_nt_movdir64b(char *dst, const char *src, size_t len)
+{
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE,
+		     src += CACHELINE_SIZE)
+		x86_movdir64b(dst, src);
+}
+
+/*
+ * Non-temporal fill kernels: same alignment rules as the copy kernels
+ */
+static void x86_memset_nt_sse2(char *dst, int c, size_t len)
+{
+	__m128i v = _mm_set1_epi8((char)c);
+
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE) {
+		_mm_stream_si128((__m128i *)dst, v);
+		_mm_stream_si128((__m128i *)(dst + 16), v);
+		_mm_stream_si128((__m128i *)(dst + 32), v);
+		_mm_stream_si128((__m128i *)(dst + 48), v);
+	}
+}
+
+static void __attribute__((target("avx")))
+x86_memset_nt_avx(char *dst, int c, size_t len)
+{
+	__m256i v = _mm256_set1_epi8((char)c);
+
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE) {
+		_mm256_stream_si256((__m256i *)dst, v);
+		_mm256_stream_si256((__m256i *)(dst + 32), v);
+	}
+}
+
+static void __attribute__((target("avx512f")))
+x86_memset_nt_avx512(char *dst, int c, size_t len)
+{
+	__m512i v = _mm512_set1_epi32(0x01010101 * (unsigned char)c);
+
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE)
+		_mm512_stream_si512((void *)dst, v);
+}
+
+static void x86_memset_nt_movdir64b(char *dst, int c, size_t len)
+{
+	char line[64] __attribute__((aligned(64)));
+
+	memset(line, c, sizeof(line));
+	for (; len; len -= CACHELINE_SIZE, dst += CACHELINE_SIZE)
+		x86_movdir64b(dst, line);
+}
+
+/*
+ * Flush a range of memory [addr, addr+len) using the flush function;
+ * returns the number of cache lines flushed
+ */
+static size_t x86_flush_range(uintptr_t start, size_t len, fcc_func_ptr fcc_func)
+{
+	size_t nlines = 0;
+
+	if (len == 0)
+		return 0;
+
+	/* Align to cache line boundary (64 bytes on x86-64) */
+	uintptr_t ptr = start & ~(CACHELINE_SIZE - 1);
+	uintptr_t end = start + len;
+	famfs_log(FAMFS_LOG_DEBUG,
+		  "start = 0x%" PRIxPTR " ptr = 0x%" PRIxPTR " end: 0x%" PRIxPTR "\n",
+		  (uintptr_t)start, (uintptr_t)ptr, (uintptr_t)end );
+	
+	for (; ptr < end; ptr += CACHELINE_SIZE) {
+		fcc_func(ptr);
+		nlines++;
+	}
+	return nlines;
+}
+
+/*
+ * Flush strategy
+ *
+ * By default the instructions come from CPUID alone: flush_processor_cache()
+ * uses CLWB (which leaves the line cached), else CLFLUSHOPT, else CLFLUSH;
+ * invalidate_processor_cache() uses CLFLUSHOPT, else CLFLUSH.
+ *
+ * CPUID only says which instructions exist, not what they cost: on some
+ * CPUs CLWB is no cheaper than CLFLUSHOPT (or is implemented as it). With
+ * FCC_CALIBRATE=1 in the environment, init times each available
+ * instruction on a dirty buffer (the median of FCC_CAL_REPS runs, which
+ * is still noisy) and only moves off the CPUID choice for an instruction
+ * that is more than FCC_CAL_FACTOR times cheaper.
+ *
+ * A written range bigger than the last-level cache can't stay cached
+ * anyway, so keeping its lines with CLWB only displaces other data. If
+ * calibration finds the invalidating instruction no slower than CLWB
+ * (within the same FCC_CAL_FACTOR), write-backs of at least the LLC size
+ * use it instead.
+ * FCC_FLUSH_THRESHOLD=<bytes> in the environment sets that threshold
+ * regardless (0 turns it off).
+ *
+ * perf/fcc_bench.c measures the same costs across range sizes.
+ */
+#define FCC_CAL_LINES      4096
+#define FCC_CAL_REPS       31
+#define FCC_CAL_FACTOR     2
+#define FCC_DEFAULT_LLC    (32UL * 1024 * 1024)
+
+static uint64_t x86_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int x86_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Median-of-FCC_CAL_REPS cost per line of @insn on dirty lines */
+static double x86_calibrate_insn(enum fcc_insn insn, char *buf)
+{
+	uint64_t t[FCC_CAL_REPS];
+	int r;
+
+	for (r = 0; r < FCC_CAL_REPS; r++) {
+		memset(buf, r, FCC_CAL_LINES * CACHELINE_SIZE);
+		t[r] = x86_now_ns();
+		x86_flush_range((uintptr_t)buf, FCC_CAL_LINES * CACHELINE_SIZE,
+				insn_func[insn]);
+		x86_sfence();
+		t[r] = x86_now_ns() - t[r];
+	}
+	qsort(t, FCC_CAL_REPS, sizeof(t[0]), x86_cmp_u64);
+	return (double)t[FCC_CAL_REPS / 2] / FCC_CAL_LINES;
+}
+
+/* The first supported instruction of @insns (CPUID order, best first);
+ * with calibrated costs, a later one replaces it only if it is more than
+ * FCC_CAL_FACTOR times cheaper */
+static enum fcc_insn x86_pick_insn(const enum fcc_insn *insns, int n,
+				   const double *ns)
+{
+	enum fcc_insn pick = FCC_NINSN;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!insn_supported[insns[i]])
+			continue;
+		if (pick == FCC_NINSN ||
+		    ns[insns[i]] * FCC_CAL_FACTOR < ns[pick])
+			pick = insns[i];
+	}
+	return (pick == FCC_NINSN) ? FCC_INSN_CLFLUSH : pick;
+}
+
+static void x86_select_flush_strategy(void)
+{
+	static const enum fcc_insn flush_order[] = {
+		FCC_INSN_CLWB, FCC_INSN_CLFLUSHOPT, FCC_INSN_CLFLUSH,
+	};
+	static const enum fcc_insn inval_order[] = {
+		FCC_INSN_CLFLUSHOPT, FCC_INSN_CLFLUSH,
+	};
+	const char *env = getenv("FCC_FLUSH_THRESHOLD");
+	const char *cal = getenv("FCC_CALIBRATE");
+	double *ns = strategy.line_ns;
+	int calibrated = 0;
+	enum fcc_insn i;
+	long llc;
+	char *buf;
+
+	/* Uncalibrated, all costs are 0 and the picks are the CPUID order */
+	if (cal && atoi(cal) &&
+	    posix_memalign((void **)&buf, CACHELINE_SIZE,
+			   FCC_CAL_LINES * CACHELINE_SIZE) == 0) {
+		for (i = 0; i < FCC_NINSN; i++)
+			if (insn_supported[i])
+				ns[i] = x86_calibrate_insn(i, buf);
+		free(buf);
+		calibrated = 1;
+	}
+
+	strategy.flush = x86_pick_insn(flush_order,
+				       sizeof(flush_order) / sizeof(flush_order[0]),
+				       ns);
+	strategy.invalidate = x86_pick_insn(inval_order,
+				       sizeof(inval_order) / sizeof(inval_order[0]),
+				       ns);
+
+	strategy.large_flush = strategy.flush;
+	strategy.large_threshold = SIZE_MAX;
+	if (calibrated && strategy.flush == FCC_INSN_CLWB &&
+	    ns[strategy.invalidate] < ns[FCC_INSN_CLWB] * FCC_CAL_FACTOR) {
+		llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+		strategy.large_flush = strategy.invalidate;
+		strategy.large_threshold = (llc > 0) ? (size_t)llc :
+			FCC_DEFAULT_LLC;
+	}
+	if (env) {
+		strategy.large_flush = strategy.invalidate;
+		strategy.large_threshold = strtoull(env, NULL, 0);
+		if (!strategy.large_threshold) {
+			strategy.large_flush = strategy.flush;
+			strategy.large_threshold = SIZE_MAX;
+		}
+	}
+}
+
 /* Initialize function pointers based on CPU features
  * (detect if CLWB/CLFLUSHOPT are available)
  */
@@ -73,11 +364,16 @@ static void x86_init_flush_functions(void)
 	int has_clflushopt = 0;
 	int has_clflush = 0;
 	int has_clwb = 0;
+	int has_movdir64b = 0;
+	int use_movdir64b;
+	const char *env;
 
-	/* CPUID leaf 7, sub-leaf 0: EBX bits 23 = CLFLUSHOPT, 24 = CLWB */
+	/* CPUID leaf 7, sub-leaf 0: EBX bits 23 = CLFLUSHOPT, 24 = CLWB;
+	 * ECX bit 28 = MOVDIR64B */
 	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
 		has_clflushopt = (ebx >> 23) & 1;
 		has_clwb       = (ebx >> 24) & 1;
+		has_movdir64b  = (ecx >> 28) & 1;
 	}
 	/* Check for CLFLUSH support using CPUID leaf 1
 	 * CLFSH feature is indicated by bit 19 of the EDX register
@@ -85,43 +381,53 @@ static void x86_init_flush_functions(void)
 	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
 	has_clflush = (edx >> 19) & 1;
 
-	/* Select optimal flush instructions */
-	if (has_clwb) {
-		assert(has_clflush);
-		flush_cacheline_func = x86_flush_clwb;
-		/* If CLFLUSHOPT is also available, use it for invalidation,
-		 * else fall back to CLFLUSH */
-		if (has_clflushopt)
-			invalidate_cacheline_func = x86_flush_clflushopt;
-		else
-			invalidate_cacheline_func = x86_flush_clflush;
-	} else if (has_clflushopt) {
-		flush_cacheline_func = x86_flush_clflushopt;
-		invalidate_cacheline_func = x86_flush_clflushopt;
-	} else if (has_clflush) {
-		/* Only CLFLUSH is available */
-		flush_cacheline_func = x86_flush_clflush;
-		invalidate_cacheline_func = x86_flush_clflush;
-	}
-	fence_func = x86_sfence;
-}
+	insn_supported[FCC_INSN_CLFLUSH]    = has_clflush;
+	insn_supported[FCC_INSN_CLFLUSHOPT] = has_clflushopt;
+	insn_supported[FCC_INSN_CLWB]       = has_clwb;
 
-/* Flush a range of memory [addr, addr+len) using the flush function */
-static void x86_flush_range(uintptr_t start, size_t len, fcc_func_ptr fcc_func)
-{
-	if (len == 0)
-		return;
+	fence_func = x86_sfence;
 
-	/* Align to cache line boundary (64 bytes on x86-64) */
-	uintptr_t ptr = start & ~(CACHELINE_SIZE - 1);
-	uintptr_t end = start + len;
-	famfs_log(FAMFS_LOG_DEBUG,
-		  "start = 0x%" PRIxPTR " ptr = 0x%" PRIxPTR " end: 0x%" PRIxPTR "\n",
-		  (uintptr_t)start, (uintptr_t)ptr, (uintptr_t)end );
-	
-	for (; ptr < end; ptr += CACHELINE_SIZE) {
-		fcc_func(ptr);
+	/* SSE2 is baseline on x86-64; the wider kernels also need OS
+	 * support for the vector state, which __builtin_cpu_supports()
+	 * checks */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		memcpy_nt_func = x86_memcpy_nt_avx512;
+		memset_nt_func = x86_memset_nt_avx512;
+	} else if (__builtin_cpu_supports("avx")) {
+		memcpy_nt_func = x86_memcpy_nt_avx;
+		memset_nt_func = x86_memset_nt_avx;
+	} else {
+		memcpy_nt_func = x86_memcpy_nt_sse2;
+		memset_nt_func = x86_memset_nt_sse2;
+	}
+	/* A MOVDIR64B moves a whole line with one instruction, but it has
+	 * not been shown to beat the vector kernels on bulk copies, so it is
+	 * only used when FCC_MOVDIR64B=1 is in the environment */
+	env = getenv("FCC_MOVDIR64B");
+	use_movdir64b = has_movdir64b && env && atoi(env);
+	if (use_movdir64b) {
+		memcpy_nt_func = x86_memcpy_nt_movdir64b;
+		memset_nt_func = x86_memset_nt_movdir64b;
 	}
+
+	x86_select_flush_strategy();
+	flush_cacheline_func = insn_func[strategy.flush];
+	invalidate_cacheline_func = insn_func[strategy.invalidate];
+	large_flush_func = insn_func[strategy.large_flush];
+
+	famfs_log(FAMFS_LOG_INFO,
+		  "libfcc: flush %s, invalidate %s, flush >= %zu bytes %s; "
+		  "ns/line clflush %.1f clflushopt %.1f clwb %.1f; "
+		  "nt stores %s\n",
+		  insn_name[strategy.flush], insn_name[strategy.invalidate],
+		  strategy.large_threshold, insn_name[strategy.large_flush],
+		  strategy.line_ns[FCC_INSN_CLFLUSH],
+		  strategy.line_ns[FCC_INSN_CLFLUSHOPT],
+		  strategy.line_ns[FCC_INSN_CLWB],
+		  (use_movdir64b) ? "movdir64b" :
+		  (memcpy_nt_func == x86_memcpy_nt_avx512) ? "avx512" :
+		  (memcpy_nt_func == x86_memcpy_nt_avx) ? "avx" : "sse2");
 }
 
 void flush_processor_cache(const void *addr, size_t len)
@@ -132,7 +438,9 @@ void flush_processor_cache(const void *addr, size_t len)
 			(uintptr_t)addr, len);
 
 	/* Ensure all flush instructions have completed and data is visible */
-	x86_flush_range((uintptr_t)addr, len, flush_cacheline_func);
+	x86_flush_range((uintptr_t)addr, len,
+			(len >= strategy.large_threshold) ?
+			large_flush_func : flush_cacheline_func);
 	fence_func(); /* ensure all prior memory ops complete before flushing */
 }
 
@@ -159,3 +467,212 @@ void hard_flush_processor_cache(const void *addr, size_t len)
 	fence_func(); /* ensure all prior memory ops complete before flushing */
 }
 
+/* A cacheline-aligned span [start, end) */
+struct x86_span {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+/* Batches up to this size are sorted on the stack */
+#define FCC_SMALL_BATCH 16
+
+static int x86_span_cmp(const void *a, const void *b)
+{
+	const struct x86_span *sa = a;
+	const struct x86_span *sb = b;
+
+	return (sa->start > sb->start) - (sa->start < sb->start);
+}
+
+/*
+ * Apply @fcc_func once to each cache line covered by a batch of ranges:
+ * the ranges are rounded out to cacheline boundaries, sorted, and merged
+ * where they overlap or touch. Returns the number of lines visited. The
+ * caller fences.
+ */
+static size_t x86_flush_ranges(const struct iovec *iov, int iovcnt,
+			       fcc_func_ptr fcc_func)
+{
+	struct x86_span small[FCC_SMALL_BATCH];
+	struct x86_span *spans = small;
+	uintptr_t ptr, end;
+	size_t nlines = 0;
+	int i, j, n = 0;
+
+	if (iovcnt <= 0)
+		return 0;
+
+	if (iovcnt > FCC_SMALL_BATCH) {
+		spans = malloc(iovcnt * sizeof(*spans));
+		if (!spans) {
+			/* No memory to merge; lines may be visited twice */
+			for (i = 0; i < iovcnt; i++)
+				nlines += x86_flush_range(
+					(uintptr_t)iov[i].iov_base,
+					iov[i].iov_len, fcc_func);
+			return nlines;
+		}
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		struct x86_span sp;
+
+		if (iov[i].iov_len == 0)
+			continue;
+		sp.start = (uintptr_t)iov[i].iov_base & ~(CACHELINE_SIZE - 1);
+		sp.end = ((uintptr_t)iov[i].iov_base + iov[i].iov_len +
+			  CACHELINE_SIZE - 1) & ~(CACHELINE_SIZE - 1);
+		if (iovcnt > FCC_SMALL_BATCH) {
+			spans[n++] = sp;
+			continue;
+		}
+		/* Insertion sort; batches this small are usually in order */
+		for (j = n; j > 0 && spans[j - 1].start > sp.start; j--)
+			spans[j] = spans[j - 1];
+		spans[j] = sp;
+		n++;
+	}
+	if (iovcnt > FCC_SMALL_BATCH)
+		qsort(spans, n, sizeof(*spans), x86_span_cmp);
+
+	for (i = 0; i < n; ) {
+		ptr = spans[i].start;
+		end = spans[i].end;
+		for (i++; i < n && spans[i].start <= end; i++) {
+			if (spans[i].end > end)
+				end = spans[i].end;
+		}
+		famfs_log(FAMFS_LOG_DEBUG,
+			  "ptr = 0x%" PRIxPTR " end: 0x%" PRIxPTR "\n",
+			  ptr, end);
+		for (; ptr < end; ptr += CACHELINE_SIZE, nlines++)
+			fcc_func(ptr);
+	}
+
+	if (spans != small)
+		free(spans);
+	return nlines;
+}
+
+size_t flush_processor_cache_v(const struct iovec *iov, int iovcnt)
+{
+	size_t nlines;
+
+	pthread_once(&initialized, x86_init_flush_functions);
+	famfs_log(FAMFS_LOG_DEBUG, "flush_processor_cache_v %d ranges\n",
+		  iovcnt);
+
+	nlines = x86_flush_ranges(iov, iovcnt, flush_cacheline_func);
+	fence_func(); /* one fence for the whole batch */
+	return nlines;
+}
+
+size_t invalidate_processor_cache_v(const struct iovec *iov, int iovcnt)
+{
+	size_t nlines;
+
+	pthread_once(&initialized, x86_init_flush_functions);
+	famfs_log(FAMFS_LOG_DEBUG, "invalidate_processor_cache_v %d ranges\n",
+		  iovcnt);
+
+	nlines = x86_flush_ranges(iov, iovcnt, invalidate_cacheline_func);
+	fence_func();
+	return nlines;
+}
+
+void fcc_memcpy_nt(void *dst, const void *src, size_t len)
+{
+	uintptr_t d = (uintptr_t)dst;
+	const char *s = src;
+	size_t head, body;
+
+	pthread_once(&initialized, x86_init_flush_functions);
+
+	/* Partial cachelines at the ends are copied through the cache and
+	 * written back */
+	head = (CACHELINE_SIZE - (d & (CACHELINE_SIZE - 1))) &
+		(CACHELINE_SIZE - 1);
+	if (head > len)
+		head = len;
+	if (head) {
+		memcpy((void *)d, s, head);
+		x86_flush_range(d, head, flush_cacheline_func);
+		d += head;
+		s += head;
+		len -= head;
+	}
+
+	body = len & ~(CACHELINE_SIZE - 1);
+	if (body) {
+		memcpy_nt_func((char *)d, s, body);
+		d += body;
+		s += body;
+		len -= body;
+	}
+
+	if (len) {
+		memcpy((void *)d, s, len);
+		x86_flush_range(d, len, flush_cacheline_func);
+	}
+
+	/* One fence orders the streaming stores and the write-backs */
+	fence_func();
+}
+
+void fcc_memset_nt(void *dst, int c, size_t len)
+{
+	uintptr_t d = (uintptr_t)dst;
+	size_t head, body;
+
+	pthread_once(&initialized, x86_init_flush_functions);
+
+	/* As in fcc_memcpy_nt(), partial cachelines at the ends are written
+	 * through the cache and written back */
+	head = (CACHELINE_SIZE - (d & (CACHELINE_SIZE - 1))) &
+		(CACHELINE_SIZE - 1);
+	if (head > len)
+		head = len;
+	if (head) {
+		memset((void *)d, c, head);
+		x86_flush_range(d, head, flush_cacheline_func);
+		d += head;
+		len -= head;
+	}
+
+	body = len & ~(CACHELINE_SIZE - 1);
+	if (body) {
+		memset_nt_func((char *)d, c, body);
+		d += body;
+		len -= body;
+	}
+
+	if (len) {
+		memset((void *)d, c, len);
+		x86_flush_range(d, len, flush_cacheline_func);
+	}
+
+	fence_func();
+}
+
+void fcc_get_strategy(struct fcc_strategy *s)
+{
+	pthread_once(&initialized, x86_init_flush_functions);
+	*s = strategy;
+}
+
+const char *fcc_insn_name(enum fcc_insn insn)
+{
+	if ((int)insn < 0 || insn >= FCC_NINSN)
+		return "unknown";
+	return insn_name[insn];
+}
+
+int fcc_flush_range_insn(enum fcc_insn insn, const void *addr, size_t len)
+{
+	pthread_once(&initialized, x86_init_flush_functions);
+	if ((int)insn < 0 || insn >= FCC_NINSN || !insn_supported[insn])
+		return -1;
+	x86_flush_range((uintptr_t)addr, len, insn_func[insn]);
+	fence_func();
+	return 0;
+}
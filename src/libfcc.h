@@ -15,6 +15,7 @@
 #define LIBFCC_H
 
 #include <stddef.h>  // for size_t
+#include <sys/uio.h> // for struct iovec
 
 #ifdef __cplusplus
 extern "C" {
@@ -59,6 +60,120 @@ void invalidate_processor_cache(const void *addr, size_t len);
  */
 void hard_flush_processor_cache(const void *addr, size_t len);
 
+/**
+ * flush_processor_cache_v() - Write back a batch of ranges to main memory.
+ * @iov: Array of ranges ([iov_base, iov_base+iov_len) each).
+ * @iovcnt: Number of entries in @iov.
+ *
+ * Like calling flush_processor_cache() on each range, but every cache line
+ * covered by the batch is written back once (ranges that overlap or share
+ * a cache line are merged), and there is a single fence at the end. There
+ * is no ordering among the ranges: if one range must reach memory before
+ * another is written, they need separate calls.
+ *
+ * Return: the number of distinct cache lines written back.
+ */
+size_t flush_processor_cache_v(const struct iovec *iov, int iovcnt);
+
+/**
+ * invalidate_processor_cache_v() - Invalidate a batch of ranges.
+ * @iov: Array of ranges ([iov_base, iov_base+iov_len) each).
+ * @iovcnt: Number of entries in @iov.
+ *
+ * Vectored invalidate_processor_cache(): each cache line covered by the
+ * batch is invalidated once, followed by a single fence.
+ *
+ * Return: the number of distinct cache lines invalidated.
+ */
+size_t invalidate_processor_cache_v(const struct iovec *iov, int iovcnt);
+
+/**
+ * fcc_memcpy_nt() - Copy to memory with non-temporal (streaming) stores.
+ * @dst: Destination (e.g. a DAX mapping).
+ * @src: Source.
+ * @len: Length of the copy in bytes.
+ *
+ * Copies [src, src+len) to [dst, dst+len) without filling the cache with
+ * the destination lines, using the widest streaming stores the CPU has
+ * (SSE2/AVX/AVX-512), or MOVDIR64B if the CPU has it and FCC_MOVDIR64B=1
+ * is in the environment. Partial cachelines at either end are copied
+ * normally and written back (CLWB, or the best flush the CPU has).
+ *
+ * Visibility: when this returns, the whole destination range has been
+ * written to memory and fenced, exactly as if it had been written with
+ * cached stores followed by flush_processor_cache(). There is no need to
+ * flush the destination afterward, and stores issued after the call
+ * cannot reach memory ahead of it. Readers on other hosts still need to
+ * invalidate_processor_cache() before reading.
+ */
+void fcc_memcpy_nt(void *dst, const void *src, size_t len);
+
+/**
+ * fcc_memset_nt() - Fill memory with non-temporal (streaming) stores.
+ * @dst: Destination (e.g. a DAX mapping).
+ * @c: Fill byte.
+ * @len: Length of the range in bytes.
+ *
+ * memset() counterpart of fcc_memcpy_nt(), with the same instruction
+ * selection and the same visibility guarantee: [dst, dst+len) is in
+ * memory, and fenced, when this returns.
+ */
+void fcc_memset_nt(void *dst, int c, size_t len);
+
+/*
+ * Flush strategy
+ *
+ * At first use, libfcc picks the cache-line flush instructions
+ * flush_processor_cache() and invalidate_processor_cache() use, from CPUID.
+ * With FCC_CALIBRATE=1 in the environment, it also times them and moves
+ * off the CPUID choice only for a much cheaper instruction. The choice
+ * (and any measured costs) is logged at FAMFS_LOG_INFO.
+ * flush_processor_cache() of a range of at least large_threshold bytes
+ * uses large_flush instead of flush (see fcc-x86_64.c; FCC_FLUSH_THRESHOLD
+ * in the environment sets the threshold). perf/fcc_bench.c measures the
+ * instructions directly.
+ */
+enum fcc_insn {
+	FCC_INSN_CLFLUSH,
+	FCC_INSN_CLFLUSHOPT,
+	FCC_INSN_CLWB,
+	FCC_NINSN,
+};
+
+struct fcc_strategy {
+	enum fcc_insn flush;        /* flush_processor_cache() */
+	enum fcc_insn invalidate;   /* invalidate_processor_cache() */
+	enum fcc_insn large_flush;  /* flush_processor_cache(), big ranges */
+	size_t large_threshold;     /* SIZE_MAX: never */
+	double line_ns[FCC_NINSN];  /* calibrated cost per dirty line (0 if
+				     * unsupported or not calibrated) */
+};
+
+/**
+ * fcc_get_strategy() - Get the flush strategy libfcc selected.
+ * @s: Filled in with the strategy.
+ */
+void fcc_get_strategy(struct fcc_strategy *s);
+
+/**
+ * fcc_insn_name() - Name of a flush instruction (e.g. "clwb").
+ * @insn: Instruction.
+ */
+const char *fcc_insn_name(enum fcc_insn insn);
+
+/**
+ * fcc_flush_range_insn() - Flush a range with a specific instruction.
+ * @insn: Instruction to issue on each cache line.
+ * @addr: Starting address of the memory range.
+ * @len: Length of the range in bytes.
+ *
+ * Issues @insn on each cache line of [addr, addr+len), then fences. This
+ * bypasses the strategy; it is meant for benchmarks and tests.
+ *
+ * Return: 0, or -1 if the CPU does not support @insn.
+ */
+int fcc_flush_range_insn(enum fcc_insn insn, const void *addr, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
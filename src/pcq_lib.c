@@ -402,8 +402,11 @@ pcq_producer_put(
 	 */
 	bucket_addr = (void *)((u64)pcq + pcq->bucket_array_offset +
 			       (put_index * pcq->bucket_size));
-	memcpy(bucket_addr, entry, pcq->bucket_size);
-	flush_processor_cache(bucket_addr, pcq->bucket_size);
+	/* The bucket must reach memory before the index that publishes it
+	 * (a consumer that sees a stale bucket fails its crc check), so it
+	 * can't share a flush_processor_cache_v() batch with the index.
+	 * fcc_memcpy_nt() has it in memory, fenced, when it returns. */
+	fcc_memcpy_nt(bucket_addr, entry, pcq->bucket_size);
 	pcq->producer_index = (put_index + 1) % pcq->nbuckets;
 	flush_processor_cache(&pcq->producer_index, sizeof(pcq->producer_index));
 
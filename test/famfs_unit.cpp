@@ -23,6 +23,9 @@ extern "C" {
 #include "famfs_fmap.h"
 #include "xrand.h"
 #include "random_buffer.h"
+#include "libfcc.h"
+#include "famfs_uring.h"
+#include "famfs_wspool.h"
 #include "famfs_unit.h"
 
 //#define _GNU_SOURCE
@@ -31,6 +34,9 @@ extern "C" {
 #include <fuse_lowlevel.h>
 #include "famfs_fused_icache.h"
 #include "famfs_fused.h"
+#include "famfs_fused_stats.h"
+#include "famfs_fused_affinity.h"
+#include "famfs_fused_dirp.h"
 }
 
 /****+++++++++++++++++++++++++++++++++++++++++++++
@@ -321,6 +327,543 @@ TEST(famfs, famfs_random_buffer)
 #endif
 }
 
+TEST(famfs, famfs_random_buffer_at)
+{
+	size_t len = 1024 * 1024 + 13;
+	char *whole = (char *)calloc(1, len);
+	char *pieces = (char *)calloc(1, len);
+	size_t ofs, n;
+
+	ASSERT_NE(whole, nullptr);
+	ASSERT_NE(pieces, nullptr);
+
+	/* The data at an offset doesn't depend on where the fill started */
+	randomize_buffer_at(whole, len, 0, 42);
+	for (ofs = 0; ofs < len; ofs += n) {
+		n = std::min(len - ofs, (ofs % 7) * 4099 + 3);
+		randomize_buffer_at(pieces + ofs, n, ofs, 42);
+	}
+	ASSERT_EQ(memcmp(whole, pieces, len), 0);
+
+	ASSERT_EQ(validate_random_buffer_at(whole, len, 0, 42), -1);
+	ASSERT_EQ(validate_random_buffer_at(whole + 5, len - 5, 5, 42), -1);
+	ASSERT_EQ(validate_random_buffer_at(whole + 5, len - 5, 6, 42), 0);
+	ASSERT_NE(validate_random_buffer_at(whole, len, 0, 43), -1);
+	ASSERT_EQ(validate_random_buffer_at(whole, 0, 0, 42), -1);
+
+	/* Mismatches are reported at the first bad byte, relative to buf */
+	whole[777777] ^= 0x40;
+	ASSERT_EQ(validate_random_buffer_at(whole, len, 0, 42), 777777);
+	ASSERT_EQ(validate_random_buffer_at(whole + 3, len - 3, 3, 42),
+		  777777 - 3);
+	whole[777777] ^= 0x40;
+	whole[len - 1] ^= 1;
+	ASSERT_EQ(validate_random_buffer_at(whole, len, 0, 42),
+		  (int64_t)len - 1);
+	whole[len - 1] ^= 1;
+	whole[2] ^= 1;
+	ASSERT_EQ(validate_random_buffer_at(whole + 1, 4, 1, 42), 1);
+
+	/* Not the same data as the original stream */
+	randomize_buffer(pieces, len, 42);
+	ASSERT_NE(memcmp(whole, pieces, len), 0);
+	ASSERT_EQ(validate_random_buffer(pieces, len, 42), -1);
+
+	free(whole);
+	free(pieces);
+}
+
+TEST(famfs, famfs_memcpy_nt)
+{
+	size_t lens[] = { 0, 1, 63, 64, 65, 127, 128, 200, 4096, 4096 + 77,
+			  100000 };
+	size_t bufsize = 100000 + 256;
+	char *src, *dst, *ref;
+	size_t i, so, doff;
+
+	ASSERT_EQ(posix_memalign((void **)&src, 64, bufsize), 0);
+	ASSERT_EQ(posix_memalign((void **)&dst, 64, bufsize), 0);
+	ASSERT_EQ(posix_memalign((void **)&ref, 64, bufsize), 0);
+	randomize_buffer(src, bufsize, 7);
+
+	/* Aligned and unaligned heads and tails, on either side; the bytes
+	 * around the destination range must not be touched */
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		for (so = 0; so < 64; so += 13) {
+			for (doff = 0; doff < 128; doff += 31) {
+				memset(dst, 0xa5, bufsize);
+				memset(ref, 0xa5, bufsize);
+				memcpy(&ref[doff], &src[so], lens[i]);
+				fcc_memcpy_nt(&dst[doff], &src[so], lens[i]);
+				ASSERT_EQ(memcmp(dst, ref, bufsize), 0);
+			}
+		}
+	}
+	free(src);
+	free(dst);
+	free(ref);
+}
+
+TEST(famfs, famfs_memset_nt)
+{
+	size_t lens[] = { 0, 1, 63, 64, 65, 127, 128, 200, 4096, 4096 + 77,
+			  100000 };
+	size_t bufsize = 100000 + 256;
+	char *dst, *ref;
+	size_t i, doff;
+
+	ASSERT_EQ(posix_memalign((void **)&dst, 64, bufsize), 0);
+	ASSERT_EQ(posix_memalign((void **)&ref, 64, bufsize), 0);
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		for (doff = 0; doff < 128; doff += 31) {
+			memset(dst, 0xa5, bufsize);
+			memset(ref, 0xa5, bufsize);
+			memset(&ref[doff], 0x3c + (int)i, lens[i]);
+			fcc_memset_nt(&dst[doff], 0x3c + (int)i, lens[i]);
+			ASSERT_EQ(memcmp(dst, ref, bufsize), 0);
+		}
+	}
+	free(dst);
+	free(ref);
+}
+
+TEST(famfs, famfs_fcc_flush_v)
+{
+	struct iovec iov[100];
+	char *buf, *ref;
+	size_t bufsize = 4096;
+	int i;
+
+	ASSERT_EQ(posix_memalign((void **)&buf, 64, bufsize), 0);
+	ref = (char *)malloc(bufsize);
+	ASSERT_NE(ref, nullptr);
+	randomize_buffer(buf, bufsize, 3);
+	memcpy(ref, buf, bufsize);
+
+	ASSERT_EQ(flush_processor_cache_v(NULL, 0), 0);
+
+	/* Out of order; overlapping, shared and adjacent lines; empty range:
+	 * lines 0-1 (from the first two) and 3-4 */
+	iov[0].iov_base = buf + 256;  iov[0].iov_len = 64;
+	iov[1].iov_base = buf + 5;    iov[1].iov_len = 100;
+	iov[2].iov_base = buf + 128;  iov[2].iov_len = 0;
+	iov[3].iov_base = buf;        iov[3].iov_len = 10;
+	iov[4].iov_base = buf + 200;  iov[4].iov_len = 1;
+	ASSERT_EQ(flush_processor_cache_v(iov, 5), 4);
+	ASSERT_EQ(invalidate_processor_cache_v(iov, 5), 4);
+
+	/* A batch too big to sort on the stack: 100 8-byte ranges, in
+	 * reverse order, covering 800 bytes (13 lines) */
+	for (i = 0; i < 100; i++) {
+		iov[i].iov_base = buf + (99 - i) * 8;
+		iov[i].iov_len = 8;
+	}
+	ASSERT_EQ(flush_processor_cache_v(iov, 100), 13);
+	ASSERT_EQ(invalidate_processor_cache_v(iov, 100), 13);
+
+	/* One range straddling lines */
+	iov[0].iov_base = buf + 63;
+	iov[0].iov_len = 2;
+	ASSERT_EQ(flush_processor_cache_v(iov, 1), 2);
+
+	ASSERT_EQ(memcmp(buf, ref, bufsize), 0);
+	free(buf);
+	free(ref);
+}
+
+TEST(famfs, famfs_fcc_strategy)
+{
+	struct fcc_strategy st;
+	size_t bufsize = 64 * 1024;
+	char *buf, *ref;
+	int i, nsupported = 0;
+
+	fcc_get_strategy(&st);
+	/* clwb does not invalidate */
+	ASSERT_NE(st.invalidate, FCC_INSN_CLWB);
+	ASSERT_TRUE(st.flush >= 0 && st.flush < FCC_NINSN);
+	ASSERT_TRUE(st.large_flush >= 0 && st.large_flush < FCC_NINSN);
+	ASSERT_GT(st.large_threshold, 0);
+	ASSERT_STREQ(fcc_insn_name(FCC_INSN_CLWB), "clwb");
+	ASSERT_STREQ(fcc_insn_name(FCC_NINSN), "unknown");
+
+	ASSERT_EQ(posix_memalign((void **)&buf, 64, bufsize), 0);
+	ref = (char *)malloc(bufsize);
+	ASSERT_NE(ref, nullptr);
+	randomize_buffer(buf, bufsize, 5);
+	memcpy(ref, buf, bufsize);
+
+	/* The selected instructions must work; the rest may not exist */
+	for (i = 0; i < FCC_NINSN; i++) {
+		if (fcc_flush_range_insn((enum fcc_insn)i, buf, bufsize) == 0)
+			nsupported++;
+		else
+			ASSERT_TRUE(i != st.flush && i != st.invalidate &&
+				    i != st.large_flush);
+	}
+	ASSERT_GT(nsupported, 0);
+	ASSERT_EQ(fcc_flush_range_insn(FCC_NINSN, buf, bufsize), -1);
+
+	/* Uncalibrated, the choice is the CPUID order */
+	if (!getenv("FCC_CALIBRATE") && !getenv("FCC_FLUSH_THRESHOLD")) {
+		for (i = 0; i < FCC_NINSN; i++)
+			ASSERT_EQ(st.line_ns[i], 0);
+		if (fcc_flush_range_insn(FCC_INSN_CLWB, buf, 64) == 0) {
+			ASSERT_EQ(st.flush, FCC_INSN_CLWB);
+		}
+		if (fcc_flush_range_insn(FCC_INSN_CLFLUSHOPT, buf, 64) == 0) {
+			ASSERT_EQ(st.invalidate, FCC_INSN_CLFLUSHOPT);
+		}
+		ASSERT_EQ(st.large_threshold, SIZE_MAX);
+	}
+
+	/* Both sides of the large-range threshold */
+	flush_processor_cache(buf, bufsize);
+	flush_processor_cache(buf, 64);
+	ASSERT_EQ(memcmp(buf, ref, bufsize), 0);
+	free(buf);
+	free(ref);
+}
+
+struct uring_test_ctx {
+	char *out;
+	off_t base;
+	size_t consumed;
+	size_t fail_after;
+};
+
+static int
+uring_test_consume(void *arg, const char *buf, size_t len, off_t offset)
+{
+	struct uring_test_ctx *ctx = (struct uring_test_ctx *)arg;
+
+	if (ctx->fail_after && ctx->consumed >= ctx->fail_after)
+		return 42;
+	memcpy(&ctx->out[offset - ctx->base], buf, len);
+	ctx->consumed += len;
+	return 0;
+}
+
+TEST(famfs, famfs_uring_reader)
+{
+	size_t size = 5 * 1024 * 1024 + 123;
+	struct famfs_uring_reader rd;
+	struct uring_test_ctx ctx;
+	char *data, *out;
+	int fd, rc;
+
+	data = (char *)malloc(size);
+	out = (char *)malloc(size);
+	ASSERT_NE(data, nullptr);
+	ASSERT_NE(out, nullptr);
+	randomize_buffer(data, size, 11);
+
+	fd = open("/tmp/famfs_uring_test", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	ASSERT_GT(fd, 0);
+	ASSERT_EQ(write(fd, data, size), (ssize_t)size);
+
+	rc = famfs_uring_reader_init(&rd, 3, 65536);
+	if (rc) {
+		/* No io_uring here (e.g. disabled by sysctl or seccomp) */
+		printf("io_uring unavailable (%d); skipping\n", rc);
+		goto out;
+	}
+
+	/* The whole file, with many more reads than slots */
+	memset(&ctx, 0, sizeof(ctx));
+	memset(out, 0, size);
+	ctx.out = out;
+	rc = famfs_uring_read_range(&rd, fd, 0, size, uring_test_consume, &ctx);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(ctx.consumed, size);
+	ASSERT_EQ(memcmp(out, data, size), 0);
+
+	/* An unaligned range that ends at EOF */
+	memset(&ctx, 0, sizeof(ctx));
+	memset(out, 0, size);
+	ctx.out = out;
+	ctx.base = 4096 + 7;
+	rc = famfs_uring_read_range(&rd, fd, ctx.base, size - ctx.base,
+				    uring_test_consume, &ctx);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(memcmp(out, &data[ctx.base], size - ctx.base), 0);
+
+	/* Less than one buffer */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.out = out;
+	ctx.base = 100;
+	rc = famfs_uring_read_range(&rd, fd, 100, 1000, uring_test_consume,
+				    &ctx);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(memcmp(out, &data[100], 1000), 0);
+
+	/* Reading past EOF fails */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.out = out;
+	ctx.base = size - 1000;
+	rc = famfs_uring_read_range(&rd, fd, ctx.base, 65536 * 4,
+				    uring_test_consume, &ctx);
+	ASSERT_EQ(rc, -ENODATA);
+
+	/* A consumer error stops the read, and the reader is still usable */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.out = out;
+	ctx.fail_after = 65536 * 5;
+	rc = famfs_uring_read_range(&rd, fd, 0, size, uring_test_consume, &ctx);
+	ASSERT_EQ(rc, 42);
+	ASSERT_LT(ctx.consumed, size);
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(out, 0, size);
+	ctx.out = out;
+	rc = famfs_uring_read_range(&rd, fd, 0, size, uring_test_consume, &ctx);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(memcmp(out, data, size), 0);
+
+	/* Bad fd */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.out = out;
+	rc = famfs_uring_read_range(&rd, 9999, 0, size, uring_test_consume,
+				    &ctx);
+	ASSERT_EQ(rc, -EBADF);
+
+	famfs_uring_reader_destroy(&rd);
+out:
+	close(fd);
+	unlink("/tmp/famfs_uring_test");
+	free(data);
+	free(out);
+}
+
+static void
+cp_plan_check(size_t size, u64 nstrips, u64 chunk)
+{
+	struct famfs_log_fmap fmap;
+	struct famfs_cp_unit *units;
+	size_t nunits, i, p, o;
+	unsigned char *seen;
+	size_t covered = 0;
+
+	memset(&fmap, 0, sizeof(fmap));
+	fmap.fmap_ext_type = FAMFS_EXT_INTERLEAVE;
+	fmap.fmap_niext = 1;
+	fmap.ie[0].ie_nstrips = nstrips;
+	fmap.ie[0].ie_chunk_size = chunk;
+
+	nunits = famfs_cp_plan(size, &fmap, NULL, 0);
+	ASSERT_GT(nunits, 0);
+	units = (struct famfs_cp_unit *)calloc(nunits, sizeof(*units));
+	ASSERT_EQ(famfs_cp_plan(size, &fmap, units, nunits), nunits);
+
+	/* Every chunk of the file is copied exactly once */
+	seen = (unsigned char *)calloc((size + chunk - 1) / chunk, 1);
+	for (i = 0; i < nunits; i++) {
+		size_t strip = (units[i].offset / chunk) % nstrips;
+
+		ASSERT_EQ(units[i].offset % chunk, 0);
+		ASSERT_EQ(units[i].size, chunk);
+		ASSERT_EQ(units[i].stride, nstrips * chunk);
+		ASSERT_GT(units[i].npieces, 0);
+
+		/* Consecutive units are on different strips */
+		if (i > 0 && nstrips > 1)
+			ASSERT_NE(strip, (units[i - 1].offset / chunk) %
+				  nstrips);
+
+		for (p = 0; p < units[i].npieces; p++) {
+			o = units[i].offset + p * units[i].stride;
+			if (o >= size)
+				continue;
+			/* All pieces of a unit are on one strip */
+			ASSERT_EQ((o / chunk) % nstrips, strip);
+			ASSERT_EQ(seen[o / chunk], 0);
+			seen[o / chunk] = 1;
+			covered += std::min((size_t)chunk, size - o);
+		}
+	}
+	ASSERT_EQ(covered, size);
+	free(seen);
+	free(units);
+}
+
+TEST(famfs, famfs_cp_plan)
+{
+	struct famfs_cp_unit units[4];
+	struct famfs_log_fmap fmap;
+	u64 MiB = 1024 * 1024;
+
+	/* Not interleaved: 128 MiB ranges */
+	ASSERT_EQ(famfs_cp_plan(300 * MiB, NULL, units, 4), 3);
+	ASSERT_EQ(units[0].offset, 0);
+	ASSERT_EQ(units[0].size, 128 * MiB);
+	ASSERT_EQ(units[0].npieces, 1);
+	ASSERT_EQ(units[2].offset, 256 * MiB);
+	ASSERT_EQ(units[2].size, 44 * MiB);
+	ASSERT_EQ(famfs_cp_plan(1, NULL, units, 4), 1);
+
+	memset(&fmap, 0, sizeof(fmap));
+	fmap.fmap_ext_type = FAMFS_EXT_SIMPLE;
+	fmap.fmap_nextents = 1;
+	ASSERT_EQ(famfs_cp_plan(129 * MiB, &fmap, units, 4), 2);
+
+	/* Interleaved: a 2 MiB chunk makes 64-chunk (128 MiB) runs */
+	fmap.fmap_ext_type = FAMFS_EXT_INTERLEAVE;
+	fmap.fmap_niext = 1;
+	fmap.ie[0].ie_nstrips = 4;
+	fmap.ie[0].ie_chunk_size = 2 * MiB;
+	ASSERT_EQ(famfs_cp_plan(1024 * MiB, &fmap, units, 4), 8);
+	ASSERT_EQ(units[0].offset, 0);
+	ASSERT_EQ(units[1].offset, 2 * MiB);
+	ASSERT_EQ(units[3].offset, 6 * MiB);
+	ASSERT_EQ(units[0].stride, 8 * MiB);
+	ASSERT_EQ(units[0].npieces, 64);
+
+	cp_plan_check(1024 * MiB, 4, 2 * MiB);
+	cp_plan_check(1024 * MiB + 4097, 4, 2 * MiB);
+	cp_plan_check(5 * MiB, 4, 2 * MiB);       /* Partial stripe */
+	cp_plan_check(3 * MiB, 8, 2 * MiB);       /* Less than a stripe */
+	cp_plan_check(777 * MiB + 1, 3, 4 * MiB);
+	cp_plan_check(2000 * MiB, 16, 256 * MiB); /* Chunk > CP_CHUNKSIZE */
+}
+
+static void
+wsp_test_inc(void *arg)
+{
+	__atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void
+wsp_test_slow_inc(void *arg)
+{
+	usleep(1000);
+	__atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+}
+
+struct wsp_test_range {
+	size_t base;
+	size_t grain;
+	int *seen;
+	int bad;
+	int done;
+};
+
+static void
+wsp_test_range_fn(void *arg, size_t start, size_t end)
+{
+	struct wsp_test_range *r = (struct wsp_test_range *)arg;
+	size_t i;
+
+	if ((start - r->base) % r->grain || end - start > r->grain ||
+	    end <= start)
+		__atomic_add_fetch(&r->bad, 1, __ATOMIC_RELAXED);
+	for (i = start; i < end; i++)
+		__atomic_add_fetch(&r->seen[i - r->base], 1, __ATOMIC_RELAXED);
+	usleep(200);
+}
+
+static void
+wsp_test_range_done(void *arg)
+{
+	struct wsp_test_range *r = (struct wsp_test_range *)arg;
+
+	__atomic_add_fetch(&r->done, 1, __ATOMIC_RELAXED);
+}
+
+TEST(famfs, famfs_wspool)
+{
+	struct wsp_test_range r[2];
+	struct famfs_wsp_group g;
+	struct famfs_wsp *wsp;
+	size_t len = 1000;
+	int count = 0;
+	int i, j;
+
+	ASSERT_EQ(famfs_wsp_create(0), nullptr);
+	famfs_wsp_destroy(NULL, 0);
+	ASSERT_EQ(famfs_wsp_should_split(), 0); /* Not in a pool thread */
+
+	wsp = famfs_wsp_create(4);
+	ASSERT_NE(wsp, nullptr);
+	ASSERT_EQ(famfs_wsp_nthreads(wsp), 4);
+
+	/* A group completes when all of its tasks have run */
+	famfs_wsp_group_init(&g);
+	for (i = 0; i < 100; i++)
+		ASSERT_EQ(famfs_wsp_submit(wsp, &g, wsp_test_inc, &count), 0);
+	famfs_wsp_group_wait(&g);
+	ASSERT_EQ(count, 100);
+
+	/* Ranges are covered exactly once in grain-aligned pieces (however
+	 * they get split), and done runs once per range, before the group
+	 * completes */
+	for (i = 0; i < 2; i++) {
+		memset(&r[i], 0, sizeof(r[i]));
+		r[i].base = (i) ? 5 : 0;
+		r[i].grain = (i) ? 7 : 1;
+		r[i].seen = (int *)calloc(len, sizeof(int));
+		ASSERT_NE(r[i].seen, nullptr);
+		ASSERT_EQ(famfs_wsp_submit_range(wsp, &g, wsp_test_range_fn,
+						 wsp_test_range_done, &r[i],
+						 r[i].base, r[i].base + len,
+						 r[i].grain), 0);
+	}
+	famfs_wsp_group_wait(&g);
+	for (i = 0; i < 2; i++) {
+		ASSERT_EQ(r[i].bad, 0);
+		ASSERT_EQ(r[i].done, 1);
+		for (j = 0; j < (int)len; j++)
+			ASSERT_EQ(r[i].seen[j], 1);
+		free(r[i].seen);
+	}
+
+	/* An empty range just completes */
+	memset(&r[0], 0, sizeof(r[0]));
+	r[0].grain = 1;
+	ASSERT_EQ(famfs_wsp_submit_range(wsp, &g, wsp_test_range_fn,
+					 wsp_test_range_done, &r[0], 3, 3, 1),
+		  0);
+	famfs_wsp_group_wait(&g);
+	ASSERT_EQ(r[0].done, 1);
+	famfs_wsp_group_destroy(&g);
+
+	/* Destroy (without abort) runs everything that was queued */
+	count = 0;
+	for (i = 0; i < 50; i++)
+		ASSERT_EQ(famfs_wsp_submit(wsp, NULL, wsp_test_slow_inc,
+					   &count), 0);
+	famfs_wsp_destroy(wsp, 0);
+	ASSERT_EQ(count, 50);
+
+	/* Destroy with abort drops queued ranges, but still calls their done
+	 * callbacks and completes their group */
+	wsp = famfs_wsp_create(1);
+	ASSERT_NE(wsp, nullptr);
+	famfs_wsp_group_init(&g);
+	count = 0;
+	for (i = 0; i < 10; i++)
+		ASSERT_EQ(famfs_wsp_submit(wsp, &g, wsp_test_slow_inc,
+					   &count), 0);
+	for (i = 0; i < 2; i++) {
+		memset(&r[i], 0, sizeof(r[i]));
+		r[i].grain = 1;
+		r[i].seen = (int *)calloc(len, sizeof(int));
+		ASSERT_NE(r[i].seen, nullptr);
+		ASSERT_EQ(famfs_wsp_submit_range(wsp, &g, wsp_test_range_fn,
+						 wsp_test_range_done, &r[i],
+						 0, len, 1), 0);
+	}
+	famfs_wsp_destroy(wsp, 1);
+	famfs_wsp_group_wait(&g);
+	famfs_wsp_group_destroy(&g);
+	ASSERT_LE(count, 10);
+	for (i = 0; i < 2; i++) {
+		ASSERT_EQ(r[i].bad, 0);
+		ASSERT_EQ(r[i].done, 1);
+		free(r[i].seen);
+	}
+}
+
 #define booboofile "/tmp/booboo"
 TEST(famfs, famfs_file_is_famfs_v1)
 {
@@ -849,6 +1392,28 @@ TEST(famfs, famfs_log)
 			     FAMFS_MASTER, 1);
 	ASSERT_EQ(rc, 0);
 
+	/* Incremental shadow logplay (as done by famfs_fused log tailing):
+	 * two ranges should create everything exactly once */
+	{
+		struct famfs_log_stats ls = {};
+		u64 half = logp->famfs_log_next_index / 2;
+
+		system("sudo rm -rf /tmp/famfs_shadow3");
+		system("sudo mkdir -p /tmp/famfs_shadow3/root");
+		rc = __famfs_logplay_range("/tmp/famfs_shadow3", logp, 0, half,
+					   0, 1, 0, FAMFS_CLIENT, &ls, 0);
+		ASSERT_EQ(rc, 0);
+		ASSERT_EQ(ls.n_entries, half);
+		rc = __famfs_logplay_range("/tmp/famfs_shadow3", logp, half,
+					   logp->famfs_log_next_index + 10,
+					   0, 1, 0, FAMFS_CLIENT, &ls, 0);
+		ASSERT_EQ(rc, 0);
+		ASSERT_EQ(ls.n_entries, logp->famfs_log_next_index);
+		ASSERT_EQ(ls.f_created + ls.d_created,
+			  logp->famfs_log_next_index);
+		ASSERT_EQ(ls.f_existed + ls.d_existed, 0);
+	}
+
 	/*
 	 * Test some errors in the log header and log entries
 	 */
@@ -1025,6 +1590,95 @@ TEST(famfs, famfs_log)
 
 }
 
+TEST(famfs, famfs_alloc_map)
+{
+	u64 device_size = 1024 * 1024 * 1024;
+	u64 nbits, alloc_errs, fsize_total, alloc_sum, half;
+	struct famfs_alloc_summary as, as2;
+	struct famfs_log_stats logstats;
+	struct famfs_superblock *sb;
+	struct famfs_locked_log ll;
+	struct famfs_alloc_map am;
+	struct famfs_log *logp;
+	extern int mock_kmod;
+	extern int mock_fstype;
+	int save_kmod = mock_kmod;
+	int save_fstype = mock_fstype;
+	int from_daemon = 1;
+	u8 *bitmap;
+	int rc;
+	int i;
+
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+
+	/* Prepare a fake famfs (move changes to this block everywhere it is) */
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+
+	rc = famfs_init_locked_log(&ll, "/tmp/famfs", 0, 1);
+	ASSERT_EQ(rc, 0);
+	for (i = 0; i < 16; i++) {
+		char filename[64];
+		int fd;
+
+		sprintf(filename, "/tmp/famfs/am%04d", i);
+		fd = __famfs_mkfile(&ll, filename, 0, 0, 0, 3 * 1048576, 0, 0);
+		ASSERT_GT(fd, 0);
+		close(fd);
+	}
+	rc = famfs_release_locked_log(&ll, 0, 0);
+	ASSERT_EQ(rc, 0);
+
+	/* Apply the log in two passes, as the log tail thread would */
+	rc = famfs_alloc_map_init(&am, sb->ts_alloc_unit,
+				  sb->ts_daxdev.dd_size, sb->ts_log_len);
+	ASSERT_EQ(rc, 0);
+	famfs_alloc_map_summary(&am, &as);
+	ASSERT_EQ(as.total, device_size);
+	ASSERT_EQ(as.used + as.free, as.total);
+	ASSERT_EQ(as.largest_free, as.free);
+
+	half = logp->famfs_log_next_index / 2;
+	famfs_alloc_map_apply(&am, logp, 0, half);
+	famfs_alloc_map_apply(&am, logp, half, logp->famfs_log_next_index);
+	famfs_alloc_map_summary(&am, &as);
+
+	/* Same result as building the bitmap from the whole log */
+	memset(&logstats, 0, sizeof(logstats));
+	bitmap = famfs_build_bitmap(logp, sb->ts_alloc_unit, device_size,
+				    &nbits, &alloc_errs, &fsize_total,
+				    &alloc_sum, &logstats, 0);
+	ASSERT_NE(bitmap, nullptr);
+	ASSERT_EQ(am.nbits, nbits);
+	ASSERT_EQ(memcmp(am.bitmap, bitmap, (nbits + 7) / 8), 0);
+	ASSERT_EQ(as.used, alloc_sum);
+	ASSERT_EQ(as.errors, alloc_errs);
+	ASSERT_EQ(as.nfiles, 16);
+	ASSERT_EQ(as.log_index, logp->famfs_log_next_index);
+	ASSERT_EQ(as.used + as.free, as.total);
+	ASSERT_GT(as.largest_free, 0);
+	ASSERT_LE(as.largest_free, as.free);
+	free(bitmap);
+	famfs_alloc_map_free(&am);
+
+	/* famfs df without a daemon scans the log and gets the same answer */
+	rc = famfs_df("/tmp/famfs", &as2, &from_daemon, 1);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(from_daemon, 0);
+	ASSERT_EQ(as2.used, as.used);
+	ASSERT_EQ(as2.free, as.free);
+	ASSERT_EQ(as2.largest_free, as.largest_free);
+
+	/* Bad geometry */
+	ASSERT_NE(famfs_alloc_map_init(&am, 3000, device_size, 0), 0);
+	ASSERT_NE(famfs_alloc_map_init(&am, 4096, 0, 0), 0);
+
+	/* Later tests expect whatever mock state the famfs_log test left */
+	mock_fstype = save_fstype;
+	mock_kmod = save_kmod;
+}
+
 TEST(famfs, famfs_log_overflow_mkdir_p)
 {
 	u64 device_size = 64ULL * 1024ULL * 1024ULL * 1024ULL;
@@ -1266,6 +1920,133 @@ TEST(famfs, famfs_cp) {
 	system("rmdir /tmp/destdir");
 }
 
+TEST(famfs, famfs_cp_dir)
+{
+	const char *dirs[] = { "", "/a", "/a/b", "/a/b/c", "/d", "/e" };
+	u64 device_size = 1024 * 1024 * 256;
+	extern int mock_kmod, mock_fstype;
+	int mock_kmod_save = mock_kmod;
+	int mock_fstype_save = mock_fstype;
+	struct famfs_superblock *sb;
+	struct famfs_locked_log ll;
+	struct famfs_log *logp;
+	char path[PATH_MAX];
+	int rc, d, f;
+	u64 index;
+
+	/* Prepare a fake famfs */
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+
+	/* Source tree: 6 directories with 3 files each */
+	system("rm -rf /tmp/cpdir_src");
+	system("mkdir -p /tmp/cpdir_src/a/b/c /tmp/cpdir_src/d /tmp/cpdir_src/e");
+	for (d = 0; d < 6; d++) {
+		for (f = 0; f < 3; f++) {
+			snprintf(path, sizeof(path), "dd if=/dev/urandom "
+				 "of=/tmp/cpdir_src%s/f%d bs=4096 count=1 "
+				 "2>/dev/null", dirs[d], f);
+			system(path);
+		}
+	}
+
+	/* The data copies fail on the mock (the stub files are empty), but
+	 * with a thread pool that doesn't fail the cp */
+	rc = famfs_init_locked_log(&ll, "/tmp/famfs", 2, 0);
+	ASSERT_EQ(rc, 0);
+
+	index = logp->famfs_log_next_index;
+	rc = famfs_cp_dir(&ll, "/tmp/cpdir_src", "/tmp/famfs/cpdir_dst",
+			  0755, 0, 0, 0);
+	ASSERT_EQ(rc, 0);
+
+	/* Every directory and file was created and logged, and the batched
+	 * log flushes are done */
+	ASSERT_EQ(logp->famfs_log_next_index - index, 6 + 18);
+	ASSERT_EQ(ll.log_unflushed, 0);
+	ASSERT_EQ(ll.log_batch, 0);
+	for (d = 0; d < 6; d++) {
+		for (f = 0; f < 3; f++) {
+			struct stat st;
+
+			snprintf(path, sizeof(path), "/tmp/famfs/cpdir_dst%s/f%d",
+				 dirs[d], f);
+			ASSERT_EQ(stat(path, &st), 0);
+		}
+	}
+
+	/* A destination that can't be created fails without logging */
+	system("mkdir -p /tmp/cpdir_src/z/y");
+	system("dd if=/dev/urandom of=/tmp/cpdir_src/z/y/f bs=4096 count=1 "
+	       "2>/dev/null");
+	system("touch /tmp/famfs/cpdir_dst2");
+	index = logp->famfs_log_next_index;
+	rc = famfs_cp_dir(&ll, "/tmp/cpdir_src/z", "/tmp/famfs/cpdir_dst2/z",
+			  0755, 0, 0, 0);
+	ASSERT_NE(rc, 0);
+	ASSERT_EQ(logp->famfs_log_next_index, index);
+
+	rc = famfs_release_locked_log(&ll, 0, 0);
+	ASSERT_EQ(rc, 0);
+
+	system("rm -rf /tmp/cpdir_src");
+	mock_kmod = mock_kmod_save;
+	mock_fstype = mock_fstype_save;
+}
+
+TEST(famfs, famfs_log_batch_full)
+{
+	u64 device_size = 1024 * 1024 * 256;
+	extern int mock_kmod, mock_fstype;
+	int mock_kmod_save = mock_kmod;
+	int mock_fstype_save = mock_fstype;
+	struct famfs_superblock *sb;
+	struct famfs_locked_log ll;
+	struct famfs_log *logp;
+	char path[PATH_MAX];
+	u64 index;
+	int rc, i;
+
+	mock_kmod = 1;
+	mock_fstype = FAMFS_V1;
+	rc = create_mock_famfs_instance("/tmp/famfs", device_size, &sb, &logp);
+	ASSERT_EQ(rc, 0);
+
+	rc = famfs_init_locked_log(&ll, "/tmp/famfs", 0, 0);
+	ASSERT_EQ(rc, 0);
+
+	/* Leave room for 6 entries, and defer flushes in batches of 4 */
+	index = ll.logp->famfs_log_next_index;
+	ll.logp->famfs_log_last_index = index + 5;
+	ll.log_batch = 4;
+
+	for (i = 0; i < 6; i++) {
+		snprintf(path, sizeof(path), "/tmp/famfs/batchdir%d", i);
+		rc = __famfs_mkdir(&ll, path, 0755, 0, 0, 0);
+		ASSERT_EQ(rc, 0);
+		ASSERT_EQ(ll.log_unflushed, (u64)(i + 1) % 4);
+	}
+
+	/* The log fills up mid-batch: the failed append is not counted, and
+	 * the entries deferred before it are still owed a flush */
+	rc = __famfs_mkdir(&ll, "/tmp/famfs/batchdir6", 0755, 0, 0, 0);
+	ASSERT_NE(rc, 0);
+	ASSERT_EQ(ll.logp->famfs_log_next_index, index + 6);
+	ASSERT_EQ(ll.log_unflushed, 2);
+
+	famfs_log_batch_flush(&ll);
+	ASSERT_EQ(ll.log_unflushed, 0);
+	ll.log_batch = 0;
+
+	rc = famfs_release_locked_log(&ll, 0, 0);
+	ASSERT_EQ(rc, 0);
+
+	mock_kmod = mock_kmod_save;
+	mock_fstype = mock_fstype_save;
+}
+
 TEST(famfs, famfs_print_role_string) {
 	/* Increase code coverage */
 	famfs_print_role_string(FAMFS_MASTER);
@@ -1816,6 +2597,875 @@ TEST(famfs, famfs_icache_test) {
 	famfs_icache_destroy(&icache);
 }
 
+TEST(famfs, famfs_icache_compact_test) {
+	const char *longname =
+		"a_name_that_is_too_long_to_fit_in_the_inline_name_buffer";
+	struct famfs_log_file_meta fmeta = {}, fmeta2;
+	struct famfs_inode *root_inode, *inode, *freed;
+	char *shadow_root = "/tmp/test/root_compact";
+	struct famfs_icache icache;
+	struct stat st;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	system("mkdir -p /tmp/test/root_compact");
+	ASSERT_EQ(famfs_icache_init(NULL, &icache, shadow_root), 0);
+	root_inode = famfs_icache_find_get_from_ino(&icache, 1);
+
+	/* Interleaved fmap: only the strips in use are kept */
+	fmeta.fm_size = 0x1000000;
+	fmeta.fm_fmap.fmap_ext_type = FAMFS_EXT_INTERLEAVE;
+	fmeta.fm_fmap.fmap_niext = 1;
+	fmeta.fm_fmap.ie[0].ie_nstrips = 3;
+	fmeta.fm_fmap.ie[0].ie_chunk_size = 0x200000;
+	for (i = 0; i < 3; i++) {
+		fmeta.fm_fmap.ie[0].ie_strips[i].se_offset = 0x40000000 * i;
+		fmeta.fm_fmap.ie[0].ie_strips[i].se_len = 0x800000;
+	}
+
+	pthread_mutex_lock(&icache.mutex);
+	for (i = 0; i < 2 * FAMFS_INODE_SLAB_COUNT; i++) {
+		inode = famfs_inode_alloc(&icache, -1,
+					  (i & 1) ? longname : "short",
+					  i + 2, 0, &fmeta, &st, FAMFS_FREG,
+					  root_inode);
+		ASSERT_NE(inode, nullptr);
+		ASSERT_EQ((uintptr_t)inode % FAMFS_CACHELINE, 0);
+		if (i & 1) {
+			ASSERT_NE(inode->name, inode->iname);
+			ASSERT_STREQ(inode->name, longname);
+		} else {
+			ASSERT_EQ(inode->name, inode->iname);
+			ASSERT_STREQ(inode->name, "short");
+		}
+		ASSERT_EQ(inode->fmap->nextents, 3);
+		famfs_icache_insert_locked(&icache, inode);
+		famfs_inode_putref_locked(inode, 1);
+	}
+	ASSERT_EQ(icache.nslabs, 2);
+
+	/* Round trip through the compact fmap */
+	inode = famfs_icache_find_get_from_ino_locked(&icache, 7);
+	ASSERT_NE(inode, nullptr);
+	ASSERT_EQ(famfs_cfmap_to_fmeta(inode->fmap, NULL, &fmeta2), 0);
+	ASSERT_EQ(fmeta2.fm_size, fmeta.fm_size);
+	ASSERT_EQ(fmeta2.fm_fmap.fmap_ext_type, (u32)FAMFS_EXT_INTERLEAVE);
+	ASSERT_EQ(fmeta2.fm_fmap.fmap_niext, 1);
+	ASSERT_EQ(fmeta2.fm_fmap.ie[0].ie_nstrips, 3);
+	ASSERT_EQ(fmeta2.fm_fmap.ie[0].ie_chunk_size, 0x200000);
+	ASSERT_EQ(memcmp(fmeta2.fm_fmap.ie[0].ie_strips,
+			 fmeta.fm_fmap.ie[0].ie_strips,
+			 3 * sizeof(struct famfs_simple_extent)), 0);
+
+	/* Freed inodes are recycled, and the stale nodeid is not valid */
+	freed = inode;
+	famfs_inode_putref_locked(inode, 2);
+	ASSERT_EQ(famfs_get_inode_from_nodeid_locked(&icache,
+						     (uintptr_t)freed),
+		  nullptr);
+	inode = famfs_inode_alloc(&icache, -1, "again", 100000, 0, NULL, &st,
+				  FAMFS_FDIR, root_inode);
+	ASSERT_EQ(inode, freed);
+	ASSERT_EQ(inode->fmap, nullptr);
+	famfs_icache_insert_locked(&icache, inode);
+	ASSERT_EQ(icache.nslabs, 2);
+
+	/* A bad fmap is refused */
+	fmeta.fm_fmap.ie[0].ie_nstrips = FAMFS_MAX_SIMPLE_EXTENTS + 1;
+	ASSERT_EQ(famfs_cfmap_alloc(&fmeta), nullptr);
+	pthread_mutex_unlock(&icache.mutex);
+
+	famfs_inode_putref(root_inode);
+	famfs_icache_destroy(&icache);
+	ASSERT_EQ(icache.nslabs, 0);
+}
+
+TEST(famfs, famfs_icache_forget_test) {
+	struct famfs_inode *root_inode, *dir, *f1, *f2, bogus;
+	char *shadow_root = "/tmp/test/root_forget";
+	struct fuse_forget_data forgets[3];
+	struct famfs_icache icache;
+	struct stat st;
+	u64 count;
+
+	memset(&st, 0, sizeof(st));
+	memset(&bogus, 0, sizeof(bogus));
+	system("mkdir -p /tmp/test/root_forget");
+	ASSERT_EQ(famfs_icache_init(NULL, &icache, shadow_root), 0);
+	root_inode = famfs_icache_find_get_from_ino(&icache, 1);
+	count = icache.count;
+
+	/* A directory with two files; each has one kernel lookup */
+	pthread_mutex_lock(&icache.mutex);
+	dir = famfs_inode_alloc(&icache, -1, "dir", 2, 0, NULL, &st,
+				FAMFS_FDIR, root_inode);
+	ASSERT_NE(dir, nullptr);
+	famfs_icache_insert_locked(&icache, dir);
+	famfs_inode_putref_locked(dir, 1);
+	f1 = famfs_inode_alloc(&icache, -1, "f1", 3, 0, NULL, &st,
+			       FAMFS_FREG, dir);
+	ASSERT_NE(f1, nullptr);
+	famfs_icache_insert_locked(&icache, f1);
+	famfs_inode_putref_locked(f1, 1);
+	f2 = famfs_inode_alloc(&icache, -1, "f2", 4, 0, NULL, &st,
+			       FAMFS_FREG, dir);
+	ASSERT_NE(f2, nullptr);
+	famfs_icache_insert_locked(&icache, f2);
+	famfs_inode_putref_locked(f2, 1);
+	pthread_mutex_unlock(&icache.mutex);
+	ASSERT_EQ(icache.count, count + 3);
+	ASSERT_EQ(dir->refcount, 3);
+
+	/* Bad nodeids are skipped; dir is still held by f2 */
+	forgets[0].ino = (uintptr_t)f1;
+	forgets[0].nlookup = 1;
+	forgets[1].ino = (uintptr_t)&bogus;
+	forgets[1].nlookup = 1;
+	forgets[2].ino = (uintptr_t)dir;
+	forgets[2].nlookup = 1;
+	ASSERT_EQ(famfs_icache_forget(&icache, forgets, 3), 1);
+	ASSERT_EQ(icache.count, count + 2);
+	ASSERT_EQ(dir->refcount, 1);
+	ASSERT_EQ(famfs_icache_find_get_from_ino(&icache, 3), nullptr);
+
+	/* More lookups than refs: skipped */
+	forgets[0].ino = (uintptr_t)f2;
+	forgets[0].nlookup = 2;
+	ASSERT_EQ(famfs_icache_forget(&icache, forgets, 1), 0);
+
+	/* Releasing the last child frees the parent too */
+	forgets[0].nlookup = 1;
+	ASSERT_EQ(famfs_icache_forget(&icache, forgets, 1), 2);
+	ASSERT_EQ(icache.count, count);
+	ASSERT_EQ(famfs_icache_find_get_from_ino(&icache, 2), nullptr);
+	ASSERT_EQ(famfs_get_inode_from_nodeid(&icache, (uintptr_t)dir),
+		  nullptr);
+
+	/* The root is never freed */
+	forgets[0].ino = FUSE_ROOT_ID;
+	forgets[0].nlookup = 1;
+	famfs_icache_forget(&icache, forgets, 1);
+	ASSERT_EQ(icache.root.icache, &icache);
+
+	famfs_icache_destroy(&icache);
+}
+
+TEST(famfs, famfs_cfmap_map_range_test) {
+	struct famfs_log_file_meta fmeta = {};
+	struct famfs_cfmap *cf;
+	struct iovec iov[8];
+	char *base = (char *)0x10000000; /* never dereferenced */
+	size_t mapped;
+	int i;
+
+	/* Two simple extents */
+	fmeta.fm_size = 0x300000;
+	fmeta.fm_fmap.fmap_ext_type = FAMFS_EXT_SIMPLE;
+	fmeta.fm_fmap.fmap_nextents = 2;
+	fmeta.fm_fmap.se[0].se_offset = 0x400000;
+	fmeta.fm_fmap.se[0].se_len = 0x200000;
+	fmeta.fm_fmap.se[1].se_offset = 0x1000000;
+	fmeta.fm_fmap.se[1].se_len = 0x200000;
+	cf = famfs_cfmap_alloc(&fmeta);
+	ASSERT_NE(cf, nullptr);
+
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x2000000, 0x1000, 0x1000,
+					iov, 8, &mapped), 1);
+	ASSERT_EQ(mapped, 0x1000);
+	ASSERT_EQ(iov[0].iov_base, base + 0x401000);
+
+	/* Spans both extents */
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x2000000, 0x1ff000, 0x2000,
+					iov, 8, &mapped), 2);
+	ASSERT_EQ(mapped, 0x2000);
+	ASSERT_EQ(iov[0].iov_base, base + 0x5ff000);
+	ASSERT_EQ(iov[0].iov_len, 0x1000);
+	ASSERT_EQ(iov[1].iov_base, base + 0x1000000);
+	ASSERT_EQ(iov[1].iov_len, 0x1000);
+
+	/* Only one iovec: a prefix is mapped */
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x2000000, 0x1ff000, 0x2000,
+					iov, 1, &mapped), 1);
+	ASSERT_EQ(mapped, 0x1000);
+
+	/* Clamped at EOF, and nothing at or beyond EOF */
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x2000000, 0x2ff000, 0x10000,
+					iov, 8, &mapped), 1);
+	ASSERT_EQ(mapped, 0x1000);
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x2000000, 0x300000, 0x1000,
+					iov, 8, &mapped), 0);
+	ASSERT_EQ(mapped, 0);
+
+	/* Extent beyond the end of the device */
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x1080000, 0x200000, 0x200000,
+					iov, 8, &mapped), -EINVAL);
+	free(cf);
+
+	/* Interleaved: 3 strips, 2MiB chunks */
+	memset(&fmeta, 0, sizeof(fmeta));
+	fmeta.fm_size = 0x1000000;
+	fmeta.fm_fmap.fmap_ext_type = FAMFS_EXT_INTERLEAVE;
+	fmeta.fm_fmap.fmap_niext = 1;
+	fmeta.fm_fmap.ie[0].ie_nstrips = 3;
+	fmeta.fm_fmap.ie[0].ie_chunk_size = 0x200000;
+	for (i = 0; i < 3; i++) {
+		fmeta.fm_fmap.ie[0].ie_strips[i].se_offset = 0x1000000 * (i + 1);
+		fmeta.fm_fmap.ie[0].ie_strips[i].se_len = 0x600000;
+	}
+	cf = famfs_cfmap_alloc(&fmeta);
+	ASSERT_NE(cf, nullptr);
+
+	/* Chunk 4 is the second chunk of strip 1 */
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x4000000, 0x810000, 0x1000,
+					iov, 8, &mapped), 1);
+	ASSERT_EQ(iov[0].iov_base, base + 0x2000000 + 0x210000);
+
+	/* Crossing a chunk boundary moves to the next strip */
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x4000000, 0x1ff000, 0x2000,
+					iov, 8, &mapped), 2);
+	ASSERT_EQ(iov[0].iov_base, base + 0x11ff000);
+	ASSERT_EQ(iov[1].iov_base, base + 0x2000000);
+	ASSERT_EQ(mapped, 0x2000);
+
+	/* Strips on other devices are not supported */
+	cf->ext[1].se_devindex = 1;
+	ASSERT_EQ(famfs_cfmap_map_range(cf, base, 0x4000000, 0x200000, 0x1000,
+					iov, 8, &mapped), -EINVAL);
+	free(cf);
+}
+
+struct flock_thread_arg {
+	struct famfs_inode *inode;
+	uint64_t owner;
+	int op;
+	int rc;
+	int done;
+};
+
+static void *flock_thread_fn(void *arg)
+{
+	struct flock_thread_arg *fa = (struct flock_thread_arg *)arg;
+
+	fa->rc = famfs_icache_flock(fa->inode, fa->owner, fa->op, NULL, NULL);
+	__atomic_store_n(&fa->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int flock_always_interrupted(void *arg)
+{
+	(void)arg;
+	return 1;
+}
+
+TEST(famfs, famfs_flock_test) {
+	struct flock_thread_arg fa = {};
+	struct famfs_inode *root_inode, *inode, *inode2;
+	char *shadow_root = "/tmp/test/root_flock";
+	struct famfs_icache icache;
+	pthread_t tid;
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	system("mkdir -p /tmp/test/root_flock");
+	ASSERT_EQ(famfs_icache_init(NULL, &icache, shadow_root), 0);
+	root_inode = famfs_icache_find_get_from_ino(&icache, 1);
+
+	pthread_mutex_lock(&icache.mutex);
+	inode = famfs_inode_alloc(&icache, -1, "f1", 2, 0, NULL, &st,
+				  FAMFS_FREG, root_inode);
+	famfs_icache_insert_locked(&icache, inode);
+	inode2 = famfs_inode_alloc(&icache, -1, "f2", 3, 0, NULL, &st,
+				   FAMFS_FREG, root_inode);
+	famfs_icache_insert_locked(&icache, inode2);
+	pthread_mutex_unlock(&icache.mutex);
+
+	/* Shared locks are shared; exclusive locks are not */
+	ASSERT_EQ(famfs_icache_flock(inode, 1, LOCK_SH, NULL, NULL), 0);
+	ASSERT_EQ(famfs_icache_flock(inode, 2, LOCK_SH | LOCK_NB, NULL, NULL),
+		  0);
+	ASSERT_EQ(famfs_icache_flock(inode, 3, LOCK_EX | LOCK_NB, NULL, NULL),
+		  EWOULDBLOCK);
+
+	/* Locks on other files are independent */
+	ASSERT_EQ(famfs_icache_flock(inode2, 3, LOCK_EX | LOCK_NB, NULL, NULL),
+		  0);
+
+	/* Unlock of an unlocked owner is fine */
+	ASSERT_EQ(famfs_icache_flock(inode, 3, LOCK_UN, NULL, NULL), 0);
+
+	/* A blocked exclusive locker is granted when the readers go away */
+	fa.inode = inode;
+	fa.owner = 3;
+	fa.op = LOCK_EX;
+	ASSERT_EQ(pthread_create(&tid, NULL, flock_thread_fn, &fa), 0);
+	while (__atomic_load_n(&icache.flock_contended, __ATOMIC_ACQUIRE) < 1)
+		usleep(1000);
+
+	/* No queue jumping: a new reader waits behind the writer */
+	ASSERT_EQ(famfs_icache_flock(inode, 4, LOCK_SH | LOCK_NB, NULL, NULL),
+		  EWOULDBLOCK);
+	/* An interrupted waiter gives up */
+	ASSERT_EQ(famfs_icache_flock(inode, 4, LOCK_SH,
+				     flock_always_interrupted, NULL), EINTR);
+
+	ASSERT_EQ(famfs_icache_flock(inode, 1, LOCK_UN, NULL, NULL), 0);
+	usleep(10000);
+	ASSERT_EQ(__atomic_load_n(&fa.done, __ATOMIC_ACQUIRE), 0);
+	ASSERT_EQ(famfs_icache_flock_release(inode, 2), 1);
+	pthread_join(tid, NULL);
+	ASSERT_EQ(fa.rc, 0);
+
+	/* Downgrade is atomic, and lets readers in */
+	ASSERT_EQ(famfs_icache_flock(inode, 3, LOCK_SH, NULL, NULL), 0);
+	ASSERT_EQ(famfs_icache_flock(inode, 4, LOCK_SH | LOCK_NB, NULL, NULL),
+		  0);
+	ASSERT_EQ(famfs_icache_flock(inode, 3, LOCK_EX | LOCK_NB, NULL, NULL),
+		  EWOULDBLOCK);
+	ASSERT_EQ(famfs_icache_flock_release(inode, 4), 1);
+	ASSERT_EQ(famfs_icache_flock(inode, 3, LOCK_EX | LOCK_NB, NULL, NULL),
+		  0);
+	ASSERT_EQ(famfs_icache_flock_release(inode, 3), 1);
+	ASSERT_EQ(famfs_icache_flock_release(inode, 3), 0);
+	ASSERT_EQ(famfs_icache_flock_release(inode2, 3), 1);
+
+	ASSERT_EQ(famfs_icache_flock(inode, 1, 0, NULL, NULL), EINVAL);
+	ASSERT_EQ(icache.flock_wouldblock, 3);
+	ASSERT_EQ(icache.flock_interrupted, 1);
+
+	pthread_mutex_lock(&icache.mutex);
+	famfs_inode_putref_locked(inode, 1);
+	famfs_inode_putref_locked(inode2, 1);
+	pthread_mutex_unlock(&icache.mutex);
+	famfs_inode_putref(root_inode);
+	famfs_icache_destroy(&icache);
+}
+
+static void negcache_count_cb(uint64_t parent_ino, const char *name,
+			      void *arg)
+{
+	(void)parent_ino;
+	(void)name;
+	(*(int *)arg)++;
+}
+
+static void *op_stats_thread_fn(void *arg)
+{
+	int i;
+
+	(void)arg;
+	for (i = 0; i < 1000; i++)
+		famfs_op_record(FAMFS_OP_LOOKUP, 2000 + i);
+	return NULL;
+}
+
+TEST(famfs, famfs_op_stats_test) {
+	struct famfs_op_hist *before, *after;
+	uint64_t v, p50, p999;
+	pthread_t tid;
+	char *out;
+	int b, i;
+
+	/* Buckets are contiguous, and each value lands in its bucket */
+	ASSERT_EQ(famfs_hist_bucket_low(0), 0);
+	for (b = 0; b < FAMFS_HIST_BUCKETS - 1; b++)
+		ASSERT_EQ(famfs_hist_bucket_high(b) + 1,
+			  famfs_hist_bucket_low(b + 1));
+	for (v = 1; v < (1ULL << 36); v = v * 3 + 1) {
+		b = famfs_hist_bucket(v);
+		ASSERT_LE(famfs_hist_bucket_low(b), v);
+		ASSERT_GE(famfs_hist_bucket_high(b), v);
+		ASSERT_LE(famfs_hist_bucket_high(b) - famfs_hist_bucket_low(b),
+			  v / 8);
+	}
+	ASSERT_EQ(famfs_hist_bucket(~0ULL), FAMFS_HIST_BUCKETS - 1);
+
+	before = (struct famfs_op_hist *)calloc(FAMFS_OP_MAX, sizeof(*before));
+	after = (struct famfs_op_hist *)calloc(FAMFS_OP_MAX, sizeof(*after));
+	famfs_op_stats_snapshot(before);
+
+	/* Stats of exited threads are kept */
+	ASSERT_EQ(pthread_create(&tid, NULL, op_stats_thread_fn, NULL), 0);
+	pthread_join(tid, NULL);
+	for (i = 0; i < 99; i++)
+		famfs_op_record(FAMFS_OP_STATFS, 1000);
+	famfs_op_record(FAMFS_OP_STATFS, 1000000);
+	famfs_op_record(FAMFS_OP_MAX, 1); /* ignored */
+
+	famfs_op_stats_snapshot(after);
+	ASSERT_EQ(after[FAMFS_OP_LOOKUP].count -
+		  before[FAMFS_OP_LOOKUP].count, 1000);
+	ASSERT_EQ(after[FAMFS_OP_STATFS].count -
+		  before[FAMFS_OP_STATFS].count, 100);
+
+	if (before[FAMFS_OP_STATFS].count == 0) {
+		struct famfs_op_hist *h = &after[FAMFS_OP_STATFS];
+
+		ASSERT_EQ(h->sum_ns, 99 * 1000 + 1000000);
+		ASSERT_EQ(h->max_ns, 1000000);
+		p50 = famfs_hist_percentile(h, 50.0);
+		p999 = famfs_hist_percentile(h, 99.9);
+		ASSERT_GE(p50, 1000);
+		ASSERT_LE(p50, 1125);
+		ASSERT_EQ(p999, 1000000);
+	}
+	free(before);
+	free(after);
+
+	out = famfs_op_stats_format(FAMFS_STATS_YAML);
+	ASSERT_NE(out, nullptr);
+	ASSERT_NE(strstr(out, "op_stats:\n  lookup:\n    count:"), nullptr);
+	ASSERT_NE(strstr(out, "  get_fmap:\n"), nullptr);
+	free(out);
+
+	out = famfs_op_stats_format(FAMFS_STATS_JSON);
+	ASSERT_NE(out, nullptr);
+	ASSERT_EQ(out[0], '{');
+	ASSERT_NE(strstr(out, "\"statfs\": {\"count\": "), nullptr);
+	free(out);
+
+	out = famfs_op_stats_format(FAMFS_STATS_PROMETHEUS);
+	ASSERT_NE(out, nullptr);
+	ASSERT_NE(strstr(out, "# TYPE famfs_fuse_op_duration_seconds "
+			 "histogram\n"), nullptr);
+	ASSERT_NE(strstr(out, "famfs_fuse_op_duration_seconds_bucket"
+			 "{op=\"statfs\",le=\"+Inf\"}"), nullptr);
+	ASSERT_NE(strstr(out, "famfs_fuse_op_duration_seconds_count"
+			 "{op=\"lookup\"}"), nullptr);
+	/* Every op has every power of two bucket up to 2^FAMFS_HIST_MAX_MSB
+	 * ns, whatever it has recorded, plus +Inf */
+	ASSERT_NE(strstr(out, "famfs_fuse_op_duration_seconds_bucket"
+			 "{op=\"statfs\",le=\"8e-09\"}"), nullptr);
+	ASSERT_NE(strstr(out, "famfs_fuse_op_duration_seconds_bucket"
+			 "{op=\"statfs\",le=\"1099.51163\"}"), nullptr);
+	for (i = 0; i < FAMFS_OP_MAX; i++) {
+		char pfx[128];
+		const char *s;
+		int n = 0;
+
+		snprintf(pfx, sizeof(pfx),
+			 "famfs_fuse_op_duration_seconds_bucket{op=\"%s\",",
+			 famfs_op_name((enum famfs_fuse_op)i));
+		for (s = strstr(out, pfx); s; s = strstr(s + 1, pfx))
+			n++;
+		ASSERT_EQ(n, FAMFS_HIST_MAX_MSB - FAMFS_HIST_SUB_BITS + 2);
+	}
+	free(out);
+}
+
+static void *trace_thread_fn(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		famfs_trace_begin(FAMFS_OP_GETATTR, (uintptr_t)arg, NULL,
+				  famfs_op_now());
+		famfs_trace_end(famfs_op_now());
+	}
+	return NULL;
+}
+
+TEST(famfs, famfs_trace_test) {
+	struct famfs_trace_rec recs[64];
+	struct famfs_trace_hdr *hdr;
+	struct timespec now;
+	uint32_t nthreads;
+	pthread_t tid;
+	size_t n, len;
+	char *dump;
+	int i;
+
+	famfs_trace_init(5); /* rounded up to 8 */
+
+	/* The ring has 8 slots; the oldest slot is the next one written,
+	 * so the last 7 records are dumped */
+	for (i = 0; i < 20; i++) {
+		famfs_trace_begin(FAMFS_OP_LOOKUP, i, "somefile",
+				  famfs_op_now());
+		famfs_trace_flags(FAMFS_TRACE_ICACHE_MISS);
+		if (i & 1)
+			famfs_trace_err(ENOENT);
+		famfs_trace_end(famfs_op_now());
+	}
+	famfs_trace_err(EIO);            /* no request: ignored */
+	famfs_trace_end(famfs_op_now());
+
+	n = famfs_trace_snapshot(recs, 64, 0, &nthreads);
+	ASSERT_EQ(n, 7);
+	ASSERT_EQ(nthreads, 1);
+	for (i = 0; i < 7; i++) {
+		ASSERT_EQ(recs[i].nodeid, (uint64_t)(13 + i));
+		ASSERT_EQ(recs[i].op, FAMFS_OP_LOOKUP);
+		ASSERT_EQ(recs[i].name_hash, famfs_trace_hash("somefile"));
+		ASSERT_EQ(recs[i].flags, FAMFS_TRACE_ICACHE_MISS);
+		ASSERT_EQ(recs[i].err, (i & 1) ? 0 : ENOENT);
+		ASSERT_LE(recs[i].start_ns, recs[i].end_ns);
+		ASSERT_NE(recs[i].tid, 0);
+		if (i) {
+			ASSERT_GE(recs[i].start_ns, recs[i - 1].end_ns);
+		}
+	}
+
+	/* Exited threads' rings are kept, and reused by new threads */
+	ASSERT_EQ(pthread_create(&tid, NULL, trace_thread_fn, (void *)100), 0);
+	pthread_join(tid, NULL);
+	ASSERT_EQ(pthread_create(&tid, NULL, trace_thread_fn, (void *)200), 0);
+	pthread_join(tid, NULL);
+	n = famfs_trace_snapshot(recs, 64, 0, &nthreads);
+	ASSERT_EQ(nthreads, 2);
+	ASSERT_EQ(n, 7 + 6);
+
+	/* Nothing has ended since now */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	n = famfs_trace_snapshot(recs, 64,
+				 now.tv_sec * 1000000000ULL + now.tv_nsec + 1,
+				 NULL);
+	ASSERT_EQ(n, 0);
+
+	dump = (char *)famfs_trace_dump(0, &len);
+	ASSERT_NE(dump, nullptr);
+	hdr = (struct famfs_trace_hdr *)dump;
+	ASSERT_EQ(memcmp(hdr->magic, FAMFS_TRACE_MAGIC, 8), 0);
+	ASSERT_EQ(hdr->version, FAMFS_TRACE_VERSION);
+	ASSERT_EQ(hdr->rec_size, sizeof(struct famfs_trace_rec));
+	ASSERT_EQ(hdr->nops, FAMFS_OP_MAX);
+	ASSERT_EQ(hdr->nrecs, 13);
+	ASSERT_EQ(len, sizeof(*hdr) + FAMFS_OP_MAX * FAMFS_TRACE_OPNAME_LEN
+		  + 13 * sizeof(struct famfs_trace_rec));
+	ASSERT_STREQ(dump + sizeof(*hdr) +
+		     FAMFS_OP_LOOKUP * FAMFS_TRACE_OPNAME_LEN, "lookup");
+	free(dump);
+
+	famfs_trace_init(0);
+	famfs_trace_begin(FAMFS_OP_LOOKUP, 1, NULL, famfs_op_now());
+	famfs_trace_end(famfs_op_now());
+	ASSERT_EQ(famfs_trace_snapshot(recs, 64, 0, NULL), 13);
+	famfs_trace_init(FAMFS_TRACE_DEFAULT_RECORDS);
+}
+
+TEST(famfs, famfs_negcache_test) {
+	struct famfs_negcache nc;
+	uint64_t gen;
+	int ncb = 0;
+	int rc;
+
+	/* Disabled cache never hits and never inserts */
+	rc = famfs_negcache_init(&nc, 0, 1.0);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 1, "foo", famfs_negcache_gen(&nc)),
+		  -1);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 1, "foo"), 0);
+	famfs_negcache_destroy(&nc);
+
+	rc = famfs_negcache_init(&nc, 4, 60.0);
+	ASSERT_EQ(rc, 0);
+
+	gen = famfs_negcache_gen(&nc);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 1, "foo"), 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 1, "foo", gen), 0);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 1, "foo"), 1);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 2, "foo"), 0); /* other parent */
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 1, "fo"), 0);
+
+	/* An invalidation after the generation was sampled blocks insert */
+	gen = famfs_negcache_gen(&nc);
+	famfs_negcache_invalidate(&nc, 1, "foo");
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 1, "foo"), 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 1, "foo", gen), -1);
+	ASSERT_EQ(nc.count, 0);
+
+	/* LRU eviction: "a" is touched, so "b" is the victim */
+	gen = famfs_negcache_gen(&nc);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 7, "a", gen), 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 7, "b", gen), 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 7, "c", gen), 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 7, "d", gen), 0);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 7, "a"), 1);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 7, "e", gen), 0);
+	ASSERT_EQ(nc.count, 4);
+	ASSERT_EQ(nc.evictions, 1);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 7, "b"), 0);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 7, "a"), 1);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 7, "e"), 1);
+
+	ASSERT_EQ(famfs_negcache_invalidate_all(&nc, negcache_count_cb, &ncb),
+		  4);
+	ASSERT_EQ(ncb, 4);
+	ASSERT_EQ(nc.count, 0);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 7, "a"), 0);
+	famfs_negcache_destroy(&nc);
+
+	/* Entries expire */
+	rc = famfs_negcache_init(&nc, 4, 0.001);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(famfs_negcache_insert(&nc, 1, "bar",
+					famfs_negcache_gen(&nc)), 0);
+	usleep(5000);
+	ASSERT_EQ(famfs_negcache_lookup(&nc, 1, "bar"), 0);
+	ASSERT_EQ(nc.expirations, 1);
+	ASSERT_EQ(nc.count, 0);
+	famfs_negcache_destroy(&nc);
+}
+
+static struct famfs_dirlist *
+dircache_test_list(uint64_t ino, uint64_t version, int nents)
+{
+	struct famfs_dirlist *dl = famfs_dirlist_alloc(ino, version);
+	int i;
+
+	/* Entries of 24 and 32 bytes, at offsets 100, 200, ... */
+	for (i = 0; dl && i < nents; i++) {
+		size_t len = (i & 1) ? 32 : 24;
+		char *p = famfs_dirlist_reserve(dl, len);
+
+		if (!p || famfs_dirlist_add(dl, len, (i + 1) * 100))
+			return NULL;
+		memset(p, 'a' + i % 26, len);
+	}
+	return dl;
+}
+
+TEST(famfs, famfs_dircache_test) {
+	struct famfs_dirlist *dl, *dl2, *big;
+	struct famfs_dircache dc;
+	struct timespec m = { 1000, 5 };
+	struct timespec c = { 1000, 6 };
+	uint64_t version = famfs_dircache_version(&m, &c);
+	uint32_t nents;
+	int rc;
+
+	/* Listings: entry positions, offsets and reply spans */
+	dl = dircache_test_list(1, version, 1000);
+	ASSERT_NE(dl, nullptr);
+	ASSERT_EQ(dl->count, 1000);
+	ASSERT_EQ(dl->len, 500 * 24 + 500 * 32);
+	ASSERT_EQ(dl->buf[dl->pos[27]], 'a' + 1);
+	ASSERT_EQ(famfs_dirlist_find(dl, 0), 0);
+	ASSERT_EQ(famfs_dirlist_find(dl, 100), 1);
+	ASSERT_EQ(famfs_dirlist_find(dl, 100000), 1000);
+	ASSERT_EQ(famfs_dirlist_find(dl, 150), -1);
+	ASSERT_EQ(famfs_dirlist_span(dl, 0, 56, &nents), 56);
+	ASSERT_EQ(nents, 2);
+	ASSERT_EQ(famfs_dirlist_span(dl, 0, 79, &nents), 56);
+	ASSERT_EQ(nents, 2);
+	ASSERT_EQ(famfs_dirlist_span(dl, 1, 23, &nents), 0);
+	ASSERT_EQ(nents, 0);
+	ASSERT_EQ(famfs_dirlist_span(dl, 998, 4096, &nents), 56);
+	ASSERT_EQ(nents, 2);
+	ASSERT_EQ(famfs_dirlist_span(dl, 1000, 4096, &nents), 0);
+	ASSERT_EQ(famfs_dirlist_span(dl, 0, 1 << 20, &nents), dl->len);
+	ASSERT_EQ(nents, 1000);
+
+	/* Disabled cache never hits and never inserts */
+	rc = famfs_dircache_init(&dc, 0);
+	ASSERT_EQ(rc, 0);
+	ASSERT_NE(famfs_dircache_insert(&dc, dl), 0);
+	ASSERT_EQ(famfs_dircache_get(&dc, 1, version), nullptr);
+	famfs_dircache_destroy(&dc);
+
+	rc = famfs_dircache_init(&dc, 1024 * 1024);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(famfs_dircache_get(&dc, 1, version), nullptr);
+	ASSERT_EQ(famfs_dircache_insert(&dc, dl), 0);
+	ASSERT_EQ(dc.count, 1);
+	dl2 = famfs_dircache_get(&dc, 1, version);
+	ASSERT_EQ(dl2, dl);
+	ASSERT_EQ(dl->refcount, 3);
+	famfs_dirlist_put(&dc, dl2);
+	ASSERT_EQ(famfs_dircache_get(&dc, 2, version), nullptr);
+
+	/* A new version drops the listing, but our ref keeps it readable */
+	c.tv_nsec++;
+	ASSERT_EQ(famfs_dircache_get(&dc, 1,
+				     famfs_dircache_version(&m, &c)), nullptr);
+	ASSERT_EQ(dc.stale, 1);
+	ASSERT_EQ(dc.count, 0);
+	ASSERT_EQ(dl->refcount, 1);
+	ASSERT_EQ(dl->buf[dl->pos[999]], 'a' + 999 % 26);
+	famfs_dirlist_put(&dc, dl);
+
+	/* Invalidation */
+	dl = dircache_test_list(1, version, 10);
+	ASSERT_EQ(famfs_dircache_insert(&dc, dl), 0);
+	famfs_dirlist_put(&dc, dl);
+	famfs_dircache_invalidate(&dc, 1);
+	ASSERT_EQ(dc.invalidations, 1);
+	ASSERT_EQ(dc.count, 0);
+	ASSERT_EQ(dc.bytes, 0);
+
+	/* Listings too big for the cache aren't cached */
+	big = dircache_test_list(3, version, 20000);
+	ASSERT_NE(big, nullptr);
+	ASSERT_NE(famfs_dircache_insert(&dc, big), 0);
+	famfs_dirlist_put(&dc, big);
+
+	/* LRU eviction: 1 is touched, so 2 is the victim */
+	for (int i = 1; ; i++) {
+		dl = dircache_test_list(i, version, 1000);
+		ASSERT_NE(dl, nullptr);
+		ASSERT_EQ(famfs_dircache_insert(&dc, dl), 0);
+		famfs_dirlist_put(&dc, dl);
+		if (i == 2) {
+			dl = famfs_dircache_get(&dc, 1, version);
+			ASSERT_NE(dl, nullptr);
+			famfs_dirlist_put(&dc, dl);
+		}
+		if (dc.evictions)
+			break;
+	}
+	ASSERT_EQ(dc.evictions, 1);
+	ASSERT_LE(dc.bytes, dc.max_bytes);
+	dl = famfs_dircache_get(&dc, 1, version);
+	ASSERT_NE(dl, nullptr);
+	famfs_dirlist_put(&dc, dl);
+	ASSERT_EQ(famfs_dircache_get(&dc, 2, version), nullptr);
+
+	ASSERT_EQ(famfs_dircache_invalidate_all(&dc), dc.inserts - 3);
+	ASSERT_EQ(dc.count, 0);
+	ASSERT_EQ(dc.bytes, 0);
+	famfs_dircache_destroy(&dc);
+}
+
+#define DIRP_TEST_NFILES 300
+
+/* Count an entry of the dirp test directory (f000..f299, plus . and ..) */
+static void
+dirp_test_count(int *seen, const char *name)
+{
+	if (name[0] == 'f')
+		seen[atoi(name + 1)]++;
+	else
+		seen[DIRP_TEST_NFILES]++;
+}
+
+/* One readdir call that has room for @n entries. Like the handler, it
+ * peeks at the entry that doesn't fit. Returns the entries sent */
+static int
+dirp_test_readdir(struct famfs_icache *icache, struct famfs_dirp *d,
+		  off_t *offset, int n, int *seen)
+{
+	struct dirent *de;
+	int i, err;
+
+	famfs_dirp_readdir_begin(icache, d, *offset);
+	for (i = 0; i <= n; i++) {
+		de = famfs_dirp_readdir_peek(d, &err);
+		if (!de || i == n)
+			break;
+		dirp_test_count(seen, de->d_name);
+		*offset = de->d_off;
+		famfs_dirp_readdir_next(d);
+	}
+	return (i > n) ? n : i;
+}
+
+/* One readdirplus call that has room for @n entries */
+static int
+dirp_test_readdirplus(struct famfs_icache *icache, struct famfs_dirp *d,
+		      off_t *offset, int n, int *seen)
+{
+	struct famfs_shadow_ent *ent;
+	int i, err;
+
+	if (famfs_dirp_readdirplus_begin(icache, d, *offset))
+		return -1;
+	for (i = 0; i <= n; i++) {
+		ent = famfs_dirp_readdirplus_peek(d, NULL, NULL, &err);
+		if (!ent || i == n)
+			break;
+		dirp_test_count(seen, ent->name);
+		*offset = ent->nextoff;
+		famfs_dirp_readdirplus_next(d);
+	}
+	famfs_dirp_readdirplus_end(d);
+	return (i > n) ? n : i;
+}
+
+TEST(famfs, famfs_dirp_test) {
+	const int sizes[] = { 50, 30, 200, 7, 1, 128, 3, 129, 64 };
+	int seen[DIRP_TEST_NFILES + 1];
+	struct famfs_icache icache;
+	struct famfs_dirp d;
+	char path[PATH_MAX];
+	off_t offset;
+	int i, n, call, idle;
+
+	system("rm -rf /tmp/test/dirp; mkdir -p /tmp/test/dirp");
+	for (i = 0; i < DIRP_TEST_NFILES; i++) {
+		snprintf(path, sizeof(path), "/tmp/test/dirp/f%03d", i);
+		close(open(path, O_CREAT | O_WRONLY, 0644));
+	}
+	memset(&icache, 0, sizeof(icache));
+	pthread_mutex_init(&icache.mutex, NULL);
+
+	/* Alternate readdir and readdirplus on one handle, each continuing
+	 * at the offset of the last entry the previous call sent: every
+	 * entry comes back exactly once */
+	for (n = 0; n < 2; n++) {
+		memset(&d, 0, sizeof(d));
+		d.dp = opendir("/tmp/test/dirp");
+		ASSERT_NE(d.dp, nullptr);
+		memset(seen, 0, sizeof(seen));
+		offset = 0;
+		idle = 0;
+		for (call = 0; idle < 2; call++) {
+			int sz = sizes[call % (sizeof(sizes) / sizeof(sizes[0]))];
+			int got;
+
+			if ((call + n) % 2)
+				got = dirp_test_readdir(&icache, &d, &offset,
+							sz, seen);
+			else
+				got = dirp_test_readdirplus(&icache, &d,
+							    &offset, sz, seen);
+			ASSERT_GE(got, 0);
+			idle = (got) ? 0 : idle + 1;
+		}
+		for (i = 0; i < DIRP_TEST_NFILES; i++)
+			ASSERT_EQ(seen[i], 1);
+		ASSERT_EQ(seen[DIRP_TEST_NFILES], 2); /* . and .. */
+
+		/* Rewinding starts over */
+		memset(seen, 0, sizeof(seen));
+		offset = 0;
+		ASSERT_EQ(dirp_test_readdirplus(&icache, &d, &offset, 10, seen),
+			  10);
+		offset = 0;
+		ASSERT_EQ(dirp_test_readdir(&icache, &d, &offset, 1000, seen),
+			  DIRP_TEST_NFILES + 2);
+		famfs_dirp_release(&icache, &d);
+	}
+
+	pthread_mutex_destroy(&icache.mutex);
+	system("rm -rf /tmp/test/dirp");
+}
+
+TEST(famfs, famfs_cpulist_parse_test) {
+	cpu_set_t set;
+
+	ASSERT_EQ(famfs_cpulist_parse("0-3,8,10-11", &set), 0);
+	ASSERT_EQ(CPU_COUNT(&set), 7);
+	ASSERT_TRUE(CPU_ISSET(3, &set));
+	ASSERT_FALSE(CPU_ISSET(4, &set));
+	ASSERT_TRUE(CPU_ISSET(8, &set));
+	ASSERT_TRUE(CPU_ISSET(11, &set));
+
+	/* Strides, and the trailing newline of a sysfs cpulist */
+	ASSERT_EQ(famfs_cpulist_parse("0-15:4\n", &set), 0);
+	ASSERT_EQ(CPU_COUNT(&set), 4);
+	ASSERT_TRUE(CPU_ISSET(12, &set));
+
+	ASSERT_EQ(famfs_cpulist_parse("", &set), -1);
+	ASSERT_EQ(famfs_cpulist_parse("3-1", &set), -1);
+	ASSERT_EQ(famfs_cpulist_parse("0,,1", &set), -1);
+	ASSERT_EQ(famfs_cpulist_parse("0-x", &set), -1);
+	ASSERT_EQ(famfs_cpulist_parse("0-3:0", &set), -1);
+	ASSERT_EQ(famfs_cpulist_parse("100000", &set), -1);
+
+	/* No cpus= and no numa_queues is a no-op */
+	ASSERT_EQ(famfs_affinity_init(NULL, 0), 0);
+	ASSERT_EQ(famfs_affinity_init("bogus", 0), -1);
+}
+
 TEST(famfs, famfs_log_test) {
 	famfs_log(FAMFS_LOG_NOTICE, "%s:\n", __func__);
 	famfs_log(FAMFS_INVALID, "bad log level\n");
@@ -1841,6 +3491,103 @@ TEST(famfs, famfs_log_test) {
 	famfs_log(FAMFS_LOG_NOTICE, "%s:\n", __func__);
 }
 
+static int log_arg_evals;
+static int log_func_calls;
+
+static int log_arg(void)
+{
+	return ++log_arg_evals;
+}
+
+static void count_log_func(enum famfs_log_level level, const char *fmt,
+			   va_list ap)
+{
+	(void)level;
+	(void)fmt;
+	(void)ap;
+	log_func_calls++;
+}
+
+TEST(famfs, famfs_log_macro_test) {
+	int i;
+
+	famfs_log_set_level(FAMFS_LOG_NOTICE);
+	famfs_set_log_func(count_log_func);
+
+	/* Disabled levels don't evaluate their arguments */
+	famfs_log(FAMFS_LOG_DEBUG, "%d\n", log_arg());
+	famfs_log(FAMFS_LOG_INFO, "%d\n", log_arg());
+	ASSERT_EQ(log_arg_evals, 0);
+	ASSERT_EQ(log_func_calls, 0);
+
+	famfs_log(FAMFS_LOG_NOTICE, "%d\n", log_arg());
+	famfs_log(FAMFS_LOG_ERR, "%d\n", log_arg());
+	ASSERT_EQ(log_arg_evals, 2);
+	ASSERT_EQ(log_func_calls, 2);
+
+	famfs_log_set_level(FAMFS_LOG_DEBUG);
+	famfs_log(FAMFS_LOG_DEBUG, "%d\n", log_arg());
+	ASSERT_EQ(log_arg_evals, (FAMFS_LOG_MAX_LEVEL >= FAMFS_LOG_DEBUG) ? 3 : 2);
+	famfs_set_log_func(NULL);
+
+	/* Async syslog */
+	ASSERT_EQ(famfs_log_enable_async(0), -EINVAL);
+	ASSERT_EQ(famfs_log_enable_async(4), 0);
+	ASSERT_EQ(famfs_log_enable_async(4), 0);
+	famfs_log_enable_syslog("famfs_unit", LOG_PID, LOG_USER);
+	for (i = 0; i < 100; i++)
+		famfs_log(FAMFS_LOG_DEBUG, "%s: async %d\n", __func__, i);
+	famfs_log_disable_async();
+	famfs_log_disable_async();
+	famfs_log(FAMFS_LOG_DEBUG, "%s: sync again\n", __func__);
+	famfs_log_disable_syslog();
+	famfs_log_close_syslog();
+	famfs_log_set_level(FAMFS_LOG_NOTICE);
+}
+
+TEST(famfs, famfs_flush_files)
+{
+	const char *files[] = {
+		"/tmp/famfs_flush_big",     /* split across threads */
+		"/tmp/famfs_flush_small",
+		"/tmp/famfs_flush_empty",
+		"/tmp/famfs_flush_nope",    /* doesn't exist */
+		"/tmp",                     /* not a regular file */
+	};
+	size_t big = 520ULL * 1024 * 1024;
+	struct famfs_flush_stats stats;
+	int fd, rc;
+
+	/* Sparse, so it's quick to create */
+	fd = open(files[0], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	ASSERT_GT(fd, 0);
+	ASSERT_EQ(ftruncate(fd, big), 0);
+	close(fd);
+	system("dd if=/dev/urandom of=/tmp/famfs_flush_small bs=4096 count=3 "
+	       "2>/dev/null");
+	system("rm -f /tmp/famfs_flush_nope; touch /tmp/famfs_flush_empty");
+
+	rc = famfs_flush_files(5, (char * const *)files, 4, 2, &stats);
+	ASSERT_EQ(rc, 2);
+	ASSERT_EQ(stats.nfiles, 3);
+	ASSERT_EQ(stats.bytes, big + 3 * 4096);
+	ASSERT_GT(stats.ns, 0);
+
+	/* Single-threaded */
+	rc = famfs_flush_files(2, (char * const *)files, 1, 0, &stats);
+	ASSERT_EQ(rc, 0);
+	ASSERT_EQ(stats.nfiles, 2);
+
+	ASSERT_EQ(famfs_flush_file(files[1], 0), 0);
+	ASSERT_EQ(famfs_flush_file(files[2], 0), 0);
+	ASSERT_EQ(famfs_flush_file(files[3], 0), 3);
+	ASSERT_EQ(famfs_flush_file(files[4], 1), 2);
+
+	unlink(files[0]);
+	unlink(files[1]);
+	unlink(files[2]);
+}
+
 TEST(famfs, famfs_misc)
 {
 	char **strings;
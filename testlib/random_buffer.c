@@ -65,3 +65,312 @@ validate_random_buffer(void *buf, size_t len, unsigned int seed)
 
 	return -1;
 }
+
+/*
+ * Counter-based random data
+ *
+ * Word i of a file (bytes [8i, 8i + 8), little endian) is the SplitMix64
+ * output for counter i: mix64(key + i * GAMMA), where the key is derived
+ * from the seed. Since no state carries from one word to the next, a range
+ * can be generated starting anywhere, and the word loops vectorize. The
+ * AVX2 and AVX-512 kernels are picked at run time.
+ */
+#define RB_GAMMA 0x9e3779b97f4a7c15ULL
+#define RB_MIX1  0xbf58476d1ce4e5b9ULL
+#define RB_MIX2  0x94d049bb133111ebULL
+
+static inline uint64_t
+rb_mix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * RB_MIX1;
+	z = (z ^ (z >> 27)) * RB_MIX2;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t
+rb_key(uint64_t seed)
+{
+	return rb_mix64(seed ^ 0x66616d6673726e64ULL);
+}
+
+static inline uint64_t
+rb_word(uint64_t key, uint64_t i)
+{
+	return rb_mix64(key + i * RB_GAMMA);
+}
+
+/* Fill @n words starting with word @first; returns nothing */
+typedef void (*rb_fill_fn)(uint8_t *dst, size_t n, uint64_t key,
+			   uint64_t first);
+/* Compare @n words; returns the index of the first mismatch, or @n */
+typedef size_t (*rb_cmp_fn)(const uint8_t *src, size_t n, uint64_t key,
+			    uint64_t first);
+
+static void
+rb_fill_generic(uint8_t *dst, size_t n, uint64_t key, uint64_t first)
+{
+	uint64_t z = key + first * RB_GAMMA;
+	size_t i;
+
+	for (i = 0; i < n; i++, z += RB_GAMMA) {
+		uint64_t val = rb_mix64(z);
+
+		memcpy(dst + i * 8, &val, 8);
+	}
+}
+
+static size_t
+rb_cmp_generic(const uint8_t *src, size_t n, uint64_t key, uint64_t first)
+{
+	uint64_t z = key + first * RB_GAMMA;
+	size_t i;
+
+	for (i = 0; i < n; i++, z += RB_GAMMA) {
+		uint64_t val = rb_mix64(z);
+
+		if (memcmp(src + i * 8, &val, 8) != 0)
+			break;
+	}
+	return i;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* AVX2 has no 64-bit multiply; build one from 32x32->64 multiplies */
+static inline __attribute__((target("avx2"))) __m256i
+rb_mul64_avx2(__m256i a, __m256i b, __m256i b_hi)
+{
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i t1 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+	__m256i t2 = _mm256_mul_epu32(a, b_hi);
+
+	return _mm256_add_epi64(lo,
+			_mm256_slli_epi64(_mm256_add_epi64(t1, t2), 32));
+}
+
+static inline __attribute__((target("avx2"))) __m256i
+rb_mix64_avx2(__m256i z)
+{
+	const __m256i m1 = _mm256_set1_epi64x(RB_MIX1);
+	const __m256i m1_hi = _mm256_set1_epi64x(RB_MIX1 >> 32);
+	const __m256i m2 = _mm256_set1_epi64x(RB_MIX2);
+	const __m256i m2_hi = _mm256_set1_epi64x(RB_MIX2 >> 32);
+
+	z = rb_mul64_avx2(_mm256_xor_si256(z, _mm256_srli_epi64(z, 30)),
+			  m1, m1_hi);
+	z = rb_mul64_avx2(_mm256_xor_si256(z, _mm256_srli_epi64(z, 27)),
+			  m2, m2_hi);
+	return _mm256_xor_si256(z, _mm256_srli_epi64(z, 31));
+}
+
+static __attribute__((target("avx2"))) void
+rb_fill_avx2(uint8_t *dst, size_t n, uint64_t key, uint64_t first)
+{
+	const __m256i step = _mm256_set1_epi64x(4 * RB_GAMMA);
+	uint64_t z0 = key + first * RB_GAMMA;
+	__m256i z = _mm256_set_epi64x(z0 + 3 * RB_GAMMA, z0 + 2 * RB_GAMMA,
+				      z0 + RB_GAMMA, z0);
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		_mm256_storeu_si256((__m256i *)(dst + i * 8),
+				    rb_mix64_avx2(z));
+		z = _mm256_add_epi64(z, step);
+	}
+	rb_fill_generic(dst + i * 8, n - i, key, first + i);
+}
+
+static __attribute__((target("avx2"))) size_t
+rb_cmp_avx2(const uint8_t *src, size_t n, uint64_t key, uint64_t first)
+{
+	const __m256i step = _mm256_set1_epi64x(4 * RB_GAMMA);
+	uint64_t z0 = key + first * RB_GAMMA;
+	__m256i z = _mm256_set_epi64x(z0 + 3 * RB_GAMMA, z0 + 2 * RB_GAMMA,
+				      z0 + RB_GAMMA, z0);
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+		__m256i eq = _mm256_cmpeq_epi64(v, rb_mix64_avx2(z));
+
+		if (_mm256_movemask_epi8(eq) != -1)
+			break;
+		z = _mm256_add_epi64(z, step);
+	}
+	/* The tail, or the vector with the mismatch */
+	return i + rb_cmp_generic(src + i * 8, n - i, key, first + i);
+}
+
+static inline __attribute__((target("avx512f,avx512dq"))) __m512i
+rb_mix64_avx512(__m512i z)
+{
+	const __m512i m1 = _mm512_set1_epi64(RB_MIX1);
+	const __m512i m2 = _mm512_set1_epi64(RB_MIX2);
+
+	z = _mm512_mullo_epi64(_mm512_xor_si512(z, _mm512_srli_epi64(z, 30)),
+			       m1);
+	z = _mm512_mullo_epi64(_mm512_xor_si512(z, _mm512_srli_epi64(z, 27)),
+			       m2);
+	return _mm512_xor_si512(z, _mm512_srli_epi64(z, 31));
+}
+
+static __attribute__((target("avx512f,avx512dq"))) void
+rb_fill_avx512(uint8_t *dst, size_t n, uint64_t key, uint64_t first)
+{
+	const __m512i step = _mm512_set1_epi64(8 * RB_GAMMA);
+	const __m512i lanes = _mm512_set_epi64(7 * RB_GAMMA, 6 * RB_GAMMA,
+					       5 * RB_GAMMA, 4 * RB_GAMMA,
+					       3 * RB_GAMMA, 2 * RB_GAMMA,
+					       RB_GAMMA, 0);
+	__m512i z = _mm512_add_epi64(
+		_mm512_set1_epi64(key + first * RB_GAMMA), lanes);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		_mm512_storeu_si512((void *)(dst + i * 8), rb_mix64_avx512(z));
+		z = _mm512_add_epi64(z, step);
+	}
+	rb_fill_generic(dst + i * 8, n - i, key, first + i);
+}
+
+static __attribute__((target("avx512f,avx512dq"))) size_t
+rb_cmp_avx512(const uint8_t *src, size_t n, uint64_t key, uint64_t first)
+{
+	const __m512i step = _mm512_set1_epi64(8 * RB_GAMMA);
+	const __m512i lanes = _mm512_set_epi64(7 * RB_GAMMA, 6 * RB_GAMMA,
+					       5 * RB_GAMMA, 4 * RB_GAMMA,
+					       3 * RB_GAMMA, 2 * RB_GAMMA,
+					       RB_GAMMA, 0);
+	__m512i z = _mm512_add_epi64(
+		_mm512_set1_epi64(key + first * RB_GAMMA), lanes);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m512i v = _mm512_loadu_si512((const void *)(src + i * 8));
+
+		if (_mm512_cmpneq_epu64_mask(v, rb_mix64_avx512(z)))
+			break;
+		z = _mm512_add_epi64(z, step);
+	}
+	return i + rb_cmp_generic(src + i * 8, n - i, key, first + i);
+}
+#endif
+
+static rb_fill_fn rb_fill;
+static rb_cmp_fn rb_cmp;
+
+static void
+rb_select_kernels(void)
+{
+	rb_fill_fn fill = rb_fill_generic;
+	rb_cmp_fn cmp = rb_cmp_generic;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") &&
+	    __builtin_cpu_supports("avx512dq")) {
+		fill = rb_fill_avx512;
+		cmp = rb_cmp_avx512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		fill = rb_fill_avx2;
+		cmp = rb_cmp_avx2;
+	}
+#endif
+	/* Racing callers all pick the same kernels */
+	__atomic_store_n(&rb_cmp, cmp, __ATOMIC_RELAXED);
+	__atomic_store_n(&rb_fill, fill, __ATOMIC_RELEASE);
+}
+
+void
+randomize_buffer_at(void *buf, size_t len, u_int64_t offset, u_int64_t seed)
+{
+	uint64_t key = rb_key(seed);
+	uint8_t *p = buf;
+	uint64_t word = offset / 8;
+	size_t skip = offset % 8;
+	size_t n;
+
+	if (len == 0)
+		return;
+	if (!__atomic_load_n(&rb_fill, __ATOMIC_ACQUIRE))
+		rb_select_kernels();
+
+	/* Partial first word */
+	if (skip) {
+		uint64_t val = rb_word(key, word++);
+
+		n = (len < 8 - skip) ? len : 8 - skip;
+		memcpy(p, (uint8_t *)&val + skip, n);
+		p += n;
+		len -= n;
+	}
+
+	n = len / 8;
+	rb_fill(p, n, key, word);
+	p += n * 8;
+	word += n;
+	len -= n * 8;
+
+	/* Partial last word */
+	if (len) {
+		uint64_t val = rb_word(key, word);
+
+		memcpy(p, &val, len);
+	}
+}
+
+int64_t
+validate_random_buffer_at(
+	const void *buf,
+	size_t len,
+	u_int64_t offset,
+	u_int64_t seed)
+{
+	uint64_t key = rb_key(seed);
+	const uint8_t *p = buf;
+	uint64_t word = offset / 8;
+	size_t skip = offset % 8;
+	size_t n, i;
+
+	if (len == 0)
+		return -1;
+	if (!__atomic_load_n(&rb_fill, __ATOMIC_ACQUIRE))
+		rb_select_kernels();
+
+	if (skip) {
+		uint64_t val = rb_word(key, word++);
+
+		n = (len < 8 - skip) ? len : 8 - skip;
+		for (i = 0; i < n; i++)
+			if (p[i] != ((uint8_t *)&val)[skip + i])
+				return i;
+		p += n;
+		len -= n;
+	}
+
+	n = len / 8;
+	i = rb_cmp(p, n, key, word);
+	if (i < n) {
+		uint64_t val = rb_word(key, word + i);
+		size_t b;
+
+		/* Find the byte */
+		for (b = 0; b < 8; b++)
+			if (p[i * 8 + b] != ((uint8_t *)&val)[b])
+				break;
+		return (p - (const uint8_t *)buf) + i * 8 + b;
+	}
+	p += n * 8;
+	word += n;
+	len -= n * 8;
+
+	if (len) {
+		uint64_t val = rb_word(key, word);
+
+		for (i = 0; i < len; i++)
+			if (p[i] != ((uint8_t *)&val)[i])
+				return (p - (const uint8_t *)buf) + i;
+	}
+	return -1;
+}
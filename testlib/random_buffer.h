@@ -22,6 +22,27 @@ randomize_buffer(void *buf, size_t len, unsigned int seed);
 int
 validate_random_buffer(void *buf, size_t len, unsigned int seed);
 
+/* randomize_buffer_at
+ *
+ * Write counter-based pseudo-random data: each 8-byte word of a file is a
+ * function of the seed and the word's offset in the file, so any range of
+ * a file can be filled independently (e.g. by many threads). @offset is the
+ * file offset of @buf. This is not the same data that randomize_buffer()
+ * writes.
+ */
+void
+randomize_buffer_at(void *buf, size_t len, u_int64_t offset, u_int64_t seed);
+
+/* validate_random_buffer_at
+ *
+ * Validate a range written by randomize_buffer_at(). Returns the offset
+ * (relative to @buf) of the first byte that doesn't match, or -1 if the
+ * whole range matches.
+ */
+int64_t
+validate_random_buffer_at(const void *buf, size_t len, u_int64_t offset,
+			  u_int64_t seed);
+
 /* generate_random_u_int32_t
  *
  * Create and return a random u_int32_t between min and max inclusive with